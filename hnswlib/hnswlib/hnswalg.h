@@ -2,7 +2,11 @@
 
 #include "visited_list_pool.h"
 #include "hnswlib.h"
+#include "label_map.h"
+#include "link_list_arena.h"
+#include "segmented_storage.h"
 #include <atomic>
+#include <cstdio>
 #include <random>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,14 +14,18 @@
 #include <list>
 
 namespace hnswlib {
-typedef unsigned int tableint;
 typedef unsigned int linklistsizeint;
 
 template<typename dist_t>
 class HierarchicalNSW : public AlgorithmInterface<dist_t> {
  public:
     static const tableint MAX_LABEL_OPERATION_LOCKS = 65536;
+    static const size_t MAX_SEGMENT_SIZE = 1 << 20;  // elements per storage segment
+    static const size_t MIN_SEGMENT_SIZE = 1 << 10;  // for elements too large to fit MAX_SEGMENT_BYTES
+    static const size_t MAX_SEGMENT_BYTES = 1 << 26;  // cap on the level 0 bytes of one segment
     static const unsigned char DELETE_MARK = 0x01;
+    static const unsigned int LINK_ARENA_MARK = 0xffffffff;  // marks the link list arena block in saved files
+    static const unsigned int LABEL_MAP_MAGIC = 0x4c424c4d;  // marks the optional label map block at the end of the file
 
     size_t max_elements_{0};
     mutable std::atomic<size_t> cur_element_count{0};  // current number of elements
@@ -39,24 +47,25 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     mutable std::vector<std::mutex> label_op_locks_;
 
     std::mutex global;
-    std::vector<std::mutex> link_list_locks_;
+    SegmentedArray<std::mutex> link_list_locks_;
 
     tableint enterpoint_node_{0};
 
     size_t size_links_level0_{0};
     size_t offsetData_{0}, offsetLevel0_{0}, label_offset_{ 0 };
 
-    char *data_level0_memory_{nullptr};
-    char **linkLists_{nullptr};
-    std::vector<int> element_levels_;  // keeps level of each element
+    // Per-element storage is split into segments, see segmented_storage.h
+    SegmentedBlocks data_level0_memory_;
+    SegmentedArray<size_t> linkLists_;  // offsets of the upper-layer link lists in link_list_arena_
+    LinkListArena link_list_arena_;
+    SegmentedArray<int> element_levels_;  // keeps level of each element
 
     size_t data_size_{0};
 
     DISTFUNC<dist_t> fstdistfunc_;
     void *dist_func_param_{nullptr};
 
-    mutable std::mutex label_lookup_lock;  // lock for label_lookup_
-    std::unordered_map<labeltype, tableint> label_lookup_;
+    LabelLookupMap label_lookup_;  // sharded, each shard has its own lock
 
     std::default_random_engine level_generator_;
     std::default_random_engine update_probability_generator_;
@@ -92,9 +101,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         size_t ef_construction = 200,
         size_t random_seed = 100,
         bool allow_replace_deleted = false)
-        : link_list_locks_(max_elements),
-            label_op_locks_(MAX_LABEL_OPERATION_LOCKS),
-            element_levels_(max_elements),
+        : label_op_locks_(MAX_LABEL_OPERATION_LOCKS),
             allow_replace_deleted_(allow_replace_deleted) {
         max_elements_ = max_elements;
         num_deleted_ = 0;
@@ -116,11 +123,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         label_offset_ = size_links_level0_ + data_size_;
         offsetLevel0_ = 0;
 
-        data_level0_memory_ = (char *) malloc(max_elements_ * size_data_per_element_);
-        if (data_level0_memory_ == nullptr)
-            throw std::runtime_error("Not enough memory");
+        initElementStorage(max_elements_);
 
         cur_element_count = 0;
+        label_lookup_.reserve(max_elements);
 
         visited_list_pool_ = new VisitedListPool(1, max_elements);
 
@@ -128,26 +134,43 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         enterpoint_node_ = -1;
         maxlevel_ = -1;
 
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements_);
-        if (linkLists_ == nullptr)
-            throw std::runtime_error("Not enough memory: HierarchicalNSW failed to allocate linklists");
         size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        // an element has 1 / (M - 1) upper levels on average
+        link_list_arena_.init(max_elements_ * size_links_per_element_ / std::max<size_t>(M_ - 1, 1));
         mult_ = 1 / log(1.0 * M_);
         revSize_ = 1.0 / mult_;
     }
 
 
     ~HierarchicalNSW() {
-        free(data_level0_memory_);
-        for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
-                free(linkLists_[i]);
-        }
-        free(linkLists_);
         delete visited_list_pool_;
     }
 
 
+    /*
+    * Picks the segment size for the per-element storage and allocates room for max_elements.
+    * The segment size only depends on the element size, so an index that starts small
+    * still grows in large segments: MAX_SEGMENT_SIZE elements, fewer if their level 0
+    * data would pass MAX_SEGMENT_BYTES, but at least MIN_SEGMENT_SIZE.
+    */
+    void initElementStorage(size_t max_elements) {
+        size_t segment_size = MIN_SEGMENT_SIZE;
+        while (segment_size < MAX_SEGMENT_SIZE &&
+               segment_size * 2 * size_data_per_element_ <= MAX_SEGMENT_BYTES)
+            segment_size <<= 1;
+
+        data_level0_memory_.init(segment_size, size_data_per_element_);
+        linkLists_.init(segment_size);
+        element_levels_.init(segment_size);
+        link_list_locks_.init(segment_size);
+
+        data_level0_memory_.resize(max_elements);
+        linkLists_.resize(max_elements);
+        element_levels_.resize(max_elements);
+        link_list_locks_.resize(max_elements);
+    }
+
+
     struct CompareByFirst {
         constexpr bool operator()(std::pair<dist_t, tableint> const& a,
             std::pair<dist_t, tableint> const& b) const noexcept {
@@ -170,23 +193,23 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     inline labeltype getExternalLabel(tableint internal_id) const {
         labeltype return_label;
-        memcpy(&return_label, (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), sizeof(labeltype));
+        memcpy(&return_label, (data_level0_memory_.at(internal_id) + label_offset_), sizeof(labeltype));
         return return_label;
     }
 
 
     inline void setExternalLabel(tableint internal_id, labeltype label) const {
-        memcpy((data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), &label, sizeof(labeltype));
+        memcpy((data_level0_memory_.at(internal_id) + label_offset_), &label, sizeof(labeltype));
     }
 
 
     inline labeltype *getExternalLabeLp(tableint internal_id) const {
-        return (labeltype *) (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_);
+        return (labeltype *) (data_level0_memory_.at(internal_id) + label_offset_);
     }
 
 
     inline char *getDataByInternalId(tableint internal_id) const {
-        return (data_level0_memory_ + internal_id * size_data_per_element_ + offsetData_);
+        return (data_level0_memory_.at(internal_id) + offsetData_);
     }
 
 
@@ -213,6 +236,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         VisitedList *vl = visited_list_pool_->getFreeVisitedList();
         vl_type *visited_array = vl->mass;
         vl_type visited_array_tag = vl->curV;
+        // the list may predate a concurrent resizeIndex, ids past its end are skipped
+        tableint visited_array_size = vl->numelements;
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidateSet;
@@ -227,7 +252,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             lowerBound = std::numeric_limits<dist_t>::max();
             candidateSet.emplace(-lowerBound, ep_id);
         }
-        visited_array[ep_id] = visited_array_tag;
+        if (ep_id < visited_array_size)
+            visited_array[ep_id] = visited_array_tag;
 
         while (!candidateSet.empty()) {
             std::pair<dist_t, tableint> curr_el_pair = candidateSet.top();
@@ -250,10 +276,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             size_t size = getListCount((linklistsizeint*)data);
             tableint *datal = (tableint *) (data + 1);
 #ifdef USE_SSE
+            // getDataByInternalId reads the segment table, so only prefetch ids that are in the list
             _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
             _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-            _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
-            _mm_prefetch(getDataByInternalId(*(datal + 1)), _MM_HINT_T0);
+            if (size > 0)
+                _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
+            if (size > 1)
+                _mm_prefetch(getDataByInternalId(*(datal + 1)), _MM_HINT_T0);
 #endif
 
             for (size_t j = 0; j < size; j++) {
@@ -261,8 +290,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 //                    if (candidate_id == 0) continue;
 #ifdef USE_SSE
                 _mm_prefetch((char *) (visited_array + *(datal + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(getDataByInternalId(*(datal + j + 1)), _MM_HINT_T0);
+                if (j + 1 < size)
+                    _mm_prefetch(getDataByInternalId(*(datal + j + 1)), _MM_HINT_T0);
 #endif
+                if (candidate_id >= visited_array_size) continue;
                 if (visited_array[candidate_id] == visited_array_tag) continue;
                 visited_array[candidate_id] = visited_array_tag;
                 char *currObj1 = (getDataByInternalId(candidate_id));
@@ -297,6 +328,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         VisitedList *vl = visited_list_pool_->getFreeVisitedList();
         vl_type *visited_array = vl->mass;
         vl_type visited_array_tag = vl->curV;
+        // the list may predate a concurrent resizeIndex, ids past its end are skipped
+        tableint visited_array_size = vl->numelements;
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
@@ -312,7 +345,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             candidate_set.emplace(-lowerBound, ep_id);
         }
 
-        visited_array[ep_id] = visited_array_tag;
+        if (ep_id < visited_array_size)
+            visited_array[ep_id] = visited_array_tag;
 
         while (!candidate_set.empty()) {
             std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
@@ -335,18 +369,20 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 #ifdef USE_SSE
             _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
             _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-            _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
+            if (size > 0)
+                _mm_prefetch(getDataByInternalId(*(data + 1)), _MM_HINT_T0);
             _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
 #endif
 
             for (size_t j = 1; j <= size; j++) {
-                int candidate_id = *(data + j);
+                tableint candidate_id = *(data + j);
 //                    if (candidate_id == 0) continue;
 #ifdef USE_SSE
                 _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
-                                _MM_HINT_T0);  ////////////
+                if (j < size)
+                    _mm_prefetch(getDataByInternalId(*(data + j + 1)), _MM_HINT_T0);  ////////////
 #endif
+                if (candidate_id >= visited_array_size) continue;
                 if (!(visited_array[candidate_id] == visited_array_tag)) {
                     visited_array[candidate_id] = visited_array_tag;
 
@@ -356,8 +392,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     if (top_candidates.size() < ef || lowerBound > dist) {
                         candidate_set.emplace(-dist, candidate_id);
 #ifdef USE_SSE
-                        _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
-                                        offsetLevel0_,  ///////////
+                        _mm_prefetch(get_linklist0(candidate_set.top().second),  ///////////
                                         _MM_HINT_T0);  ////////////////////////
 #endif
 
@@ -423,7 +458,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     linklistsizeint *get_linklist0(tableint internal_id) const {
-        return (linklistsizeint *) (data_level0_memory_ + internal_id * size_data_per_element_ + offsetLevel0_);
+        return (linklistsizeint *) (data_level0_memory_.at(internal_id) + offsetLevel0_);
     }
 
 
@@ -433,7 +468,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     linklistsizeint *get_linklist(tableint internal_id, int level) const {
-        return (linklistsizeint *) (linkLists_[internal_id] + (level - 1) * size_links_per_element_);
+        return (linklistsizeint *) (link_list_arena_.at(linkLists_[internal_id]) + (level - 1) * size_links_per_element_);
     }
 
 
@@ -569,37 +604,39 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    /*
+    * Grows the capacity by appending storage segments, existing elements are not copied.
+    * Searches may run concurrently with resizeIndex, insertions and deletions may not.
+    * Shrinking only lowers the element limit, the memory is kept.
+    */
     void resizeIndex(size_t new_max_elements) {
         if (new_max_elements < cur_element_count)
             throw std::runtime_error("Cannot resize, max element is less than the current number of elements");
 
-        delete visited_list_pool_;
-        visited_list_pool_ = new VisitedListPool(1, new_max_elements);
+        // grow the visited lists first, searches in flight skip ids past the end of their list
+        visited_list_pool_->resize(new_max_elements);
 
         element_levels_.resize(new_max_elements);
-
-        std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
-
-        // Reallocate base layer
-        char * data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
-        if (data_level0_memory_new == nullptr)
-            throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
-        data_level0_memory_ = data_level0_memory_new;
-
-        // Reallocate all other layers
-        char ** linkLists_new = (char **) realloc(linkLists_, sizeof(void *) * new_max_elements);
-        if (linkLists_new == nullptr)
-            throw std::runtime_error("Not enough memory: resizeIndex failed to allocate other layers");
-        linkLists_ = linkLists_new;
+        link_list_locks_.resize(new_max_elements);
+        linkLists_.resize(new_max_elements);
+        data_level0_memory_.resize(new_max_elements);
 
         max_elements_ = new_max_elements;
     }
 
 
+    /*
+    * Writes the index to a temporary file that is renamed over location, so an index
+    * with link lists mapped from location by loadIndex can be saved back to it.
+    */
     void saveIndex(const std::string &location) {
-        std::ofstream output(location, std::ios::binary);
+        std::string tmp_location = location + ".tmp";
+        std::ofstream output(tmp_location, std::ios::binary);
         std::streampos position;
 
+        if (!output.is_open())
+            throw std::runtime_error("Cannot open file");
+
         writeBinaryPOD(output, offsetLevel0_);
         writeBinaryPOD(output, max_elements_);
         writeBinaryPOD(output, cur_element_count);
@@ -615,19 +652,50 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         writeBinaryPOD(output, mult_);
         writeBinaryPOD(output, ef_construction_);
 
-        output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
+        data_level0_memory_.saveTo(output, cur_element_count);
+
+        // Upper layers as one arena block. The mark takes the place of the first
+        // per-element link list size written by older versions.
+        unsigned int mark = LINK_ARENA_MARK;
+        writeBinaryPOD(output, mark);
+        size_t chunkSize = link_list_arena_.chunkSize();
+        size_t arenaSize = link_list_arena_.bytesUsed();
+        writeBinaryPOD(output, chunkSize);
+        writeBinaryPOD(output, arenaSize);
+        element_levels_.saveTo(output, cur_element_count);
+        linkLists_.saveTo(output, cur_element_count);
+        link_list_arena_.saveTo(output);
+
+        // Label map block, lets loadIndex skip rebuilding the map. Older readers reject the file.
+        unsigned int magic = LABEL_MAP_MAGIC;
+        writeBinaryPOD(output, magic);
+        size_t labelMapSize = label_lookup_.serializedSize();
+        writeBinaryPOD(output, labelMapSize);
+        label_lookup_.saveTo(output);
+        output.close();
+        if (!output) {
+            std::remove(tmp_location.c_str());
+            throw std::runtime_error("Cannot write file");
+        }
 
-        for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
-            writeBinaryPOD(output, linkListSize);
-            if (linkListSize)
-                output.write(linkLists_[i], linkListSize);
+#ifdef _WIN32
+        // rename does not replace an existing file on Windows
+        std::remove(location.c_str());
+#endif
+        if (std::rename(tmp_location.c_str(), location.c_str()) != 0) {
+            std::remove(tmp_location.c_str());
+            throw std::runtime_error("Cannot rename file");
         }
-        output.close();
     }
 
 
-    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
+    /*
+    * Loads an index written by saveIndex. Files written before the link list arena
+    * and the label map block were added are still accepted.
+    * With mmap_link_lists the upper layers are mapped copy-on-write from the file
+    * instead of being read into memory (POSIX only, ignored for older files).
+    */
+    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0, bool mmap_link_lists = false) {
         std::ifstream input(location, std::ios::binary);
 
         if (!input.is_open())
@@ -666,18 +734,50 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         /// Optional - check if index is ok:
         input.seekg(cur_element_count * size_data_per_element_, input.cur);
-        for (size_t i = 0; i < cur_element_count; i++) {
-            if (input.tellg() < 0 || input.tellg() >= total_filesize) {
-                throw std::runtime_error("Index seems to be corrupted or unsupported");
+        bool arena_format = false;
+        size_t chunkSize = 0, arenaSize = 0;
+        std::streampos arena_pos = -1;
+        if (input.tellg() >= 0 && input.tellg() < total_filesize) {
+            unsigned int mark;
+            readBinaryPOD(input, mark);
+            if (mark == LINK_ARENA_MARK) {
+                arena_format = true;
+                readBinaryPOD(input, chunkSize);
+                readBinaryPOD(input, arenaSize);
+                input.seekg(cur_element_count * (sizeof(int) + sizeof(size_t)), input.cur);
+                arena_pos = input.tellg();
+                input.seekg(arenaSize, input.cur);
+            } else {
+                input.seekg(-(std::streamoff) sizeof(mark), input.cur);
             }
+        }
+        if (!arena_format) {
+            for (size_t i = 0; i < cur_element_count; i++) {
+                if (input.tellg() < 0 || input.tellg() >= total_filesize) {
+                    throw std::runtime_error("Index seems to be corrupted or unsupported");
+                }
 
-            unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
-            if (linkListSize != 0) {
-                input.seekg(linkListSize, input.cur);
+                unsigned int linkListSize;
+                readBinaryPOD(input, linkListSize);
+                if (linkListSize != 0) {
+                    input.seekg(linkListSize, input.cur);
+                }
             }
         }
 
+        // optional label map block
+        std::streampos label_map_pos = -1;
+        if (input.tellg() >= 0 && input.tellg() < total_filesize) {
+            unsigned int magic = 0;
+            size_t labelMapSize = 0;
+            readBinaryPOD(input, magic);
+            readBinaryPOD(input, labelMapSize);
+            if (!input || magic != LABEL_MAP_MAGIC)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            label_map_pos = input.tellg();
+            input.seekg(labelMapSize, input.cur);
+        }
+
         // throw exception if it either corrupted or old index
         if (input.tellg() != total_filesize)
             throw std::runtime_error("Index seems to be corrupted or unsupported");
@@ -687,41 +787,55 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         input.seekg(pos, input.beg);
 
-        data_level0_memory_ = (char *) malloc(max_elements * size_data_per_element_);
-        if (data_level0_memory_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
-        input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
+        initElementStorage(max_elements);
+        data_level0_memory_.loadFrom(input, cur_element_count);
 
         size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
 
         size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
-        std::vector<std::mutex>(max_elements).swap(link_list_locks_);
         std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
 
         visited_list_pool_ = new VisitedListPool(1, max_elements);
 
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements);
-        if (linkLists_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
-        element_levels_ = std::vector<int>(max_elements);
         revSize_ = 1.0 / mult_;
         ef_ = 10;
-        for (size_t i = 0; i < cur_element_count; i++) {
-            label_lookup_[getExternalLabel(i)] = i;
-            unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
-            if (linkListSize == 0) {
-                element_levels_[i] = 0;
-                linkLists_[i] = nullptr;
-            } else {
-                element_levels_[i] = linkListSize / size_links_per_element_;
-                linkLists_[i] = (char *) malloc(linkListSize);
-                if (linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-                input.read(linkLists_[i], linkListSize);
+        if (arena_format) {
+            unsigned int mark;
+            readBinaryPOD(input, mark);
+            readBinaryPOD(input, chunkSize);
+            readBinaryPOD(input, arenaSize);
+            element_levels_.loadFrom(input, cur_element_count);
+            linkLists_.loadFrom(input, cur_element_count);
+            if (!mmap_link_lists || !link_list_arena_.mapFrom(location, (size_t) (std::streamoff) arena_pos, chunkSize, arenaSize))
+                link_list_arena_.loadFrom(input, chunkSize, arenaSize);
+        } else {
+            link_list_arena_.init(max_elements * size_links_per_element_ / std::max<size_t>(M_ - 1, 1));
+            for (size_t i = 0; i < cur_element_count; i++) {
+                unsigned int linkListSize;
+                readBinaryPOD(input, linkListSize);
+                if (linkListSize == 0) {
+                    element_levels_[i] = 0;
+                    linkLists_[i] = 0;
+                } else {
+                    element_levels_[i] = linkListSize / size_links_per_element_;
+                    linkLists_[i] = link_list_arena_.allocate(linkListSize);
+                    input.read(link_list_arena_.at(linkLists_[i]), linkListSize);
+                }
             }
         }
 
+        bool label_map_loaded = false;
+        if (label_map_pos >= 0) {
+            input.clear();
+            input.seekg(label_map_pos, input.beg);
+            label_map_loaded = label_lookup_.loadFrom(input, cur_element_count);
+        }
+        if (!label_map_loaded) {
+            label_lookup_.reserve(max_elements);
+            for (size_t i = 0; i < cur_element_count; i++)
+                label_lookup_.insert(getExternalLabel(i), i);
+        }
+
         for (size_t i = 0; i < cur_element_count; i++) {
             if (isMarkedDeleted(i)) {
                 num_deleted_ += 1;
@@ -740,13 +854,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
         
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end() || isMarkedDeleted(search->second)) {
+        tableint internalId;
+        if (!label_lookup_.find(label, internalId) || isMarkedDeleted(internalId)) {
             throw std::runtime_error("Label not found");
         }
-        tableint internalId = search->second;
-        lock_table.unlock();
 
         char* data_ptrv = getDataByInternalId(internalId);
         size_t dim = *((size_t *) dist_func_param_);
@@ -767,13 +878,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
 
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end()) {
+        tableint internalId;
+        if (!label_lookup_.find(label, internalId)) {
             throw std::runtime_error("Label not found");
         }
-        tableint internalId = search->second;
-        lock_table.unlock();
 
         markDeletedInternal(internalId);
     }
@@ -809,13 +917,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
 
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end()) {
+        tableint internalId;
+        if (!label_lookup_.find(label, internalId)) {
             throw std::runtime_error("Label not found");
         }
-        tableint internalId = search->second;
-        lock_table.unlock();
 
         unmarkDeletedInternal(internalId);
     }
@@ -894,10 +999,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             labeltype label_replaced = getExternalLabel(internal_id_replaced);
             setExternalLabel(internal_id_replaced, label);
 
-            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
             label_lookup_.erase(label_replaced);
-            label_lookup_[label] = internal_id_replaced;
-            lock_table.unlock();
+            label_lookup_.insert(label, internal_id_replaced);
 
             unmarkDeletedInternal(internal_id_replaced);
             updatePoint(data_point, internal_id_replaced, 1.0);
@@ -1003,11 +1106,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     int size = getListCount(data);
                     tableint *datal = (tableint *) (data + 1);
 #ifdef USE_SSE
-                    _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
+                    if (size > 0)
+                        _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
 #endif
                     for (int i = 0; i < size; i++) {
 #ifdef USE_SSE
-                        _mm_prefetch(getDataByInternalId(*(datal + i + 1)), _MM_HINT_T0);
+                        if (i + 1 < size)
+                            _mm_prefetch(getDataByInternalId(*(datal + i + 1)), _MM_HINT_T0);
 #endif
                         tableint cand = datal[i];
                         dist_t d = fstdistfunc_(dataPoint, getDataByInternalId(cand), dist_func_param_);
@@ -1068,16 +1173,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         {
             // Checking if the element with the same label already exists
             // if so, updating it *instead* of creating a new element.
-            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-            auto search = label_lookup_.find(label);
-            if (search != label_lookup_.end()) {
-                tableint existingInternalId = search->second;
+            // Callers hold the label op lock, so no other thread can insert this label in between.
+            tableint existingInternalId;
+            if (label_lookup_.find(label, existingInternalId)) {
                 if (allow_replace_deleted_) {
                     if (isMarkedDeleted(existingInternalId)) {
                         throw std::runtime_error("Can't use addPoint to update deleted elements if replacement of deleted elements is enabled.");
                     }
                 }
-                lock_table.unlock();
 
                 if (isMarkedDeleted(existingInternalId)) {
                     unmarkDeletedInternal(existingInternalId);
@@ -1087,13 +1190,15 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 return existingInternalId;
             }
 
-            if (cur_element_count >= max_elements_) {
-                throw std::runtime_error("The number of elements exceeds the specified limit");
-            }
+            size_t count = cur_element_count.load();
+            do {
+                if (count >= max_elements_) {
+                    throw std::runtime_error("The number of elements exceeds the specified limit");
+                }
+            } while (!cur_element_count.compare_exchange_weak(count, count + 1));
 
-            cur_c = cur_element_count;
-            cur_element_count++;
-            label_lookup_[label] = cur_c;
+            cur_c = count;
+            label_lookup_.insert(label, cur_c);
         }
 
         std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
@@ -1110,17 +1215,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         tableint currObj = enterpoint_node_;
         tableint enterpoint_copy = enterpoint_node_;
 
-        memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
+        memset(data_level0_memory_.at(cur_c) + offsetLevel0_, 0, size_data_per_element_);
 
         // Initialisation of the data and label
         memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
         memcpy(getDataByInternalId(cur_c), data_point, data_size_);
 
         if (curlevel) {
-            linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * curlevel + 1);
-            if (linkLists_[cur_c] == nullptr)
-                throw std::runtime_error("Not enough memory: addPoint failed to allocate linklist");
-            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
+            linkLists_[cur_c] = link_list_arena_.allocate(size_links_per_element_ * curlevel);
         }
 
         if ((signed)currObj != -1) {
@@ -111,9 +111,9 @@ static bool AVX512Capable() {
 #include <vector>
 #include <iostream>
 #include <string.h>
+#include "types.h"
 
 namespace hnswlib {
-typedef size_t labeltype;
 
 // This can be extended to store state for filtering (e.g. from a std::set)
 class BaseFilterFunctor {
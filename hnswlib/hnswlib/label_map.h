@@ -0,0 +1,353 @@
+#pragma once
+
+#include <mutex>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <iostream>
+#include "types.h"
+
+namespace hnswlib {
+
+///////////////////////////////////////////////////////////
+//
+// Flat open-addressing map from external labels to internal ids.
+//
+// The table is split into NUM_SHARDS independent shards, each with its
+// own mutex, so concurrent inserts and lookups of different labels
+// rarely contend. Every shard stores keys and ids in two flat arrays and
+// resolves collisions with linear probing; erase uses backward-shift
+// deletion, so no tombstones are needed. An id of EMPTY_ID marks a free
+// slot, which is safe because internal ids are always below max_elements_.
+//
+// Compared to std::unordered_map this costs 12 bytes per slot instead of
+// a heap node per element, and each shard can be written to and read from
+// a stream as two contiguous arrays, so loading an index does not have to
+// rebuild the map element by element.
+//
+/////////////////////////////////////////////////////////
+
+class LabelLookupMap {
+ public:
+    static const size_t NUM_SHARDS = 64;
+    static const tableint EMPTY_ID = (tableint) -1;
+
+ private:
+    static const size_t MIN_SHARD_CAPACITY = 16;
+
+    struct Shard {
+        mutable std::mutex lock;
+        size_t capacity{0};  // always a power of two (or zero)
+        size_t size{0};
+        labeltype *keys{nullptr};
+        tableint *ids{nullptr};
+    };
+
+    Shard shards_[NUM_SHARDS];
+
+    static inline size_t hashLabel(labeltype label) {
+        // splitmix64 finalizer, spreads sequential labels over shards and slots
+        uint64_t x = (uint64_t) label;
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return (size_t) x;
+    }
+
+    static inline size_t shardOf(size_t hash) {
+        return (hash >> 58) & (NUM_SHARDS - 1);
+    }
+
+    static void allocShard(Shard &shard, size_t capacity) {
+        // zeroed so that saveTo writes the same bytes for empty slots
+        labeltype *keys = (labeltype *) calloc(capacity, sizeof(labeltype));
+        tableint *ids = (tableint *) malloc(capacity * sizeof(tableint));
+        if (keys == nullptr || ids == nullptr) {
+            free(keys);
+            free(ids);
+            throw std::runtime_error("Not enough memory: LabelLookupMap failed to allocate shard");
+        }
+        memset(ids, 0xff, capacity * sizeof(tableint));
+        shard.keys = keys;
+        shard.ids = ids;
+        shard.capacity = capacity;
+    }
+
+    static void freeShard(Shard &shard) {
+        free(shard.keys);
+        free(shard.ids);
+        shard.keys = nullptr;
+        shard.ids = nullptr;
+        shard.capacity = 0;
+        shard.size = 0;
+    }
+
+    static void placeNoCheck(Shard &shard, labeltype label, tableint id) {
+        size_t mask = shard.capacity - 1;
+        size_t slot = hashLabel(label) & mask;
+        while (shard.ids[slot] != EMPTY_ID)
+            slot = (slot + 1) & mask;
+        shard.keys[slot] = label;
+        shard.ids[slot] = id;
+    }
+
+    static void rehashShard(Shard &shard, size_t new_capacity) {
+        Shard old;
+        old.capacity = shard.capacity;
+        old.keys = shard.keys;
+        old.ids = shard.ids;
+
+        allocShard(shard, new_capacity);
+        for (size_t i = 0; i < old.capacity; i++) {
+            if (old.ids[i] != EMPTY_ID)
+                placeNoCheck(shard, old.keys[i], old.ids[i]);
+        }
+        free(old.keys);
+        free(old.ids);
+    }
+
+    static size_t capacityFor(size_t num_elements) {
+        // keep the load factor at or below 3/4
+        size_t capacity = MIN_SHARD_CAPACITY;
+        while (capacity * 3 < num_elements * 4)
+            capacity <<= 1;
+        return capacity;
+    }
+
+    // returns the slot of the label or the capacity if it is absent
+    static size_t findSlot(const Shard &shard, labeltype label) {
+        if (shard.capacity == 0)
+            return 0;
+        size_t mask = shard.capacity - 1;
+        size_t slot = hashLabel(label) & mask;
+        while (shard.ids[slot] != EMPTY_ID) {
+            if (shard.keys[slot] == label)
+                return slot;
+            slot = (slot + 1) & mask;
+        }
+        return shard.capacity;
+    }
+
+ public:
+    LabelLookupMap() {}
+
+    LabelLookupMap(const LabelLookupMap &) = delete;
+    LabelLookupMap &operator=(const LabelLookupMap &) = delete;
+
+    ~LabelLookupMap() {
+        clear();
+    }
+
+
+    /*
+    * Pre-sizes the shards for the expected number of labels.
+    */
+    void reserve(size_t num_elements) {
+        size_t per_shard = (num_elements + NUM_SHARDS - 1) / NUM_SHARDS;
+        size_t capacity = capacityFor(per_shard + per_shard / 8);
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            std::unique_lock <std::mutex> lock(shards_[s].lock);
+            if (shards_[s].capacity < capacity)
+                rehashShard(shards_[s], capacity);
+        }
+    }
+
+
+    void clear() {
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            std::unique_lock <std::mutex> lock(shards_[s].lock);
+            freeShard(shards_[s]);
+        }
+    }
+
+
+    /*
+    * Looks up the internal id of the label. Returns false if the label is absent.
+    */
+    bool find(labeltype label, tableint &id) const {
+        const Shard &shard = shards_[shardOf(hashLabel(label))];
+        std::unique_lock <std::mutex> lock(shard.lock);
+        size_t slot = findSlot(shard, label);
+        if (slot == shard.capacity)
+            return false;
+        id = shard.ids[slot];
+        return true;
+    }
+
+
+    bool contains(labeltype label) const {
+        tableint id;
+        return find(label, id);
+    }
+
+
+    /*
+    * Inserts the label or overwrites the id of an existing label.
+    */
+    void insert(labeltype label, tableint id) {
+        Shard &shard = shards_[shardOf(hashLabel(label))];
+        std::unique_lock <std::mutex> lock(shard.lock);
+        size_t slot = findSlot(shard, label);
+        if (slot != shard.capacity) {
+            shard.ids[slot] = id;
+            return;
+        }
+        if ((shard.size + 1) * 4 > shard.capacity * 3)
+            rehashShard(shard, shard.capacity ? shard.capacity * 2 : MIN_SHARD_CAPACITY);
+        placeNoCheck(shard, label, id);
+        shard.size++;
+    }
+
+
+    /*
+    * Removes the label. Returns false if the label is absent.
+    */
+    bool erase(labeltype label) {
+        Shard &shard = shards_[shardOf(hashLabel(label))];
+        std::unique_lock <std::mutex> lock(shard.lock);
+        size_t slot = findSlot(shard, label);
+        if (slot == shard.capacity)
+            return false;
+
+        // backward-shift deletion keeps probe sequences contiguous
+        size_t mask = shard.capacity - 1;
+        size_t hole = slot;
+        size_t next = (hole + 1) & mask;
+        while (shard.ids[next] != EMPTY_ID) {
+            size_t home = hashLabel(shard.keys[next]) & mask;
+            // move the entry back if the hole lies between its home slot and its position
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                shard.keys[hole] = shard.keys[next];
+                shard.ids[hole] = shard.ids[next];
+                hole = next;
+            }
+            next = (next + 1) & mask;
+        }
+        shard.keys[hole] = 0;
+        shard.ids[hole] = EMPTY_ID;
+        shard.size--;
+        return true;
+    }
+
+
+    size_t size() const {
+        size_t total = 0;
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            std::unique_lock <std::mutex> lock(shards_[s].lock);
+            total += shards_[s].size;
+        }
+        return total;
+    }
+
+
+    size_t memoryUsage() const {
+        size_t total = sizeof(*this);
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            std::unique_lock <std::mutex> lock(shards_[s].lock);
+            total += shards_[s].capacity * (sizeof(labeltype) + sizeof(tableint));
+        }
+        return total;
+    }
+
+
+    /*
+    * Calls fn(label, id) for every entry. The map must not be modified concurrently.
+    */
+    template<typename FUNC>
+    void forEach(FUNC fn) const {
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            const Shard &shard = shards_[s];
+            for (size_t i = 0; i < shard.capacity; i++) {
+                if (shard.ids[i] != EMPTY_ID)
+                    fn(shard.keys[i], shard.ids[i]);
+            }
+        }
+    }
+
+
+    /*
+    * Number of bytes written by saveTo.
+    */
+    size_t serializedSize() const {
+        size_t total = sizeof(size_t);
+        for (size_t s = 0; s < NUM_SHARDS; s++)
+            total += 2 * sizeof(size_t) + shards_[s].capacity * (sizeof(labeltype) + sizeof(tableint));
+        return total;
+    }
+
+
+    /*
+    * Writes the shards as they are laid out in memory:
+    * [num_shards] then per shard [capacity][size][keys][ids].
+    */
+    void saveTo(std::ostream &output) const {
+        size_t num_shards = NUM_SHARDS;
+        output.write((char *) &num_shards, sizeof(size_t));
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            const Shard &shard = shards_[s];
+            std::unique_lock <std::mutex> lock(shard.lock);
+            output.write((char *) &shard.capacity, sizeof(size_t));
+            output.write((char *) &shard.size, sizeof(size_t));
+            if (shard.capacity) {
+                output.write((char *) shard.keys, shard.capacity * sizeof(labeltype));
+                output.write((char *) shard.ids, shard.capacity * sizeof(tableint));
+            }
+        }
+    }
+
+
+    /*
+    * Reads shards written by saveTo. Returns false (leaving the map empty and
+    * the stream position unspecified) if the block was written with another
+    * shard layout, in which case the caller should rebuild the map.
+    * Throws if an id is not below num_elements or a shard size does not match
+    * its entries.
+    */
+    bool loadFrom(std::istream &input, size_t num_elements) {
+        clear();
+        size_t num_shards;
+        input.read((char *) &num_shards, sizeof(size_t));
+        if (!input || num_shards != NUM_SHARDS)
+            return false;
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            Shard &shard = shards_[s];
+            size_t capacity, size;
+            input.read((char *) &capacity, sizeof(size_t));
+            input.read((char *) &size, sizeof(size_t));
+            if (!input || (capacity & (capacity - 1)) != 0 || size > capacity) {
+                clear();
+                return false;
+            }
+            if (capacity) {
+                allocShard(shard, capacity);
+                input.read((char *) shard.keys, capacity * sizeof(labeltype));
+                input.read((char *) shard.ids, capacity * sizeof(tableint));
+            }
+            shard.size = size;
+            if (!input) {
+                clear();
+                return false;
+            }
+
+            size_t entries = 0;
+            for (size_t i = 0; i < shard.capacity; i++) {
+                if (shard.ids[i] == EMPTY_ID)
+                    continue;
+                if (shard.ids[i] >= num_elements) {
+                    clear();
+                    throw std::runtime_error("Index seems to be corrupted or unsupported");
+                }
+                entries++;
+            }
+            if (entries != size) {
+                clear();
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            }
+        }
+        return true;
+    }
+};
+}  // namespace hnswlib
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define HNSWLIB_HAVE_MMAP
+#endif
+
+namespace hnswlib {
+
+///////////////////////////////////////////////////////////
+//
+// Append-only arena for the upper-layer link lists.
+//
+// Link lists are carved from fixed-size chunks and addressed by a byte
+// offset: chunk = offset / chunk_size, position = offset % chunk_size.
+// An allocation never straddles two chunks, so the offsets of all lists
+// form a single address space that can be written to a file as one block
+// and read or mmapped back without touching individual lists.
+//
+// Chunks are never moved once allocated. The chunk table itself grows by
+// doubling; old tables are kept until the arena is destroyed, so readers
+// that loaded the table pointer before a resize stay valid.
+//
+/////////////////////////////////////////////////////////
+
+class LinkListArena {
+ public:
+    static const size_t MIN_CHUNK_SIZE = 1 << 20;
+    static const size_t MAX_CHUNK_SIZE = 1 << 26;
+
+ private:
+    size_t chunk_size_{MIN_CHUNK_SIZE};
+    size_t chunk_shift_{20};
+    std::atomic<char **> chunk_table_{nullptr};
+    size_t table_capacity_{0};
+    size_t num_chunks_{0};
+    size_t next_offset_{0};  // end of the used address space
+
+    std::mutex lock_;
+    std::vector<char **> retired_tables_;
+    std::vector<char *> owned_chunks_;  // chunks allocated with malloc
+    char *mapped_base_{nullptr};  // region mapped by mapFrom
+    size_t mapped_size_{0};
+    size_t mapped_bytes_{0};  // leading part of the address space that is backed by the mapping
+
+    char *allocChunk() {
+        char *chunk = (char *) malloc(chunk_size_);
+        if (chunk == nullptr)
+            throw std::runtime_error("Not enough memory: LinkListArena failed to allocate chunk");
+        owned_chunks_.push_back(chunk);
+        return chunk;
+    }
+
+    // must be called with lock_ held
+    void appendChunk(char *chunk) {
+        if (num_chunks_ == table_capacity_) {
+            size_t new_capacity = table_capacity_ ? table_capacity_ * 2 : 16;
+            char **new_table = (char **) malloc(new_capacity * sizeof(char *));
+            if (new_table == nullptr)
+                throw std::runtime_error("Not enough memory: LinkListArena failed to allocate chunk table");
+            char **old_table = chunk_table_.load();
+            if (old_table) {
+                memcpy(new_table, old_table, num_chunks_ * sizeof(char *));
+                retired_tables_.push_back(old_table);
+            }
+            table_capacity_ = new_capacity;
+            chunk_table_.store(new_table, std::memory_order_release);
+        }
+        chunk_table_.load()[num_chunks_] = chunk;
+        num_chunks_++;
+    }
+
+ public:
+    LinkListArena() {}
+
+    LinkListArena(const LinkListArena &) = delete;
+    LinkListArena &operator=(const LinkListArena &) = delete;
+
+    ~LinkListArena() {
+        clear();
+    }
+
+
+    void clear() {
+        std::unique_lock <std::mutex> lock(lock_);
+        for (char *chunk : owned_chunks_)
+            free(chunk);
+        owned_chunks_.clear();
+#ifdef HNSWLIB_HAVE_MMAP
+        if (mapped_base_)
+            munmap(mapped_base_, mapped_size_);
+#endif
+        mapped_base_ = nullptr;
+        mapped_size_ = 0;
+        mapped_bytes_ = 0;
+        for (char **table : retired_tables_)
+            free(table);
+        retired_tables_.clear();
+        free(chunk_table_.load());
+        chunk_table_.store(nullptr);
+        table_capacity_ = 0;
+        num_chunks_ = 0;
+        next_offset_ = 0;
+    }
+
+
+    /*
+    * Picks the chunk size for the expected total size of the link lists.
+    * Only has an effect while the arena is empty.
+    */
+    void init(size_t expected_bytes) {
+        std::unique_lock <std::mutex> lock(lock_);
+        if (num_chunks_ != 0)
+            return;
+        size_t chunk_size = MIN_CHUNK_SIZE;
+        while (chunk_size < MAX_CHUNK_SIZE && chunk_size * 16 < expected_bytes)
+            chunk_size <<= 1;
+        setChunkSize(chunk_size);
+    }
+
+
+    size_t chunkSize() const {
+        return chunk_size_;
+    }
+
+
+    size_t bytesUsed() const {
+        return next_offset_;
+    }
+
+
+    /*
+    * Reserves zero-initialized space for a link list, returns its offset.
+    */
+    size_t allocate(size_t bytes) {
+        if (bytes > chunk_size_)
+            throw std::runtime_error("Link list is larger than the arena chunk size");
+
+        std::unique_lock <std::mutex> lock(lock_);
+        size_t pos = next_offset_ & (chunk_size_ - 1);
+        if (next_offset_ == num_chunks_ * chunk_size_ || pos + bytes > chunk_size_) {
+            // start a new chunk, clearing the unused tail of the current one
+            if (next_offset_ < num_chunks_ * chunk_size_)
+                memset(at(next_offset_), 0, chunk_size_ - pos);
+            appendChunk(allocChunk());
+            next_offset_ = (num_chunks_ - 1) * chunk_size_;
+        }
+        size_t offset = next_offset_;
+        next_offset_ += bytes;
+        memset(at(offset), 0, bytes);
+        return offset;
+    }
+
+
+    inline char *at(size_t offset) const {
+        return chunk_table_.load(std::memory_order_acquire)[offset >> chunk_shift_] + (offset & (chunk_size_ - 1));
+    }
+
+
+    /*
+    * Writes the used address space as one contiguous block of bytesUsed() bytes.
+    */
+    void saveTo(std::ostream &output) const {
+        static const char zeros[4096] = {0};
+        size_t remaining = next_offset_;
+        for (size_t i = 0; remaining > 0; i++) {
+            size_t bytes = std::min(remaining, chunk_size_);
+            size_t valid = bytes;
+            // the last mapped chunk is only backed up to the end of the mapped block
+            if (i * chunk_size_ < mapped_bytes_ && (i + 1) * chunk_size_ > mapped_bytes_)
+                valid = std::min(bytes, mapped_bytes_ - i * chunk_size_);
+            output.write(chunk_table_.load()[i], valid);
+            for (size_t pad = bytes - valid; pad > 0; pad -= std::min(pad, sizeof(zeros)))
+                output.write(zeros, std::min(pad, sizeof(zeros)));
+            remaining -= bytes;
+        }
+    }
+
+
+    /*
+    * Reads a block written by saveTo into freshly allocated chunks.
+    */
+    void loadFrom(std::istream &input, size_t chunk_size, size_t bytes) {
+        clear();
+        std::unique_lock <std::mutex> lock(lock_);
+        setChunkSize(chunk_size);
+        size_t remaining = bytes;
+        while (remaining > 0) {
+            size_t n = std::min(remaining, chunk_size_);
+            char *chunk = allocChunk();
+            appendChunk(chunk);
+            input.read(chunk, n);
+            remaining -= n;
+        }
+        next_offset_ = bytes;
+    }
+
+
+    /*
+    * Maps a block written by saveTo at file_offset of the file privately (copy-on-write).
+    * The mapped chunks are never allocated from again; new link lists go to new chunks.
+    * Returns false if mmap is not available, in which case the caller should use loadFrom.
+    */
+    bool mapFrom(const std::string &location, size_t file_offset, size_t chunk_size, size_t bytes) {
+#ifdef HNSWLIB_HAVE_MMAP
+        clear();
+        std::unique_lock <std::mutex> lock(lock_);
+        setChunkSize(chunk_size);
+        if (bytes == 0)
+            return true;
+
+        int fd = open(location.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+        size_t map_offset = file_offset - file_offset % page_size;
+        size_t map_size = bytes + (file_offset - map_offset);
+        void *ptr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t) map_offset);
+        close(fd);
+        if (ptr == MAP_FAILED)
+            return false;
+
+        mapped_base_ = (char *) ptr;
+        mapped_size_ = map_size;
+        mapped_bytes_ = bytes;
+        char *base = mapped_base_ + (file_offset - map_offset);
+        size_t chunks = (bytes + chunk_size_ - 1) / chunk_size_;
+        for (size_t i = 0; i < chunks; i++)
+            appendChunk(base + i * chunk_size_);
+        // the last mapped chunk may be shorter than chunk_size, so continue in a new one
+        next_offset_ = num_chunks_ * chunk_size_;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+ private:
+    void setChunkSize(size_t chunk_size) {
+        if (chunk_size == 0 || (chunk_size & (chunk_size - 1)) != 0)
+            throw std::runtime_error("LinkListArena chunk size must be a power of two");
+        chunk_size_ = chunk_size;
+        chunk_shift_ = 0;
+        while (((size_t) 1 << chunk_shift_) < chunk_size)
+            chunk_shift_++;
+    }
+};
+}  // namespace hnswlib
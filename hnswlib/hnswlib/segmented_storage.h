@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+
+namespace hnswlib {
+
+///////////////////////////////////////////////////////////
+//
+// Two-level storage for per-element data.
+//
+// Elements live in fixed-size segments of 2^k elements, so element i is
+// found at segment i >> k, slot i & (2^k - 1). Growing the storage only
+// appends segments: existing elements are never copied or moved, and
+// pointers into them stay valid.
+//
+// The segment table is published through an atomic pointer. When it has
+// to grow, a larger copy is published and the old table is kept until
+// the storage is destroyed, so a reader that loaded the old table can
+// finish with it. Growing must not run concurrently with another grow.
+//
+/////////////////////////////////////////////////////////
+
+class SegmentTable {
+ protected:
+    std::atomic<char **> table_{nullptr};
+    size_t num_segments_{0};
+    size_t table_capacity_{0};
+    std::vector<char **> retired_tables_;
+    size_t segment_shift_{0};
+    size_t segment_mask_{0};
+
+    void appendSegment(char *segment) {
+        if (num_segments_ == table_capacity_) {
+            size_t new_capacity = table_capacity_ ? table_capacity_ * 2 : 16;
+            char **new_table = (char **) malloc(new_capacity * sizeof(char *));
+            if (new_table == nullptr)
+                throw std::runtime_error("Not enough memory: failed to allocate segment table");
+            char **old_table = table_.load();
+            if (old_table) {
+                memcpy(new_table, old_table, num_segments_ * sizeof(char *));
+                retired_tables_.push_back(old_table);
+            }
+            table_capacity_ = new_capacity;
+            table_.store(new_table, std::memory_order_release);
+        }
+        table_.load()[num_segments_] = segment;
+        num_segments_++;
+    }
+
+    void releaseTables() {
+        for (char **table : retired_tables_)
+            free(table);
+        retired_tables_.clear();
+        free(table_.load());
+        table_.store(nullptr);
+        table_capacity_ = 0;
+        num_segments_ = 0;
+    }
+
+    void setSegmentSize(size_t segment_size) {
+        if (segment_size == 0 || (segment_size & (segment_size - 1)) != 0)
+            throw std::runtime_error("Segment size must be a power of two");
+        segment_shift_ = 0;
+        while (((size_t) 1 << segment_shift_) < segment_size)
+            segment_shift_++;
+        segment_mask_ = segment_size - 1;
+    }
+
+    inline char *segment(size_t i) const {
+        return table_.load(std::memory_order_acquire)[i >> segment_shift_];
+    }
+
+ public:
+    SegmentTable() {}
+
+    SegmentTable(const SegmentTable &) = delete;
+    SegmentTable &operator=(const SegmentTable &) = delete;
+
+    size_t segmentSize() const {
+        return segment_mask_ + 1;
+    }
+
+    size_t capacity() const {
+        return num_segments_ << segment_shift_;
+    }
+};
+
+
+/*
+* Array of T, elements are value-initialized when their segment is added.
+*/
+template<typename T>
+class SegmentedArray : public SegmentTable {
+ public:
+    SegmentedArray() {}
+
+    ~SegmentedArray() {
+        clear();
+    }
+
+    void clear() {
+        char **table = table_.load();
+        for (size_t s = 0; s < num_segments_; s++)
+            delete[] (T *) table[s];
+        releaseTables();
+    }
+
+    /*
+    * Drops all elements and sets the number of elements per segment (a power of two).
+    */
+    void init(size_t segment_size) {
+        clear();
+        setSegmentSize(segment_size);
+    }
+
+    /*
+    * Grows the capacity to at least n elements, never shrinks.
+    */
+    void resize(size_t n) {
+        while (capacity() < n)
+            appendSegment((char *) new T[segmentSize()]());
+    }
+
+    inline T &operator[](size_t i) const {
+        return ((T *) segment(i))[i & segment_mask_];
+    }
+
+    void copyTo(T *dst, size_t count) const {
+        for (size_t i = 0; i < count; i += segmentSize())
+            memcpy(dst + i, &(*this)[i], std::min(segmentSize(), count - i) * sizeof(T));
+    }
+
+    void copyFrom(const T *src, size_t count) {
+        for (size_t i = 0; i < count; i += segmentSize())
+            memcpy(&(*this)[i], src + i, std::min(segmentSize(), count - i) * sizeof(T));
+    }
+
+    void saveTo(std::ostream &output, size_t count) const {
+        for (size_t i = 0; i < count; i += segmentSize())
+            output.write((char *) &(*this)[i], std::min(segmentSize(), count - i) * sizeof(T));
+    }
+
+    void loadFrom(std::istream &input, size_t count) {
+        for (size_t i = 0; i < count; i += segmentSize())
+            input.read((char *) &(*this)[i], std::min(segmentSize(), count - i) * sizeof(T));
+    }
+};
+
+
+/*
+* Fixed-size byte blocks, one per element, left uninitialized when their segment is added.
+*/
+class SegmentedBlocks : public SegmentTable {
+    size_t block_size_{0};
+
+ public:
+    SegmentedBlocks() {}
+
+    ~SegmentedBlocks() {
+        clear();
+    }
+
+    void clear() {
+        char **table = table_.load();
+        for (size_t s = 0; s < num_segments_; s++)
+            free(table[s]);
+        releaseTables();
+    }
+
+    /*
+    * Drops all elements and sets the number of elements per segment (a power of two)
+    * and the size of one element in bytes.
+    */
+    void init(size_t segment_size, size_t block_size) {
+        clear();
+        setSegmentSize(segment_size);
+        block_size_ = block_size;
+    }
+
+    /*
+    * Grows the capacity to at least n elements, never shrinks.
+    */
+    void resize(size_t n) {
+        while (capacity() < n) {
+            char *segment = (char *) malloc(segmentSize() * block_size_);
+            if (segment == nullptr)
+                throw std::runtime_error("Not enough memory: failed to allocate element segment");
+            appendSegment(segment);
+        }
+    }
+
+    inline char *at(size_t i) const {
+        return segment(i) + (i & segment_mask_) * block_size_;
+    }
+
+    void copyTo(char *dst, size_t count) const {
+        for (size_t i = 0; i < count; i += segmentSize())
+            memcpy(dst + i * block_size_, at(i), std::min(segmentSize(), count - i) * block_size_);
+    }
+
+    void copyFrom(const char *src, size_t count) {
+        for (size_t i = 0; i < count; i += segmentSize())
+            memcpy(at(i), src + i * block_size_, std::min(segmentSize(), count - i) * block_size_);
+    }
+
+    void saveTo(std::ostream &output, size_t count) const {
+        for (size_t i = 0; i < count; i += segmentSize())
+            output.write(at(i), std::min(segmentSize(), count - i) * block_size_);
+    }
+
+    void loadFrom(std::istream &input, size_t count) {
+        for (size_t i = 0; i < count; i += segmentSize())
+            input.read(at(i), std::min(segmentSize(), count - i) * block_size_);
+    }
+};
+}  // namespace hnswlib
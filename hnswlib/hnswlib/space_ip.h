@@ -314,6 +314,136 @@ InnerProductDistanceSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v,
 }
 #endif
 
+#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
+
+/*
+* Kernels for a dimension known at compile time, see L2SqrDimSSE.
+*/
+#if defined(USE_AVX512)
+template<size_t DIM>
+static float
+InnerProductDistanceDimAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    static_assert(DIM % 32 == 0, "DIM must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float PORTABLE_ALIGN64 TmpRes[16];
+
+    __m512 sum0 = _mm512_set1_ps(0);
+    __m512 sum1 = _mm512_set1_ps(0);
+    __m512 sum2 = _mm512_set1_ps(0);
+    __m512 sum3 = _mm512_set1_ps(0);
+
+    size_t i = 0;
+    for (; i + 64 <= DIM; i += 64) {
+        sum0 = _mm512_add_ps(sum0, _mm512_mul_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i)));
+        sum1 = _mm512_add_ps(sum1, _mm512_mul_ps(_mm512_loadu_ps(pVect1 + i + 16), _mm512_loadu_ps(pVect2 + i + 16)));
+        sum2 = _mm512_add_ps(sum2, _mm512_mul_ps(_mm512_loadu_ps(pVect1 + i + 32), _mm512_loadu_ps(pVect2 + i + 32)));
+        sum3 = _mm512_add_ps(sum3, _mm512_mul_ps(_mm512_loadu_ps(pVect1 + i + 48), _mm512_loadu_ps(pVect2 + i + 48)));
+    }
+    if (DIM % 64 != 0) {
+        sum0 = _mm512_add_ps(sum0, _mm512_mul_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i)));
+        sum1 = _mm512_add_ps(sum1, _mm512_mul_ps(_mm512_loadu_ps(pVect1 + i + 16), _mm512_loadu_ps(pVect2 + i + 16)));
+    }
+
+    sum0 = _mm512_add_ps(_mm512_add_ps(sum0, sum1), _mm512_add_ps(sum2, sum3));
+    _mm512_store_ps(TmpRes, sum0);
+    float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7] + TmpRes[8] + TmpRes[9] + TmpRes[10] + TmpRes[11] + TmpRes[12] + TmpRes[13] + TmpRes[14] + TmpRes[15];
+
+    return 1.0f - sum;
+}
+#endif
+
+#if defined(USE_AVX)
+template<size_t DIM>
+static float
+InnerProductDistanceDimAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    static_assert(DIM % 32 == 0, "DIM must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    __m256 sum0 = _mm256_set1_ps(0);
+    __m256 sum1 = _mm256_set1_ps(0);
+    __m256 sum2 = _mm256_set1_ps(0);
+    __m256 sum3 = _mm256_set1_ps(0);
+
+    for (size_t i = 0; i < DIM; i += 32) {
+        sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i)));
+        sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(pVect1 + i + 8), _mm256_loadu_ps(pVect2 + i + 8)));
+        sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(_mm256_loadu_ps(pVect1 + i + 16), _mm256_loadu_ps(pVect2 + i + 16)));
+        sum3 = _mm256_add_ps(sum3, _mm256_mul_ps(_mm256_loadu_ps(pVect1 + i + 24), _mm256_loadu_ps(pVect2 + i + 24)));
+    }
+
+    sum0 = _mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3));
+    _mm256_store_ps(TmpRes, sum0);
+    float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+
+    return 1.0f - sum;
+}
+#endif
+
+template<size_t DIM>
+static float
+InnerProductDistanceDimSSE(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    static_assert(DIM % 32 == 0, "DIM must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    __m128 sum0 = _mm_set1_ps(0);
+    __m128 sum1 = _mm_set1_ps(0);
+    __m128 sum2 = _mm_set1_ps(0);
+    __m128 sum3 = _mm_set1_ps(0);
+
+    for (size_t i = 0; i < DIM; i += 16) {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(pVect1 + i), _mm_loadu_ps(pVect2 + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(pVect1 + i + 4), _mm_loadu_ps(pVect2 + i + 4)));
+        sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_loadu_ps(pVect1 + i + 8), _mm_loadu_ps(pVect2 + i + 8)));
+        sum3 = _mm_add_ps(sum3, _mm_mul_ps(_mm_loadu_ps(pVect1 + i + 12), _mm_loadu_ps(pVect2 + i + 12)));
+    }
+
+    sum0 = _mm_add_ps(_mm_add_ps(sum0, sum1), _mm_add_ps(sum2, sum3));
+    _mm_store_ps(TmpRes, sum0);
+    float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+
+    return 1.0f - sum;
+}
+
+template<size_t DIM>
+static DISTFUNC<float>
+InnerProductDistanceDimSelect() {
+#if defined(USE_AVX512)
+    if (AVX512Capable())
+        return InnerProductDistanceDimAVX512<DIM>;
+#endif
+#if defined(USE_AVX)
+    if (AVXCapable())
+        return InnerProductDistanceDimAVX<DIM>;
+#endif
+    return InnerProductDistanceDimSSE<DIM>;
+}
+
+/*
+* Returns the kernel specialized for dim, or nullptr if dim is not one of
+* the common embedding sizes.
+*/
+static DISTFUNC<float>
+InnerProductDistanceForDim(size_t dim) {
+    switch (dim) {
+        case 96: return InnerProductDistanceDimSelect<96>();
+        case 128: return InnerProductDistanceDimSelect<128>();
+        case 256: return InnerProductDistanceDimSelect<256>();
+        case 384: return InnerProductDistanceDimSelect<384>();
+        case 512: return InnerProductDistanceDimSelect<512>();
+        case 768: return InnerProductDistanceDimSelect<768>();
+        case 1024: return InnerProductDistanceDimSelect<1024>();
+        case 1536: return InnerProductDistanceDimSelect<1536>();
+        case 3072: return InnerProductDistanceDimSelect<3072>();
+        default: return nullptr;
+    }
+}
+#endif
+
 class InnerProductSpace : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
     size_t data_size_;
@@ -352,6 +482,10 @@ class InnerProductSpace : public SpaceInterface<float> {
             fstdistfunc_ = InnerProductDistanceSIMD16ExtResiduals;
         else if (dim > 4)
             fstdistfunc_ = InnerProductDistanceSIMD4ExtResiduals;
+
+        DISTFUNC<float> dim_func = InnerProductDistanceForDim(dim);
+        if (dim_func)
+            fstdistfunc_ = dim_func;
 #endif
         dim_ = dim;
         data_size_ = dim * sizeof(float);
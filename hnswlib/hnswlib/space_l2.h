@@ -205,6 +205,151 @@ L2SqrSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty
 }
 #endif
 
+#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
+
+/*
+* Kernels for a dimension known at compile time. DIM is a multiple of 32,
+* so there is no residual loop, and four independent accumulators hide the
+* latency of the additions. qty_ptr is ignored.
+*/
+#if defined(USE_AVX512)
+template<size_t DIM>
+static float
+L2SqrDimAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    static_assert(DIM % 32 == 0, "DIM must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float PORTABLE_ALIGN64 TmpRes[16];
+
+    __m512 diff0, diff1, diff2, diff3;
+    __m512 sum0 = _mm512_set1_ps(0);
+    __m512 sum1 = _mm512_set1_ps(0);
+    __m512 sum2 = _mm512_set1_ps(0);
+    __m512 sum3 = _mm512_set1_ps(0);
+
+    size_t i = 0;
+    for (; i + 64 <= DIM; i += 64) {
+        diff0 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i));
+        diff1 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i + 16), _mm512_loadu_ps(pVect2 + i + 16));
+        diff2 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i + 32), _mm512_loadu_ps(pVect2 + i + 32));
+        diff3 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i + 48), _mm512_loadu_ps(pVect2 + i + 48));
+        sum0 = _mm512_add_ps(sum0, _mm512_mul_ps(diff0, diff0));
+        sum1 = _mm512_add_ps(sum1, _mm512_mul_ps(diff1, diff1));
+        sum2 = _mm512_add_ps(sum2, _mm512_mul_ps(diff2, diff2));
+        sum3 = _mm512_add_ps(sum3, _mm512_mul_ps(diff3, diff3));
+    }
+    if (DIM % 64 != 0) {
+        diff0 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i));
+        diff1 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i + 16), _mm512_loadu_ps(pVect2 + i + 16));
+        sum0 = _mm512_add_ps(sum0, _mm512_mul_ps(diff0, diff0));
+        sum1 = _mm512_add_ps(sum1, _mm512_mul_ps(diff1, diff1));
+    }
+
+    sum0 = _mm512_add_ps(_mm512_add_ps(sum0, sum1), _mm512_add_ps(sum2, sum3));
+    _mm512_store_ps(TmpRes, sum0);
+    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] +
+            TmpRes[7] + TmpRes[8] + TmpRes[9] + TmpRes[10] + TmpRes[11] + TmpRes[12] +
+            TmpRes[13] + TmpRes[14] + TmpRes[15];
+}
+#endif
+
+#if defined(USE_AVX)
+template<size_t DIM>
+static float
+L2SqrDimAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    static_assert(DIM % 32 == 0, "DIM must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    __m256 diff0, diff1, diff2, diff3;
+    __m256 sum0 = _mm256_set1_ps(0);
+    __m256 sum1 = _mm256_set1_ps(0);
+    __m256 sum2 = _mm256_set1_ps(0);
+    __m256 sum3 = _mm256_set1_ps(0);
+
+    for (size_t i = 0; i < DIM; i += 32) {
+        diff0 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i));
+        diff1 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i + 8), _mm256_loadu_ps(pVect2 + i + 8));
+        diff2 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i + 16), _mm256_loadu_ps(pVect2 + i + 16));
+        diff3 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i + 24), _mm256_loadu_ps(pVect2 + i + 24));
+        sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(diff0, diff0));
+        sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(diff1, diff1));
+        sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(diff2, diff2));
+        sum3 = _mm256_add_ps(sum3, _mm256_mul_ps(diff3, diff3));
+    }
+
+    sum0 = _mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3));
+    _mm256_store_ps(TmpRes, sum0);
+    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+}
+#endif
+
+template<size_t DIM>
+static float
+L2SqrDimSSE(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    static_assert(DIM % 32 == 0, "DIM must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    __m128 diff0, diff1, diff2, diff3;
+    __m128 sum0 = _mm_set1_ps(0);
+    __m128 sum1 = _mm_set1_ps(0);
+    __m128 sum2 = _mm_set1_ps(0);
+    __m128 sum3 = _mm_set1_ps(0);
+
+    for (size_t i = 0; i < DIM; i += 16) {
+        diff0 = _mm_sub_ps(_mm_loadu_ps(pVect1 + i), _mm_loadu_ps(pVect2 + i));
+        diff1 = _mm_sub_ps(_mm_loadu_ps(pVect1 + i + 4), _mm_loadu_ps(pVect2 + i + 4));
+        diff2 = _mm_sub_ps(_mm_loadu_ps(pVect1 + i + 8), _mm_loadu_ps(pVect2 + i + 8));
+        diff3 = _mm_sub_ps(_mm_loadu_ps(pVect1 + i + 12), _mm_loadu_ps(pVect2 + i + 12));
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(diff0, diff0));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(diff1, diff1));
+        sum2 = _mm_add_ps(sum2, _mm_mul_ps(diff2, diff2));
+        sum3 = _mm_add_ps(sum3, _mm_mul_ps(diff3, diff3));
+    }
+
+    sum0 = _mm_add_ps(_mm_add_ps(sum0, sum1), _mm_add_ps(sum2, sum3));
+    _mm_store_ps(TmpRes, sum0);
+    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+}
+
+template<size_t DIM>
+static DISTFUNC<float>
+L2SqrDimSelect() {
+#if defined(USE_AVX512)
+    if (AVX512Capable())
+        return L2SqrDimAVX512<DIM>;
+#endif
+#if defined(USE_AVX)
+    if (AVXCapable())
+        return L2SqrDimAVX<DIM>;
+#endif
+    return L2SqrDimSSE<DIM>;
+}
+
+/*
+* Returns the kernel specialized for dim, or nullptr if dim is not one of
+* the common embedding sizes.
+*/
+static DISTFUNC<float>
+L2SqrForDim(size_t dim) {
+    switch (dim) {
+        case 96: return L2SqrDimSelect<96>();
+        case 128: return L2SqrDimSelect<128>();
+        case 256: return L2SqrDimSelect<256>();
+        case 384: return L2SqrDimSelect<384>();
+        case 512: return L2SqrDimSelect<512>();
+        case 768: return L2SqrDimSelect<768>();
+        case 1024: return L2SqrDimSelect<1024>();
+        case 1536: return L2SqrDimSelect<1536>();
+        case 3072: return L2SqrDimSelect<3072>();
+        default: return nullptr;
+    }
+}
+#endif
+
 class L2Space : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
     size_t data_size_;
@@ -232,6 +377,10 @@ class L2Space : public SpaceInterface<float> {
             fstdistfunc_ = L2SqrSIMD16ExtResiduals;
         else if (dim > 4)
             fstdistfunc_ = L2SqrSIMD4ExtResiduals;
+
+        DISTFUNC<float> dim_func = L2SqrForDim(dim);
+        if (dim_func)
+            fstdistfunc_ = dim_func;
 #endif
         dim_ = dim;
         data_size_ = dim * sizeof(float);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace hnswlib {
+typedef size_t labeltype;
+typedef unsigned int tableint;
+}  // namespace hnswlib
@@ -64,9 +64,31 @@ class VisitedListPool {
 
     void releaseVisitedList(VisitedList *vl) {
         std::unique_lock <std::mutex> lock(poolguard);
+        if (vl->numelements < (unsigned int) numelements) {
+            // handed out before a resize
+            delete vl;
+            return;
+        }
         pool.push_front(vl);
     }
 
+    /*
+    * New lists get numelements1 entries, smaller pooled lists are dropped.
+    * Lists in use stay valid and are dropped when released.
+    */
+    void resize(int numelements1) {
+        std::unique_lock <std::mutex> lock(poolguard);
+        numelements = numelements1;
+        for (auto it = pool.begin(); it != pool.end();) {
+            if ((*it)->numelements < (unsigned int) numelements) {
+                delete *it;
+                it = pool.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
     ~VisitedListPool() {
         while (pool.size()) {
             VisitedList *rez = pool.front();
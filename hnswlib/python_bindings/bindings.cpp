@@ -6,35 +6,71 @@
 #include "hnswlib.h"
 #include <thread>
 #include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <stdlib.h>
 #include <assert.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 namespace py = pybind11;
 using namespace pybind11::literals;  // needed to bring in _a literal
 
 /*
- * replacement for the openmp '#pragma omp parallel for' directive
- * only handles a subset of functionality (no reductions etc)
- * Process ids from start (inclusive) to end (EXCLUSIVE)
- *
- * The method is borrowed from nmslib
+ * Persistent worker threads for ParallelFor.
+ * Workers are started on first use and reused by later calls, so add_items and
+ * knn_query do not create and join threads every time. The pool runs one job at
+ * a time and the calling thread takes part in it as thread 0. Calls made while
+ * the pool is busy (from other Python threads) start their own threads instead.
  */
-template<class Function>
-inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn) {
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-    }
+class ThreadPool {
+    std::mutex job_mutex;  // serializes jobs
+    std::mutex mutex;
+    std::condition_variable job_cv;
+    std::condition_variable done_cv;
+    size_t num_workers = 0;
+
+    const std::function<void(size_t, size_t)>* job_fn = nullptr;
+    size_t job_id = 0;
+    size_t job_threads = 0;
+    size_t job_end = 0;
+    size_t workers_finished = 0;
+    std::atomic<size_t> current{0};
+
+    // keep track of exceptions in threads
+    // https://stackoverflow.com/a/32428427/1713196
+    std::exception_ptr lastException = nullptr;
+    std::mutex lastExceptMutex;
+
+    void work(size_t threadId) {
+        while (true) {
+            size_t id = current.fetch_add(1);
+
+            if (id >= job_end) {
+                break;
+            }
 
-    if (numThreads == 1) {
-        for (size_t id = start; id < end; id++) {
-            fn(id, 0);
+            try {
+                (*job_fn)(id, threadId);
+            } catch (...) {
+                std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
+                lastException = std::current_exception();
+                /*
+                 * This will work even when current is the largest value that
+                 * size_t can fit, because fetch_add returns the previous value
+                 * before the increment (what will result in overflow
+                 * and produce 0 instead of current + 1).
+                 */
+                current = job_end;
+                break;
+            }
         }
-    } else {
+    }
+
+    static void runWithNewThreads(size_t start, size_t end, size_t numThreads, const std::function<void(size_t, size_t)>& fn) {
         std::vector<std::thread> threads;
         std::atomic<size_t> current(start);
-
-        // keep track of exceptions in threads
-        // https://stackoverflow.com/a/32428427/1713196
         std::exception_ptr lastException = nullptr;
         std::mutex lastExceptMutex;
 
@@ -52,12 +88,6 @@ inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn
                     } catch (...) {
                         std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
                         lastException = std::current_exception();
-                        /*
-                         * This will work even when current is the largest value that
-                         * size_t can fit, because fetch_add returns the previous value
-                         * before the increment (what will result in overflow
-                         * and produce 0 instead of current + 1).
-                         */
                         current = end;
                         break;
                     }
@@ -71,6 +101,103 @@ inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn
             std::rethrow_exception(lastException);
         }
     }
+
+    void workerLoop(size_t threadId) {
+        size_t seen_job = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            job_cv.wait(lock, [&] { return job_id != seen_job; });
+            seen_job = job_id;
+            if (threadId >= job_threads)
+                continue;
+
+            lock.unlock();
+            work(threadId);
+            lock.lock();
+
+            if (++workers_finished == job_threads - 1)
+                done_cv.notify_one();
+        }
+    }
+
+ public:
+    /*
+     * The pool is never destroyed, its threads are detached and end with the process.
+     * A forked child gets a new pool since the parent's workers do not exist there.
+     * Python threads call this with the GIL released, so the checks run under a mutex.
+     */
+    static ThreadPool& instance() {
+        static std::mutex instance_mutex;
+        static ThreadPool* pool = nullptr;
+        std::unique_lock<std::mutex> lock(instance_mutex);
+#ifndef _WIN32
+        static pid_t pool_pid = 0;
+        if (pool == nullptr || pool_pid != getpid()) {
+            pool = new ThreadPool();
+            pool_pid = getpid();
+        }
+#else
+        if (pool == nullptr)
+            pool = new ThreadPool();
+#endif
+        return *pool;
+    }
+
+    void run(size_t start, size_t end, size_t numThreads, const std::function<void(size_t, size_t)>& fn) {
+        std::unique_lock<std::mutex> job_lock(job_mutex, std::try_to_lock);
+        if (!job_lock.owns_lock()) {
+            runWithNewThreads(start, end, numThreads, fn);
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        for (; num_workers < numThreads - 1; num_workers++) {
+            size_t threadId = num_workers + 1;
+            std::thread([this, threadId] { workerLoop(threadId); }).detach();
+        }
+
+        job_fn = &fn;
+        job_threads = numThreads;
+        job_end = end;
+        current = start;
+        workers_finished = 0;
+        lastException = nullptr;
+        job_id++;
+        lock.unlock();
+        job_cv.notify_all();
+
+        work(0);
+
+        lock.lock();
+        done_cv.wait(lock, [&] { return workers_finished == job_threads - 1; });
+        job_fn = nullptr;
+        if (lastException) {
+            std::rethrow_exception(lastException);
+        }
+    }
+};
+
+
+/*
+ * replacement for the openmp '#pragma omp parallel for' directive
+ * only handles a subset of functionality (no reductions etc)
+ * Process ids from start (inclusive) to end (EXCLUSIVE)
+ *
+ * The method is borrowed from nmslib, threads come from ThreadPool
+ */
+template<class Function>
+inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn) {
+    if (numThreads <= 0) {
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    if (numThreads == 1) {
+        for (size_t id = start; id < end; id++) {
+            fn(id, 0);
+        }
+    } else {
+        ThreadPool::instance().run(start, end, numThreads, std::function<void(size_t, size_t)>(fn));
+    }
 }
 
 
@@ -112,33 +239,29 @@ inline void get_input_array_shapes(const py::buffer_info& buffer, size_t* rows,
 }
 
 
-inline std::vector<size_t> get_input_ids_and_check_shapes(const py::object& ids_, size_t feature_rows) {
-    std::vector<size_t> ids;
-    if (!ids_.is_none()) {
-        py::array_t < size_t, py::array::c_style | py::array::forcecast > items(ids_);
-        auto ids_numpy = items.request();
-        // check shapes
-        if (!((ids_numpy.ndim == 1 && ids_numpy.shape[0] == feature_rows) ||
-              (ids_numpy.ndim == 0 && feature_rows == 1))) {
-            char msg[256];
-            snprintf(msg, sizeof(msg),
-                "The input label shape %d does not match the input data vector shape %d",
-                ids_numpy.ndim, feature_rows);
-            throw std::runtime_error(msg);
-        }
-        // extract data
-        if (ids_numpy.ndim == 1) {
-            std::vector<size_t> ids1(ids_numpy.shape[0]);
-            for (size_t i = 0; i < ids1.size(); i++) {
-                ids1[i] = items.data()[i];
-            }
-            ids.swap(ids1);
-        } else if (ids_numpy.ndim == 0) {
-            ids.push_back(*items.data());
-        }
+/*
+ * Returns a pointer to the labels inside ids_array (nullptr if ids_ is None).
+ * The labels are not copied, ids_array keeps them alive.
+ */
+inline const size_t* get_input_ids_and_check_shapes(
+    const py::object& ids_,
+    size_t feature_rows,
+    py::array_t < size_t, py::array::c_style | py::array::forcecast >& ids_array) {
+    if (ids_.is_none()) {
+        return nullptr;
     }
-
-    return ids;
+    ids_array = py::array_t < size_t, py::array::c_style | py::array::forcecast >(ids_);
+    auto ids_numpy = ids_array.request();
+    // check shapes
+    if (!((ids_numpy.ndim == 1 && ids_numpy.shape[0] == feature_rows) ||
+          (ids_numpy.ndim == 0 && feature_rows == 1))) {
+        char msg[256];
+        snprintf(msg, sizeof(msg),
+            "The input label shape %d does not match the input data vector shape %d",
+            ids_numpy.ndim, feature_rows);
+        throw std::runtime_error(msg);
+    }
+    return ids_array.data();
 }
 
 
@@ -235,7 +358,7 @@ class Index {
     }
 
 
-    void normalize_vector(float* data, float* norm_array) {
+    void normalize_vector(const float* data, float* norm_array) {
         float norm = 0.0f;
         for (int i = 0; i < dim; i++)
             norm += data[i] * data[i];
@@ -262,37 +385,42 @@ class Index {
             num_threads = 1;
         }
 
-        std::vector<size_t> ids = get_input_ids_and_check_shapes(ids_, rows);
+        py::array_t < size_t, py::array::c_style | py::array::forcecast > ids_array;
+        const size_t* ids = get_input_ids_and_check_shapes(ids_, rows, ids_array);
+
+        // C-contiguous float32 input is used in place, rows are features apart
+        const dist_t* vectors = (const dist_t*)buffer.ptr;
 
         {
-            int start = 0;
-            if (!ep_added) {
-                size_t id = ids.size() ? ids.at(0) : (cur_l);
-                float* vector_data = (float*)items.data(0);
+            py::gil_scoped_release l;
+
+            size_t start = 0;
+            if (!ep_added && rows > 0) {
+                size_t id = ids ? ids[0] : (cur_l);
+                const float* vector_data = vectors;
                 std::vector<float> norm_array(dim);
                 if (normalize) {
                     normalize_vector(vector_data, norm_array.data());
                     vector_data = norm_array.data();
                 }
-                appr_alg->addPoint((void*)vector_data, (size_t)id, replace_deleted);
+                appr_alg->addPoint((const void*)vector_data, (size_t)id, replace_deleted);
                 start = 1;
                 ep_added = true;
             }
 
-            py::gil_scoped_release l;
             if (normalize == false) {
                 ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
-                    size_t id = ids.size() ? ids.at(row) : (cur_l + row);
-                    appr_alg->addPoint((void*)items.data(row), (size_t)id, replace_deleted);
+                    size_t id = ids ? ids[row] : (cur_l + row);
+                    appr_alg->addPoint((const void*)(vectors + row * features), (size_t)id, replace_deleted);
                     });
             } else {
                 std::vector<float> norm_array(num_threads * dim);
                 ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
                     // normalize vector:
                     size_t start_idx = threadId * dim;
-                    normalize_vector((float*)items.data(row), (norm_array.data() + start_idx));
+                    normalize_vector(vectors + row * features, (norm_array.data() + start_idx));
 
-                    size_t id = ids.size() ? ids.at(row) : (cur_l + row);
+                    size_t id = ids ? ids[row] : (cur_l + row);
                     appr_alg->addPoint((void*)(norm_array.data() + start_idx), (size_t)id, replace_deleted);
                     });
             }
@@ -329,9 +457,10 @@ class Index {
     std::vector<hnswlib::labeltype> getIdsList() {
         std::vector<hnswlib::labeltype> ids;
 
-        for (auto kv : appr_alg->label_lookup_) {
-            ids.push_back(kv.first);
-        }
+        ids.reserve(appr_alg->label_lookup_.size());
+        appr_alg->label_lookup_.forEach([&ids](hnswlib::labeltype label, hnswlib::tableint id) {
+            ids.push_back(label);
+        });
         return ids;
     }
 
@@ -352,7 +481,7 @@ class Index {
 
         char* data_level0_npy = (char*)malloc(level0_npy_size);
         char* link_list_npy = (char*)malloc(link_npy_size);
-        int* element_levels_npy = (int*)malloc(appr_alg->element_levels_.size() * sizeof(int));
+        int* element_levels_npy = (int*)malloc(appr_alg->max_elements_ * sizeof(int));
 
         hnswlib::labeltype* label_lookup_key_npy = (hnswlib::labeltype*)malloc(appr_alg->label_lookup_.size() * sizeof(hnswlib::labeltype));
         hnswlib::tableint* label_lookup_val_npy = (hnswlib::tableint*)malloc(appr_alg->label_lookup_.size() * sizeof(hnswlib::tableint));
@@ -361,21 +490,21 @@ class Index {
         memset(label_lookup_val_npy, -1, appr_alg->label_lookup_.size() * sizeof(hnswlib::tableint));
 
         size_t idx = 0;
-        for (auto it = appr_alg->label_lookup_.begin(); it != appr_alg->label_lookup_.end(); ++it) {
-            label_lookup_key_npy[idx] = it->first;
-            label_lookup_val_npy[idx] = it->second;
+        appr_alg->label_lookup_.forEach([&](hnswlib::labeltype label, hnswlib::tableint id) {
+            label_lookup_key_npy[idx] = label;
+            label_lookup_val_npy[idx] = id;
             idx++;
-        }
+        });
 
         memset(link_list_npy, 0, link_npy_size);
 
-        memcpy(data_level0_npy, appr_alg->data_level0_memory_, level0_npy_size);
-        memcpy(element_levels_npy, appr_alg->element_levels_.data(), appr_alg->element_levels_.size() * sizeof(int));
+        appr_alg->data_level0_memory_.copyTo(data_level0_npy, appr_alg->cur_element_count);
+        appr_alg->element_levels_.copyTo(element_levels_npy, appr_alg->max_elements_);
 
         for (size_t i = 0; i < appr_alg->cur_element_count; i++) {
             size_t linkListSize = appr_alg->element_levels_[i] > 0 ? appr_alg->size_links_per_element_ * appr_alg->element_levels_[i] : 0;
             if (linkListSize) {
-                memcpy(link_list_npy + link_npy_offsets[i], appr_alg->linkLists_[i], linkListSize);
+                memcpy(link_list_npy + link_npy_offsets[i], appr_alg->get_linklist(i, 1), linkListSize);
             }
         }
 
@@ -430,7 +559,7 @@ class Index {
                 free_when_done_id),
 
             "element_levels"_a = py::array_t<int>(
-                { appr_alg->element_levels_.size() },  // shape
+                { appr_alg->max_elements_ },  // shape
                 { sizeof(int) },  // C-style contiguous strides for each index
                 element_levels_npy,  // the data pointer
                 free_when_done_lvl),
@@ -546,11 +675,11 @@ class Index {
             if (label_lookup_val_npy.data()[i] < 0) {
                 throw std::runtime_error("Internal id cannot be negative!");
             } else {
-                appr_alg->label_lookup_.insert(std::make_pair(label_lookup_key_npy.data()[i], label_lookup_val_npy.data()[i]));
+                appr_alg->label_lookup_.insert(label_lookup_key_npy.data()[i], label_lookup_val_npy.data()[i]);
             }
         }
 
-        memcpy(appr_alg->element_levels_.data(), element_levels_npy.data(), element_levels_npy.nbytes());
+        appr_alg->element_levels_.copyFrom(element_levels_npy.data(), element_levels_npy.size());
 
         size_t link_npy_size = 0;
         std::vector<size_t> link_npy_offsets(appr_alg->cur_element_count);
@@ -562,18 +691,15 @@ class Index {
                 link_npy_size += linkListSize;
         }
 
-        memcpy(appr_alg->data_level0_memory_, data_level0_npy.data(), data_level0_npy.nbytes());
+        appr_alg->data_level0_memory_.copyFrom(data_level0_npy.data(), appr_alg->cur_element_count);
 
         for (size_t i = 0; i < appr_alg->max_elements_; i++) {
             size_t linkListSize = appr_alg->element_levels_[i] > 0 ? appr_alg->size_links_per_element_ * appr_alg->element_levels_[i] : 0;
             if (linkListSize == 0) {
-                appr_alg->linkLists_[i] = nullptr;
+                appr_alg->linkLists_[i] = 0;
             } else {
-                appr_alg->linkLists_[i] = (char*)malloc(linkListSize);
-                if (appr_alg->linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-
-                memcpy(appr_alg->linkLists_[i], link_list_npy.data() + link_npy_offsets[i], linkListSize);
+                appr_alg->linkLists_[i] = appr_alg->link_list_arena_.allocate(linkListSize);
+                memcpy(appr_alg->get_linklist(i, 1), link_list_npy.data() + link_npy_offsets[i], linkListSize);
             }
         }
 
@@ -604,25 +730,34 @@ class Index {
         const std::function<bool(hnswlib::labeltype)>& filter = nullptr) {
         py::array_t < dist_t, py::array::c_style | py::array::forcecast > items(input);
         auto buffer = items.request();
-        hnswlib::labeltype* data_numpy_l;
-        dist_t* data_numpy_d;
         size_t rows, features;
+        get_input_array_shapes(buffer, &rows, &features);
 
         if (num_threads <= 0)
             num_threads = num_threads_default;
 
+        // results are written straight into the returned arrays
+        py::array_t<hnswlib::labeltype> labels(
+            { rows, k },  // shape
+            { k * sizeof(hnswlib::labeltype),
+              sizeof(hnswlib::labeltype) });  // C-style contiguous strides for each index
+        py::array_t<dist_t> distances(
+            { rows, k },  // shape
+            { k * sizeof(dist_t), sizeof(dist_t) });  // C-style contiguous strides for each index
+        hnswlib::labeltype* data_numpy_l = labels.mutable_data();
+        dist_t* data_numpy_d = distances.mutable_data();
+
+        // C-contiguous float32 input is used in place, rows are features apart
+        const dist_t* vectors = (const dist_t*)buffer.ptr;
+
         {
             py::gil_scoped_release l;
-            get_input_array_shapes(buffer, &rows, &features);
 
             // avoid using threads when the number of searches is small:
             if (rows <= num_threads * 4) {
                 num_threads = 1;
             }
 
-            data_numpy_l = new hnswlib::labeltype[rows * k];
-            data_numpy_d = new dist_t[rows * k];
-
             // Warning: search with a filter works slow in python in multithreaded mode. For best performance set num_threads=1
             CustomFilterFunctor idFilter(filter);
             CustomFilterFunctor* p_idFilter = filter ? &idFilter : nullptr;
@@ -630,7 +765,7 @@ class Index {
             if (normalize == false) {
                 ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
                     std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
-                        (void*)items.data(row), k, p_idFilter);
+                        (const void*)(vectors + row * features), k, p_idFilter);
                     if (result.size() != k)
                         throw std::runtime_error(
                             "Cannot return the results in a contigious 2D array. Probably ef or M is too small");
@@ -644,10 +779,8 @@ class Index {
             } else {
                 std::vector<float> norm_array(num_threads * features);
                 ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                    float* data = (float*)items.data(row);
-
                     size_t start_idx = threadId * dim;
-                    normalize_vector((float*)items.data(row), (norm_array.data() + start_idx));
+                    normalize_vector(vectors + row * features, (norm_array.data() + start_idx));
 
                     std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
                         (void*)(norm_array.data() + start_idx), k, p_idFilter);
@@ -663,25 +796,8 @@ class Index {
                 });
             }
         }
-        py::capsule free_when_done_l(data_numpy_l, [](void* f) {
-            delete[] f;
-            });
-        py::capsule free_when_done_d(data_numpy_d, [](void* f) {
-            delete[] f;
-            });
 
-        return py::make_tuple(
-            py::array_t<hnswlib::labeltype>(
-                { rows, k },  // shape
-                { k * sizeof(hnswlib::labeltype),
-                  sizeof(hnswlib::labeltype) },  // C-style contiguous strides for each index
-                data_numpy_l,  // the data pointer
-                free_when_done_l),
-            py::array_t<dist_t>(
-                { rows, k },  // shape
-                { k * sizeof(dist_t), sizeof(dist_t) },  // C-style contiguous strides for each index
-                data_numpy_d,  // the data pointer
-                free_when_done_d));
+        return py::make_tuple(labels, distances);
     }
 
 
@@ -759,7 +875,7 @@ class BFIndex {
     }
 
 
-    void normalize_vector(float* data, float* norm_array) {
+    void normalize_vector(const float* data, float* norm_array) {
         float norm = 0.0f;
         for (int i = 0; i < dim; i++)
             norm += data[i] * data[i];
@@ -778,16 +894,19 @@ class BFIndex {
         if (features != dim)
             throw std::runtime_error("Wrong dimensionality of the vectors");
 
-        std::vector<size_t> ids = get_input_ids_and_check_shapes(ids_, rows);
+        py::array_t < size_t, py::array::c_style | py::array::forcecast > ids_array;
+        const size_t* ids = get_input_ids_and_check_shapes(ids_, rows, ids_array);
+        const dist_t* vectors = (const dist_t*)buffer.ptr;
 
         {
+            py::gil_scoped_release l;
+            std::vector<float> normalized_vector(dim);
             for (size_t row = 0; row < rows; row++) {
-                size_t id = ids.size() ? ids.at(row) : cur_l + row;
+                size_t id = ids ? ids[row] : cur_l + row;
                 if (!normalize) {
-                    alg->addPoint((void *) items.data(row), (size_t) id);
+                    alg->addPoint((const void *) (vectors + row * features), (size_t) id);
                 } else {
-                    std::vector<float> normalized_vector(dim);
-                    normalize_vector((float *)items.data(row), normalized_vector.data());
+                    normalize_vector(vectors + row * features, normalized_vector.data());
                     alg->addPoint((void *) normalized_vector.data(), (size_t) id);
                 }
             }
@@ -823,23 +942,28 @@ class BFIndex {
         const std::function<bool(hnswlib::labeltype)>& filter = nullptr) {
         py::array_t < dist_t, py::array::c_style | py::array::forcecast > items(input);
         auto buffer = items.request();
-        hnswlib::labeltype *data_numpy_l;
-        dist_t *data_numpy_d;
         size_t rows, features;
+        get_input_array_shapes(buffer, &rows, &features);
+
+        py::array_t<hnswlib::labeltype> labels(
+            { rows, k },  // shape
+            { k * sizeof(hnswlib::labeltype),
+              sizeof(hnswlib::labeltype) });  // C-style contiguous strides for each index
+        py::array_t<dist_t> distances(
+            { rows, k },  // shape
+            { k * sizeof(dist_t), sizeof(dist_t) });  // C-style contiguous strides for each index
+        hnswlib::labeltype *data_numpy_l = labels.mutable_data();
+        dist_t *data_numpy_d = distances.mutable_data();
+        const dist_t *vectors = (const dist_t *) buffer.ptr;
         {
             py::gil_scoped_release l;
 
-            get_input_array_shapes(buffer, &rows, &features);
-
-            data_numpy_l = new hnswlib::labeltype[rows * k];
-            data_numpy_d = new dist_t[rows * k];
-
             CustomFilterFunctor idFilter(filter);
             CustomFilterFunctor* p_idFilter = filter ? &idFilter : nullptr;
 
             for (size_t row = 0; row < rows; row++) {
                 std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = alg->searchKnn(
-                        (void *) items.data(row), k, p_idFilter);
+                        (const void *) (vectors + row * features), k, p_idFilter);
                 for (int i = k - 1; i >= 0; i--) {
                     auto &result_tuple = result.top();
                     data_numpy_d[row * k + i] = result_tuple.first;
@@ -849,26 +973,7 @@ class BFIndex {
             }
         }
 
-        py::capsule free_when_done_l(data_numpy_l, [](void *f) {
-            delete[] f;
-        });
-        py::capsule free_when_done_d(data_numpy_d, [](void *f) {
-            delete[] f;
-        });
-
-
-        return py::make_tuple(
-                py::array_t<hnswlib::labeltype>(
-                        { rows, k },  // shape
-                        { k * sizeof(hnswlib::labeltype),
-                          sizeof(hnswlib::labeltype)},  // C-style contiguous strides for each index
-                        data_numpy_l,  // the data pointer
-                        free_when_done_l),
-                py::array_t<dist_t>(
-                        { rows, k },  // shape
-                        { k * sizeof(dist_t), sizeof(dist_t) },  // C-style contiguous strides for each index
-                        data_numpy_d,  // the data pointer
-                        free_when_done_d));
+        return py::make_tuple(labels, distances);
     }
 };
 
@@ -0,0 +1,109 @@
+// This is a test file for the distance kernels specialized for common dimensions.
+// It checks them against the scalar kernels and prints the cost of one
+// distance computation compared to the generic SIMD path.
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
+
+const size_t dims[] = {96, 128, 256, 384, 512, 768, 1024, 1536, 3072};
+const size_t num_vectors = 64;  // small enough to stay in cache, so the kernels are measured
+const size_t num_pairs = 2000000;
+
+void check(bool condition, const char *message) {
+    if (!condition)
+        throw std::runtime_error(message);
+}
+
+bool close(float a, float b) {
+    return std::fabs(a - b) <= 1e-4f * std::max(1.0f, std::fabs(b));
+}
+
+volatile float sink;  // keeps the timed loops from being optimized away
+
+double ticks() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return (double) __rdtsc();
+#else
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/*
+* Returns the average number of TSC cycles (or nanoseconds, where the TSC
+* is not available) per call of func over pairs taken from data.
+*/
+double measure(hnswlib::DISTFUNC<float> func, const std::vector<float> &data, size_t dim) {
+    size_t iterations = num_pairs * 128 / dim;
+    float sum = 0;
+    double start = ticks();
+    for (size_t i = 0; i < iterations; i++) {
+        const float *a = data.data() + (i % num_vectors) * dim;
+        const float *b = data.data() + ((i * 7 + 3) % num_vectors) * dim;
+        sum += func(a, b, &dim);
+    }
+    double elapsed = ticks() - start;
+    sink = sum;
+    return elapsed / iterations;
+}
+
+void testDim(size_t dim, std::mt19937 &rng) {
+    std::uniform_real_distribution<float> distrib(-1, 1);
+    std::vector<float> data(num_vectors * dim);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = distrib(rng);
+
+    hnswlib::L2Space l2space(dim);
+    hnswlib::InnerProductSpace ipspace(dim);
+    hnswlib::DISTFUNC<float> l2_dim = hnswlib::L2SqrForDim(dim);
+    hnswlib::DISTFUNC<float> ip_dim = hnswlib::InnerProductDistanceForDim(dim);
+    check(l2_dim != nullptr && ip_dim != nullptr, "no specialized kernel");
+    check(l2space.get_dist_func() == l2_dim, "L2Space does not use the specialized kernel");
+    check(ipspace.get_dist_func() == ip_dim, "InnerProductSpace does not use the specialized kernel");
+
+    for (size_t i = 0; i < num_vectors; i++) {
+        const float *a = data.data() + i * dim;
+        const float *b = data.data() + ((i + 1) % num_vectors) * dim;
+        check(close(l2_dim(a, b, &dim), hnswlib::L2Sqr(a, b, &dim)), "wrong L2 distance");
+        check(close(ip_dim(a, b, &dim), hnswlib::InnerProductDistance(a, b, &dim)), "wrong inner product distance");
+    }
+
+    // the constructors above selected the generic kernels for this CPU
+    double l2_generic = measure(hnswlib::L2SqrSIMD16Ext, data, dim);
+    double l2_special = measure(l2_dim, data, dim);
+    double ip_generic = measure(hnswlib::InnerProductDistanceSIMD16Ext, data, dim);
+    double ip_special = measure(ip_dim, data, dim);
+    printf("%5zu  L2 %8.1f -> %8.1f   IP %8.1f -> %8.1f\n",
+        dim, l2_generic, l2_special, ip_generic, ip_special);
+}
+
+#endif
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
+    std::mt19937 rng;
+    rng.seed(47);
+    std::cout << "  dim  cycles per distance, generic -> specialized" << std::endl;
+    for (size_t dim : dims)
+        testDim(dim, rng);
+    check(hnswlib::L2SqrForDim(100) == nullptr, "unexpected kernel for dim 100");
+#else
+    std::cout << "No SIMD kernels in this build, skipping" << std::endl;
+#endif
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+// This is a test file for testing LabelLookupMap and
+// the label map block written by HierarchicalNSW::saveIndex
+
+// included first to check that it does not depend on hnswlib.h
+#include "../../hnswlib/label_map.h"
+#include "../../hnswlib/hnswlib.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+void check(bool condition, const char *message) {
+    if (!condition)
+        throw std::runtime_error(message);
+}
+
+void testMap() {
+    hnswlib::LabelLookupMap map;
+    std::unordered_map<hnswlib::labeltype, hnswlib::tableint> reference;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_int_distribution<hnswlib::labeltype> distrib_label(0, 20000);
+
+    // random inserts, overwrites and erases against std::unordered_map
+    for (int i = 0; i < 200000; i++) {
+        hnswlib::labeltype label = distrib_label(rng);
+        if (i % 3 == 2) {
+            bool erased = map.erase(label);
+            check(erased == (reference.erase(label) == 1), "erase mismatch");
+        } else {
+            map.insert(label, (hnswlib::tableint) i);
+            reference[label] = i;
+        }
+    }
+    check(map.size() == reference.size(), "size mismatch");
+    for (hnswlib::labeltype label = 0; label <= 20000; label++) {
+        hnswlib::tableint id;
+        auto search = reference.find(label);
+        bool found = map.find(label, id);
+        check(found == (search != reference.end()), "find mismatch");
+        if (found)
+            check(id == search->second, "id mismatch");
+    }
+
+    size_t visited = 0;
+    map.forEach([&](hnswlib::labeltype label, hnswlib::tableint id) {
+        check(reference.at(label) == id, "forEach mismatch");
+        visited++;
+    });
+    check(visited == reference.size(), "forEach count mismatch");
+
+    // labels that are not small integers
+    map.insert((hnswlib::labeltype) -1, 7);
+    map.insert(((hnswlib::labeltype) 1) << 63, 8);
+    check(map.contains((hnswlib::labeltype) -1), "large label not found");
+    check(map.contains(((hnswlib::labeltype) 1) << 63), "large label not found");
+}
+
+std::string saveMap(const hnswlib::LabelLookupMap &map) {
+    std::ostringstream output;
+    map.saveTo(output);
+    return output.str();
+}
+
+void testSaveDeterministic() {
+    // empty slots, including ones freed by erase, are saved as zeros
+    hnswlib::LabelLookupMap map1;
+    hnswlib::LabelLookupMap map2;
+    for (int i = 0; i < 2; i++) {
+        hnswlib::LabelLookupMap &map = i == 0 ? map1 : map2;
+        for (hnswlib::labeltype label = 0; label < 5000; label++)
+            map.insert(label * 7, (hnswlib::tableint) label);
+        for (hnswlib::labeltype label = 0; label < 5000; label += 3)
+            map.erase(label * 7);
+    }
+    std::string saved = saveMap(map1);
+    check(saved == saveMap(map1), "saving twice gives different bytes");
+    check(saved == saveMap(map2), "same map saved with different bytes");
+}
+
+void testLoadCorrupt() {
+    hnswlib::LabelLookupMap map;
+    for (hnswlib::labeltype label = 0; label < 100; label++)
+        map.insert(label * 5, (hnswlib::tableint) label);
+
+    std::istringstream input(saveMap(map));
+    hnswlib::LabelLookupMap loaded;
+    check(loaded.loadFrom(input, 100), "map not loaded");
+    check(loaded.size() == 100, "loaded map has wrong size");
+
+    // ids past the number of elements
+    std::istringstream corrupt(saveMap(map));
+    bool thrown = false;
+    try {
+        loaded.loadFrom(corrupt, 50);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    check(thrown, "ids past the number of elements were loaded");
+    check(loaded.size() == 0, "map not cleared after corrupt load");
+}
+
+void testSaveLoad() {
+    int d = 8;
+    size_t n = 2000;
+    std::string path = "label_lookup_test.bin";
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < n * d; i++) {
+        data[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> *alg_hnsw = new hnswlib::HierarchicalNSW<float>(&space, n);
+    for (size_t i = 0; i < n; i++) {
+        alg_hnsw->addPoint(data.data() + i * d, 3 * i + 1);
+    }
+    alg_hnsw->markDelete(4);
+    alg_hnsw->saveIndex(path);
+    size_t label_map_bytes = sizeof(unsigned int) + sizeof(size_t) + alg_hnsw->label_lookup_.serializedSize();
+    delete alg_hnsw;
+
+    // index with the label map block
+    alg_hnsw = new hnswlib::HierarchicalNSW<float>(&space, path);
+    check(alg_hnsw->label_lookup_.size() == n, "loaded label map has wrong size");
+    for (size_t i = 0; i < n; i++) {
+        hnswlib::tableint id;
+        check(alg_hnsw->label_lookup_.find(3 * i + 1, id), "label not found after load");
+        check(alg_hnsw->getExternalLabel(id) == 3 * i + 1, "label maps to wrong element");
+    }
+    check(alg_hnsw->getDeletedCount() == 1, "deleted count not restored");
+    delete alg_hnsw;
+
+    // index in the old format, without the label map block
+    std::vector<char> contents;
+    {
+        std::ifstream input(path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+    {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        output.write(contents.data(), contents.size() - label_map_bytes);
+    }
+    alg_hnsw = new hnswlib::HierarchicalNSW<float>(&space, path);
+    check(alg_hnsw->label_lookup_.size() == n, "rebuilt label map has wrong size");
+    for (size_t i = 0; i < n; i++) {
+        if (3 * i + 1 == 4)
+            continue;  // deleted
+        std::vector<float> v = alg_hnsw->getDataByLabel<float>(3 * i + 1);
+        check(std::equal(v.begin(), v.end(), data.begin() + i * d), "wrong vector after load");
+    }
+    delete alg_hnsw;
+
+    std::remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testMap();
+    testSaveDeterministic();
+    testLoadCorrupt();
+    testSaveLoad();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
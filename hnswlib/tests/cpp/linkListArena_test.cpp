@@ -0,0 +1,132 @@
+// This is a test file for testing the link list arena of HierarchicalNSW:
+// saving it as one block, reading and mmapping it back,
+// saving a mapped index to its own file, and loading indexes saved with per-element link lists
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+void check(bool condition, const char *message) {
+    if (!condition)
+        throw std::runtime_error(message);
+}
+
+// writes the index in the format used before the link list arena
+void saveIndexLegacy(hnswlib::HierarchicalNSW<float> *alg, const std::string &location) {
+    std::ofstream output(location, std::ios::binary);
+    hnswlib::writeBinaryPOD(output, alg->offsetLevel0_);
+    hnswlib::writeBinaryPOD(output, alg->max_elements_);
+    hnswlib::writeBinaryPOD(output, alg->cur_element_count);
+    hnswlib::writeBinaryPOD(output, alg->size_data_per_element_);
+    hnswlib::writeBinaryPOD(output, alg->label_offset_);
+    hnswlib::writeBinaryPOD(output, alg->offsetData_);
+    hnswlib::writeBinaryPOD(output, alg->maxlevel_);
+    hnswlib::writeBinaryPOD(output, alg->enterpoint_node_);
+    hnswlib::writeBinaryPOD(output, alg->maxM_);
+    hnswlib::writeBinaryPOD(output, alg->maxM0_);
+    hnswlib::writeBinaryPOD(output, alg->M_);
+    hnswlib::writeBinaryPOD(output, alg->mult_);
+    hnswlib::writeBinaryPOD(output, alg->ef_construction_);
+    alg->data_level0_memory_.saveTo(output, alg->cur_element_count);
+    for (size_t i = 0; i < alg->cur_element_count; i++) {
+        unsigned int linkListSize = alg->element_levels_[i] > 0 ? alg->size_links_per_element_ * alg->element_levels_[i] : 0;
+        hnswlib::writeBinaryPOD(output, linkListSize);
+        if (linkListSize)
+            output.write((char *) alg->get_linklist(i, 1), linkListSize);
+    }
+}
+
+void compareIndexes(hnswlib::HierarchicalNSW<float> *a, hnswlib::HierarchicalNSW<float> *b) {
+    check(a->cur_element_count == b->cur_element_count, "element count differs");
+    for (size_t i = 0; i < a->cur_element_count; i++) {
+        check(a->element_levels_[i] == b->element_levels_[i], "element level differs");
+        for (int level = 1; level <= a->element_levels_[i]; level++) {
+            check(memcmp(a->get_linklist(i, level), b->get_linklist(i, level), a->size_links_per_element_) == 0,
+                  "link list differs");
+        }
+    }
+}
+
+void test() {
+    int d = 16;
+    size_t n = 5000;
+    int k = 10;
+    std::string path = "link_list_arena_test.bin";
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < n * d; i++) {
+        data[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    // small M gives more upper levels
+    hnswlib::HierarchicalNSW<float> *alg_hnsw = new hnswlib::HierarchicalNSW<float>(&space, n, 4);
+    for (size_t i = 0; i < n; i++) {
+        alg_hnsw->addPoint(data.data() + i * d, i);
+    }
+    alg_hnsw->saveIndex(path);
+
+    hnswlib::HierarchicalNSW<float> *alg_read = new hnswlib::HierarchicalNSW<float>(&space);
+    alg_read->loadIndex(path, &space, 2 * n);
+    compareIndexes(alg_hnsw, alg_read);
+
+    hnswlib::HierarchicalNSW<float> *alg_mapped = new hnswlib::HierarchicalNSW<float>(&space);
+    alg_mapped->loadIndex(path, &space, 2 * n, true);
+    compareIndexes(alg_hnsw, alg_mapped);
+
+    for (size_t i = 0; i < n; i += 100) {
+        auto expected = alg_hnsw->searchKnnCloserFirst(data.data() + i * d, k);
+        check(expected == alg_read->searchKnnCloserFirst(data.data() + i * d, k), "search results differ");
+        check(expected == alg_mapped->searchKnnCloserFirst(data.data() + i * d, k), "search results differ");
+    }
+
+    // saving a mapped index over the file it is mapped from keeps both intact
+    alg_mapped->saveIndex(path);
+    compareIndexes(alg_hnsw, alg_mapped);
+    hnswlib::HierarchicalNSW<float> *alg_resaved = new hnswlib::HierarchicalNSW<float>(&space);
+    alg_resaved->loadIndex(path, &space, 2 * n, true);
+    compareIndexes(alg_hnsw, alg_resaved);
+    delete alg_resaved;
+
+    // inserting into a mapped index continues in new chunks and survives another save
+    for (size_t i = 0; i < n; i++) {
+        alg_mapped->addPoint(data.data() + i * d, n + i);
+    }
+    std::string path_mapped = path + ".2";
+    alg_mapped->saveIndex(path_mapped);
+    hnswlib::HierarchicalNSW<float> *alg_reread = new hnswlib::HierarchicalNSW<float>(&space, path_mapped);
+    compareIndexes(alg_mapped, alg_reread);
+    delete alg_reread;
+    delete alg_mapped;
+    delete alg_read;
+    std::remove(path_mapped.c_str());
+
+    // old format with one size-prefixed link list per element
+    saveIndexLegacy(alg_hnsw, path);
+    hnswlib::HierarchicalNSW<float> *alg_legacy = new hnswlib::HierarchicalNSW<float>(&space, path);
+    compareIndexes(alg_hnsw, alg_legacy);
+    delete alg_legacy;
+
+    delete alg_hnsw;
+    std::remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
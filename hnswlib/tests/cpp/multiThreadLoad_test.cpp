@@ -56,8 +56,7 @@ int main() {
 
     // insert remaining elements if needed
     for (hnswlib::labeltype label = 0; label < max_elements; label++) {
-        auto search = alg_hnsw->label_lookup_.find(label);
-        if (search == alg_hnsw->label_lookup_.end()) {
+        if (!alg_hnsw->label_lookup_.contains(label)) {
             std::cout << "Adding " << label << std::endl;
             std::vector<float> data(d);
             for (int i = 0; i < d; i++) {
@@ -0,0 +1,110 @@
+// This is a test file for testing resizeIndex:
+// growing the index in segments while other threads keep searching
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+void check(bool condition, const char *message) {
+    if (!condition)
+        throw std::runtime_error(message);
+}
+
+void test() {
+    // large elements give small segments, so the index grows by several of them
+    int d = 4096;
+    int intrinsic_d = 16;
+    size_t n = 5000;
+    size_t initial_max_elements = 100;
+    int num_search_threads = 2;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    // each vector repeats a point of a low dimension, which keeps the search accurate
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < n; i++) {
+        for (int j = 0; j < intrinsic_d; j++) {
+            data[i * d + j] = distrib(rng);
+        }
+        for (int j = intrinsic_d; j < d; j++) {
+            data[i * d + j] = data[i * d + j % intrinsic_d];
+        }
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> *alg_hnsw = new hnswlib::HierarchicalNSW<float>(&space, initial_max_elements, 8, 40);
+    size_t segment_size = alg_hnsw->data_level0_memory_.segmentSize();
+    check(segment_size < n, "index fits in one segment");
+
+    // the segment size does not depend on the initial max_elements
+    hnswlib::HierarchicalNSW<float> *alg_single = new hnswlib::HierarchicalNSW<float>(&space, 1);
+    check(alg_single->data_level0_memory_.segmentSize() == segment_size, "segment size depends on max_elements");
+    delete alg_single;
+
+    // first element so that searches have an entry point
+    alg_hnsw->addPoint(data.data(), 0);
+
+    std::atomic<bool> done{false};
+    std::atomic<size_t> num_searches{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_search_threads; t++) {
+        threads.push_back(std::thread([&, t]() {
+            std::mt19937 thread_rng(t);
+            std::uniform_int_distribution<size_t> distrib_query(0, n - 1);
+            while (!done) {
+                size_t q = distrib_query(thread_rng);
+                alg_hnsw->searchKnn(data.data() + q * d, 5);
+                num_searches++;
+            }
+        }));
+    }
+
+    // insert, doubling the capacity whenever the index is full
+    char *first_element = alg_hnsw->getDataByInternalId(0);
+    for (size_t i = 1; i < n; i++) {
+        if (alg_hnsw->getCurrentElementCount() == alg_hnsw->getMaxElements()) {
+            alg_hnsw->resizeIndex(2 * alg_hnsw->getMaxElements());
+        }
+        alg_hnsw->addPoint(data.data() + i * d, i);
+    }
+    done = true;
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    check(alg_hnsw->getDataByInternalId(0) == first_element, "element moved by resizeIndex");
+    check(alg_hnsw->data_level0_memory_.segmentSize() == segment_size, "segment size changed");
+    check(alg_hnsw->getCurrentElementCount() == n, "wrong element count");
+    check(num_searches > 0, "no searches ran");
+
+    // every element finds itself
+    size_t correct = 0;
+    for (size_t i = 0; i < n; i++) {
+        auto result = alg_hnsw->searchKnn(data.data() + i * d, 1);
+        if (!result.empty() && result.top().second == i)
+            correct++;
+    }
+    float recall = (float) correct / n;
+    std::cout << "Recall: " << recall << std::endl;
+    check(recall > 0.95, "recall is too low");
+
+    delete alg_hnsw;
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
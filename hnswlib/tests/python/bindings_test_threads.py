@@ -0,0 +1,51 @@
+import unittest
+
+import numpy as np
+
+import hnswlib
+
+
+class ThreadPoolTestCase(unittest.TestCase):
+    def testThreadPool(self):
+        dim = 16
+        num_elements = 5000
+        k = 10
+
+        np.random.seed(47)
+        data = np.float32(np.random.random((num_elements, dim)))
+
+        p = hnswlib.Index(space='l2', dim=dim)
+        p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+        p.set_ef(50)
+
+        # add in several calls so the pooled threads are reused
+        for batch in np.array_split(np.arange(num_elements), 5):
+            p.add_items(data[batch], batch, num_threads=4)
+        self.assertEqual(p.get_current_count(), num_elements)
+
+        labels_single, distances_single = p.knn_query(data, k=k, num_threads=1)
+        for _ in range(3):
+            labels, distances = p.knn_query(data, k=k, num_threads=4)
+            np.testing.assert_array_equal(labels, labels_single)
+            np.testing.assert_array_equal(distances, distances_single)
+
+        self.assertEqual(labels.dtype, np.uint64)
+        self.assertEqual(distances.dtype, np.float32)
+        self.assertTrue(labels.flags['C_CONTIGUOUS'])
+        self.assertTrue(distances.flags['C_CONTIGUOUS'])
+
+        # float64 and non-contiguous inputs are converted and give the same results
+        labels, _ = p.knn_query(np.float64(data), k=k, num_threads=4)
+        np.testing.assert_array_equal(labels, labels_single)
+        labels, _ = p.knn_query(np.asfortranarray(data), k=k, num_threads=4)
+        np.testing.assert_array_equal(labels, labels_single)
+
+        # an error in a worker thread is raised and the pool stays usable
+        with self.assertRaises(RuntimeError):
+            p.knn_query(data, k=num_elements + 1, num_threads=4)
+        labels, _ = p.knn_query(data, k=k, num_threads=4)
+        np.testing.assert_array_equal(labels, labels_single)
+
+
+if __name__ == "__main__":
+    unittest.main()
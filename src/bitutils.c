@@ -0,0 +1,323 @@
+#include "postgres.h"
+
+#include "bitutils.h"
+
+/*
+ * Explicit kernels for bit vectors
+ *
+ * The default kernels count bits eight bytes at a time in portable C.
+ * On x86-64 the POPCNT instruction replaces that, and AVX-512 VPOPCNTDQ
+ * counts 64 bytes per instruction. AArch64 counts 16 bytes per CNT.
+ */
+#if (defined(__x86_64__) || defined(_M_AMD64)) && defined(__GNUC__)
+#define USE_DISPATCH
+#include <immintrin.h>
+#define TARGET_POPCNT __attribute__((target("popcnt")))
+#define TARGET_AVX512 __attribute__((target("popcnt,avx512f,avx512vpopcntdq")))
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * Load eight bytes without alignment requirements
+ */
+static inline uint64
+LoadUint64(const uint8 * x)
+{
+	uint64		value;
+
+	memcpy(&value, x, sizeof(uint64));
+	return value;
+}
+
+/*
+ * Count bits without hardware support
+ */
+static inline uint64
+PopCount64Default(uint64 x)
+{
+	x = x - ((x >> 1) & UINT64CONST(0x5555555555555555));
+	x = (x & UINT64CONST(0x3333333333333333)) + ((x >> 2) & UINT64CONST(0x3333333333333333));
+	x = (x + (x >> 4)) & UINT64CONST(0x0F0F0F0F0F0F0F0F);
+	return (x * UINT64CONST(0x0101010101010101)) >> 56;
+}
+
+/*
+ * Calculate the Jaccard distance from the bit counts
+ *
+ * Two empty sets are identical
+ */
+static inline double
+JaccardDistance(uint64 ab, uint64 aa, uint64 bb)
+{
+	if (aa + bb == 0)
+		return 0.0;
+
+	return 1.0 - (ab / ((double) (aa + bb - ab)));
+}
+
+/*
+ * Default kernels
+ */
+static uint64
+BitHammingDistanceDefault(uint32 bytes, const uint8 * ax, const uint8 * bx)
+{
+	uint64		distance = 0;
+	uint32		i = 0;
+
+	for (; i + 8 <= bytes; i += 8)
+		distance += PopCount64Default(LoadUint64(ax + i) ^ LoadUint64(bx + i));
+
+	for (; i < bytes; i++)
+		distance += PopCount64Default(ax[i] ^ bx[i]);
+
+	return distance;
+}
+
+static double
+BitJaccardDistanceDefault(uint32 bytes, const uint8 * ax, const uint8 * bx)
+{
+	uint64		ab = 0;
+	uint64		aa = 0;
+	uint64		bb = 0;
+	uint32		i = 0;
+
+	for (; i + 8 <= bytes; i += 8)
+	{
+		uint64		a = LoadUint64(ax + i);
+		uint64		b = LoadUint64(bx + i);
+
+		ab += PopCount64Default(a & b);
+		aa += PopCount64Default(a);
+		bb += PopCount64Default(b);
+	}
+
+	for (; i < bytes; i++)
+	{
+		ab += PopCount64Default(ax[i] & bx[i]);
+		aa += PopCount64Default(ax[i]);
+		bb += PopCount64Default(bx[i]);
+	}
+
+	return JaccardDistance(ab, aa, bb);
+}
+
+#ifdef USE_DISPATCH
+/*
+ * POPCNT kernels
+ */
+TARGET_POPCNT static uint64
+BitHammingDistancePopcnt(uint32 bytes, const uint8 * ax, const uint8 * bx)
+{
+	uint64		distance = 0;
+	uint32		i = 0;
+
+	for (; i + 8 <= bytes; i += 8)
+		distance += __builtin_popcountll(LoadUint64(ax + i) ^ LoadUint64(bx + i));
+
+	for (; i < bytes; i++)
+		distance += __builtin_popcount(ax[i] ^ bx[i]);
+
+	return distance;
+}
+
+TARGET_POPCNT static double
+BitJaccardDistancePopcnt(uint32 bytes, const uint8 * ax, const uint8 * bx)
+{
+	uint64		ab = 0;
+	uint64		aa = 0;
+	uint64		bb = 0;
+	uint32		i = 0;
+
+	for (; i + 8 <= bytes; i += 8)
+	{
+		uint64		a = LoadUint64(ax + i);
+		uint64		b = LoadUint64(bx + i);
+
+		ab += __builtin_popcountll(a & b);
+		aa += __builtin_popcountll(a);
+		bb += __builtin_popcountll(b);
+	}
+
+	for (; i < bytes; i++)
+	{
+		ab += __builtin_popcount(ax[i] & bx[i]);
+		aa += __builtin_popcount(ax[i]);
+		bb += __builtin_popcount(bx[i]);
+	}
+
+	return JaccardDistance(ab, aa, bb);
+}
+
+/*
+ * AVX-512 kernels, 64 bytes per block, the tail of fewer than 64 bytes
+ * is handled with POPCNT
+ */
+TARGET_AVX512 static uint64
+BitHammingDistanceAvx512(uint32 bytes, const uint8 * ax, const uint8 * bx)
+{
+	__m512i		dist = _mm512_setzero_si512();
+	uint64		distance;
+	uint32		i = 0;
+
+	for (; i + 64 <= bytes; i += 64)
+	{
+		__m512i		a = _mm512_loadu_si512((const void *) (ax + i));
+		__m512i		b = _mm512_loadu_si512((const void *) (bx + i));
+
+		dist = _mm512_add_epi64(dist, _mm512_popcnt_epi64(_mm512_xor_si512(a, b)));
+	}
+
+	distance = _mm512_reduce_add_epi64(dist);
+
+	for (; i + 8 <= bytes; i += 8)
+		distance += __builtin_popcountll(LoadUint64(ax + i) ^ LoadUint64(bx + i));
+
+	for (; i < bytes; i++)
+		distance += __builtin_popcount(ax[i] ^ bx[i]);
+
+	return distance;
+}
+
+TARGET_AVX512 static double
+BitJaccardDistanceAvx512(uint32 bytes, const uint8 * ax, const uint8 * bx)
+{
+	__m512i		ab512 = _mm512_setzero_si512();
+	__m512i		aa512 = _mm512_setzero_si512();
+	__m512i		bb512 = _mm512_setzero_si512();
+	uint64		ab;
+	uint64		aa;
+	uint64		bb;
+	uint32		i = 0;
+
+	for (; i + 64 <= bytes; i += 64)
+	{
+		__m512i		a = _mm512_loadu_si512((const void *) (ax + i));
+		__m512i		b = _mm512_loadu_si512((const void *) (bx + i));
+
+		ab512 = _mm512_add_epi64(ab512, _mm512_popcnt_epi64(_mm512_and_si512(a, b)));
+		aa512 = _mm512_add_epi64(aa512, _mm512_popcnt_epi64(a));
+		bb512 = _mm512_add_epi64(bb512, _mm512_popcnt_epi64(b));
+	}
+
+	ab = _mm512_reduce_add_epi64(ab512);
+	aa = _mm512_reduce_add_epi64(aa512);
+	bb = _mm512_reduce_add_epi64(bb512);
+
+	for (; i + 8 <= bytes; i += 8)
+	{
+		uint64		a = LoadUint64(ax + i);
+		uint64		b = LoadUint64(bx + i);
+
+		ab += __builtin_popcountll(a & b);
+		aa += __builtin_popcountll(a);
+		bb += __builtin_popcountll(b);
+	}
+
+	for (; i < bytes; i++)
+	{
+		ab += __builtin_popcount(ax[i] & bx[i]);
+		aa += __builtin_popcount(ax[i]);
+		bb += __builtin_popcount(bx[i]);
+	}
+
+	return JaccardDistance(ab, aa, bb);
+}
+#endif
+
+#ifdef USE_NEON
+/*
+ * NEON kernels, 16 bytes per block
+ *
+ * Byte counts are widened every block so the accumulators cannot overflow
+ */
+static uint64
+BitHammingDistanceNeon(uint32 bytes, const uint8 * ax, const uint8 * bx)
+{
+	uint64x2_t	dist = vdupq_n_u64(0);
+	uint64		distance;
+	uint32		i = 0;
+
+	for (; i + 16 <= bytes; i += 16)
+	{
+		uint8x16_t	c = vcntq_u8(veorq_u8(vld1q_u8(ax + i), vld1q_u8(bx + i)));
+
+		dist = vpadalq_u32(dist, vpaddlq_u16(vpaddlq_u8(c)));
+	}
+
+	distance = vaddvq_u64(dist);
+
+	for (; i < bytes; i++)
+		distance += PopCount64Default(ax[i] ^ bx[i]);
+
+	return distance;
+}
+
+static double
+BitJaccardDistanceNeon(uint32 bytes, const uint8 * ax, const uint8 * bx)
+{
+	uint64x2_t	ab2 = vdupq_n_u64(0);
+	uint64x2_t	aa2 = vdupq_n_u64(0);
+	uint64x2_t	bb2 = vdupq_n_u64(0);
+	uint64		ab;
+	uint64		aa;
+	uint64		bb;
+	uint32		i = 0;
+
+	for (; i + 16 <= bytes; i += 16)
+	{
+		uint8x16_t	a = vld1q_u8(ax + i);
+		uint8x16_t	b = vld1q_u8(bx + i);
+
+		ab2 = vpadalq_u32(ab2, vpaddlq_u16(vpaddlq_u8(vcntq_u8(vandq_u8(a, b)))));
+		aa2 = vpadalq_u32(aa2, vpaddlq_u16(vpaddlq_u8(vcntq_u8(a))));
+		bb2 = vpadalq_u32(bb2, vpaddlq_u16(vpaddlq_u8(vcntq_u8(b))));
+	}
+
+	ab = vaddvq_u64(ab2);
+	aa = vaddvq_u64(aa2);
+	bb = vaddvq_u64(bb2);
+
+	for (; i < bytes; i++)
+	{
+		ab += PopCount64Default(ax[i] & bx[i]);
+		aa += PopCount64Default(ax[i]);
+		bb += PopCount64Default(bx[i]);
+	}
+
+	return JaccardDistance(ab, aa, bb);
+}
+#endif
+
+uint64		(*BitHammingDistance) (uint32 bytes, const uint8 * ax, const uint8 * bx) = BitHammingDistanceDefault;
+double		(*BitJaccardDistance) (uint32 bytes, const uint8 * ax, const uint8 * bx) = BitJaccardDistanceDefault;
+
+/*
+ * Choose the bit vector distance kernels for the CPU
+ */
+void
+BitUtilsInit(void)
+{
+#ifdef USE_DISPATCH
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512vpopcntdq"))
+	{
+		BitHammingDistance = BitHammingDistanceAvx512;
+		BitJaccardDistance = BitJaccardDistanceAvx512;
+	}
+	else if (__builtin_cpu_supports("popcnt"))
+	{
+		BitHammingDistance = BitHammingDistancePopcnt;
+		BitJaccardDistance = BitJaccardDistancePopcnt;
+	}
+#endif
+
+#ifdef USE_NEON
+	BitHammingDistance = BitHammingDistanceNeon;
+	BitJaccardDistance = BitJaccardDistanceNeon;
+#endif
+}
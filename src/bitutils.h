@@ -0,0 +1,17 @@
+#ifndef BITUTILS_H
+#define BITUTILS_H
+
+#include "bitvec.h"
+
+/*
+ * Distance kernels for bit vectors, set by BitUtilsInit to the best
+ * implementation for the CPU the server runs on
+ *
+ * Both take the number of bytes, padding bits must be zero
+ */
+extern uint64 (*BitHammingDistance) (uint32 bytes, const uint8 * ax, const uint8 * bx);
+extern double (*BitJaccardDistance) (uint32 bytes, const uint8 * ax, const uint8 * bx);
+
+void		BitUtilsInit(void);
+
+#endif
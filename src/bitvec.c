@@ -0,0 +1,315 @@
+#include "postgres.h"
+
+#include "bitutils.h"
+#include "bitvec.h"
+#include "vector.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+
+/*
+ * Ensure same dimensions
+ */
+static inline void
+CheckDims(BitVector * a, BitVector * b)
+{
+	if (a->dim != b->dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("different bitvec dimensions %d and %d", a->dim, b->dim)));
+}
+
+/*
+ * Ensure expected dimensions
+ */
+static inline void
+CheckExpectedDim(int32 typmod, int dim)
+{
+	if (typmod != -1 && typmod != dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("expected %d dimensions, not %d", typmod, dim)));
+}
+
+/*
+ * Ensure valid dimensions
+ */
+static inline void
+CheckDim(int dim)
+{
+	if (dim < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("bitvec must have at least 1 dimension")));
+
+	if (dim > BITVEC_MAX_DIM)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("bitvec cannot have more than %d dimensions", BITVEC_MAX_DIM)));
+}
+
+/*
+ * Check if a character is whitespace
+ */
+static inline bool
+bitvec_isspace(char ch)
+{
+	if (ch == ' ' ||
+		ch == '\t' ||
+		ch == '\n' ||
+		ch == '\r' ||
+		ch == '\v' ||
+		ch == '\f')
+		return true;
+	return false;
+}
+
+/*
+ * Set each bit whose element is greater than the threshold
+ */
+BitVector *
+VectorToBitVector(Vector * vec, float threshold)
+{
+	BitVector  *result = InitBitVector(vec->dim);
+
+	for (int i = 0; i < vec->dim; i++)
+	{
+		if (vec->x[i] > threshold)
+			BitVectorSetBit(result, i);
+	}
+
+	return result;
+}
+
+/*
+ * Convert a bit vector to a vector of zeros and ones
+ *
+ * Allocates the result if it is NULL
+ */
+Vector *
+BitVectorToVector(BitVector * vec, Vector * result)
+{
+	if (result == NULL)
+		result = InitVector(vec->dim);
+
+	for (int i = 0; i < vec->dim; i++)
+		result->x[i] = BitVectorGetBit(vec, i);
+
+	return result;
+}
+
+/*
+ * Convert textual representation to internal representation
+ *
+ * The format is a string of 0s and 1s, like bit strings
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(bitvec_in);
+Datum
+bitvec_in(PG_FUNCTION_ARGS)
+{
+	char	   *lit = PG_GETARG_CSTRING(0);
+	int32		typmod = PG_GETARG_INT32(2);
+	char	   *str = lit;
+	char	   *end;
+	int			dim;
+	BitVector  *result;
+
+	while (bitvec_isspace(*str))
+		str++;
+
+	end = str;
+	while (*end == '0' || *end == '1')
+		end++;
+	dim = end - str;
+
+	while (bitvec_isspace(*end))
+		end++;
+
+	if (*end != '\0')
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type bitvec: \"%s\"", lit),
+				 errdetail("Bitvec contents must only contain \"0\" and \"1\".")));
+
+	CheckDim(dim);
+	CheckExpectedDim(typmod, dim);
+
+	result = InitBitVector(dim);
+	for (int i = 0; i < dim; i++)
+	{
+		if (str[i] == '1')
+			BitVectorSetBit(result, i);
+	}
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Convert internal representation to textual representation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(bitvec_out);
+Datum
+bitvec_out(PG_FUNCTION_ARGS)
+{
+	BitVector  *vec = PG_GETARG_BITVEC_P(0);
+	char	   *buf = (char *) palloc(vec->dim + 1);
+
+	for (int i = 0; i < vec->dim; i++)
+		buf[i] = BitVectorGetBit(vec, i) ? '1' : '0';
+	buf[vec->dim] = '\0';
+
+	PG_FREE_IF_COPY(vec, 0);
+	PG_RETURN_CSTRING(buf);
+}
+
+/*
+ * Convert type modifier
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(bitvec_typmod_in);
+Datum
+bitvec_typmod_in(PG_FUNCTION_ARGS)
+{
+	ArrayType  *ta = PG_GETARG_ARRAYTYPE_P(0);
+	int32	   *tl;
+	int			n;
+
+	tl = ArrayGetIntegerTypmods(ta, &n);
+
+	if (n != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid type modifier")));
+
+	if (*tl < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("dimensions for type bitvec must be at least 1")));
+
+	if (*tl > BITVEC_MAX_DIM)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("dimensions for type bitvec cannot exceed %d", BITVEC_MAX_DIM)));
+
+	PG_RETURN_INT32(*tl);
+}
+
+/*
+ * Convert external binary representation to internal representation
+ *
+ * The dimensions are followed by the packed bytes
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(bitvec_recv);
+Datum
+bitvec_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo	buf = (StringInfo) PG_GETARG_POINTER(0);
+	int32		typmod = PG_GETARG_INT32(2);
+	BitVector  *result;
+	int32		dim;
+	int			bytes;
+
+	dim = pq_getmsgint(buf, sizeof(int32));
+
+	CheckDim(dim);
+	CheckExpectedDim(typmod, dim);
+
+	result = InitBitVector(dim);
+	bytes = BITVEC_BYTES(dim);
+	pq_copymsgbytes(buf, (char *) result->data, bytes);
+
+	/* Distances rely on zero padding */
+	if (dim % 8 != 0 && (result->data[bytes - 1] & (0xFF >> (dim % 8))) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("expected padding bits to be 0")));
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Convert internal representation to the external binary representation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(bitvec_send);
+Datum
+bitvec_send(PG_FUNCTION_ARGS)
+{
+	BitVector  *vec = PG_GETARG_BITVEC_P(0);
+	StringInfoData buf;
+
+	pq_begintypsend(&buf);
+	pq_sendint(&buf, vec->dim, sizeof(int32));
+	pq_sendbytes(&buf, (char *) vec->data, BITVEC_BYTES(vec->dim));
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Convert bitvec to bitvec
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(bitvec);
+Datum
+bitvec(PG_FUNCTION_ARGS)
+{
+	BitVector  *arg = PG_GETARG_BITVEC_P(0);
+	int32		typmod = PG_GETARG_INT32(1);
+
+	CheckExpectedDim(typmod, arg->dim);
+
+	PG_RETURN_POINTER(arg);
+}
+
+/*
+ * Quantize a vector to one bit per dimension, set for positive elements
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(binary_quantize);
+Datum
+binary_quantize(PG_FUNCTION_ARGS)
+{
+	Vector	   *vec = PG_GETARG_VECTOR_P(0);
+
+	PG_RETURN_POINTER(VectorToBitVector(vec, 0));
+}
+
+/*
+ * Get the Hamming distance between bit vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(hamming_distance);
+Datum
+hamming_distance(PG_FUNCTION_ARGS)
+{
+	BitVector  *a = PG_GETARG_BITVEC_P(0);
+	BitVector  *b = PG_GETARG_BITVEC_P(1);
+
+	CheckDims(a, b);
+
+	PG_RETURN_FLOAT8((double) BitHammingDistance(BITVEC_BYTES(a->dim), a->data, b->data));
+}
+
+/*
+ * Get the Jaccard distance between bit vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(jaccard_distance);
+Datum
+jaccard_distance(PG_FUNCTION_ARGS)
+{
+	BitVector  *a = PG_GETARG_BITVEC_P(0);
+	BitVector  *b = PG_GETARG_BITVEC_P(1);
+
+	CheckDims(a, b);
+
+	PG_RETURN_FLOAT8(BitJaccardDistance(BITVEC_BYTES(a->dim), a->data, b->data));
+}
+
+/*
+ * Get the dimensions of a bit vector
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(bitvec_dims);
+Datum
+bitvec_dims(PG_FUNCTION_ARGS)
+{
+	BitVector  *a = PG_GETARG_BITVEC_P(0);
+
+	PG_RETURN_INT32(a->dim);
+}
@@ -0,0 +1,55 @@
+#ifndef BITVEC_H
+#define BITVEC_H
+
+#include "postgres.h"
+
+#if PG_VERSION_NUM >= 160000
+#include "varatt.h"
+#endif
+
+#include "vector.h"
+
+#define BITVEC_MAX_DIM 64000
+
+#define BITVEC_BYTES(_dim)		(((_dim) + 7) / 8)
+#define BITVEC_SIZE(_dim)		(offsetof(BitVector, data) + BITVEC_BYTES(_dim))
+#define DatumGetBitVector(x)	((BitVector *) PG_DETOAST_DATUM(x))
+#define PG_GETARG_BITVEC_P(x)	DatumGetBitVector(PG_GETARG_DATUM(x))
+#define PG_RETURN_BITVEC_P(x)	PG_RETURN_POINTER(x)
+
+/* Bit i is stored in data[i / 8] at mask 0x80 >> (i % 8), like bit strings */
+#define BitVectorGetBit(_vec, _i)	(((_vec)->data[(_i) / 8] >> (7 - (_i) % 8)) & 1)
+#define BitVectorSetBit(_vec, _i)	((_vec)->data[(_i) / 8] |= (0x80 >> ((_i) % 8)))
+
+typedef struct BitVector
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	int32		dim;			/* number of bits, padding bits are zero */
+	uint8		data[FLEXIBLE_ARRAY_MEMBER];
+}			BitVector;
+
+BitVector  *VectorToBitVector(Vector * vec, float threshold);
+Vector	   *BitVectorToVector(BitVector * vec, Vector * result);
+
+/* Recognized by index scans to call the kernels directly */
+PGDLLEXPORT Datum hamming_distance(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum jaccard_distance(PG_FUNCTION_ARGS);
+
+/*
+ * Allocate and initialize a new bit vector
+ */
+static inline BitVector *
+InitBitVector(int dim)
+{
+	BitVector  *result;
+	int			size;
+
+	size = BITVEC_SIZE(dim);
+	result = (BitVector *) palloc0(size);
+	SET_VARSIZE(result, size);
+	result->dim = dim;
+
+	return result;
+}
+
+#endif
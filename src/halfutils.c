@@ -0,0 +1,469 @@
+#include "postgres.h"
+
+#include <math.h>
+
+#include "halfutils.h"
+
+/*
+ * Explicit SIMD kernels for half vectors
+ *
+ * Elements are widened to float with the hardware conversion (F16C on
+ * x86-64, which every CPU with AVX2 has, and the FP16 conversions that are
+ * part of AArch64) and accumulated like the float kernels in vectorutils.c.
+ */
+#if (defined(__x86_64__) || defined(_M_AMD64)) && defined(__GNUC__)
+#define USE_DISPATCH
+#include <immintrin.h>
+#define TARGET_F16C __attribute__((target("avx2,f16c,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * Default kernels
+ */
+static double
+HalfvecL2SquaredDistanceDefault(int dim, const half * ax, const half * bx)
+{
+	double		distance = 0.0;
+	double		diff;
+
+	for (int i = 0; i < dim; i++)
+	{
+		diff = HalfToFloat4(ax[i]) - HalfToFloat4(bx[i]);
+		distance += diff * diff;
+	}
+
+	return distance;
+}
+
+static double
+HalfvecInnerProductDefault(int dim, const half * ax, const half * bx)
+{
+	double		distance = 0.0;
+
+	for (int i = 0; i < dim; i++)
+		distance += (double) HalfToFloat4(ax[i]) * HalfToFloat4(bx[i]);
+
+	return distance;
+}
+
+static double
+HalfvecCosineSimilarityDefault(int dim, const half * ax, const half * bx)
+{
+	double		similarity = 0.0;
+	double		norma = 0.0;
+	double		normb = 0.0;
+
+	for (int i = 0; i < dim; i++)
+	{
+		double		a = HalfToFloat4(ax[i]);
+		double		b = HalfToFloat4(bx[i]);
+
+		similarity += a * b;
+		norma += a * a;
+		normb += b * b;
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return similarity / sqrt(norma * normb);
+}
+
+#ifdef USE_DISPATCH
+/*
+ * F16C kernels, eight elements per conversion, the tail of fewer than 8
+ * elements is handled in double
+ */
+TARGET_F16C static inline double
+HorizontalSumF16c(__m256 sum)
+{
+	float		lanes[8];
+	double		result = 0.0;
+
+	_mm256_storeu_ps(lanes, sum);
+	for (int i = 0; i < 8; i++)
+		result += lanes[i];
+
+	return result;
+}
+
+TARGET_F16C static inline __m256
+LoadHalfF16c(const half * x)
+{
+	return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) x));
+}
+
+TARGET_F16C static inline float
+HalfToFloat4F16c(half num)
+{
+	return _cvtsh_ss(num);
+}
+
+TARGET_F16C static double
+HalfvecL2SquaredDistanceF16c(int dim, const half * ax, const half * bx)
+{
+	__m256		sum0 = _mm256_setzero_ps();
+	__m256		sum1 = _mm256_setzero_ps();
+	__m256		diff;
+	double		distance;
+	int			i = 0;
+
+	for (; i + 16 <= dim; i += 16)
+	{
+		diff = _mm256_sub_ps(LoadHalfF16c(ax + i), LoadHalfF16c(bx + i));
+		sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+		diff = _mm256_sub_ps(LoadHalfF16c(ax + i + 8), LoadHalfF16c(bx + i + 8));
+		sum1 = _mm256_fmadd_ps(diff, diff, sum1);
+	}
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		diff = _mm256_sub_ps(LoadHalfF16c(ax + i), LoadHalfF16c(bx + i));
+		sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+	}
+
+	distance = HorizontalSumF16c(_mm256_add_ps(sum0, sum1));
+
+	for (; i < dim; i++)
+	{
+		double		d = HalfToFloat4F16c(ax[i]) - HalfToFloat4F16c(bx[i]);
+
+		distance += d * d;
+	}
+
+	return distance;
+}
+
+TARGET_F16C static double
+HalfvecInnerProductF16c(int dim, const half * ax, const half * bx)
+{
+	__m256		sum0 = _mm256_setzero_ps();
+	__m256		sum1 = _mm256_setzero_ps();
+	double		distance;
+	int			i = 0;
+
+	for (; i + 16 <= dim; i += 16)
+	{
+		sum0 = _mm256_fmadd_ps(LoadHalfF16c(ax + i), LoadHalfF16c(bx + i), sum0);
+		sum1 = _mm256_fmadd_ps(LoadHalfF16c(ax + i + 8), LoadHalfF16c(bx + i + 8), sum1);
+	}
+
+	for (; i + 8 <= dim; i += 8)
+		sum0 = _mm256_fmadd_ps(LoadHalfF16c(ax + i), LoadHalfF16c(bx + i), sum0);
+
+	distance = HorizontalSumF16c(_mm256_add_ps(sum0, sum1));
+
+	for (; i < dim; i++)
+		distance += (double) HalfToFloat4F16c(ax[i]) * HalfToFloat4F16c(bx[i]);
+
+	return distance;
+}
+
+TARGET_F16C static double
+HalfvecCosineSimilarityF16c(int dim, const half * ax, const half * bx)
+{
+	__m256		sim = _mm256_setzero_ps();
+	__m256		norma8 = _mm256_setzero_ps();
+	__m256		normb8 = _mm256_setzero_ps();
+	__m256		a;
+	__m256		b;
+	double		similarity;
+	double		norma;
+	double		normb;
+	int			i = 0;
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		a = LoadHalfF16c(ax + i);
+		b = LoadHalfF16c(bx + i);
+		sim = _mm256_fmadd_ps(a, b, sim);
+		norma8 = _mm256_fmadd_ps(a, a, norma8);
+		normb8 = _mm256_fmadd_ps(b, b, normb8);
+	}
+
+	similarity = HorizontalSumF16c(sim);
+	norma = HorizontalSumF16c(norma8);
+	normb = HorizontalSumF16c(normb8);
+
+	for (; i < dim; i++)
+	{
+		double		fa = HalfToFloat4F16c(ax[i]);
+		double		fb = HalfToFloat4F16c(bx[i]);
+
+		similarity += fa * fb;
+		norma += fa * fa;
+		normb += fb * fb;
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return similarity / sqrt(norma * normb);
+}
+
+/*
+ * AVX-512 kernels, sixteen elements per conversion, the tail is padded
+ * with zeros
+ */
+TARGET_AVX512 static inline double
+HorizontalSumAvx512(__m512 sum)
+{
+	float		lanes[16];
+	double		result = 0.0;
+
+	_mm512_storeu_ps(lanes, sum);
+	for (int i = 0; i < 16; i++)
+		result += lanes[i];
+
+	return result;
+}
+
+TARGET_AVX512 static inline __m512
+LoadHalfAvx512(const half * x)
+{
+	return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) x));
+}
+
+/* Masked 16-bit loads need AVX512BW, so the tail goes through a buffer */
+TARGET_AVX512 static inline __m512
+LoadHalfTailAvx512(const half * x, int count)
+{
+	half		buf[16] = {0};
+
+	memcpy(buf, x, count * sizeof(half));
+	return LoadHalfAvx512(buf);
+}
+
+TARGET_AVX512 static double
+HalfvecL2SquaredDistanceAvx512(int dim, const half * ax, const half * bx)
+{
+	__m512		sum0 = _mm512_setzero_ps();
+	__m512		sum1 = _mm512_setzero_ps();
+	__m512		diff;
+	int			i = 0;
+
+	for (; i + 32 <= dim; i += 32)
+	{
+		diff = _mm512_sub_ps(LoadHalfAvx512(ax + i), LoadHalfAvx512(bx + i));
+		sum0 = _mm512_fmadd_ps(diff, diff, sum0);
+		diff = _mm512_sub_ps(LoadHalfAvx512(ax + i + 16), LoadHalfAvx512(bx + i + 16));
+		sum1 = _mm512_fmadd_ps(diff, diff, sum1);
+	}
+
+	for (; i + 16 <= dim; i += 16)
+	{
+		diff = _mm512_sub_ps(LoadHalfAvx512(ax + i), LoadHalfAvx512(bx + i));
+		sum0 = _mm512_fmadd_ps(diff, diff, sum0);
+	}
+
+	if (i < dim)
+	{
+		diff = _mm512_sub_ps(LoadHalfTailAvx512(ax + i, dim - i), LoadHalfTailAvx512(bx + i, dim - i));
+		sum1 = _mm512_fmadd_ps(diff, diff, sum1);
+	}
+
+	return HorizontalSumAvx512(_mm512_add_ps(sum0, sum1));
+}
+
+TARGET_AVX512 static double
+HalfvecInnerProductAvx512(int dim, const half * ax, const half * bx)
+{
+	__m512		sum0 = _mm512_setzero_ps();
+	__m512		sum1 = _mm512_setzero_ps();
+	int			i = 0;
+
+	for (; i + 32 <= dim; i += 32)
+	{
+		sum0 = _mm512_fmadd_ps(LoadHalfAvx512(ax + i), LoadHalfAvx512(bx + i), sum0);
+		sum1 = _mm512_fmadd_ps(LoadHalfAvx512(ax + i + 16), LoadHalfAvx512(bx + i + 16), sum1);
+	}
+
+	for (; i + 16 <= dim; i += 16)
+		sum0 = _mm512_fmadd_ps(LoadHalfAvx512(ax + i), LoadHalfAvx512(bx + i), sum0);
+
+	if (i < dim)
+		sum1 = _mm512_fmadd_ps(LoadHalfTailAvx512(ax + i, dim - i), LoadHalfTailAvx512(bx + i, dim - i), sum1);
+
+	return HorizontalSumAvx512(_mm512_add_ps(sum0, sum1));
+}
+
+TARGET_AVX512 static double
+HalfvecCosineSimilarityAvx512(int dim, const half * ax, const half * bx)
+{
+	__m512		sim = _mm512_setzero_ps();
+	__m512		norma16 = _mm512_setzero_ps();
+	__m512		normb16 = _mm512_setzero_ps();
+	__m512		a;
+	__m512		b;
+	int			i = 0;
+
+	for (; i < dim; i += 16)
+	{
+		if (dim - i >= 16)
+		{
+			a = LoadHalfAvx512(ax + i);
+			b = LoadHalfAvx512(bx + i);
+		}
+		else
+		{
+			a = LoadHalfTailAvx512(ax + i, dim - i);
+			b = LoadHalfTailAvx512(bx + i, dim - i);
+		}
+		sim = _mm512_fmadd_ps(a, b, sim);
+		norma16 = _mm512_fmadd_ps(a, a, norma16);
+		normb16 = _mm512_fmadd_ps(b, b, normb16);
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return HorizontalSumAvx512(sim) /
+		sqrt(HorizontalSumAvx512(norma16) * HorizontalSumAvx512(normb16));
+}
+#endif
+
+#ifdef USE_NEON
+/*
+ * NEON kernels, the tail of fewer than 4 elements is handled in double
+ */
+static inline float32x4_t
+LoadHalfNeon(const half * x)
+{
+	return vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(x)));
+}
+
+static double
+HalfvecL2SquaredDistanceNeon(int dim, const half * ax, const half * bx)
+{
+	float32x4_t sum0 = vdupq_n_f32(0);
+	float32x4_t sum1 = vdupq_n_f32(0);
+	float32x4_t diff;
+	double		distance;
+	int			i = 0;
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		diff = vsubq_f32(LoadHalfNeon(ax + i), LoadHalfNeon(bx + i));
+		sum0 = vfmaq_f32(sum0, diff, diff);
+		diff = vsubq_f32(LoadHalfNeon(ax + i + 4), LoadHalfNeon(bx + i + 4));
+		sum1 = vfmaq_f32(sum1, diff, diff);
+	}
+
+	for (; i + 4 <= dim; i += 4)
+	{
+		diff = vsubq_f32(LoadHalfNeon(ax + i), LoadHalfNeon(bx + i));
+		sum0 = vfmaq_f32(sum0, diff, diff);
+	}
+
+	distance = vaddvq_f32(vaddq_f32(sum0, sum1));
+
+	for (; i < dim; i++)
+	{
+		double		d = HalfToFloat4(ax[i]) - HalfToFloat4(bx[i]);
+
+		distance += d * d;
+	}
+
+	return distance;
+}
+
+static double
+HalfvecInnerProductNeon(int dim, const half * ax, const half * bx)
+{
+	float32x4_t sum0 = vdupq_n_f32(0);
+	float32x4_t sum1 = vdupq_n_f32(0);
+	double		distance;
+	int			i = 0;
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		sum0 = vfmaq_f32(sum0, LoadHalfNeon(ax + i), LoadHalfNeon(bx + i));
+		sum1 = vfmaq_f32(sum1, LoadHalfNeon(ax + i + 4), LoadHalfNeon(bx + i + 4));
+	}
+
+	for (; i + 4 <= dim; i += 4)
+		sum0 = vfmaq_f32(sum0, LoadHalfNeon(ax + i), LoadHalfNeon(bx + i));
+
+	distance = vaddvq_f32(vaddq_f32(sum0, sum1));
+
+	for (; i < dim; i++)
+		distance += (double) HalfToFloat4(ax[i]) * HalfToFloat4(bx[i]);
+
+	return distance;
+}
+
+static double
+HalfvecCosineSimilarityNeon(int dim, const half * ax, const half * bx)
+{
+	float32x4_t sim = vdupq_n_f32(0);
+	float32x4_t norma4 = vdupq_n_f32(0);
+	float32x4_t normb4 = vdupq_n_f32(0);
+	float32x4_t a;
+	float32x4_t b;
+	double		similarity;
+	double		norma;
+	double		normb;
+	int			i = 0;
+
+	for (; i + 4 <= dim; i += 4)
+	{
+		a = LoadHalfNeon(ax + i);
+		b = LoadHalfNeon(bx + i);
+		sim = vfmaq_f32(sim, a, b);
+		norma4 = vfmaq_f32(norma4, a, a);
+		normb4 = vfmaq_f32(normb4, b, b);
+	}
+
+	similarity = vaddvq_f32(sim);
+	norma = vaddvq_f32(norma4);
+	normb = vaddvq_f32(normb4);
+
+	for (; i < dim; i++)
+	{
+		double		fa = HalfToFloat4(ax[i]);
+		double		fb = HalfToFloat4(bx[i]);
+
+		similarity += fa * fb;
+		norma += fa * fa;
+		normb += fb * fb;
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return similarity / sqrt(norma * normb);
+}
+#endif
+
+double		(*HalfvecL2SquaredDistance) (int dim, const half * ax, const half * bx) = HalfvecL2SquaredDistanceDefault;
+double		(*HalfvecInnerProduct) (int dim, const half * ax, const half * bx) = HalfvecInnerProductDefault;
+double		(*HalfvecCosineSimilarity) (int dim, const half * ax, const half * bx) = HalfvecCosineSimilarityDefault;
+
+/*
+ * Choose the half vector distance kernels for the CPU
+ */
+void
+HalfUtilsInit(void)
+{
+#ifdef USE_DISPATCH
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		HalfvecL2SquaredDistance = HalfvecL2SquaredDistanceAvx512;
+		HalfvecInnerProduct = HalfvecInnerProductAvx512;
+		HalfvecCosineSimilarity = HalfvecCosineSimilarityAvx512;
+	}
+	else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	{
+		/* F16C predates AVX2, so every CPU with AVX2 has it */
+		HalfvecL2SquaredDistance = HalfvecL2SquaredDistanceF16c;
+		HalfvecInnerProduct = HalfvecInnerProductF16c;
+		HalfvecCosineSimilarity = HalfvecCosineSimilarityF16c;
+	}
+#endif
+
+#ifdef USE_NEON
+	HalfvecL2SquaredDistance = HalfvecL2SquaredDistanceNeon;
+	HalfvecInnerProduct = HalfvecInnerProductNeon;
+	HalfvecCosineSimilarity = HalfvecCosineSimilarityNeon;
+#endif
+}
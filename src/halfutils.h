@@ -0,0 +1,135 @@
+#ifndef HALFUTILS_H
+#define HALFUTILS_H
+
+#include "halfvec.h"
+
+/* F16C converts single values in one instruction */
+#if defined(__F16C__)
+#define F16C_SUPPORT
+#include <immintrin.h>
+#endif
+
+/*
+ * Distance kernels for half vectors, set by HalfUtilsInit to the best
+ * implementation for the CPU the server runs on
+ */
+extern double (*HalfvecL2SquaredDistance) (int dim, const half * ax, const half * bx);
+extern double (*HalfvecInnerProduct) (int dim, const half * ax, const half * bx);
+extern double (*HalfvecCosineSimilarity) (int dim, const half * ax, const half * bx);
+
+void		HalfUtilsInit(void);
+
+/*
+ * Convert a half to a float4
+ */
+static inline float
+HalfToFloat4(half num)
+{
+#ifdef F16C_SUPPORT
+	return _cvtsh_ss(num);
+#else
+	union
+	{
+		float		f;
+		uint32		i;
+	}			swapfloat;
+	uint32		sign = ((uint32) (num & 0x8000)) << 16;
+	int			exponent = (num & 0x7C00) >> 10;
+	uint32		mantissa = num & 0x03FF;
+
+	if (exponent == 31)
+	{
+		/* Infinity or NaN */
+		swapfloat.i = sign | 0x7F800000 | (mantissa << 13);
+	}
+	else if (exponent == 0)
+	{
+		if (mantissa == 0)
+			swapfloat.i = sign;
+		else
+		{
+			/* Subnormal, shift until the implicit bit is set */
+			exponent = 113;
+			while ((mantissa & 0x0400) == 0)
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			swapfloat.i = sign | ((uint32) exponent << 23) | ((mantissa & 0x03FF) << 13);
+		}
+	}
+	else
+		swapfloat.i = sign | ((uint32) (exponent + 112) << 23) | (mantissa << 13);
+
+	return swapfloat.f;
+#endif
+}
+
+/*
+ * Convert a float4 to a half, rounding to nearest even
+ *
+ * Values too large for a half become infinity
+ */
+static inline half
+Float4ToHalfUnchecked(float num)
+{
+#ifdef F16C_SUPPORT
+	return _cvtss_sh(num, _MM_FROUND_TO_NEAREST_INT);
+#else
+	union
+	{
+		float		f;
+		uint32		i;
+	}			swapfloat;
+	uint32		bin;
+	half		sign;
+	int			exponent;
+	uint32		mantissa;
+	uint32		rem;
+	half		result;
+
+	swapfloat.f = num;
+	bin = swapfloat.i;
+	sign = (bin >> 16) & 0x8000;
+	exponent = ((bin >> 23) & 0xFF) - 127 + 15;
+	mantissa = bin & 0x007FFFFF;
+
+	/* Infinity or NaN */
+	if (exponent == 255 - 127 + 15)
+		return sign | 0x7C00 | (mantissa != 0 ? 0x0200 : 0);
+
+	/* Overflow */
+	if (exponent >= 31)
+		return sign | 0x7C00;
+
+	/* Subnormal or zero */
+	if (exponent <= 0)
+	{
+		int			shift = 14 - exponent;
+
+		if (shift > 24)
+			return sign;
+
+		mantissa |= 0x00800000;
+		result = mantissa >> shift;
+		rem = mantissa & ((1U << shift) - 1);
+
+		/* A carry into the exponent gives the smallest normal */
+		if (rem > (1U << (shift - 1)) || (rem == (1U << (shift - 1)) && (result & 1)))
+			result++;
+
+		return sign | result;
+	}
+
+	result = sign | (exponent << 10) | (mantissa >> 13);
+	rem = mantissa & 0x1FFF;
+
+	/* A carry into the exponent rounds up to the next binade or infinity */
+	if (rem > 0x1000 || (rem == 0x1000 && (result & 1)))
+		result++;
+
+	return result;
+#endif
+}
+
+#endif
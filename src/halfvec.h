@@ -0,0 +1,54 @@
+#ifndef HALFVEC_H
+#define HALFVEC_H
+
+#include "postgres.h"
+
+#if PG_VERSION_NUM >= 160000
+#include "varatt.h"
+#endif
+
+#include "vector.h"
+
+#define HALFVEC_MAX_DIM 16000
+
+#define HALFVEC_SIZE(_dim)		(offsetof(HalfVector, x) + sizeof(half)*(_dim))
+#define DatumGetHalfVector(x)	((HalfVector *) PG_DETOAST_DATUM(x))
+#define PG_GETARG_HALFVEC_P(x)	DatumGetHalfVector(PG_GETARG_DATUM(x))
+#define PG_RETURN_HALFVEC_P(x)	PG_RETURN_POINTER(x)
+
+/* IEEE 754 half precision, stored as its bit pattern */
+typedef uint16 half;
+
+typedef struct HalfVector
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	int16		dim;			/* number of dimensions */
+	int16		unused;
+	half		x[FLEXIBLE_ARRAY_MEMBER];
+}			HalfVector;
+
+HalfVector *VectorToHalfVector(Vector * vec);
+Vector	   *HalfVectorToVector(HalfVector * vec, Vector * result);
+
+/* Recognized by index scans to call the kernels directly */
+PGDLLEXPORT Datum halfvec_l2_squared_distance(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum halfvec_negative_inner_product(PG_FUNCTION_ARGS);
+
+/*
+ * Allocate and initialize a new half vector
+ */
+static inline HalfVector *
+InitHalfVector(int dim)
+{
+	HalfVector *result;
+	int			size;
+
+	size = HALFVEC_SIZE(dim);
+	result = (HalfVector *) palloc0(size);
+	SET_VARSIZE(result, size);
+	result->dim = dim;
+
+	return result;
+}
+
+#endif
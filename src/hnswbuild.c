@@ -3,6 +3,7 @@
 #include <float.h>
 
 #include "catalog/index.h"
+#include "halfutils.h"
 #include "hnswflat.h"
 #include "miscadmin.h"
 #include "storage/bufmgr.h"
@@ -78,10 +79,9 @@ SetDefaultProbas(HnswflatBuildState * buildstate) {
 static HnswflatVertex
 HnswFormDataTuple(HnswflatBuildState *buildstate,
     ItemPointer iptr, Datum *values, bool *isnull) {
-    ArrayType *arr;
     text *rawText;
-    int dim, i, len;
-    float4 *data;
+    int dim, len;
+    char *data;
     char *rawData;
     char dest[1024 * 1024];
     HnswflatVertex res = (HnswflatVertex) palloc(buildstate->vertex_tuple_size);
@@ -91,18 +91,30 @@ HnswFormDataTuple(HnswflatBuildState *buildstate,
         return NULL;
     }
   
-    arr = DatumGetArrayTypeP(values[0]);
-    dim = ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr));
+    /* Vertex elements keep the width of the indexed type */
+    if (buildstate->type == HNSWFLAT_TYPE_HALFVEC) {
+        HalfVector *vec = DatumGetHalfVector(values[0]);
+
+        dim = vec->dim;
+        data = (char *) vec->x;
+    } else if (buildstate->type == HNSWFLAT_TYPE_BITVEC) {
+        BitVector *vec = DatumGetBitVector(values[0]);
+
+        dim = vec->dim;
+        data = (char *) vec->data;
+    } else {
+        Vector *vec = DatumGetVector(values[0]);
+
+        dim = vec->dim;
+        data = (char *) vec->x;
+    }
     if (dim != buildstate->dimensions) {
         elog(WARNING, "data dimension[%d] not equal to configure dimension[%d]",
           dim, buildstate->dimensions);
         pfree(res);
         return NULL;
     }
-    data = ((float *)ARR_DATA_PTR(arr));
-    for (i = 0; i < dim; ++i) {
-        res->vector[i] = data[i];
-    }
+    memcpy(res->vector, data, buildstate->vector_size);
     res->level = RandomLevel(opts);
     res->offset = buildstate->edgetuples;
     buildstate->edgetuples += level + 2;
@@ -190,21 +202,39 @@ InitBuildState(HnswflatBuildState * buildstate, Relation heap, Relation index, I
     buildstate->base_nb_num = HnswflatGetBnn(index);
     buildstate->ef_build = HnswflatGetEfb(index);
     buildstate->ef_search = HnswflatGetEfs(index);
+    buildstate->type = HnswflatGetType(index);
 
 	/* Require column to have dimensions to be indexed */
 	if (buildstate->dimensions < 0)
 		elog(ERROR, "column does not have dimensions");
 
-	if (buildstate->dimensions > HNSWFLAT_MAX_DIM)
+	if (buildstate->type == HNSWFLAT_TYPE_BITVEC)
+	{
+		if (buildstate->dimensions > HNSWFLAT_MAX_BITVEC_DIM)
+			elog(ERROR, "column cannot have more than %d dimensions for hnswflat index", HNSWFLAT_MAX_BITVEC_DIM);
+	}
+	else if (buildstate->type == HNSWFLAT_TYPE_HALFVEC)
+	{
+		if (buildstate->dimensions > HNSWFLAT_MAX_HALFVEC_DIM)
+			elog(ERROR, "column cannot have more than %d dimensions for hnswflat index", HNSWFLAT_MAX_HALFVEC_DIM);
+	}
+	else if (buildstate->dimensions > HNSWFLAT_MAX_DIM)
 		elog(ERROR, "column cannot have more than %d dimensions for hnswflat index", HNSWFLAT_MAX_DIM);
 
+	if (buildstate->type == HNSWFLAT_TYPE_HALFVEC)
+		buildstate->vector_size = sizeof(half) * buildstate->dimensions;
+	else if (buildstate->type == HNSWFLAT_TYPE_BITVEC)
+		buildstate->vector_size = BITVEC_BYTES(buildstate->dimensions);
+	else
+		buildstate->vector_size = sizeof(float) * buildstate->dimensions;
+
 	buildstate->reltuples = 0;
 	buildstate->indtuples = 0;
     buildstate->edgetuples = 0;
     buildstate->ep_id = -1;
     buildstate->ep_level = -1;
     buildstate->edge_tuple_size = HnswflatEdgeTupleHeaderSize + sizeof(HnswGid) * buildstate->base_nb_num;
-    buildstate->vertex_tuple_size = HnswflatVertexTupleHeaderSize + sizeof(float) * buildstate->dimensions;
+    buildstate->vertex_tuple_size = HnswflatVertexTupleHeaderSize + buildstate->vector_size;
 
 	/* Get support functions */
 	buildstate->procinfo = index_getprocinfo(index, 1, HNSWFLAT_DISTANCE_PROC);
@@ -332,6 +362,7 @@ InmemoryLoad(HnswIndex * hnsw_Index, HnswflatBuildState * buildstate, ForkNumber
     Size        itemsz;
 	BlockNumber nextblkno = HNSWFLAT_HEAD_BLKNO;
 	int         i;
+	float      *point = palloc(sizeof(float) * buildstate->dimensions);
 
     /* Search all vertex tuple pages */
 	while (BlockNumberIsValid(nextblkno))
@@ -347,7 +378,25 @@ InmemoryLoad(HnswIndex * hnsw_Index, HnswflatBuildState * buildstate, ForkNumber
 		for (offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
         {
             vertex = (HnswflatVertex) PageGetItem(cpage, PageGetItemId(cpage, offno));
-            hnsw_addPoint(hnsw_Index, vertex->vector, count);
+            if (buildstate->type == HNSWFLAT_TYPE_HALFVEC)
+            {
+                half       *x = (half *) vertex->vector;
+
+                for (i = 0; i < buildstate->dimensions; i++)
+                    point[i] = HalfToFloat4(x[i]);
+                hnsw_addPoint(hnsw_Index, point, count);
+            }
+            else if (buildstate->type == HNSWFLAT_TYPE_BITVEC)
+            {
+                uint8      *x = (uint8 *) vertex->vector;
+
+                /* Squared L2 over zeros and ones is the Hamming distance */
+                for (i = 0; i < buildstate->dimensions; i++)
+                    point[i] = (x[i / 8] >> (7 - i % 8)) & 1;
+                hnsw_addPoint(hnsw_Index, point, count);
+            }
+            else
+                hnsw_addPoint(hnsw_Index, (float *) vertex->vector, count);
             /* TODO create in-memory hnsw structures when traversing vertex tuples
              * NOTICE currently I assume vertex id and level starts from 0. Not sure about how Faiss starts
              * Watch out when loading values of levels and neighbors
@@ -358,6 +407,8 @@ InmemoryLoad(HnswIndex * hnsw_Index, HnswflatBuildState * buildstate, ForkNumber
 
 		UnlockReleaseBuffer(cbuf);
     }
+
+    pfree(point);
 }
 
 /*
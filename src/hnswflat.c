@@ -3,11 +3,14 @@
 #include <float.h>
 
 #include "access/amapi.h"
+#include "bitutils.h"
 #include "commands/vacuum.h"
+#include "halfutils.h"
 #include "hnswflat.h"
 #include "utils/guc.h"
 #include "utils/selfuncs.h"
 #include "utils/spccache.h"
+#include "vectorutils.h"
 
 #if PG_VERSION_NUM >= 120000
 #include "commands/progress.h"
@@ -21,6 +24,10 @@ static relopt_kind hnswflat_relopt_kind;
 void
 _PG_init(void)
 {
+	VectorUtilsInit();
+	HalfUtilsInit();
+	BitUtilsInit();
+
 	hnswflat_relopt_kind = add_reloption_kind();
 	add_int_reloption(hnswflat_relopt_kind, "base_nb_num", "Max number of neighbors for each layer",
 					  HNSWFLAT_DEFAULT_BNN, 5, HNSWFLAT_MAX_BNN
@@ -13,6 +13,8 @@
 #include "port.h"				/* for strtof() and random() */
 #include "utils/sampling.h"
 #include "utils/tuplesort.h"
+#include "bitvec.h"
+#include "halfvec.h"
 #include "vector.h"
 
 #if PG_VERSION_NUM >= 150000
@@ -24,6 +26,8 @@
 #endif
 
 #define HNSWFLAT_MAX_DIM 2000
+#define HNSWFLAT_MAX_HALFVEC_DIM (HNSWFLAT_MAX_DIM * 2)
+#define HNSWFLAT_MAX_BITVEC_DIM (HNSWFLAT_MAX_DIM * 32)
 #define HNSWFLAT_MAX_LEVEL 100
 #define	RAND_MAX	0x7fffffff
 
@@ -86,6 +90,14 @@
 /* Exported functions */
 PGDLLEXPORT void _PG_init(void);
 
+/* Types of the indexed column */
+typedef enum HnswflatType
+{
+	HNSWFLAT_TYPE_VECTOR,
+	HNSWFLAT_TYPE_HALFVEC,
+	HNSWFLAT_TYPE_BITVEC
+}			HnswflatType;
+
 typedef struct VectorArrayData
 {
 	int			length;
@@ -122,6 +134,8 @@ typedef struct HnswflatBuildState
     int         base_nb_num;           
     int         ef_build;            
     int         ef_search;
+	HnswflatType type;
+	int			vector_size;	/* bytes of vertex data */
 
 	/* Statistics */
 	double		indtuples;
@@ -182,7 +196,7 @@ typedef struct HnswflatVertexData {
   	uint16 		level;
 	int64		offset;
 	ItemPointerData heap_ptr;
-	float 		vector[FLEXIBLE_ARRAY_MEMBER];
+	char		vector[FLEXIBLE_ARRAY_MEMBER];	/* floats, halves or bits, like the indexed column */
 } HnswflatVertexData;
 
 typedef HnswflatVertexData * HnswflatVertex;
@@ -250,6 +264,7 @@ bool		HnswflatNormValue(FmgrInfo *procinfo, Oid collation, Datum *value, Vector
 int			HnswflatGetBnn(Relation index);
 int			HnswflatGetEfb(Relation index);
 int			HnswflatGetEfs(Relation index);
+HnswflatType HnswflatGetType(Relation index);
 void		HnswflatCommitBuffer(Buffer buf, GenericXLogState *state);
 void		HnswflatAppendPage(Relation index, Buffer *buf, Page *page, GenericXLogState **state, ForkNumber forkNum);
 Buffer		HnswflatNewBuffer(Relation index, ForkNumber forkNum);
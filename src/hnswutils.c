@@ -2,6 +2,7 @@
 
 #include "hnswflat.h"
 #include "storage/bufmgr.h"
+#include "utils/lsyscache.h"
 #include "vector.h"
 
 /*
@@ -83,6 +84,31 @@ HnswflatGetEfs(Relation index)
 	return HNSWFLAT_DEFAULT_EFS;
 }
 
+/*
+ * Get the type of the indexed column
+ *
+ * Types are matched by OID in the schema of the extension. Only called
+ * once per build, which keeps it in the build state.
+ */
+HnswflatType
+HnswflatGetType(Relation index)
+{
+	Oid			typid = TupleDescAttr(index->rd_att, 0)->atttypid;
+	Oid			namespaceId = get_func_namespace(index->rd_amhandler);
+	HnswflatType result;
+
+	if (typid == VectorTypeOid("vector", namespaceId))
+		result = HNSWFLAT_TYPE_VECTOR;
+	else if (typid == VectorTypeOid("halfvec", namespaceId))
+		result = HNSWFLAT_TYPE_HALFVEC;
+	else if (typid == VectorTypeOid("bitvec", namespaceId))
+		result = HNSWFLAT_TYPE_BITVEC;
+	else
+		elog(ERROR, "type not supported for hnswflat index");
+
+	return result;
+}
+
 /*
  * Get proc
  */
@@ -10,25 +10,33 @@
 
 #include <float.h>
 #include <sys/mman.h>
+#include "access/xact.h"
 #include "catalog/index.h"
 #include "ivfflat.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 #include "storage/bufmgr.h"
+#include "tcop/tcopprot.h"
 #include "utils/memutils.h"
+#include "utils/snapmgr.h"
 
 #if PG_VERSION_NUM >= 140000
 #include "utils/backend_progress.h"
-#elif PG_VERSION_NUM >= 120000
-#include "pgstat.h"
 #endif
 
 #if PG_VERSION_NUM >= 120000
+#include "access/table.h"
 #include "access/tableam.h"
 #include "commands/progress.h"
+#include "optimizer/optimizer.h"
 #else
+#include "access/heapam.h"
+#include "optimizer/planner.h"
 #define PROGRESS_CREATEIDX_SUBPHASE 0
 #define PROGRESS_CREATEIDX_TUPLES_TOTAL 0
 #define PROGRESS_CREATEIDX_TUPLES_DONE 0
+#define table_open(r, l) heap_open(r, l)
+#define table_close(r, l) heap_close(r, l)
 #endif
 
 #include "catalog/pg_operator_d.h"
@@ -45,8 +53,84 @@
 #else
 #define UpdateProgress(index, val) ((void)val)
 #endif
+
+/* Keys for the shared memory of parallel builds */
+#define PARALLEL_KEY_IVFFLAT_SHARED		UINT64CONST(0xA000000000000001)
+#define PARALLEL_KEY_TUPLESORT			UINT64CONST(0xA000000000000002)
+#define PARALLEL_KEY_IVFFLAT_CENTERS	UINT64CONST(0xA000000000000003)
+#define PARALLEL_KEY_IVFPQ_CODEBOOK		UINT64CONST(0xA000000000000004)
+#define PARALLEL_KEY_QUERY_TEXT			UINT64CONST(0xA000000000000005)
 void createArrayMem (const char* name, const int SIZE,const float message);
 void addArrayMem (const char* name, const int SIZE,const float message);
+/*
+ * Get the position of the next sample with reservoir sampling, or -1 to
+ * skip it
+ */
+static int
+GetSamplePosition(IvfflatBuildState * buildstate, int length)
+{
+	int			targsamples = buildstate->targsamples;
+	int			k = -1;
+
+	if (length < targsamples)
+		return length;
+
+	if (buildstate->rowstoskip < 0)
+		buildstate->rowstoskip = reservoir_get_next_S(&buildstate->rstate, length, targsamples);
+
+	if (buildstate->rowstoskip <= 0)
+	{
+#if PG_VERSION_NUM >= 150000
+		k = (int) (targsamples * sampler_random_fract(&buildstate->rstate.randstate));
+#else
+		k = (int) (targsamples * sampler_random_fract(buildstate->rstate.randstate));
+#endif
+
+		Assert(k >= 0 && k < targsamples);
+	}
+
+	buildstate->rowstoskip -= 1;
+
+	return k;
+}
+
+/*
+ * Add sample of a sparse vector
+ *
+ * Samples are copied at their own size, since most sparse vectors are much
+ * smaller than the largest one
+ */
+static void
+AddSparseSample(Datum value, IvfflatBuildState * buildstate)
+{
+	SparseVector *sample;
+	int			k;
+
+	/*
+	 * Normalize with KMEANS_NORM_PROC since spherical distance function
+	 * expects unit vectors
+	 */
+	if (buildstate->kmeansnormprocinfo != NULL)
+	{
+		if (!IvfflatNormValue(buildstate->kmeansnormprocinfo, buildstate->collation, &value, NULL, IVFFLAT_TYPE_SPARSEVEC))
+			return;
+	}
+
+	k = GetSamplePosition(buildstate, buildstate->sparseSampleCount);
+	if (k < 0)
+		return;
+
+	sample = MemoryContextAlloc(buildstate->sampleCtx, VARSIZE(DatumGetPointer(value)));
+	memcpy(sample, DatumGetPointer(value), VARSIZE(DatumGetPointer(value)));
+
+	if (k == buildstate->sparseSampleCount)
+		buildstate->sparseSampleCount++;
+	else
+		pfree(buildstate->sparseSamples[k]);
+
+	buildstate->sparseSamples[k] = sample;
+}
+
 /*
  * Add sample
  */
@@ -54,45 +138,41 @@ static void
 AddSample(Datum *values, IvfflatBuildState * buildstate)
 {
 	VectorArray samples = buildstate->samples;
-	int			targsamples = samples->maxlen;
+	int			k;
 
 	/* Detoast once for all calls */
 	Datum		value = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
 
+	/* k-means runs on sparse vectors for sparsevec */
+	if (buildstate->type == IVFFLAT_TYPE_SPARSEVEC)
+	{
+		AddSparseSample(value, buildstate);
+		return;
+	}
+
+	/* k-means runs on vectors for the other types */
+	if (buildstate->type == IVFFLAT_TYPE_HALFVEC)
+		value = PointerGetDatum(HalfVectorToVector(DatumGetHalfVector(value), NULL));
+	else if (buildstate->type == IVFFLAT_TYPE_BITVEC)
+		value = PointerGetDatum(BitVectorToVector(DatumGetBitVector(value), NULL));
+
 	/*
 	 * Normalize with KMEANS_NORM_PROC since spherical distance function
 	 * expects unit vectors
 	 */
 	if (buildstate->kmeansnormprocinfo != NULL)
 	{
-		if (!IvfflatNormValue(buildstate->kmeansnormprocinfo, buildstate->collation, &value, buildstate->normvec))
+		if (!IvfflatNormValue(buildstate->kmeansnormprocinfo, buildstate->collation, &value, buildstate->normvec, IVFFLAT_TYPE_VECTOR))
 			return;
 	}
 
-	if (samples->length < targsamples)
-	{
-		VectorArraySet(samples, samples->length, DatumGetVector(value));
-		samples->length++;
-	}
-	else
-	{
-		if (buildstate->rowstoskip < 0)
-			buildstate->rowstoskip = reservoir_get_next_S(&buildstate->rstate, samples->length, targsamples);
-
-		if (buildstate->rowstoskip <= 0)
-		{
-#if PG_VERSION_NUM >= 150000
-			int			k = (int) (targsamples * sampler_random_fract(&buildstate->rstate.randstate));
-#else
-			int			k = (int) (targsamples * sampler_random_fract(buildstate->rstate.randstate));
-#endif
-
-			Assert(k >= 0 && k < targsamples);
-			VectorArraySet(samples, k, DatumGetVector(value));
-		}
+	k = GetSamplePosition(buildstate, samples->length);
+	if (k < 0)
+		return;
 
-		buildstate->rowstoskip -= 1;
-	}
+	VectorArraySet(samples, k, DatumGetVector(value));
+	if (k == samples->length)
+		samples->length++;
 }
 
 /*
@@ -126,7 +206,7 @@ SampleCallback(Relation index, CALLBACK_ITEM_POINTER, Datum *values,
 static void
 SampleRows(IvfflatBuildState * buildstate)
 {
-	int			targsamples = buildstate->samples->maxlen;
+	int			targsamples = buildstate->targsamples;
 	BlockNumber totalblocks = RelationGetNumberOfBlocks(buildstate->heap);
 
 	buildstate->rowstoskip = -1;
@@ -164,10 +244,13 @@ AddTupleToSort(Relation index, ItemPointer tid, Datum *values, IvfflatBuildState
 	/* Detoast once for all calls */
 	Datum		value = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
 
+	if (buildstate->type == IVFFLAT_TYPE_SPARSEVEC)
+		IvfflatCheckSparsevec(value);
+
 	/* Normalize if needed */
 	if (buildstate->normprocinfo != NULL)
 	{
-		if (!IvfflatNormValue(buildstate->normprocinfo, buildstate->collation, &value, buildstate->normvec))
+		if (!IvfflatNormValue(buildstate->normprocinfo, buildstate->collation, &value, buildstate->normvec, buildstate->type))
 			return;
 	}
 
@@ -183,6 +266,19 @@ AddTupleToSort(Relation index, ItemPointer tid, Datum *values, IvfflatBuildState
 		}
 	}
 
+	/* Add the entry instead of the value */
+	if (buildstate->pq)
+	{
+		Size		size = IVFPQ_TUPLE_SIZE(buildstate->codebook->m);
+		bytea	   *entry = palloc0(VARHDRSZ + size);
+
+		SET_VARSIZE(entry, VARHDRSZ + size);
+		IvfpqEncode(buildstate->codebook, DatumGetVector(value), VectorArrayGet(centers, closestCenter), (IndexTuple) VARDATA(entry));
+		value = PointerGetDatum(entry);
+	}
+	else if (buildstate->quantized)
+		value = PointerGetDatum(VectorToQuantVector(DatumGetVector(value), NULL));
+
 #ifdef IVFFLAT_KMEANS_DEBUG
 	buildstate->inertia += minDistance;
 	buildstate->listSums[closestCenter] += minDistance;
@@ -243,7 +339,7 @@ BuildCallback(Relation index, CALLBACK_ITEM_POINTER, Datum *values,
  * Get index tuple from sort state
  */
 static inline void
-GetNextTuple(Tuplesortstate *sortstate, TupleDesc tupdesc, TupleTableSlot *slot, IndexTuple *itup, int *list)
+GetNextTuple(Tuplesortstate *sortstate, TupleDesc tupdesc, TupleTableSlot *slot, IndexTuple *itup, int *list, bool pq)
 {
 	Datum		value;
 	bool		isnull;
@@ -254,7 +350,15 @@ GetNextTuple(Tuplesortstate *sortstate, TupleDesc tupdesc, TupleTableSlot *slot,
 		value = slot_getattr(slot, 3, &isnull);
 
 		/* Form the index tuple */
-		*itup = index_form_tuple(tupdesc, &value, &isnull);
+		if (pq)
+		{
+			bytea	   *entry = DatumGetByteaPP(value);
+
+			*itup = palloc(VARSIZE_ANY_EXHDR(entry));
+			memcpy(*itup, VARDATA_ANY(entry), VARSIZE_ANY_EXHDR(entry));
+		}
+		else
+			*itup = index_form_tuple(tupdesc, &value, &isnull);
 		(*itup)->t_tid = *((ItemPointer) DatumGetPointer(slot_getattr(slot, 2, &isnull)));
 	}
 	else
@@ -289,7 +393,7 @@ InsertTuples(Relation index, IvfflatBuildState * buildstate, ForkNumber forkNum)
 
 	UpdateProgress(PROGRESS_CREATEIDX_TUPLES_TOTAL, buildstate->indtuples);
 
-	GetNextTuple(buildstate->sortstate, tupdesc, slot, &itup, &list);
+	GetNextTuple(buildstate->sortstate, tupdesc, slot, &itup, &list, buildstate->pq);
 
 	for (i = 0; i < buildstate->centers->length; i++)
 	{
@@ -318,7 +422,7 @@ InsertTuples(Relation index, IvfflatBuildState * buildstate, ForkNumber forkNum)
 
 			UpdateProgress(PROGRESS_CREATEIDX_TUPLES_DONE, ++inserted);
 
-			GetNextTuple(buildstate->sortstate, tupdesc, slot, &itup, &list);
+			GetNextTuple(buildstate->sortstate, tupdesc, slot, &itup, &list, buildstate->pq);
 		}
 
 		insertPage = BufferGetBlockNumber(buf);
@@ -334,21 +438,54 @@ InsertTuples(Relation index, IvfflatBuildState * buildstate, ForkNumber forkNum)
  * Initialize the build state
  */
 static void
-InitBuildState(IvfflatBuildState * buildstate, Relation heap, Relation index, IndexInfo *indexInfo)
+InitBuildState(IvfflatBuildState * buildstate, Relation heap, Relation index, IndexInfo *indexInfo, bool pq)
 {
 	buildstate->heap = heap;
 	buildstate->index = index;
 	buildstate->indexInfo = indexInfo;
 
 	buildstate->lists = IvfflatGetLists(index);
+	buildstate->groups = IvfflatGetGroups(index);
 	buildstate->dimensions = TupleDescAttr(index->rd_att, 0)->atttypmod;
+	buildstate->type = IvfflatGetType(index);
+	buildstate->pq = pq;
+	buildstate->quantized = IvfflatIsQuantized(index);
+	buildstate->codebook = NULL;
+	buildstate->ivfleader = NULL;
 
 	/* Require column to have dimensions to be indexed */
 	if (buildstate->dimensions < 0)
 		elog(ERROR, "column does not have dimensions");
 
-	if (buildstate->dimensions > IVFFLAT_MAX_DIM)
-		elog(ERROR, "column cannot have more than %d dimensions for ivfflat index", IVFFLAT_MAX_DIM);
+	if (buildstate->groups >= buildstate->lists)
+		elog(ERROR, "groups must be less than lists");
+
+	if (pq)
+	{
+		/* Residuals are computed on vectors */
+		if (buildstate->type != IVFFLAT_TYPE_VECTOR)
+			elog(ERROR, "type not supported for ivfpq index");
+
+		/* List centers are read as vectors */
+		if (buildstate->dimensions > IVFFLAT_MAX_DIM)
+			elog(ERROR, "column cannot have more than %d dimensions for ivfpq index", IVFFLAT_MAX_DIM);
+
+		if (buildstate->dimensions % IvfpqGetM(index, buildstate->dimensions) != 0)
+			elog(ERROR, "dimensions must be divisible by m");
+	}
+
+	if (buildstate->type == IVFFLAT_TYPE_BITVEC)
+	{
+		if (buildstate->dimensions > IVFFLAT_MAX_BITVEC_DIM)
+			elog(ERROR, "column cannot have more than %d dimensions for ivfflat index", IVFFLAT_MAX_BITVEC_DIM);
+	}
+	else if (buildstate->type == IVFFLAT_TYPE_HALFVEC)
+	{
+		if (buildstate->dimensions > IVFFLAT_MAX_HALFVEC_DIM)
+			elog(ERROR, "column cannot have more than %d dimensions for ivfflat index", IVFFLAT_MAX_HALFVEC_DIM);
+	}
+	else if (buildstate->type == IVFFLAT_TYPE_VECTOR && buildstate->dimensions > IVFFLAT_MAX_QUANTVEC_DIM)
+		elog(ERROR, "column cannot have more than %d dimensions for ivfflat index", IVFFLAT_MAX_QUANTVEC_DIM);
 
 	buildstate->reltuples = 0;
 	buildstate->indtuples = 0;
@@ -359,6 +496,10 @@ InitBuildState(IvfflatBuildState * buildstate, Relation heap, Relation index, In
 	buildstate->kmeansnormprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_KMEANS_NORM_PROC);
 	buildstate->collation = index->rd_indcollation[0];
 
+	/* Quantized vectors need bounds on the distance to be rechecked */
+	if (buildstate->quantized && IvfflatGetQuantBoundFunc(buildstate->procinfo, buildstate->normprocinfo != NULL) == NULL)
+		elog(ERROR, "column cannot have more than %d dimensions for this opclass", IVFFLAT_MAX_DIM);
+
 	/* Require more than one dimension for spherical k-means */
 	/* Lists check for backwards compatibility */
 	/* TODO Remove lists check in 0.3.0 */
@@ -373,7 +514,7 @@ InitBuildState(IvfflatBuildState * buildstate, Relation heap, Relation index, In
 #endif
 	TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 1, "list", INT4OID, -1, 0);
 	TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 2, "tid", TIDOID, -1, 0);
-	TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 3, "vector", RelationGetDescr(index)->attrs[0].atttypid, -1, 0);
+	TupleDescInitEntry(buildstate->tupdesc, (AttrNumber) 3, "vector", pq ? BYTEAOID : RelationGetDescr(index)->attrs[0].atttypid, -1, 0);
 
 #if PG_VERSION_NUM >= 120000
 	buildstate->slot = MakeSingleTupleTableSlot(buildstate->tupdesc, &TTSOpsVirtual);
@@ -381,11 +522,20 @@ InitBuildState(IvfflatBuildState * buildstate, Relation heap, Relation index, In
 	buildstate->slot = MakeSingleTupleTableSlot(buildstate->tupdesc);
 #endif
 
-	buildstate->centers = VectorArrayInit(buildstate->lists, buildstate->dimensions);
+	/* Sparse vectors can have too many dimensions for dense centers */
+	if (buildstate->type == IVFFLAT_TYPE_SPARSEVEC)
+		buildstate->centers = VectorArrayInit(buildstate->lists, buildstate->dimensions, SPARSEVEC_SIZE(IVFFLAT_SPARSEVEC_CENTER_NNZ));
+	else
+		buildstate->centers = VectorArrayInit(buildstate->lists, buildstate->dimensions, VECTOR_SIZE(buildstate->dimensions));
+	buildstate->groupCenters = NULL;
+	buildstate->groupCounts = NULL;
 	buildstate->listInfo = palloc(sizeof(ListInfo) * buildstate->lists);
 
-	/* Reuse for each tuple */
-	buildstate->normvec = InitVector(buildstate->dimensions);
+	/* Reuse for each tuple, except for sparse vectors */
+	if (buildstate->type == IVFFLAT_TYPE_SPARSEVEC)
+		buildstate->normvec = NULL;
+	else
+		buildstate->normvec = InitVector(buildstate->dimensions);
 
 	buildstate->tmpCtx = AllocSetContextCreate(CurrentMemoryContext,
 											   "Ivfflat build temporary context",
@@ -406,7 +556,20 @@ FreeBuildState(IvfflatBuildState * buildstate)
 {
 	VectorArrayFree(buildstate->centers);
 	pfree(buildstate->listInfo);
-	pfree(buildstate->normvec);
+	if (buildstate->normvec != NULL)
+		pfree(buildstate->normvec);
+
+	if (buildstate->codebook != NULL)
+	{
+		pfree(buildstate->codebook->centroids);
+		pfree(buildstate->codebook);
+	}
+
+	if (buildstate->groupCenters != NULL)
+	{
+		VectorArrayFree(buildstate->groupCenters);
+		pfree(buildstate->groupCounts);
+	}
 
 #ifdef IVFFLAT_KMEANS_DEBUG
 	pfree(buildstate->listSums);
@@ -416,6 +579,137 @@ FreeBuildState(IvfflatBuildState * buildstate)
 	MemoryContextDelete(buildstate->tmpCtx);
 }
 
+/*
+ * Convert centers to the type of the indexed column
+ */
+static VectorArray
+ConvertCenters(VectorArray centers, IvfflatType type)
+{
+	Size		itemsize;
+	VectorArray typedCenters;
+
+	/* Centers of sparse vectors are computed as sparse vectors */
+	if (type == IVFFLAT_TYPE_VECTOR || type == IVFFLAT_TYPE_SPARSEVEC)
+		return centers;
+
+	itemsize = type == IVFFLAT_TYPE_HALFVEC ? HALFVEC_SIZE(centers->dim) : BITVEC_SIZE(centers->dim);
+	typedCenters = VectorArrayInit(centers->maxlen, centers->dim, itemsize);
+
+	for (int i = 0; i < centers->length; i++)
+	{
+		void	   *center;
+
+		if (type == IVFFLAT_TYPE_HALFVEC)
+			center = VectorToHalfVector(VectorArrayGet(centers, i));
+		else
+		{
+			/* Round each mean of zeros and ones to the nearer bit */
+			center = VectorToBitVector(VectorArrayGet(centers, i), 0.5);
+		}
+
+		VectorArraySet(typedCenters, i, center);
+		pfree(center);
+	}
+	typedCenters->length = centers->length;
+
+	VectorArrayFree(centers);
+	return typedCenters;
+}
+
+/*
+ * Quantize centers for the list and group pages
+ *
+ * Tuples are still assigned with the exact centers, which are not freed
+ */
+static VectorArray
+QuantizeCenters(VectorArray centers)
+{
+	VectorArray quantCenters = VectorArrayInit(centers->maxlen, centers->dim, QUANTVEC_SIZE(centers->dim));
+
+	for (int i = 0; i < centers->length; i++)
+		VectorToQuantVector(VectorArrayGet(centers, i), (QuantVector *) VectorArrayGet(quantCenters, i));
+	quantCenters->length = centers->length;
+
+	return quantCenters;
+}
+
+/*
+ * Cluster the list centers into groups and order lists by group, so the
+ * lists of each group are stored together
+ */
+static void
+ComputeGroups(IvfflatBuildState * buildstate)
+{
+	VectorArray centers = buildstate->centers;
+	VectorArray groupCenters;
+	VectorArray sortedCenters;
+	int			groups = buildstate->groups;
+	int		   *groupCounts = palloc0(sizeof(int) * groups);
+	int		   *closestGroups = palloc(sizeof(int) * centers->length);
+	int		   *offsets = palloc0(sizeof(int) * groups);
+	FmgrInfo   *procinfo;
+
+	/* The list centers are the samples */
+	if (buildstate->type == IVFFLAT_TYPE_SPARSEVEC)
+	{
+		SparseVector **samples = palloc(sizeof(SparseVector *) * centers->length);
+
+		for (int i = 0; i < centers->length; i++)
+			samples[i] = (SparseVector *) VectorArrayGet(centers, i);
+
+		groupCenters = VectorArrayInit(groups, centers->dim, centers->itemsize);
+		IvfflatSparseKmeans(buildstate->index, samples, centers->length, groupCenters);
+		pfree(samples);
+
+		/* Centers already have the type of the indexed column */
+		procinfo = buildstate->procinfo;
+	}
+	else
+	{
+		groupCenters = VectorArrayInit(groups, buildstate->dimensions, VECTOR_SIZE(buildstate->dimensions));
+		IvfflatKmeans(buildstate->index, centers, groupCenters);
+		procinfo = index_getprocinfo(buildstate->index, 1, IVFFLAT_KMEANS_DISTANCE_PROC);
+	}
+
+	for (int i = 0; i < centers->length; i++)
+	{
+		Datum		center = PointerGetDatum(VectorArrayGet(centers, i));
+		double		minDistance = DBL_MAX;
+		int			closestGroup = 0;
+
+		for (int j = 0; j < groups; j++)
+		{
+			double		distance = DatumGetFloat8(FunctionCall2Coll(procinfo, buildstate->collation, center, PointerGetDatum(VectorArrayGet(groupCenters, j))));
+
+			if (distance < minDistance)
+			{
+				minDistance = distance;
+				closestGroup = j;
+			}
+		}
+
+		closestGroups[i] = closestGroup;
+		groupCounts[closestGroup]++;
+	}
+
+	/* Order lists by group */
+	for (int j = 1; j < groups; j++)
+		offsets[j] = offsets[j - 1] + groupCounts[j - 1];
+
+	sortedCenters = VectorArrayInit(centers->maxlen, centers->dim, centers->itemsize);
+	for (int i = 0; i < centers->length; i++)
+		VectorArraySet(sortedCenters, offsets[closestGroups[i]]++, VectorArrayGet(centers, i));
+	sortedCenters->length = centers->length;
+
+	VectorArrayFree(centers);
+	pfree(closestGroups);
+	pfree(offsets);
+
+	buildstate->centers = sortedCenters;
+	buildstate->groupCenters = groupCenters;
+	buildstate->groupCounts = groupCounts;
+}
+
 /*
  * Compute centers
  */
@@ -436,14 +730,33 @@ ComputeCenters(IvfflatBuildState * buildstate)
 	if (buildstate->heap == NULL)
 		numSamples = 1;
 
+	buildstate->targsamples = numSamples;
+
 	/* Sample rows */
 	/* TODO Ensure within maintenance_work_mem */
-	buildstate->samples = VectorArrayInit(numSamples, buildstate->dimensions);
+	if (buildstate->type == IVFFLAT_TYPE_SPARSEVEC)
+	{
+		buildstate->sparseSamples = palloc(sizeof(SparseVector *) * numSamples);
+		buildstate->sparseSampleCount = 0;
+		buildstate->sampleCtx = AllocSetContextCreate(CurrentMemoryContext,
+													  "Ivfflat build sample context",
+													  ALLOCSET_DEFAULT_SIZES);
+	}
+	else
+		buildstate->samples = VectorArrayInit(numSamples, buildstate->dimensions, VECTOR_SIZE(buildstate->dimensions));
+
 	if (buildstate->heap != NULL)
 	{
+		int			sampleCount;
+
 		SampleRows(buildstate);
 
-		if (buildstate->samples->length < buildstate->lists)
+		if (buildstate->type == IVFFLAT_TYPE_SPARSEVEC)
+			sampleCount = buildstate->sparseSampleCount;
+		else
+			sampleCount = buildstate->samples->length;
+
+		if (sampleCount < buildstate->lists)
 		{
 			ereport(NOTICE,
 					(errmsg("ivfflat index created with little data"),
@@ -452,11 +765,40 @@ ComputeCenters(IvfflatBuildState * buildstate)
 		}
 	}
 
+	if (buildstate->type == IVFFLAT_TYPE_SPARSEVEC)
+	{
+		/* Calculate centers */
+		IvfflatBench("k-means", IvfflatSparseKmeans(buildstate->index, buildstate->sparseSamples, buildstate->sparseSampleCount, buildstate->centers));
+
+		/* Free samples before we allocate more memory */
+		pfree(buildstate->sparseSamples);
+		MemoryContextDelete(buildstate->sampleCtx);
+
+		/* Group lists by the closest group center */
+		if (buildstate->groups > 0)
+			IvfflatBench("groups", ComputeGroups(buildstate));
+
+		return;
+	}
+
 	/* Calculate centers */
 	IvfflatBench("k-means", IvfflatKmeans(buildstate->index, buildstate->samples, buildstate->centers));
 
+	/* Train codebooks on the residuals */
+	if (buildstate->pq)
+		IvfflatBench("codebooks", buildstate->codebook = IvfpqTrainCodebook(buildstate->index, buildstate->samples, buildstate->centers, IvfpqGetM(buildstate->index, buildstate->dimensions)));
+
 	/* Free samples before we allocate more memory */
 	VectorArrayFree(buildstate->samples);
+
+	/* Group lists by the closest group center */
+	if (buildstate->groups > 0)
+		IvfflatBench("groups", ComputeGroups(buildstate));
+
+	/* Lists and groups store centers with the type of the indexed column */
+	buildstate->centers = ConvertCenters(buildstate->centers, buildstate->type);
+	if (buildstate->groupCenters != NULL)
+		buildstate->groupCenters = ConvertCenters(buildstate->groupCenters, buildstate->type);
 }
 
 /*
@@ -479,6 +821,12 @@ CreateMetaPage(Relation index, int dimensions, int lists, ForkNumber forkNum)
 	metap->version = IVFFLAT_VERSION;
 	metap->dimensions = dimensions;
 	metap->lists = lists;
+	metap->groups = 0;
+	metap->groupPage = InvalidBlockNumber;
+	metap->pendingHead = InvalidBlockNumber;
+	metap->pendingTail = InvalidBlockNumber;
+	metap->nPendingPages = 0;
+	metap->nFlushingPages = 0;
 	((PageHeader) page)->pd_lower =
 		((char *) metap + sizeof(IvfflatMetaPageData)) - (char *) page;
 
@@ -489,7 +837,7 @@ CreateMetaPage(Relation index, int dimensions, int lists, ForkNumber forkNum)
  * Create list pages
  */
 static void
-CreateListPages(Relation index, VectorArray centers, int dimensions,
+CreateListPages(Relation index, VectorArray centers,
 				int lists, ForkNumber forkNum, ListInfo * *listInfo)
 {
 	int			i;
@@ -500,7 +848,7 @@ CreateListPages(Relation index, VectorArray centers, int dimensions,
 	Size		itemsz;
 	IvfflatList list;
 
-	itemsz = MAXALIGN(IVFFLAT_LIST_SIZE(dimensions));
+	itemsz = MAXALIGN(IVFFLAT_LIST_SIZE(centers->itemsize));
 	list = palloc(itemsz);
 
 	buf = IvfflatNewBuffer(index, forkNum);
@@ -511,7 +859,7 @@ CreateListPages(Relation index, VectorArray centers, int dimensions,
 		/* Load list */
 		list->startPage = InvalidBlockNumber;
 		list->insertPage = InvalidBlockNumber;
-		memcpy(&list->center, VectorArrayGet(centers, i), VECTOR_SIZE(dimensions));
+		memcpy(&list->center, VectorArrayGet(centers, i), centers->itemsize);
 
 		/* Ensure free space */
 		if (PageGetFreeSpace(page) < itemsz)
@@ -532,6 +880,73 @@ CreateListPages(Relation index, VectorArray centers, int dimensions,
 	pfree(list);
 }
 
+/*
+ * Create group pages
+ */
+static void
+CreateGroupPages(Relation index, VectorArray groupCenters, int *groupCounts,
+				 ListInfo * listInfo, ForkNumber forkNum)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState *state;
+	Size		itemsz;
+	IvfflatGroup group;
+	BlockNumber groupPage;
+	IvfflatMetaPage metap;
+	int			firstList = 0;
+
+	itemsz = MAXALIGN(IVFFLAT_GROUP_SIZE(groupCenters->itemsize));
+	group = palloc0(itemsz);
+
+	buf = IvfflatNewBuffer(index, forkNum);
+	IvfflatInitRegisterPage(index, &buf, &page, &state);
+
+	groupPage = BufferGetBlockNumber(buf);
+
+	for (int i = 0; i < groupCenters->length; i++)
+	{
+		/* Lists are ordered by group */
+		group->listCount = groupCounts[i];
+		if (groupCounts[i] > 0)
+		{
+			group->listPage = listInfo[firstList].blkno;
+			group->listOffset = listInfo[firstList].offno;
+		}
+		else
+		{
+			group->listPage = InvalidBlockNumber;
+			group->listOffset = InvalidOffsetNumber;
+		}
+		memcpy(&group->center, VectorArrayGet(groupCenters, i), groupCenters->itemsize);
+		firstList += groupCounts[i];
+
+		/* Ensure free space */
+		if (PageGetFreeSpace(page) < itemsz)
+			IvfflatAppendPage(index, &buf, &page, &state, forkNum);
+
+		/* Add the item */
+		if (PageAddItem(page, (Item) group, itemsz, InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
+			elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+	}
+
+	IvfflatCommitBuffer(buf, state);
+
+	/* Update the metapage */
+	buf = ReadBufferExtended(index, forkNum, IVFFLAT_METAPAGE_BLKNO, RBM_NORMAL, NULL);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, 0);
+
+	metap = IvfflatPageGetMeta(page);
+	metap->groups = groupCenters->length;
+	metap->groupPage = groupPage;
+
+	IvfflatCommitBuffer(buf, state);
+
+	pfree(group);
+}
+
 /*
  * Print k-means metrics
  */
@@ -593,23 +1008,435 @@ ScanTable(IvfflatBuildState * buildstate)
 }
 
 /*
- * Create entry pages
+ * Begin a sort by list, the same for the leader and workers
  */
-static void
-CreateEntryPages(IvfflatBuildState * buildstate, ForkNumber forkNum)
+static Tuplesortstate *
+InitBuildSortState(TupleDesc tupdesc, int memory, SortCoordinate coordinate)
 {
 	AttrNumber	attNums[] = {1};
 	Oid			sortOperators[] = {Int4LessOperator};
 	Oid			sortCollations[] = {InvalidOid};
 	bool		nullsFirstFlags[] = {false};
 
-	UpdateProgress(PROGRESS_CREATEIDX_SUBPHASE, PROGRESS_IVFFLAT_PHASE_SORT);
+	return tuplesort_begin_heap(tupdesc, 1, attNums, sortOperators, sortCollations, nullsFirstFlags, memory, coordinate, false);
+}
+
+/*
+ * Assign tuples and sort them within a participant
+ */
+static void
+IvfflatParallelScanAndSort(Relation heap, Relation index, IvfflatShared * ivfshared, Sharedsort *sharedsort, char *ivfcenters, float *ivfcodebook, int sortmem, bool progress)
+{
+	SortCoordinate coordinate;
+	IvfflatBuildState buildstate;
+	IndexInfo  *indexInfo;
+	double		reltuples;
+#if PG_VERSION_NUM >= 120000
+	TableScanDesc scan;
+#else
+	HeapScanDesc scan;
+#endif
+
+	/* Initialize local tuplesort coordination state */
+	coordinate = palloc0(sizeof(SortCoordinateData));
+	coordinate->isWorker = true;
+	coordinate->nParticipants = -1;
+	coordinate->sharedsort = sharedsort;
+
+	indexInfo = BuildIndexInfo(index);
+	indexInfo->ii_Concurrent = ivfshared->isconcurrent;
+	InitBuildState(&buildstate, heap, index, indexInfo, ivfshared->pq);
+
+	/* Use the centers from the leader, which have the indexed type */
+	VectorArrayFree(buildstate.centers);
+	buildstate.centers = VectorArrayInit(ivfshared->numcenters, buildstate.dimensions, ivfshared->itemsize);
+	memcpy(buildstate.centers->items, ivfcenters, ivfshared->itemsize * ivfshared->numcenters);
+	buildstate.centers->length = ivfshared->numcenters;
+
+	if (ivfshared->pq)
+	{
+		Size		size = sizeof(float) * IVFPQ_CENTROIDS * buildstate.dimensions;
+
+		buildstate.codebook = palloc(sizeof(IvfpqCodebook));
+		buildstate.codebook->dimensions = buildstate.dimensions;
+		buildstate.codebook->m = IvfpqGetM(index, buildstate.dimensions);
+		buildstate.codebook->dsub = buildstate.dimensions / buildstate.codebook->m;
+		buildstate.codebook->centroids = palloc(size);
+		memcpy(buildstate.codebook->centroids, ivfcodebook, size);
+	}
+
+	buildstate.sortstate = InitBuildSortState(buildstate.tupdesc, sortmem, coordinate);
+
+	/* Join parallel scan */
+#if PG_VERSION_NUM >= 120000
+	scan = table_beginscan_parallel(heap, ParallelTableScanFromIvfflatShared(ivfshared));
+	reltuples = table_index_build_scan(heap, index, indexInfo,
+									   true, progress, BuildCallback, (void *) &buildstate, scan);
+#else
+	scan = heap_beginscan_parallel(heap, ParallelTableScanFromIvfflatShared(ivfshared));
+	reltuples = IndexBuildHeapScan(heap, index, indexInfo,
+								   true, BuildCallback, (void *) &buildstate, scan);
+#endif
+
+	/* Execute this participant's part of the sort */
+	tuplesort_performsort(buildstate.sortstate);
+
+	/* Record statistics */
+	SpinLockAcquire(&ivfshared->mutex);
+	ivfshared->nparticipantsdone++;
+	ivfshared->reltuples += reltuples;
+	ivfshared->indtuples += buildstate.indtuples;
+#ifdef IVFFLAT_KMEANS_DEBUG
+	ivfshared->inertia += buildstate.inertia;
+#endif
+	SpinLockRelease(&ivfshared->mutex);
+
+	/* Notify leader */
+	ConditionVariableSignal(&ivfshared->workersdonecv);
+
+	/* We can end tuplesorts immediately */
+	tuplesort_end(buildstate.sortstate);
+
+	FreeBuildState(&buildstate);
+}
+
+/*
+ * Perform work within a launched parallel process
+ */
+void
+IvfflatParallelBuildMain(dsm_segment *seg, shm_toc *toc)
+{
+	char	   *sharedquery;
+	IvfflatShared *ivfshared;
+	Sharedsort *sharedsort;
+	char	   *ivfcenters;
+	float	   *ivfcodebook;
+	Relation	heapRel;
+	Relation	indexRel;
+	LOCKMODE	heapLockmode;
+	LOCKMODE	indexLockmode;
+	int			sortmem;
+
+	/* Set debug_query_string for individual workers first */
+	sharedquery = shm_toc_lookup(toc, PARALLEL_KEY_QUERY_TEXT, true);
+	debug_query_string = sharedquery;
+
+	/* Report the query string from leader */
+	pgstat_report_activity(STATE_RUNNING, debug_query_string);
+
+	/* Look up shared state */
+	ivfshared = shm_toc_lookup(toc, PARALLEL_KEY_IVFFLAT_SHARED, false);
+
+	/* Open relations using lock modes known to be obtained by index.c */
+	if (!ivfshared->isconcurrent)
+	{
+		heapLockmode = ShareLock;
+		indexLockmode = AccessExclusiveLock;
+	}
+	else
+	{
+		heapLockmode = ShareUpdateExclusiveLock;
+		indexLockmode = RowExclusiveLock;
+	}
+
+	heapRel = table_open(ivfshared->heaprelid, heapLockmode);
+	indexRel = index_open(ivfshared->indexrelid, indexLockmode);
+
+	/* Look up shared state private to tuplesort.c */
+	sharedsort = shm_toc_lookup(toc, PARALLEL_KEY_TUPLESORT, false);
+	tuplesort_attach_shared(sharedsort, seg);
+
+	ivfcenters = shm_toc_lookup(toc, PARALLEL_KEY_IVFFLAT_CENTERS, false);
+	ivfcodebook = shm_toc_lookup(toc, PARALLEL_KEY_IVFPQ_CODEBOOK, true);
+
+	/* Perform sorting */
+	sortmem = maintenance_work_mem / ivfshared->scantuplesortstates;
+	IvfflatParallelScanAndSort(heapRel, indexRel, ivfshared, sharedsort, ivfcenters, ivfcodebook, sortmem, false);
+
+	index_close(indexRel, indexLockmode);
+	table_close(heapRel, heapLockmode);
+}
+
+/*
+ * End a parallel build
+ */
+static void
+IvfflatEndParallel(IvfflatLeader * ivfleader)
+{
+	/* Shutdown worker processes */
+	WaitForParallelWorkersToFinish(ivfleader->pcxt);
+
+	/* Free last reference to MVCC snapshot, if one was used */
+	if (IsMVCCSnapshot(ivfleader->snapshot))
+		UnregisterSnapshot(ivfleader->snapshot);
+	DestroyParallelContext(ivfleader->pcxt);
+	ExitParallelMode();
+}
+
+/*
+ * Get the size of the shared state and parallel heap scan descriptor
+ */
+static Size
+ParallelEstimateShared(Relation heap, Snapshot snapshot)
+{
+#if PG_VERSION_NUM >= 120000
+	return add_size(BUFFERALIGN(sizeof(IvfflatShared)), table_parallelscan_estimate(heap, snapshot));
+#else
+	return add_size(BUFFERALIGN(sizeof(IvfflatShared)), heap_parallelscan_estimate(snapshot));
+#endif
+}
+
+/*
+ * Begin a parallel build
+ *
+ * Workers assign tuples to the centers from the leader and each sorts its
+ * share, and the leader merges the sorted runs. Falls back to a serial
+ * build if no workers can be launched.
+ */
+static void
+IvfflatBeginParallel(IvfflatBuildState * buildstate, bool isconcurrent, int request)
+{
+	ParallelContext *pcxt;
+	int			scantuplesortstates;
+	Snapshot	snapshot;
+	Size		estivfshared;
+	Size		estsort;
+	Size		estcenters;
+	Size		estcodebook = 0;
+	IvfflatShared *ivfshared;
+	Sharedsort *sharedsort;
+	char	   *ivfcenters;
+	float	   *ivfcodebook = NULL;
+	IvfflatLeader *ivfleader = (IvfflatLeader *) palloc0(sizeof(IvfflatLeader));
+	int			querylen;
+
+	/* Enter parallel mode and create context */
+	EnterParallelMode();
+	Assert(request > 0);
+#if PG_VERSION_NUM >= 120000
+	pcxt = CreateParallelContext("vector", "IvfflatParallelBuildMain", request);
+#else
+	pcxt = CreateParallelContext("vector", "IvfflatParallelBuildMain", request, true);
+#endif
+
+	/* The leader participates as a worker */
+	scantuplesortstates = request + 1;
+
+	/* Get snapshot for table scan */
+	if (!isconcurrent)
+		snapshot = SnapshotAny;
+	else
+		snapshot = RegisterSnapshot(GetTransactionSnapshot());
+
+	/* Estimate size of workspaces */
+	estivfshared = ParallelEstimateShared(buildstate->heap, snapshot);
+	shm_toc_estimate_chunk(&pcxt->estimator, estivfshared);
+	estsort = tuplesort_estimate_shared(scantuplesortstates);
+	shm_toc_estimate_chunk(&pcxt->estimator, estsort);
+	estcenters = buildstate->centers->itemsize * buildstate->centers->length;
+	shm_toc_estimate_chunk(&pcxt->estimator, estcenters);
+	shm_toc_estimate_keys(&pcxt->estimator, 3);
+
+	if (buildstate->pq)
+	{
+		estcodebook = sizeof(float) * IVFPQ_CENTROIDS * buildstate->dimensions;
+		shm_toc_estimate_chunk(&pcxt->estimator, estcodebook);
+		shm_toc_estimate_keys(&pcxt->estimator, 1);
+	}
+
+	/* Finally, estimate PARALLEL_KEY_QUERY_TEXT space */
+	if (debug_query_string)
+	{
+		querylen = strlen(debug_query_string);
+		shm_toc_estimate_chunk(&pcxt->estimator, querylen + 1);
+		shm_toc_estimate_keys(&pcxt->estimator, 1);
+	}
+	else
+		querylen = 0;			/* keep compiler quiet */
+
+	/* Everyone's had a chance to ask for space, so now create the DSM */
+	InitializeParallelDSM(pcxt);
+
+	/* If no DSM segment was available, back out (do serial build) */
+	if (pcxt->seg == NULL)
+	{
+		if (IsMVCCSnapshot(snapshot))
+			UnregisterSnapshot(snapshot);
+		DestroyParallelContext(pcxt);
+		ExitParallelMode();
+		return;
+	}
+
+	/* Store shared build state, for which we reserved space */
+	ivfshared = (IvfflatShared *) shm_toc_allocate(pcxt->toc, estivfshared);
+	/* Initialize immutable state */
+	ivfshared->heaprelid = RelationGetRelid(buildstate->heap);
+	ivfshared->indexrelid = RelationGetRelid(buildstate->index);
+	ivfshared->isconcurrent = isconcurrent;
+	ivfshared->scantuplesortstates = scantuplesortstates;
+	ivfshared->pq = buildstate->pq;
+	ivfshared->numcenters = buildstate->centers->length;
+	ivfshared->itemsize = buildstate->centers->itemsize;
+	ConditionVariableInit(&ivfshared->workersdonecv);
+	SpinLockInit(&ivfshared->mutex);
+	/* Initialize mutable state */
+	ivfshared->nparticipantsdone = 0;
+	ivfshared->reltuples = 0;
+	ivfshared->indtuples = 0;
+#ifdef IVFFLAT_KMEANS_DEBUG
+	ivfshared->inertia = 0;
+#endif
+#if PG_VERSION_NUM >= 120000
+	table_parallelscan_initialize(buildstate->heap,
+								  ParallelTableScanFromIvfflatShared(ivfshared),
+								  snapshot);
+#else
+	heap_parallelscan_initialize(ParallelTableScanFromIvfflatShared(ivfshared),
+								 buildstate->heap, snapshot);
+#endif
+
+	/* Store shared tuplesort-private state, for which we reserved space */
+	sharedsort = (Sharedsort *) shm_toc_allocate(pcxt->toc, estsort);
+	tuplesort_initialize_shared(sharedsort, scantuplesortstates, pcxt->seg);
+
+	ivfcenters = shm_toc_allocate(pcxt->toc, estcenters);
+	memcpy(ivfcenters, buildstate->centers->items, estcenters);
+
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_IVFFLAT_SHARED, ivfshared);
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_TUPLESORT, sharedsort);
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_IVFFLAT_CENTERS, ivfcenters);
+
+	if (buildstate->pq)
+	{
+		ivfcodebook = shm_toc_allocate(pcxt->toc, estcodebook);
+		memcpy(ivfcodebook, buildstate->codebook->centroids, estcodebook);
+		shm_toc_insert(pcxt->toc, PARALLEL_KEY_IVFPQ_CODEBOOK, ivfcodebook);
+	}
+
+	/* Store query string for workers */
+	if (debug_query_string)
+	{
+		char	   *sharedquery;
 
-	buildstate->sortstate = tuplesort_begin_heap(buildstate->tupdesc, 1, attNums, sortOperators, sortCollations, nullsFirstFlags, maintenance_work_mem, NULL, false);
+		sharedquery = (char *) shm_toc_allocate(pcxt->toc, querylen + 1);
+		memcpy(sharedquery, debug_query_string, querylen + 1);
+		shm_toc_insert(pcxt->toc, PARALLEL_KEY_QUERY_TEXT, sharedquery);
+	}
+
+	/* Launch workers, saving status for leader/caller */
+	LaunchParallelWorkers(pcxt);
+	ivfleader->pcxt = pcxt;
+	ivfleader->nparticipanttuplesorts = pcxt->nworkers_launched + 1;
+	ivfleader->ivfshared = ivfshared;
+	ivfleader->sharedsort = sharedsort;
+	ivfleader->snapshot = snapshot;
+	ivfleader->ivfcenters = ivfcenters;
+	ivfleader->ivfcodebook = ivfcodebook;
+
+	/* If no workers were successfully launched, back out (do serial build) */
+	if (pcxt->nworkers_launched == 0)
+	{
+		IvfflatEndParallel(ivfleader);
+		return;
+	}
+
+	/* Log participants */
+	ereport(DEBUG1, (errmsg("using %d parallel workers", pcxt->nworkers_launched)));
+
+	/* Save leader state now that it's clear build will be parallel */
+	buildstate->ivfleader = ivfleader;
+
+	/* Join heap scan ourselves */
+	IvfflatParallelScanAndSort(buildstate->heap, buildstate->index, ivfshared, sharedsort, ivfcenters, ivfcodebook,
+							   maintenance_work_mem / ivfleader->nparticipanttuplesorts, true);
+
+	/* Wait for all launched workers */
+	WaitForParallelWorkersToAttach(pcxt);
+}
+
+/*
+ * Wait for all participants to finish scanning
+ */
+static double
+ParallelHeapScan(IvfflatBuildState * buildstate)
+{
+	IvfflatShared *ivfshared = buildstate->ivfleader->ivfshared;
+	int			nparticipanttuplesorts = buildstate->ivfleader->nparticipanttuplesorts;
+	double		reltuples;
+
+	for (;;)
+	{
+		SpinLockAcquire(&ivfshared->mutex);
+		if (ivfshared->nparticipantsdone == nparticipanttuplesorts)
+		{
+			buildstate->indtuples = ivfshared->indtuples;
+			reltuples = ivfshared->reltuples;
+#ifdef IVFFLAT_KMEANS_DEBUG
+			buildstate->inertia = ivfshared->inertia;
+#endif
+			SpinLockRelease(&ivfshared->mutex);
+			break;
+		}
+		SpinLockRelease(&ivfshared->mutex);
+
+		ConditionVariableSleep(&ivfshared->workersdonecv,
+							   WAIT_EVENT_PARALLEL_CREATE_INDEX_SCAN);
+	}
+
+	ConditionVariableCancelSleep();
+
+	return reltuples;
+}
+
+/*
+ * Assign tuples to lists and add them to the sort
+ */
+static void
+AssignTuples(IvfflatBuildState * buildstate)
+{
+	int			parallel_workers = 0;
+	SortCoordinate coordinate = NULL;
+
+	/* Calculate parallel workers */
+	if (buildstate->heap != NULL)
+		parallel_workers = plan_create_index_workers(RelationGetRelid(buildstate->heap), RelationGetRelid(buildstate->index));
+
+	/* Attempt to launch parallel worker scan when required */
+	if (parallel_workers > 0)
+		IvfflatBeginParallel(buildstate, buildstate->indexInfo->ii_Concurrent, parallel_workers);
+
+	/* Set up coordination state if at least one worker launched */
+	if (buildstate->ivfleader)
+	{
+		coordinate = (SortCoordinate) palloc0(sizeof(SortCoordinateData));
+		coordinate->isWorker = false;
+		coordinate->nParticipants = buildstate->ivfleader->nparticipanttuplesorts;
+		coordinate->sharedsort = buildstate->ivfleader->sharedsort;
+	}
+
+	/* Begin serial/leader tuplesort */
+	buildstate->sortstate = InitBuildSortState(buildstate->tupdesc, maintenance_work_mem, coordinate);
 
 	/* Add tuples to sort */
 	if (buildstate->heap != NULL)
-		IvfflatBench("assign tuples", ScanTable(buildstate));
+	{
+		if (buildstate->ivfleader)
+			buildstate->reltuples = ParallelHeapScan(buildstate);
+		else
+			ScanTable(buildstate);
+	}
+}
+
+/*
+ * Create entry pages
+ */
+static void
+CreateEntryPages(IvfflatBuildState * buildstate, ForkNumber forkNum)
+{
+	UpdateProgress(PROGRESS_CREATEIDX_SUBPHASE, PROGRESS_IVFFLAT_PHASE_SORT);
+
+	/* Add tuples to sort */
+	IvfflatBench("assign tuples", AssignTuples(buildstate));
 
 	/* Sort */
 	IvfflatBench("sort tuples", tuplesort_performsort(buildstate->sortstate));
@@ -621,6 +1448,10 @@ CreateEntryPages(IvfflatBuildState * buildstate, ForkNumber forkNum)
 	/* Insert */
 	IvfflatBench("load tuples", InsertTuples(buildstate->index, buildstate, forkNum));
 	tuplesort_end(buildstate->sortstate);
+
+	/* End parallel build */
+	if (buildstate->ivfleader)
+		IvfflatEndParallel(buildstate->ivfleader);
 }
 
 /*
@@ -628,8 +1459,10 @@ CreateEntryPages(IvfflatBuildState * buildstate, ForkNumber forkNum)
  */
 static void
 BuildIndex(Relation heap, Relation index, IndexInfo *indexInfo,
-		   IvfflatBuildState * buildstate, ForkNumber forkNum)
+		   IvfflatBuildState * buildstate, ForkNumber forkNum, bool pq)
 {
+	VectorArray listCenters;
+	VectorArray groupCenters;
 
 // createArrayMem ("xb_tttt", 4096,1.23);
 // addArrayMem ("xb_tttt", 4096,5.32);
@@ -637,15 +1470,37 @@ BuildIndex(Relation heap, Relation index, IndexInfo *indexInfo,
 
 
 
-	InitBuildState(buildstate, heap, index, indexInfo);
+	InitBuildState(buildstate, heap, index, indexInfo, pq);
 
 	ComputeCenters(buildstate);
 
+	/* Vectors past the page limit have quantized centers */
+	listCenters = buildstate->centers;
+	groupCenters = buildstate->groupCenters;
+	if (buildstate->quantized)
+	{
+		listCenters = QuantizeCenters(listCenters);
+		if (groupCenters != NULL)
+			groupCenters = QuantizeCenters(groupCenters);
+	}
+
 	/* Create pages */
-	CreateMetaPage(index, buildstate->dimensions, buildstate->lists, forkNum);
-	CreateListPages(index, buildstate->centers, buildstate->dimensions, buildstate->lists, forkNum, &buildstate->listInfo);
+	/* Dimensions of sparse vectors may not fit, and are only read for ivfpq */
+	CreateMetaPage(index, buildstate->type == IVFFLAT_TYPE_SPARSEVEC ? 0 : buildstate->dimensions, buildstate->lists, forkNum);
+	CreateListPages(index, listCenters, buildstate->lists, forkNum, &buildstate->listInfo);
+	if (buildstate->pq)
+		IvfpqCreateCodebookPages(index, buildstate->codebook, forkNum);
+	if (groupCenters != NULL)
+		CreateGroupPages(index, groupCenters, buildstate->groupCounts, buildstate->listInfo, forkNum);
 	CreateEntryPages(buildstate, forkNum);
 
+	if (buildstate->quantized)
+	{
+		VectorArrayFree(listCenters);
+		if (groupCenters != NULL)
+			VectorArrayFree(groupCenters);
+	}
+
 	FreeBuildState(buildstate);
 }
 
@@ -658,7 +1513,25 @@ ivfflatbuild(Relation heap, Relation index, IndexInfo *indexInfo)
 	IndexBuildResult *result;
 	IvfflatBuildState buildstate;
 
-	BuildIndex(heap, index, indexInfo, &buildstate, MAIN_FORKNUM);
+	BuildIndex(heap, index, indexInfo, &buildstate, MAIN_FORKNUM, false);
+
+	result = (IndexBuildResult *) palloc(sizeof(IndexBuildResult));
+	result->heap_tuples = buildstate.reltuples;
+	result->index_tuples = buildstate.indtuples;
+
+	return result;
+}
+
+/*
+ * Build the product quantized index for a logged table
+ */
+IndexBuildResult *
+ivfpqbuild(Relation heap, Relation index, IndexInfo *indexInfo)
+{
+	IndexBuildResult *result;
+	IvfflatBuildState buildstate;
+
+	BuildIndex(heap, index, indexInfo, &buildstate, MAIN_FORKNUM, true);
 
 	result = (IndexBuildResult *) palloc(sizeof(IndexBuildResult));
 	result->heap_tuples = buildstate.reltuples;
@@ -676,7 +1549,19 @@ ivfflatbuildempty(Relation index)
 	IndexInfo  *indexInfo = BuildIndexInfo(index);
 	IvfflatBuildState buildstate;
 
-	BuildIndex(NULL, index, indexInfo, &buildstate, INIT_FORKNUM);
+	BuildIndex(NULL, index, indexInfo, &buildstate, INIT_FORKNUM, false);
+}
+
+/*
+ * Build the product quantized index for an unlogged table
+ */
+void
+ivfpqbuildempty(Relation index)
+{
+	IndexInfo  *indexInfo = BuildIndexInfo(index);
+	IvfflatBuildState buildstate;
+
+	BuildIndex(NULL, index, indexInfo, &buildstate, INIT_FORKNUM, true);
 }
 
 void addArrayMem (const char* name, const int SIZE,const float message){
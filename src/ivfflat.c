@@ -3,18 +3,28 @@
 #include <float.h>
 
 #include "access/amapi.h"
+#include "bitutils.h"
 #include "commands/vacuum.h"
 #include "ivfflat.h"
+#include "optimizer/planner.h"
 #include "utils/guc.h"
 #include "utils/selfuncs.h"
 #include "utils/spccache.h"
+#include "halfutils.h"
+#include "vectorutils.h"
 
 #if PG_VERSION_NUM >= 120000
 #include "commands/progress.h"
 #endif
 
 int			ivfflat_probes;
+int			ivfflat_group_probes;
+bool		ivfflat_iterative_scan;
+int			ivfflat_max_probes;
+int			ivfflat_pending_list_limit;
+bool		ivfpq_rerank;
 static relopt_kind ivfflat_relopt_kind;
+static relopt_kind ivfpq_relopt_kind;
 
 /*
  * Initialize index options and variables
@@ -22,17 +32,74 @@ static relopt_kind ivfflat_relopt_kind;
 void
 _PG_init(void)
 {
+	VectorUtilsInit();
+	HalfUtilsInit();
+	BitUtilsInit();
+
 	ivfflat_relopt_kind = add_reloption_kind();
 	add_int_reloption(ivfflat_relopt_kind, "lists", "Number of inverted lists",
 					  IVFFLAT_DEFAULT_LISTS, 1, IVFFLAT_MAX_LISTS
 #if PG_VERSION_NUM >= 130000
 					  ,AccessExclusiveLock
+#endif
+		);
+	add_int_reloption(ivfflat_relopt_kind, "groups", "Number of groups of lists",
+					  IVFFLAT_DEFAULT_GROUPS, 0, IVFFLAT_MAX_LISTS
+#if PG_VERSION_NUM >= 130000
+					  ,AccessExclusiveLock
+#endif
+		);
+	add_bool_reloption(ivfflat_relopt_kind, "fastupdate", "Enables fast update with a pending list",
+					   IVFFLAT_DEFAULT_FASTUPDATE
+#if PG_VERSION_NUM >= 130000
+					   ,ShareUpdateExclusiveLock
 #endif
 		);
 
 	DefineCustomIntVariable("ivfflat.probes", "Sets the number of probes",
 							"Valid range is 1..lists.", &ivfflat_probes,
 							1, 1, IVFFLAT_MAX_LISTS, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("ivfflat.iterative_scan", "Scans more lists when the probed lists run out",
+							 NULL, &ivfflat_iterative_scan,
+							 false, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("ivfflat.max_probes", "Sets the max number of probes for iterative scans",
+							"Valid range is 1..lists.", &ivfflat_max_probes,
+							IVFFLAT_MAX_LISTS, 1, IVFFLAT_MAX_LISTS, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("ivfflat.group_probes", "Sets the number of groups to probe",
+							"More groups are probed until there are enough lists for probes.", &ivfflat_group_probes,
+							IVFFLAT_DEFAULT_GROUP_PROBES, 1, IVFFLAT_MAX_LISTS, PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("ivfflat.pending_list_limit", "Sets the max size of the pending list",
+							"Inserts move the pending tuples to lists past this size.", &ivfflat_pending_list_limit,
+							IVFFLAT_DEFAULT_PENDING_LIST_LIMIT, 64, MAX_KILOBYTES, PGC_USERSET, GUC_UNIT_KB, NULL, NULL, NULL);
+
+	ivfpq_relopt_kind = add_reloption_kind();
+	add_int_reloption(ivfpq_relopt_kind, "lists", "Number of inverted lists",
+					  IVFFLAT_DEFAULT_LISTS, 1, IVFFLAT_MAX_LISTS
+#if PG_VERSION_NUM >= 130000
+					  ,AccessExclusiveLock
+#endif
+		);
+	add_int_reloption(ivfpq_relopt_kind, "groups", "Number of groups of lists",
+					  IVFFLAT_DEFAULT_GROUPS, 0, IVFFLAT_MAX_LISTS
+#if PG_VERSION_NUM >= 130000
+					  ,AccessExclusiveLock
+#endif
+		);
+	/* Default is outside the range to pick m from the dimensions */
+	add_int_reloption(ivfpq_relopt_kind, "m", "Number of subvectors",
+					  IVFPQ_DEFAULT_M, 1, IVFFLAT_MAX_DIM
+#if PG_VERSION_NUM >= 130000
+					  ,AccessExclusiveLock
+#endif
+		);
+
+	DefineCustomBoolVariable("ivfpq.rerank", "Re-ranks results with exact distances",
+							 NULL, &ivfpq_rerank,
+							 true, PGC_USERSET, 0, NULL, NULL, NULL);
 }
 
 /*
@@ -136,6 +203,18 @@ ivfflatcostestimate(PlannerInfo *root, IndexPath *path, double loop_count,
 	if (ratio < costs.indexSelectivity)
 		costs.indexSelectivity = ratio;
 
+	/* Lists are divided among the participants of a parallel scan */
+	if (path->path.parallel_workers > 0)
+	{
+		double		divisor = path->path.parallel_workers;
+
+		/* Same as the planner, the leader does less as workers are added */
+		if (parallel_leader_participation && 1.0 - 0.3 * divisor > 0)
+			divisor += 1.0 - 0.3 * divisor;
+
+		costs.indexTotalCost /= divisor;
+	}
+
 	/* Use total cost since most work happens before first tuple is returned */
 	*indexStartupCost = costs.indexTotalCost;
 	*indexTotalCost = costs.indexTotalCost;
@@ -152,6 +231,8 @@ ivfflatoptions(Datum reloptions, bool validate)
 {
 	static const relopt_parse_elt tab[] = {
 		{"lists", RELOPT_TYPE_INT, offsetof(IvfflatOptions, lists)},
+		{"groups", RELOPT_TYPE_INT, offsetof(IvfflatOptions, groups)},
+		{"fastupdate", RELOPT_TYPE_BOOL, offsetof(IvfflatOptions, fastupdate)},
 	};
 
 #if PG_VERSION_NUM >= 130000
@@ -173,6 +254,37 @@ ivfflatoptions(Datum reloptions, bool validate)
 #endif
 }
 
+/*
+ * Parse and validate the reloptions for ivfpq
+ */
+static bytea *
+ivfpqoptions(Datum reloptions, bool validate)
+{
+	static const relopt_parse_elt tab[] = {
+		{"lists", RELOPT_TYPE_INT, offsetof(IvfpqOptions, base.lists)},
+		{"groups", RELOPT_TYPE_INT, offsetof(IvfpqOptions, base.groups)},
+		{"m", RELOPT_TYPE_INT, offsetof(IvfpqOptions, m)},
+	};
+
+#if PG_VERSION_NUM >= 130000
+	return (bytea *) build_reloptions(reloptions, validate,
+									  ivfpq_relopt_kind,
+									  sizeof(IvfpqOptions),
+									  tab, lengthof(tab));
+#else
+	relopt_value *options;
+	int			numoptions;
+	IvfpqOptions *rdopts;
+
+	options = parseRelOptions(reloptions, validate, ivfpq_relopt_kind, &numoptions);
+	rdopts = allocateReloptStruct(sizeof(IvfpqOptions), options, numoptions);
+	fillRelOptions((void *) rdopts, sizeof(IvfpqOptions), options, numoptions,
+				   validate, tab, lengthof(tab));
+
+	return (bytea *) rdopts;
+#endif
+}
+
 /*
  * Validate catalog entries for the specified operator class
  */
@@ -209,7 +321,10 @@ ivfflathandler(PG_FUNCTION_ARGS)
 	amroutine->amstorage = false;
 	amroutine->amclusterable = false;
 	amroutine->ampredlocks = false;
-	amroutine->amcanparallel = false;
+	amroutine->amcanparallel = true;
+#if PG_VERSION_NUM >= 170000
+	amroutine->amcanbuildparallel = true;
+#endif
 	amroutine->amcaninclude = false;
 #if PG_VERSION_NUM >= 130000
 	amroutine->amusemaintenanceworkmem = false; /* not used during VACUUM */
@@ -243,9 +358,30 @@ ivfflathandler(PG_FUNCTION_ARGS)
 	amroutine->amrestrpos = NULL;
 
 	/* Interface functions to support parallel index scans */
-	amroutine->amestimateparallelscan = NULL;
-	amroutine->aminitparallelscan = NULL;
-	amroutine->amparallelrescan = NULL;
+	amroutine->amestimateparallelscan = ivfflatestimateparallelscan;
+	amroutine->aminitparallelscan = ivfflatinitparallelscan;
+	amroutine->amparallelrescan = ivfflatparallelrescan;
+
+	PG_RETURN_POINTER(amroutine);
+}
+
+/*
+ * Define index handler for ivfpq
+ *
+ * Lists hold product quantized entries instead of values, and everything
+ * else is shared with ivfflat
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(ivfpqhandler);
+Datum
+ivfpqhandler(PG_FUNCTION_ARGS)
+{
+	IndexAmRoutine *amroutine = (IndexAmRoutine *) DatumGetPointer(ivfflathandler(fcinfo));
+
+	amroutine->ambuild = ivfpqbuild;
+	amroutine->ambuildempty = ivfpqbuildempty;
+	amroutine->aminsert = ivfpqinsert;
+	amroutine->amoptions = ivfpqoptions;
+	amroutine->ambeginscan = ivfpqbeginscan;
 
 	PG_RETURN_POINTER(amroutine);
 }
@@ -8,11 +8,19 @@
 #endif
 
 #include "access/generic_xlog.h"
+#include "access/parallel.h"
 #include "access/reloptions.h"
 #include "nodes/execnodes.h"
 #include "port.h"				/* for strtof() and random() */
+#include "storage/condition_variable.h"
+#include "storage/spin.h"
 #include "utils/sampling.h"
+#include "utils/snapshot.h"
 #include "utils/tuplesort.h"
+#include "bitvec.h"
+#include "halfvec.h"
+#include "quantutils.h"
+#include "sparsevec.h"
 #include "vector.h"
 
 #if PG_VERSION_NUM >= 150000
@@ -25,6 +33,21 @@
 
 #define IVFFLAT_MAX_DIM 2000
 
+/* Vectors past IVFFLAT_MAX_DIM are stored quantized, see quantutils.h */
+#define IVFFLAT_MAX_QUANTVEC_DIM VECTOR_MAX_DIM
+
+/* Half vectors take half the space on the page */
+#define IVFFLAT_MAX_HALFVEC_DIM (IVFFLAT_MAX_DIM * 2)
+
+/* k-means runs on vectors, one element per bit */
+#define IVFFLAT_MAX_BITVEC_DIM VECTOR_MAX_DIM
+
+/* Sparse vectors are limited by the non-zero elements that fit on a page */
+#define IVFFLAT_MAX_SPARSEVEC_NNZ 1000
+
+/* Centers of sparse vectors keep their largest elements */
+#define IVFFLAT_SPARSEVEC_CENTER_NNZ 256
+
 /* Support functions */
 #define IVFFLAT_DISTANCE_PROC 1
 #define IVFFLAT_NORM_PROC 2
@@ -42,16 +65,38 @@
 #define IVFFLAT_DEFAULT_LISTS	100
 #define IVFFLAT_MAX_LISTS		32768
 
+/* Groups of lists, searched first to select lists */
+#define IVFFLAT_DEFAULT_GROUPS	0	/* no groups */
+#define IVFFLAT_DEFAULT_GROUP_PROBES	3
+
+/* Pending list, where inserts add tuples before they are moved to lists */
+#define IVFFLAT_DEFAULT_FASTUPDATE	false
+#define IVFFLAT_DEFAULT_PENDING_LIST_LIMIT	4096	/* in kB */
+
+/* Product quantization, one byte per subvector */
+#define IVFPQ_CENTROIDS			256
+#define IVFPQ_DEFAULT_M			0	/* chosen from the dimensions */
+
+/* Relative slack for rounding in the error bounds */
+#define IVFPQ_ERROR_SLACK		1e-5
+
 /* Build phases */
 /* PROGRESS_CREATEIDX_SUBPHASE_INITIALIZE is 1 */
 #define PROGRESS_IVFFLAT_PHASE_KMEANS	2
 #define PROGRESS_IVFFLAT_PHASE_SORT		3
 #define PROGRESS_IVFFLAT_PHASE_LOAD		4
 
-#define IVFFLAT_LIST_SIZE(_dim)	(offsetof(IvfflatListData, center) + VECTOR_SIZE(_dim))
+#define IVFFLAT_LIST_SIZE(_size)	(offsetof(IvfflatListData, center) + (_size))
+#define IVFFLAT_GROUP_SIZE(_size)	(offsetof(IvfflatGroupData, center) + (_size))
 
 #define IvfflatPageGetOpaque(page)	((IvfflatPageOpaque) PageGetSpecialPointer(page))
 #define IvfflatPageGetMeta(page)	((IvfflatMetaPageData *) PageGetContents(page))
+#define IvfpqPageGetMeta(page)		((IvfpqMetaPageData *) PageGetContents(page))
+
+/* Entries are the heap TID, the error bound, and one code per subvector */
+#define IVFPQ_TUPLE_SIZE(_m)		(sizeof(IndexTupleData) + sizeof(float) + (_m))
+#define IvfpqTupleError(itup)		(*((float *) ((char *) (itup) + sizeof(IndexTupleData))))
+#define IvfpqTupleCodes(itup)		((uint8 *) ((char *) (itup) + sizeof(IndexTupleData) + sizeof(float)))
 
 #ifdef IVFFLAT_BENCH
 #define IvfflatBench(name, code) \
@@ -78,15 +123,31 @@
 
 /* Variables */
 extern int	ivfflat_probes;
+extern int	ivfflat_group_probes;
+extern bool ivfflat_iterative_scan;
+extern int	ivfflat_max_probes;
+extern int	ivfflat_pending_list_limit;
+extern bool ivfpq_rerank;
 
 /* Exported functions */
 PGDLLEXPORT void _PG_init(void);
+PGDLLEXPORT void IvfflatParallelBuildMain(dsm_segment *seg, shm_toc *toc);
+
+/* Types of the indexed column */
+typedef enum IvfflatType
+{
+	IVFFLAT_TYPE_VECTOR,
+	IVFFLAT_TYPE_HALFVEC,
+	IVFFLAT_TYPE_BITVEC,
+	IVFFLAT_TYPE_SPARSEVEC
+}			IvfflatType;
 
 typedef struct VectorArrayData
 {
 	int			length;
 	int			maxlen;
 	int			dim;
+	Size		itemsize;
 	Vector	   *items;
 }			VectorArrayData;
 
@@ -103,8 +164,74 @@ typedef struct IvfflatOptions
 {
 	int32		vl_len_;		/* varlena header (do not touch directly!) */
 	int			lists;			/* number of lists */
+	int			groups;			/* number of groups of lists */
+	bool		fastupdate;		/* add tuples to the pending list */
 }			IvfflatOptions;
 
+/* IVFPQ index options, base must come first for the shared accessors */
+typedef struct IvfpqOptions
+{
+	IvfflatOptions base;		/* fastupdate is always false */
+	int			m;				/* number of subvectors */
+}			IvfpqOptions;
+
+/*
+ * Codebooks for the residuals of each list center, stored as centroid k of
+ * subvector j at (j * IVFPQ_CENTROIDS + k) * dsub
+ */
+typedef struct IvfpqCodebook
+{
+	int			dimensions;
+	int			m;
+	int			dsub;
+	float	   *centroids;
+}			IvfpqCodebook;
+
+/*
+ * Shared state for a parallel build, followed by the parallel heap scan
+ * descriptor
+ */
+typedef struct IvfflatShared
+{
+	/* Immutable state */
+	Oid			heaprelid;
+	Oid			indexrelid;
+	bool		isconcurrent;
+	int			scantuplesortstates;
+	bool		pq;
+	int			numcenters;
+	Size		itemsize;		/* of centers, which have the indexed type */
+
+	/* Worker progress */
+	ConditionVariable workersdonecv;
+
+	/* Mutex for mutable state */
+	slock_t		mutex;
+
+	/* Mutable state */
+	int			nparticipantsdone;
+	double		reltuples;
+	double		indtuples;
+
+#ifdef IVFFLAT_KMEANS_DEBUG
+	double		inertia;
+#endif
+}			IvfflatShared;
+
+#define ParallelTableScanFromIvfflatShared(shared) \
+	((void *) ((char *) (shared) + BUFFERALIGN(sizeof(IvfflatShared))))
+
+typedef struct IvfflatLeader
+{
+	ParallelContext *pcxt;
+	int			nparticipanttuplesorts;
+	IvfflatShared *ivfshared;
+	Sharedsort *sharedsort;
+	Snapshot	snapshot;
+	char	   *ivfcenters;
+	float	   *ivfcodebook;
+}			IvfflatLeader;
+
 typedef struct IvfflatBuildState
 {
 	/* Info */
@@ -115,6 +242,10 @@ typedef struct IvfflatBuildState
 	/* Settings */
 	int			dimensions;
 	int			lists;
+	int			groups;
+	IvfflatType type;
+	bool		pq;
+	bool		quantized;		/* vectors past IVFFLAT_MAX_DIM */
 
 	/* Statistics */
 	double		indtuples;
@@ -127,10 +258,17 @@ typedef struct IvfflatBuildState
 	Oid			collation;
 
 	/* Variables */
+	int			targsamples;
 	VectorArray samples;
+	SparseVector **sparseSamples;	/* instead of samples for sparsevec */
+	int			sparseSampleCount;
+	MemoryContext sampleCtx;
 	VectorArray centers;
+	VectorArray groupCenters;
+	int		   *groupCounts;
 	ListInfo   *listInfo;
 	Vector	   *normvec;
+	IvfpqCodebook *codebook;
 
 #ifdef IVFFLAT_KMEANS_DEBUG
 	double		inertia;
@@ -150,6 +288,9 @@ typedef struct IvfflatBuildState
 
 	/* Memory */
 	MemoryContext tmpCtx;
+
+	/* Parallel builds */
+	IvfflatLeader *ivfleader;
 }			IvfflatBuildState;
 
 typedef struct IvfflatMetaPageData
@@ -158,10 +299,26 @@ typedef struct IvfflatMetaPageData
 	uint32		version;
 	uint16		dimensions;
 	uint16		lists;
+	uint16		groups;			/* zero for indexes built without groups */
+	BlockNumber groupPage;		/* first group page */
+
+	/* Pending list, only valid if pd_lower includes it */
+	BlockNumber pendingHead;	/* first pending page */
+	BlockNumber pendingTail;	/* pending page for the next tuple */
+	uint32		nPendingPages;	/* head to tail, without an empty tail */
+	uint32		nFlushingPages; /* leading pages that may also be in lists */
 }			IvfflatMetaPageData;
 
 typedef IvfflatMetaPageData * IvfflatMetaPage;
 
+/* IVFPQ metapage, base must come first so ivfflat code can read it */
+typedef struct IvfpqMetaPageData
+{
+	IvfflatMetaPageData base;
+	uint16		m;
+	BlockNumber codebookPage;	/* first codebook page */
+}			IvfpqMetaPageData;
+
 typedef struct IvfflatPageOpaqueData
 {
 	BlockNumber nextblkno;
@@ -171,29 +328,148 @@ typedef struct IvfflatPageOpaqueData
 
 typedef IvfflatPageOpaqueData * IvfflatPageOpaque;
 
+/*
+ * Pending pages with tuples that are not in lists, in order from startPage
+ * to tailPage
+ */
+typedef struct IvfflatPendingInfo
+{
+	BlockNumber startPage;
+	BlockNumber tailPage;
+	uint32		nPages;
+	uint32		nFlushingPages; /* leading pages that may also be in lists */
+}			IvfflatPendingInfo;
+
 typedef struct IvfflatListData
 {
 	BlockNumber startPage;
 	BlockNumber insertPage;
-	Vector		center;
+	Vector		center;			/* has the type of the indexed column, or is
+								 * a QuantVector past IVFFLAT_MAX_DIM */
 }			IvfflatListData;
 
 typedef IvfflatListData * IvfflatList;
 
+/*
+ * Lists are stored by group, so the lists of a group are the count lists
+ * starting at the list page and offset
+ */
+typedef struct IvfflatGroupData
+{
+	BlockNumber listPage;
+	OffsetNumber listOffset;
+	uint16		listCount;
+	Vector		center;			/* same as the centers of lists */
+}			IvfflatGroupData;
+
+typedef IvfflatGroupData * IvfflatGroup;
+
+/*
+ * Lists, groups, and the ivfpq codebook, cached in rd_amcache since they
+ * only change when the index is rebuilt, which resets the relcache entry
+ *
+ * Centers are copied from the list pages and stored back to back in list
+ * order, so the lists of a group are next to each other. Insert pages
+ * change with inserts and vacuum, so they are always read from the list
+ * pages. rd_amcache must be a single chunk, so the arrays follow the
+ * struct.
+ */
+typedef struct IvfflatCache
+{
+	IvfflatType type;			/* of the indexed column */
+	bool		hasLists;		/* false if lists do not fit in work_mem */
+	int			lists;
+	int			groups;
+	Size		centerSize;		/* stride of centers and group centers */
+	char	   *centers;
+	BlockNumber *startPages;
+	ListInfo   *listInfo;
+	char	   *groupCenters;
+	int		   *groupStarts;	/* first list of each group */
+	int		   *groupCounts;
+	IvfpqCodebook *codebook;	/* NULL unless loaded for ivfpq */
+}			IvfflatCache;
+
+#define IvfflatCacheCenter(_cache, _offset) ((Vector *) ((_cache)->centers + (_offset) * (_cache)->centerSize))
+#define IvfflatCacheGroupCenter(_cache, _offset) ((Vector *) ((_cache)->groupCenters + (_offset) * (_cache)->centerSize))
+
+/*
+ * Called for each list searched, with a center as stored on the list page
+ * that is only valid during the call
+ */
+typedef void (*IvfflatListCallback) (BlockNumber startPage, ListInfo listInfo, Vector * center, double distance, void *arg);
+
 typedef struct IvfflatScanList
 {
 	pairingheap_node ph_node;
 	BlockNumber startPage;
+	ListInfo	listInfo;		/* to read the center for ivfpq */
 	double		distance;
 }			IvfflatScanList;
 
+/*
+ * Shared state of a parallel scan, where the first participant selects the
+ * lists and every participant claims lists from nextList
+ */
+typedef enum IvfflatParallelScanStatus
+{
+	IVFFLAT_PARALLEL_NOT_INITIALIZED,
+	IVFFLAT_PARALLEL_SELECTING,
+	IVFFLAT_PARALLEL_READY
+}			IvfflatParallelScanStatus;
+
+typedef struct IvfflatParallelScanData
+{
+	int			maxLists;
+	int			maxPendingTids;
+
+	/* Mutex for mutable state */
+	slock_t		mutex;
+	ConditionVariable listsreadycv;
+
+	/* Mutable state */
+	IvfflatParallelScanStatus status;
+	int			listCount;
+	int			nextList;
+	int			pendingCount;	/* -1 if the pending tids did not fit */
+	IvfflatScanList lists[FLEXIBLE_ARRAY_MEMBER];	/* heap nodes unused */
+
+	/* Followed by maxPendingTids sorted pending tids */
+}			IvfflatParallelScanData;
+
+typedef IvfflatParallelScanData * IvfflatParallelScan;
+
+#define IVFFLAT_PARALLEL_SCAN_LISTS_SIZE(_maxLists) MAXALIGN(offsetof(IvfflatParallelScanData, lists) + (_maxLists) * sizeof(IvfflatScanList))
+#define IvfflatParallelScanPendingTids(_pscan) ((ItemPointer) ((char *) (_pscan) + IVFFLAT_PARALLEL_SCAN_LISTS_SIZE((_pscan)->maxLists)))
+
+/* Shared pending tids of a parallel scan, about 6 MB */
+#define IVFFLAT_PARALLEL_MAX_PENDING_TIDS	(1024 * 1024)
+
+typedef struct IvfflatScanItem
+{
+	double		distance;
+	ItemPointerData tid;
+	BlockNumber indexblkno;
+}			IvfflatScanItem;
+
+/* Distance between two detoasted values of the indexed type */
+typedef double (*IvfflatDistanceFunc) (Pointer a, Pointer b);
+
 typedef struct IvfflatScanOpaqueData
 {
 	int			probes;
+	int			maxLists;		/* more than probes for iterative scans */
 	bool		first;
 	Buffer		buf;
+	Datum		value;
 
-	/* Sorting */
+	/* Candidates, a min-heap ordered as items are returned */
+	IvfflatScanItem *items;
+	int64		itemCount;
+	int64		maxItems;
+
+	/* Sorting, used instead of items past work_mem */
+	bool		spilled;
 	Tuplesortstate *sortstate;
 	TupleDesc	tupdesc;
 	TupleTableSlot *slot;
@@ -203,48 +479,104 @@ typedef struct IvfflatScanOpaqueData
 	FmgrInfo   *procinfo;
 	FmgrInfo   *normprocinfo;
 	Oid			collation;
+	IvfflatDistanceFunc distfunc;	/* NULL if not a built-in opclass */
+
+	/* Pending list, with tids sorted to skip tuples also in lists */
+	ItemPointerData *pendingTids;
+	int			pendingCount;
 
-	/* Lists */
+	/* Product quantization, codebook is NULL for ivfflat */
+	IvfpqCodebook *codebook;
+	float	   *table;
+	Vector	   *center;
+
+	/* Distances are bounds for the executor to recheck */
+	bool		rerank;
+
+	/* Lists, sorted by distance once selected */
 	pairingheap *listQueue;
+	int			listCount;
+	int			listIndex;		/* next list to scan */
+	int			batchEnd;		/* end of lists for the current items */
 	IvfflatScanList lists[FLEXIBLE_ARRAY_MEMBER];	/* must come last */
 }			IvfflatScanOpaqueData;
 
 typedef IvfflatScanOpaqueData * IvfflatScanOpaque;
 
-#define VECTOR_ARRAY_SIZE(_length, _dim) (sizeof(VectorArrayData) + (_length) * VECTOR_SIZE(_dim))
-#define VECTOR_ARRAY_OFFSET(_arr, _offset) ((char*) (_arr)->items + (_offset) * VECTOR_SIZE((_arr)->dim))
+#define VECTOR_ARRAY_SIZE(_length, _size) (sizeof(VectorArrayData) + (_length) * (_size))
+#define VECTOR_ARRAY_OFFSET(_arr, _offset) ((char*) (_arr)->items + (_offset) * (_arr)->itemsize)
 #define VectorArrayGet(_arr, _offset) ((Vector *) VECTOR_ARRAY_OFFSET(_arr, _offset))
-#define VectorArraySet(_arr, _offset, _val) memcpy(VECTOR_ARRAY_OFFSET(_arr, _offset), _val, VECTOR_SIZE((_arr)->dim))
+#define VectorArraySet(_arr, _offset, _val) memcpy(VECTOR_ARRAY_OFFSET(_arr, _offset), _val, (_arr)->itemsize)
 
 /* Methods */
-VectorArray VectorArrayInit(int maxlen, int dimensions);
+VectorArray VectorArrayInit(int maxlen, int dimensions, Size itemsize);
 void		VectorArrayFree(VectorArray arr);
 void		PrintVectorArray(char *msg, VectorArray arr);
 void		IvfflatKmeans(Relation index, VectorArray samples, VectorArray centers);
+void		IvfflatSparseKmeans(Relation index, SparseVector * *samples, int numSamples, VectorArray centers);
 FmgrInfo   *IvfflatOptionalProcInfo(Relation rel, uint16 procnum);
-bool		IvfflatNormValue(FmgrInfo *procinfo, Oid collation, Datum *value, Vector * result);
+bool		IvfflatNormValue(FmgrInfo *procinfo, Oid collation, Datum *value, Vector * result, IvfflatType type);
 int			IvfflatGetLists(Relation index);
+int			IvfflatGetGroups(Relation index);
+bool		IvfflatGetFastUpdate(Relation index);
+IvfflatCache *IvfflatGetCache(Relation index, bool pq);
+IvfflatDistanceFunc IvfflatGetDistanceFunc(FmgrInfo *procinfo);
+IvfflatDistanceFunc IvfflatGetQuantDistanceFunc(FmgrInfo *procinfo);
+IvfflatDistanceFunc IvfflatGetQuantBoundFunc(FmgrInfo *procinfo, bool normalized);
+bool		IvfflatIsQuantized(Relation index);
+void		IvfflatSearchLists(Relation index, FmgrInfo *procinfo, Oid collation, Datum value, int minLists, IvfflatListCallback callback, void *arg);
+void		IvfflatFindList(Relation index, Datum value, ListInfo * listInfo, BlockNumber *startPage, Vector * center);
+IvfflatType IvfflatGetType(Relation index);
+void		IvfflatCheckSparsevec(Datum value);
 void		IvfflatUpdateList(Relation index, GenericXLogState *state, ListInfo listInfo, BlockNumber insertPage, BlockNumber originalInsertPage, BlockNumber startPage, ForkNumber forkNum);
 void		IvfflatCommitBuffer(Buffer buf, GenericXLogState *state);
 void		IvfflatAppendPage(Relation index, Buffer *buf, Page *page, GenericXLogState **state, ForkNumber forkNum);
 Buffer		IvfflatNewBuffer(Relation index, ForkNumber forkNum);
 void		IvfflatInitPage(Buffer buf, Page page);
 void		IvfflatInitRegisterPage(Relation index, Buffer *buf, Page *page, GenericXLogState **state);
+bool		IvfflatGetPending(Relation index, IvfflatPendingInfo * pending);
+bool		IvfflatInsertPending(Relation index, IndexTuple itup);
+void		IvfflatFlushPending(Relation index, int workMem);
+void		IvfflatBulkDeletePending(Relation index, IndexBulkDeleteResult *stats, IndexBulkDeleteCallback callback, void *callback_state);
+int			IvfflatCompareTids(const void *a, const void *b);
+int			IvfpqGetM(Relation index, int dimensions);
+IvfpqCodebook *IvfpqTrainCodebook(Relation index, VectorArray samples, VectorArray centers, int m);
+void		IvfpqCreateCodebookPages(Relation index, IvfpqCodebook * codebook, ForkNumber forkNum);
+IvfpqCodebook *IvfpqGetCodebook(Relation index);
+void		IvfpqReadCodebook(Relation index, BlockNumber blkno, float *centroids, Size size);
+void		IvfpqEncode(IvfpqCodebook * codebook, Vector * value, Vector * center, IndexTuple itup);
+double		IvfpqComputeTable(IvfpqCodebook * codebook, Vector * query, Vector * center, float *table);
 
 /* Index access methods */
 IndexBuildResult *ivfflatbuild(Relation heap, Relation index, IndexInfo *indexInfo);
 void		ivfflatbuildempty(Relation index);
+IndexBuildResult *ivfpqbuild(Relation heap, Relation index, IndexInfo *indexInfo);
+void		ivfpqbuildempty(Relation index);
 bool		ivfflatinsert(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid, Relation heap, IndexUniqueCheck checkUnique
 #if PG_VERSION_NUM >= 140000
 						  ,bool indexUnchanged
 #endif
 						  ,IndexInfo *indexInfo
 );
+bool		ivfpqinsert(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid, Relation heap, IndexUniqueCheck checkUnique
+#if PG_VERSION_NUM >= 140000
+						,bool indexUnchanged
+#endif
+						,IndexInfo *indexInfo
+);
 IndexBulkDeleteResult *ivfflatbulkdelete(IndexVacuumInfo *info, IndexBulkDeleteResult *stats, IndexBulkDeleteCallback callback, void *callback_state);
 IndexBulkDeleteResult *ivfflatvacuumcleanup(IndexVacuumInfo *info, IndexBulkDeleteResult *stats);
 IndexScanDesc ivfflatbeginscan(Relation index, int nkeys, int norderbys);
+IndexScanDesc ivfpqbeginscan(Relation index, int nkeys, int norderbys);
 void		ivfflatrescan(IndexScanDesc scan, ScanKey keys, int nkeys, ScanKey orderbys, int norderbys);
 bool		ivfflatgettuple(IndexScanDesc scan, ScanDirection dir);
 void		ivfflatendscan(IndexScanDesc scan);
+#if PG_VERSION_NUM >= 170000
+Size		ivfflatestimateparallelscan(int nkeys, int norderbys);
+#else
+Size		ivfflatestimateparallelscan(void);
+#endif
+void		ivfflatinitparallelscan(void *target);
+void		ivfflatparallelrescan(IndexScanDesc scan);
 
 #endif
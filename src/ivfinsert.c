@@ -3,69 +3,97 @@
 #include <float.h>
 
 #include "ivfflat.h"
+#include "miscadmin.h"
 #include "storage/bufmgr.h"
 #include "utils/memutils.h"
 
+typedef struct InsertPageState
+{
+	bool		found;
+	ListInfo   *listInfo;
+	BlockNumber *startPage;
+	Vector	   *center;
+	double		minDistance;
+}			InsertPageState;
+
 /*
- * Find the list that minimizes the distance function
+ * Keep the closest list
  */
 static void
-FindInsertPage(Relation rel, Datum *values, BlockNumber *insertPage, ListInfo * listInfo)
+CheckInsertList(BlockNumber startPage, ListInfo listInfo, Vector * center, double distance, void *arg)
+{
+	InsertPageState *state = (InsertPageState *) arg;
+
+	if (distance < state->minDistance || !state->found)
+	{
+		*state->listInfo = listInfo;
+		*state->startPage = startPage;
+		state->minDistance = distance;
+		state->found = true;
+
+		if (state->center != NULL)
+			memcpy(state->center, center, VECTOR_SIZE(center->dim));
+	}
+}
+
+/*
+ * Find the list that minimizes the distance function
+ *
+ * Copies the center of the list if center is not NULL
+ */
+void
+IvfflatFindList(Relation index, Datum value, ListInfo * listInfo, BlockNumber *startPage, Vector * center)
 {
-	Buffer		cbuf;
-	Page		cpage;
-	IvfflatList list;
-	double		distance;
-	double		minDistance = DBL_MAX;
-	BlockNumber nextblkno = IVFFLAT_HEAD_BLKNO;
 	FmgrInfo   *procinfo;
 	Oid			collation;
-	OffsetNumber offno;
-	OffsetNumber maxoffno;
+	InsertPageState state;
 
-	/* Avoid compiler warning */
-	listInfo->blkno = nextblkno;
-	listInfo->offno = FirstOffsetNumber;
+	procinfo = index_getprocinfo(index, 1, IVFFLAT_DISTANCE_PROC);
+	collation = index->rd_indcollation[0];
 
-	procinfo = index_getprocinfo(rel, 1, IVFFLAT_DISTANCE_PROC);
-	collation = rel->rd_indcollation[0];
+	state.found = false;
+	state.listInfo = listInfo;
+	state.startPage = startPage;
+	state.center = center;
+	state.minDistance = DBL_MAX;
 
-	/* Search all list pages */
-	while (BlockNumberIsValid(nextblkno))
-	{
-		cbuf = ReadBuffer(rel, nextblkno);
-		LockBuffer(cbuf, BUFFER_LOCK_SHARE);
-		cpage = BufferGetPage(cbuf);
-		maxoffno = PageGetMaxOffsetNumber(cpage);
+	IvfflatSearchLists(index, procinfo, collation, value, 1, CheckInsertList, &state);
 
-		for (offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
-		{
-			list = (IvfflatList) PageGetItem(cpage, PageGetItemId(cpage, offno));
-			distance = DatumGetFloat8(FunctionCall2Coll(procinfo, collation, values[0], PointerGetDatum(&list->center)));
-
-			if (distance < minDistance || !BlockNumberIsValid(*insertPage))
-			{
-				*insertPage = list->insertPage;
-				listInfo->blkno = nextblkno;
-				listInfo->offno = offno;
-				minDistance = distance;
-			}
-		}
+	if (!state.found)
+		elog(ERROR, "no lists in \"%s\"", RelationGetRelationName(index));
+}
+
+/*
+ * Find the insert page of the closest list
+ */
+static void
+FindInsertPage(Relation rel, Datum value, BlockNumber *insertPage, ListInfo * listInfo, Vector * center)
+{
+	BlockNumber startPage;
+	Buffer		buf;
+	Page		page;
+	IvfflatList list;
 
-		nextblkno = IvfflatPageGetOpaque(cpage)->nextblkno;
+	IvfflatFindList(rel, value, listInfo, &startPage, center);
 
-		UnlockReleaseBuffer(cbuf);
-	}
+	/* Insert pages change with inserts and vacuum, so they are not cached */
+	buf = ReadBuffer(rel, listInfo->blkno);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	list = (IvfflatList) PageGetItem(page, PageGetItemId(page, listInfo->offno));
+	*insertPage = list->insertPage;
+	UnlockReleaseBuffer(buf);
 }
 
 /*
  * Insert a tuple into the index
  */
 static void
-InsertTuple(Relation rel, Datum *values, bool *isnull, ItemPointer heap_tid, Relation heapRel)
+InsertTuple(Relation rel, Datum *values, bool *isnull, ItemPointer heap_tid, Relation heapRel, bool pq)
 {
 	IndexTuple	itup;
 	Datum		value;
+	Datum		stored;
 	FmgrInfo   *normprocinfo;
 	Buffer		buf;
 	Page		page;
@@ -74,25 +102,61 @@ InsertTuple(Relation rel, Datum *values, bool *isnull, ItemPointer heap_tid, Rel
 	BlockNumber insertPage = InvalidBlockNumber;
 	ListInfo	listInfo;
 	BlockNumber originalInsertPage;
+	IvfpqCodebook *codebook = NULL;
+	Vector	   *center = NULL;
+	IvfflatType type;
 
 	/* Detoast once for all calls */
 	value = PointerGetDatum(PG_DETOAST_DATUM(values[0]));
 
+	/* Check before the value is added to the pending list */
+	type = IvfflatGetType(rel);
+	if (type == IVFFLAT_TYPE_SPARSEVEC)
+		IvfflatCheckSparsevec(value);
+
 	/* Normalize if needed */
 	normprocinfo = IvfflatOptionalProcInfo(rel, IVFFLAT_NORM_PROC);
 	if (normprocinfo != NULL)
 	{
-		if (!IvfflatNormValue(normprocinfo, rel->rd_indcollation[0], &value, NULL))
+		if (!IvfflatNormValue(normprocinfo, rel->rd_indcollation[0], &value, NULL, type))
 			return;
 	}
 
+	/* Vectors past the page limit are stored quantized */
+	stored = value;
+	if (IvfflatIsQuantized(rel))
+		stored = PointerGetDatum(VectorToQuantVector(DatumGetVector(value), NULL));
+
+	/* Defer finding the list to when the pending list is flushed */
+	if (!pq && IvfflatGetFastUpdate(rel))
+	{
+		itup = index_form_tuple(RelationGetDescr(rel), &stored, isnull);
+		itup->t_tid = *heap_tid;
+
+		if (IvfflatInsertPending(rel, itup))
+			IvfflatFlushPending(rel, work_mem);
+		return;
+	}
+
+	if (pq)
+	{
+		codebook = IvfpqGetCodebook(rel);
+		center = InitVector(codebook->dimensions);
+	}
+
 	/* Find the insert page - sets the page and list info */
-	FindInsertPage(rel, values, &insertPage, &listInfo);
+	FindInsertPage(rel, value, &insertPage, &listInfo, center);
 	Assert(BlockNumberIsValid(insertPage));
 	originalInsertPage = insertPage;
 
 	/* Form tuple */
-	itup = index_form_tuple(RelationGetDescr(rel), &value, isnull);
+	if (pq)
+	{
+		itup = palloc0(IVFPQ_TUPLE_SIZE(codebook->m));
+		IvfpqEncode(codebook, DatumGetVector(value), center, itup);
+	}
+	else
+		itup = index_form_tuple(RelationGetDescr(rel), &stored, isnull);
 	itup->t_tid = *heap_tid;
 
 	/* Get tuple size */
@@ -176,6 +240,39 @@ InsertTuple(Relation rel, Datum *values, bool *isnull, ItemPointer heap_tid, Rel
 		IvfflatUpdateList(rel, state, listInfo, insertPage, originalInsertPage, InvalidBlockNumber, MAIN_FORKNUM);
 }
 
+/*
+ * Insert a tuple into the index in a temporary memory context
+ *
+ * The context is kept in ii_AmCache and reset for each row, instead of
+ * being created and deleted for each row
+ */
+static void
+InsertIndexTuple(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid, Relation heap, IndexInfo *indexInfo, bool pq)
+{
+	MemoryContext oldCtx;
+	MemoryContext insertCtx = (MemoryContext) indexInfo->ii_AmCache;
+
+	/*
+	 * Use memory context since detoast, IvfflatNormValue, and
+	 * index_form_tuple can allocate
+	 */
+	if (insertCtx == NULL)
+	{
+		insertCtx = AllocSetContextCreate(indexInfo->ii_Context,
+										  "Ivfflat insert temporary context",
+										  ALLOCSET_DEFAULT_SIZES);
+		indexInfo->ii_AmCache = insertCtx;
+	}
+	oldCtx = MemoryContextSwitchTo(insertCtx);
+
+	/* Insert tuple */
+	InsertTuple(index, values, isnull, heap_tid, heap, pq);
+
+	/* Free memory */
+	MemoryContextSwitchTo(oldCtx);
+	MemoryContextReset(insertCtx);
+}
+
 /*
  * Insert a tuple into the index
  */
@@ -188,28 +285,32 @@ ivfflatinsert(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid,
 			  ,IndexInfo *indexInfo
 )
 {
-	MemoryContext oldCtx;
-	MemoryContext insertCtx;
-
 	/* Skip nulls */
 	if (isnull[0])
 		return false;
 
-	/*
-	 * Use memory context since detoast, IvfflatNormValue, and
-	 * index_form_tuple can allocate
-	 */
-	insertCtx = AllocSetContextCreate(CurrentMemoryContext,
-									  "Ivfflat insert temporary context",
-									  ALLOCSET_DEFAULT_SIZES);
-	oldCtx = MemoryContextSwitchTo(insertCtx);
+	InsertIndexTuple(index, values, isnull, heap_tid, heap, indexInfo, false);
 
-	/* Insert tuple */
-	InsertTuple(index, values, isnull, heap_tid, heap);
+	return false;
+}
 
-	/* Delete memory context */
-	MemoryContextSwitchTo(oldCtx);
-	MemoryContextDelete(insertCtx);
+/*
+ * Insert a tuple into the product quantized index
+ */
+bool
+ivfpqinsert(Relation index, Datum *values, bool *isnull, ItemPointer heap_tid,
+			Relation heap, IndexUniqueCheck checkUnique
+#if PG_VERSION_NUM >= 140000
+			,bool indexUnchanged
+#endif
+			,IndexInfo *indexInfo
+)
+{
+	/* Skip nulls */
+	if (isnull[0])
+		return false;
+
+	InsertIndexTuple(index, values, isnull, heap_tid, heap, indexInfo, true);
 
 	return false;
 }
@@ -3,8 +3,323 @@
 #include <float.h>
 #include <math.h>
 
+#ifndef WIN32
+#include <pthread.h>
+#include <signal.h>
+#endif
+
 #include "ivfflat.h"
 #include "miscadmin.h"
+#include "vector.h"
+#include "vectorutils.h"
+
+/* Not worth starting a thread for less work */
+#define KMEANS_MIN_SAMPLES_PER_THREAD 1024
+#define KMEANS_MIN_CENTERS_PER_THREAD 16
+#define KMEANS_MAX_THREADS 64
+
+typedef double (*KmeansDistanceFunc) (int dim, const float *ax, const float *bx);
+
+/*
+ * State shared by the leader and worker threads
+ *
+ * Worker threads only read and write the arrays here and never call into
+ * Postgres (no palloc, elog, fmgr, or interrupts)
+ */
+typedef struct KmeansState
+{
+	VectorArray samples;
+	VectorArray centers;
+	VectorArray newCenters;
+	int			numSamples;
+	int			numCenters;
+	int			dimensions;
+	bool		elkan;
+	int			nthreads;
+
+	/* Kernel, or NULL to call the support function in the leader only */
+	KmeansDistanceFunc distance;
+	FmgrInfo   *procinfo;
+	Oid			collation;
+
+	/* Use float instead of double to save memory */
+	int		   *centerCounts;
+	int		   *closestCenters;
+	float	   *lowerBound;		/* every center for Elkan, second closest for
+								 * Hamerly */
+	float	   *upperBound;
+	float	   *s;
+	float	   *halfcdist;		/* Elkan only */
+	float	   *newcdist;
+	float	   *weight;			/* kmeans++ only */
+
+	/* Set by the leader for each phase */
+	int			newCenter;
+	bool		rjreset;
+	double		maxcdist;
+	double		secondcdist;
+	int			maxCenter;
+}			KmeansState;
+
+typedef struct KmeansTask KmeansTask;
+
+typedef void (*KmeansTaskFunc) (KmeansState * state, KmeansTask * task);
+
+/*
+ * A range of samples or centers, with results combined by the leader
+ */
+struct KmeansTask
+{
+	KmeansState *state;
+	KmeansTaskFunc func;
+	int64		start;
+	int64		end;
+	double		sum;
+	int64		changes;
+};
+
+static double
+KmeansL2Distance(int dim, const float *ax, const float *bx)
+{
+	return sqrt(VectorL2SquaredDistance(dim, ax, bx));
+}
+
+static double
+KmeansSphericalDistance(int dim, const float *ax, const float *bx)
+{
+	double		distance = VectorInnerProduct(dim, ax, bx);
+
+	/* Prevent NaN with acos with loss of precision */
+	if (distance > 1)
+		distance = 1;
+	else if (distance < -1)
+		distance = -1;
+
+	return acos(distance) / M_PI;
+}
+
+/*
+ * Get the kernel for the k-means distance function
+ *
+ * Returns NULL for other opclasses, which use fmgr
+ */
+static KmeansDistanceFunc
+GetKmeansDistanceFunc(FmgrInfo *procinfo)
+{
+	PGFunction	fn = procinfo->fn_addr;
+
+	if (fn == l2_distance)
+		return KmeansL2Distance;
+	if (fn == vector_spherical_distance)
+		return KmeansSphericalDistance;
+
+	return NULL;
+}
+
+/*
+ * Get the distance between vectors
+ */
+static inline double
+KmeansDistance(KmeansState * state, Vector * a, Vector * b)
+{
+	if (likely(state->distance != NULL))
+		return state->distance(state->dimensions, a->x, b->x);
+
+	return DatumGetFloat8(FunctionCall2Coll(state->procinfo, state->collation, PointerGetDatum(a), PointerGetDatum(b)));
+}
+
+#ifndef WIN32
+static void *
+KmeansThreadMain(void *arg)
+{
+	KmeansTask *task = (KmeansTask *) arg;
+
+	task->func(task->state, task);
+	return NULL;
+}
+#endif
+
+/*
+ * Split [0, n) across the leader and worker threads and combine the results
+ *
+ * The leader runs the first range, and any range whose thread fails to start
+ */
+static void
+KmeansRun(KmeansState * state, KmeansTaskFunc func, int64 n, int64 minPerThread, KmeansTask * result)
+{
+	KmeansTask	tasks[KMEANS_MAX_THREADS];
+	bool		started[KMEANS_MAX_THREADS];
+	int			nthreads = state->nthreads;
+	int			i;
+
+#ifndef WIN32
+	pthread_t	threads[KMEANS_MAX_THREADS];
+	sigset_t	mask;
+	sigset_t	oldmask;
+#endif
+
+	if (n / minPerThread < nthreads)
+		nthreads = Max(n / minPerThread, 1);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		tasks[i].state = state;
+		tasks[i].func = func;
+		tasks[i].start = n * i / nthreads;
+		tasks[i].end = n * (i + 1) / nthreads;
+		tasks[i].sum = 0;
+		tasks[i].changes = 0;
+		started[i] = false;
+	}
+
+#ifndef WIN32
+	if (nthreads > 1)
+	{
+		/* Signals for the backend must be handled by the leader */
+		sigfillset(&mask);
+		pthread_sigmask(SIG_SETMASK, &mask, &oldmask);
+
+		for (i = 1; i < nthreads; i++)
+			started[i] = pthread_create(&threads[i], NULL, KmeansThreadMain, &tasks[i]) == 0;
+
+		pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+	}
+#endif
+
+	for (i = 0; i < nthreads; i++)
+	{
+		if (!started[i])
+			func(state, &tasks[i]);
+	}
+
+	result->sum = 0;
+	result->changes = 0;
+
+	for (i = 0; i < nthreads; i++)
+	{
+#ifndef WIN32
+		if (started[i])
+			pthread_join(threads[i], NULL);
+#endif
+
+		result->sum += tasks[i].sum;
+		result->changes += tasks[i].changes;
+	}
+}
+
+/*
+ * Initialize the state shared by the leader and worker threads
+ */
+static void
+InitKmeansState(KmeansState * state, Relation index, VectorArray samples, VectorArray centers, bool elkan)
+{
+	int			i;
+
+	state->samples = samples;
+	state->centers = centers;
+	state->numSamples = samples->length;
+	state->numCenters = centers->maxlen;
+	state->dimensions = centers->dim;
+	state->elkan = elkan;
+
+	/* Set support functions */
+	state->procinfo = index_getprocinfo(index, 1, IVFFLAT_KMEANS_DISTANCE_PROC);
+	state->collation = index->rd_indcollation[0];
+	state->distance = GetKmeansDistanceFunc(state->procinfo);
+
+	/* fmgr is not thread-safe */
+	state->nthreads = 1;
+	if (state->distance != NULL)
+		state->nthreads = Min(max_parallel_maintenance_workers + 1, KMEANS_MAX_THREADS);
+
+	/* Allocate space */
+	state->centerCounts = palloc(sizeof(int) * state->numCenters);
+	state->closestCenters = palloc(sizeof(int) * state->numSamples);
+	state->upperBound = palloc(sizeof(float) * state->numSamples);
+	state->s = palloc(sizeof(float) * state->numCenters);
+	state->newcdist = palloc(sizeof(float) * state->numCenters);
+
+	if (elkan)
+	{
+		state->lowerBound = palloc_extended(sizeof(float) * state->numSamples * state->numCenters, MCXT_ALLOC_HUGE);
+		state->halfcdist = palloc_extended(sizeof(float) * state->numCenters * state->numCenters, MCXT_ALLOC_HUGE);
+	}
+	else
+	{
+		state->lowerBound = palloc(sizeof(float) * state->numSamples);
+		state->halfcdist = NULL;
+	}
+
+	state->newCenters = VectorArrayInit(state->numCenters, state->dimensions, VECTOR_SIZE(state->dimensions));
+	for (i = 0; i < state->numCenters; i++)
+	{
+		Vector	   *vec = VectorArrayGet(state->newCenters, i);
+
+		SET_VARSIZE(vec, VECTOR_SIZE(state->dimensions));
+		vec->dim = state->dimensions;
+	}
+}
+
+/*
+ * Free the state
+ */
+static void
+FreeKmeansState(KmeansState * state)
+{
+	VectorArrayFree(state->newCenters);
+	pfree(state->centerCounts);
+	pfree(state->closestCenters);
+	pfree(state->lowerBound);
+	pfree(state->upperBound);
+	pfree(state->s);
+	if (state->halfcdist != NULL)
+		pfree(state->halfcdist);
+	pfree(state->newcdist);
+}
+
+/*
+ * Compute the distance from samples to the new center for kmeans++
+ *
+ * Also sets the bounds, so samples are assigned to their closest center
+ * once seeding is done
+ */
+static void
+SeedRange(KmeansState * state, KmeansTask * task)
+{
+	Vector	   *center = VectorArrayGet(state->centers, state->newCenter);
+	int			i = state->newCenter;
+	int64		numCenters = state->numCenters;
+	double		sum = 0.0;
+
+	for (int64 j = task->start; j < task->end; j++)
+	{
+		double		distance = KmeansDistance(state, VectorArrayGet(state->samples, j), center);
+
+		if (state->elkan)
+			state->lowerBound[j * numCenters + i] = distance;
+
+		if (distance < state->upperBound[j])
+		{
+			if (!state->elkan)
+				state->lowerBound[j] = state->upperBound[j];
+
+			state->upperBound[j] = distance;
+			state->closestCenters[j] = i;
+		}
+		else if (!state->elkan && distance < state->lowerBound[j])
+			state->lowerBound[j] = distance;
+
+		/* Use distance squared for weighted probability distribution */
+		distance *= distance;
+
+		if (distance < state->weight[j])
+			state->weight[j] = distance;
+
+		sum += state->weight[j];
+	}
+
+	task->sum = sum;
+}
 
 /*
  * Initialize with kmeans++
@@ -12,65 +327,51 @@
  * https://theory.stanford.edu/~sergei/papers/kMeansPP-soda.pdf
  */
 static void
-InitCenters(Relation index, VectorArray samples, VectorArray centers, float *lowerBound)
+InitCenters(KmeansState * state)
 {
-	FmgrInfo   *procinfo;
-	Oid			collation;
+	VectorArray samples = state->samples;
+	VectorArray centers = state->centers;
+	int			numCenters = state->numCenters;
+	int			numSamples = state->numSamples;
 	int			i;
 	int64		j;
-	double		distance;
-	double		sum;
 	double		choice;
-	Vector	   *vec;
-	float	   *weight = palloc(samples->length * sizeof(float));
-	int			numCenters = centers->maxlen;
-	int			numSamples = samples->length;
+	KmeansTask	result;
 
-	procinfo = index_getprocinfo(index, 1, IVFFLAT_KMEANS_DISTANCE_PROC);
-	collation = index->rd_indcollation[0];
+	state->weight = palloc(numSamples * sizeof(float));
 
 	/* Choose an initial center uniformly at random */
 	VectorArraySet(centers, 0, VectorArrayGet(samples, RandomInt() % samples->length));
 	centers->length++;
 
 	for (j = 0; j < numSamples; j++)
-		weight[j] = DBL_MAX;
+	{
+		state->weight[j] = FLT_MAX;
+		state->closestCenters[j] = 0;
+		state->upperBound[j] = FLT_MAX;
+
+		if (!state->elkan)
+			state->lowerBound[j] = FLT_MAX;
+	}
 
 	for (i = 0; i < numCenters; i++)
 	{
 		CHECK_FOR_INTERRUPTS();
 
-		sum = 0.0;
-
-		for (j = 0; j < numSamples; j++)
-		{
-			vec = VectorArrayGet(samples, j);
-
-			/* Only need to compute distance for new center */
-			/* TODO Use triangle inequality to reduce distance calculations */
-			distance = DatumGetFloat8(FunctionCall2Coll(procinfo, collation, PointerGetDatum(vec), PointerGetDatum(VectorArrayGet(centers, i))));
-
-			/* Set lower bound */
-			lowerBound[j * numCenters + i] = distance;
-
-			/* Use distance squared for weighted probability distribution */
-			distance *= distance;
-
-			if (distance < weight[j])
-				weight[j] = distance;
-
-			sum += weight[j];
-		}
+		/* Only need to compute distance for new center */
+		/* TODO Use triangle inequality to reduce distance calculations */
+		state->newCenter = i;
+		KmeansRun(state, SeedRange, numSamples, KMEANS_MIN_SAMPLES_PER_THREAD, &result);
 
 		/* Only compute lower bound on last iteration */
 		if (i + 1 == numCenters)
 			break;
 
 		/* Choose new center using weighted probability distribution. */
-		choice = sum * RandomDouble();
+		choice = result.sum * RandomDouble();
 		for (j = 0; j < numSamples - 1; j++)
 		{
-			choice -= weight[j];
+			choice -= state->weight[j];
 			if (choice <= 0)
 				break;
 		}
@@ -79,7 +380,8 @@ InitCenters(Relation index, VectorArray samples, VectorArray centers, float *low
 		centers->length++;
 	}
 
-	pfree(weight);
+	pfree(state->weight);
+	state->weight = NULL;
 }
 
 /*
@@ -157,309 +459,569 @@ QuickCenters(Relation index, VectorArray samples, VectorArray centers)
 }
 
 /*
- * Use Elkan for performance. This requires distance function to satisfy triangle inequality.
- *
- * We use L2 distance for L2 (not L2 squared like index scan)
- * and angular distance for inner product and cosine distance
+ * Estimate the memory needed for k-means
  *
- * https://www.aaai.org/Papers/ICML/2003/ICML03-022.pdf
+ * Elkan keeps a lower bound for every sample and center and the distances
+ * between centers, while Hamerly only keeps one lower bound per sample
  */
-static void
-ElkanKmeans(Relation index, VectorArray samples, VectorArray centers)
+static Size
+KmeansMemory(VectorArray samples, VectorArray centers, bool elkan)
 {
-	FmgrInfo   *procinfo;
-	FmgrInfo   *normprocinfo;
-	Oid			collation;
-	Vector	   *vec;
-	Vector	   *newCenter;
-	int			iteration;
-	int64		j;
-	int64		k;
-	int			dimensions = centers->dim;
-	int			numCenters = centers->maxlen;
-	int			numSamples = samples->length;
-	VectorArray newCenters;
-	int		   *centerCounts;
-	int		   *closestCenters;
-	float	   *lowerBound;
-	float	   *upperBound;
-	float	   *s;
-	float	   *halfcdist;
-	float	   *newcdist;
-	int			changes;
-	double		minDistance;
-	int			closestCenter;
-	double		distance;
-	bool		rj;
-	bool		rjreset;
-	double		dxcx;
-	double		dxc;
+	Size		numSamples = samples->length;
+	Size		numCenters = centers->maxlen;
+	Size		totalSize;
+
+	/* Samples, centers, and new centers */
+	totalSize = VECTOR_ARRAY_SIZE(samples->maxlen, samples->itemsize);
+	totalSize += VECTOR_ARRAY_SIZE(centers->maxlen, centers->itemsize);
+	totalSize += VECTOR_ARRAY_SIZE(numCenters, VECTOR_SIZE(centers->dim));
+
+	/* Center counts, closest centers, upper bounds, s, and new distances */
+	totalSize += sizeof(int) * numCenters;
+	totalSize += sizeof(int) * numSamples;
+	totalSize += sizeof(float) * numSamples;
+	totalSize += sizeof(float) * numCenters * 2;
+
+	/* Lower bounds */
+	if (elkan)
+	{
+		totalSize += sizeof(float) * numSamples * numCenters;
+		totalSize += sizeof(float) * numCenters * numCenters;
+	}
+	else
+		totalSize += sizeof(float) * numSamples;
 
-	/* Calculate allocation sizes */
-	Size		samplesSize = VECTOR_ARRAY_SIZE(samples->maxlen, samples->dim);
-	Size		centersSize = VECTOR_ARRAY_SIZE(centers->maxlen, centers->dim);
-	Size		newCentersSize = VECTOR_ARRAY_SIZE(numCenters, dimensions);
-	Size		centerCountsSize = sizeof(int) * numCenters;
-	Size		closestCentersSize = sizeof(int) * numSamples;
-	Size		lowerBoundSize = sizeof(float) * numSamples * numCenters;
-	Size		upperBoundSize = sizeof(float) * numSamples;
-	Size		sSize = sizeof(float) * numCenters;
-	Size		halfcdistSize = sizeof(float) * numCenters * numCenters;
-	Size		newcdistSize = sizeof(float) * numCenters;
-
-	/* Calculate total size */
-	Size		totalSize = samplesSize + centersSize + newCentersSize + centerCountsSize + closestCentersSize + lowerBoundSize + upperBoundSize + sSize + halfcdistSize + newcdistSize;
+	return totalSize;
+}
 
-	/* Check memory requirements */
+/*
+ * Check memory requirements
+ */
+static void
+CheckMemory(Size totalSize)
+{
 	/* Add one to error message to ceil */
 	if (totalSize > (Size) maintenance_work_mem * 1024L)
 		ereport(ERROR,
 				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
 				 errmsg("memory required is %zu MB, maintenance_work_mem is %d MB",
 						totalSize / (1024 * 1024) + 1, maintenance_work_mem / 1024)));
+}
 
-	/* Ensure indexing does not overflow */
-	if (numCenters * numCenters > INT_MAX)
-		elog(ERROR, "Indexing overflow detected. Please report a bug.");
-
-	/* Set support functions */
-	procinfo = index_getprocinfo(index, 1, IVFFLAT_KMEANS_DISTANCE_PROC);
-	normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_KMEANS_NORM_PROC);
-	collation = index->rd_indcollation[0];
+/*
+ * Sum the samples assigned to a range of centers and take the mean
+ *
+ * Each thread reads every assignment but only writes its own centers, so
+ * no partial sums need to be combined
+ */
+static void
+NewCentersRange(KmeansState * state, KmeansTask * task)
+{
+	VectorArray samples = state->samples;
+	VectorArray newCenters = state->newCenters;
+	int			dimensions = state->dimensions;
+	int		   *centerCounts = state->centerCounts;
+	Vector	   *vec;
+	Vector	   *newCenter;
+	int64		j;
+	int64		k;
 
-	/* Allocate space */
-	/* Use float instead of double to save memory */
-	centerCounts = palloc(centerCountsSize);
-	closestCenters = palloc(closestCentersSize);
-	lowerBound = palloc_extended(lowerBoundSize, MCXT_ALLOC_HUGE);
-	upperBound = palloc(upperBoundSize);
-	s = palloc(sSize);
-	halfcdist = palloc_extended(halfcdistSize, MCXT_ALLOC_HUGE);
-	newcdist = palloc(newcdistSize);
-
-	newCenters = VectorArrayInit(numCenters, dimensions);
-	for (j = 0; j < numCenters; j++)
+	for (j = task->start; j < task->end; j++)
 	{
 		vec = VectorArrayGet(newCenters, j);
-		SET_VARSIZE(vec, VECTOR_SIZE(dimensions));
-		vec->dim = dimensions;
+		for (k = 0; k < dimensions; k++)
+			vec->x[k] = 0.0;
+
+		centerCounts[j] = 0;
 	}
 
-	/* Pick initial centers */
-	InitCenters(index, samples, centers, lowerBound);
+	for (j = 0; j < state->numSamples; j++)
+	{
+		int			closestCenter = state->closestCenters[j];
 
-	/* Assign each x to its closest initial center c(x) = argmin d(x,c) */
-	for (j = 0; j < numSamples; j++)
+		if (closestCenter < task->start || closestCenter >= task->end)
+			continue;
+
+		vec = VectorArrayGet(samples, j);
+
+		/* Increment sum and count of closest center */
+		newCenter = VectorArrayGet(newCenters, closestCenter);
+		for (k = 0; k < dimensions; k++)
+			newCenter->x[k] += vec->x[k];
+
+		centerCounts[closestCenter] += 1;
+	}
+
+	for (j = task->start; j < task->end; j++)
 	{
-		minDistance = DBL_MAX;
-		closestCenter = 0;
+		if (centerCounts[j] == 0)
+			continue;
 
-		/* Find closest center */
-		for (k = 0; k < numCenters; k++)
-		{
-			/* TODO Use Lemma 1 in k-means++ initialization */
-			distance = lowerBound[j * numCenters + k];
+		vec = VectorArrayGet(newCenters, j);
 
-			if (distance < minDistance)
-			{
-				minDistance = distance;
-				closestCenter = k;
-			}
+		/* Double avoids overflow, but requires more memory */
+		/* TODO Update bounds */
+		for (k = 0; k < dimensions; k++)
+		{
+			if (isinf(vec->x[k]))
+				vec->x[k] = vec->x[k] > 0 ? FLT_MAX : -FLT_MAX;
 		}
 
-		upperBound[j] = minDistance;
-		closestCenters[j] = closestCenter;
+		for (k = 0; k < dimensions; k++)
+			vec->x[k] /= centerCounts[j];
 	}
+}
 
-	/* Give 500 iterations to converge */
-	for (iteration = 0; iteration < 500; iteration++)
+/*
+ * Set each new center to the mean of the samples assigned to it
+ */
+static void
+ComputeNewCenters(KmeansState * state, FmgrInfo *normprocinfo)
+{
+	KmeansTask	result;
+
+	KmeansRun(state, NewCentersRange, state->numCenters, KMEANS_MIN_CENTERS_PER_THREAD, &result);
+
+	for (int j = 0; j < state->numCenters; j++)
 	{
-		/* Can take a while, so ensure we can interrupt */
-		CHECK_FOR_INTERRUPTS();
+		Vector	   *vec = VectorArrayGet(state->newCenters, j);
 
-		changes = 0;
+		if (state->centerCounts[j] == 0)
+		{
+			/* TODO Handle empty centers properly */
+			for (int k = 0; k < state->dimensions; k++)
+				vec->x[k] = RandomDouble();
+		}
 
-		/* Step 1: For all centers, compute distance */
-		for (j = 0; j < numCenters; j++)
+		/* Normalize if needed */
+		if (normprocinfo != NULL)
+			ApplyNorm(normprocinfo, state->collation, vec);
+	}
+}
+
+/*
+ * Compute how far each center moved
+ */
+static void
+CenterMovedRange(KmeansState * state, KmeansTask * task)
+{
+	for (int64 j = task->start; j < task->end; j++)
+		state->newcdist[j] = KmeansDistance(state, VectorArrayGet(state->centers, j), VectorArrayGet(state->newCenters, j));
+}
+
+/*
+ * Replace the centers with the new centers
+ */
+static void
+MoveCenters(KmeansState * state)
+{
+	for (int j = 0; j < state->numCenters; j++)
+		memcpy(VectorArrayGet(state->centers, j), VectorArrayGet(state->newCenters, j), VECTOR_SIZE(state->dimensions));
+}
+
+/*
+ * Step 1: For all centers, compute distance
+ */
+static void
+ElkanCenterDistanceRange(KmeansState * state, KmeansTask * task)
+{
+	int64		numCenters = state->numCenters;
+
+	for (int64 j = task->start; j < task->end; j++)
+	{
+		Vector	   *vec = VectorArrayGet(state->centers, j);
+
+		for (int64 k = j + 1; k < numCenters; k++)
 		{
-			vec = VectorArrayGet(centers, j);
+			double		distance = 0.5 * KmeansDistance(state, vec, VectorArrayGet(state->centers, k));
 
-			for (k = j + 1; k < numCenters; k++)
-			{
-				distance = 0.5 * DatumGetFloat8(FunctionCall2Coll(procinfo, collation, PointerGetDatum(vec), PointerGetDatum(VectorArrayGet(centers, k))));
-				halfcdist[j * numCenters + k] = distance;
-				halfcdist[k * numCenters + j] = distance;
-			}
+			state->halfcdist[j * numCenters + k] = distance;
+			state->halfcdist[k * numCenters + j] = distance;
 		}
+	}
+}
 
-		/* For all centers c, compute s(c) */
-		for (j = 0; j < numCenters; j++)
-		{
-			minDistance = DBL_MAX;
+/*
+ * For all centers c, compute s(c)
+ */
+static void
+ElkanSRange(KmeansState * state, KmeansTask * task)
+{
+	int64		numCenters = state->numCenters;
 
-			for (k = 0; k < numCenters; k++)
-			{
-				if (j == k)
-					continue;
+	for (int64 j = task->start; j < task->end; j++)
+	{
+		double		minDistance = DBL_MAX;
 
-				distance = halfcdist[j * numCenters + k];
-				if (distance < minDistance)
-					minDistance = distance;
-			}
+		for (int64 k = 0; k < numCenters; k++)
+		{
+			double		distance;
+
+			if (j == k)
+				continue;
 
-			s[j] = minDistance;
+			distance = state->halfcdist[j * numCenters + k];
+			if (distance < minDistance)
+				minDistance = distance;
 		}
 
-		rjreset = iteration != 0;
+		state->s[j] = minDistance;
+	}
+}
 
-		for (j = 0; j < numSamples; j++)
+/*
+ * Steps 2 and 3: Reassign samples
+ */
+static void
+ElkanAssignRange(KmeansState * state, KmeansTask * task)
+{
+	int64		numCenters = state->numCenters;
+	float	   *lowerBound = state->lowerBound;
+	float	   *upperBound = state->upperBound;
+	float	   *halfcdist = state->halfcdist;
+	int		   *closestCenters = state->closestCenters;
+	bool		rj;
+	double		dxcx;
+	double		dxc;
+	Vector	   *vec;
+
+	for (int64 j = task->start; j < task->end; j++)
+	{
+		/* Step 2: Identify all points x such that u(x) <= s(c(x)) */
+		if (upperBound[j] <= state->s[closestCenters[j]])
+			continue;
+
+		rj = state->rjreset;
+
+		for (int64 k = 0; k < numCenters; k++)
 		{
-			/* Step 2: Identify all points x such that u(x) <= s(c(x)) */
-			if (upperBound[j] <= s[closestCenters[j]])
+			/* Step 3: For all remaining points x and centers c */
+			if (k == closestCenters[j])
 				continue;
 
-			rj = rjreset;
+			if (upperBound[j] <= lowerBound[j * numCenters + k])
+				continue;
 
-			for (k = 0; k < numCenters; k++)
+			if (upperBound[j] <= halfcdist[closestCenters[j] * numCenters + k])
+				continue;
+
+			vec = VectorArrayGet(state->samples, j);
+
+			/* Step 3a */
+			if (rj)
 			{
-				/* Step 3: For all remaining points x and centers c */
-				if (k == closestCenters[j])
-					continue;
+				dxcx = KmeansDistance(state, vec, VectorArrayGet(state->centers, closestCenters[j]));
+
+				/* d(x,c(x)) computed, which is a form of d(x,c) */
+				lowerBound[j * numCenters + closestCenters[j]] = dxcx;
+				upperBound[j] = dxcx;
 
-				if (upperBound[j] <= lowerBound[j * numCenters + k])
-					continue;
+				rj = false;
+			}
+			else
+				dxcx = upperBound[j];
 
-				if (upperBound[j] <= halfcdist[closestCenters[j] * numCenters + k])
-					continue;
+			/* Step 3b */
+			if (dxcx > lowerBound[j * numCenters + k] || dxcx > halfcdist[closestCenters[j] * numCenters + k])
+			{
+				dxc = KmeansDistance(state, vec, VectorArrayGet(state->centers, k));
 
-				vec = VectorArrayGet(samples, j);
+				/* d(x,c) calculated */
+				lowerBound[j * numCenters + k] = dxc;
 
-				/* Step 3a */
-				if (rj)
+				if (dxc < dxcx)
 				{
-					dxcx = DatumGetFloat8(FunctionCall2Coll(procinfo, collation, PointerGetDatum(vec), PointerGetDatum(VectorArrayGet(centers, closestCenters[j]))));
+					closestCenters[j] = k;
 
-					/* d(x,c(x)) computed, which is a form of d(x,c) */
-					lowerBound[j * numCenters + closestCenters[j]] = dxcx;
-					upperBound[j] = dxcx;
+					/* c(x) changed */
+					upperBound[j] = dxc;
 
-					rj = false;
+					task->changes++;
 				}
-				else
-					dxcx = upperBound[j];
+			}
+		}
+	}
+}
 
-				/* Step 3b */
-				if (dxcx > lowerBound[j * numCenters + k] || dxcx > halfcdist[closestCenters[j] * numCenters + k])
-				{
-					dxc = DatumGetFloat8(FunctionCall2Coll(procinfo, collation, PointerGetDatum(vec), PointerGetDatum(VectorArrayGet(centers, k))));
+/*
+ * Steps 5 and 6: Update bounds for how far centers moved
+ */
+static void
+ElkanUpdateBoundsRange(KmeansState * state, KmeansTask * task)
+{
+	int64		numCenters = state->numCenters;
 
-					/* d(x,c) calculated */
-					lowerBound[j * numCenters + k] = dxc;
+	for (int64 j = task->start; j < task->end; j++)
+	{
+		for (int64 k = 0; k < numCenters; k++)
+		{
+			double		distance = state->lowerBound[j * numCenters + k] - state->newcdist[k];
 
-					if (dxc < dxcx)
-					{
-						closestCenters[j] = k;
+			if (distance < 0)
+				distance = 0;
 
-						/* c(x) changed */
-						upperBound[j] = dxc;
+			state->lowerBound[j * numCenters + k] = distance;
+		}
 
-						changes++;
-					}
+		/* We reset r(x) before Step 3 in the next iteration */
+		state->upperBound[j] += state->newcdist[state->closestCenters[j]];
+	}
+}
 
-				}
-			}
-		}
+/*
+ * Use Elkan for performance. This requires distance function to satisfy triangle inequality.
+ *
+ * We use L2 distance for L2 (not L2 squared like index scan)
+ * and angular distance for inner product and cosine distance
+ *
+ * Samples and centers are split across threads for each step
+ *
+ * https://www.aaai.org/Papers/ICML/2003/ICML03-022.pdf
+ */
+static void
+ElkanKmeans(Relation index, VectorArray samples, VectorArray centers)
+{
+	KmeansState state;
+	KmeansTask	result;
+	FmgrInfo   *normprocinfo;
+	int			iteration;
+	int64		changes;
+	int			numCenters = centers->maxlen;
+	int			numSamples = samples->length;
+
+	/* Check memory requirements */
+	CheckMemory(KmeansMemory(samples, centers, true));
+
+	/* Ensure indexing does not overflow */
+	if (numCenters * numCenters > INT_MAX)
+		elog(ERROR, "Indexing overflow detected. Please report a bug.");
+
+	normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_KMEANS_NORM_PROC);
+
+	InitKmeansState(&state, index, samples, centers, true);
+
+	/* Pick initial centers and assign each x to its closest initial center */
+	InitCenters(&state);
+
+	/* Give 500 iterations to converge */
+	for (iteration = 0; iteration < 500; iteration++)
+	{
+		/* Can take a while, so ensure we can interrupt */
+		CHECK_FOR_INTERRUPTS();
+
+		/* Step 1: For all centers, compute distance */
+		KmeansRun(&state, ElkanCenterDistanceRange, numCenters, KMEANS_MIN_CENTERS_PER_THREAD, &result);
+
+		/* For all centers c, compute s(c) */
+		KmeansRun(&state, ElkanSRange, numCenters, KMEANS_MIN_CENTERS_PER_THREAD, &result);
+
+		/* Steps 2 and 3 */
+		state.rjreset = iteration != 0;
+		KmeansRun(&state, ElkanAssignRange, numSamples, KMEANS_MIN_SAMPLES_PER_THREAD, &result);
+		changes = result.changes;
 
 		/* Step 4: For each center c, let m(c) be mean of all points assigned */
-		for (j = 0; j < numCenters; j++)
-		{
-			vec = VectorArrayGet(newCenters, j);
-			for (k = 0; k < dimensions; k++)
-				vec->x[k] = 0.0;
+		ComputeNewCenters(&state, normprocinfo);
 
-			centerCounts[j] = 0;
-		}
+		/* Steps 5 and 6 */
+		KmeansRun(&state, CenterMovedRange, numCenters, KMEANS_MIN_CENTERS_PER_THREAD, &result);
+		KmeansRun(&state, ElkanUpdateBoundsRange, numSamples, KMEANS_MIN_SAMPLES_PER_THREAD, &result);
+
+		/* Step 7 */
+		MoveCenters(&state);
 
-		for (j = 0; j < numSamples; j++)
+		if (changes == 0 && iteration != 0)
+			break;
+	}
+
+	FreeKmeansState(&state);
+}
+
+/*
+ * For all centers c, compute s(c) without storing all distances
+ *
+ * Each thread computes full rows, so every distance is computed twice
+ */
+static void
+HamerlySRange(KmeansState * state, KmeansTask * task)
+{
+	int64		numCenters = state->numCenters;
+
+	for (int64 j = task->start; j < task->end; j++)
+	{
+		Vector	   *vec = VectorArrayGet(state->centers, j);
+		double		minDistance = FLT_MAX;
+
+		for (int64 k = 0; k < numCenters; k++)
 		{
-			vec = VectorArrayGet(samples, j);
-			closestCenter = closestCenters[j];
+			double		distance;
 
-			/* Increment sum and count of closest center */
-			newCenter = VectorArrayGet(newCenters, closestCenter);
-			for (k = 0; k < dimensions; k++)
-				newCenter->x[k] += vec->x[k];
+			if (j == k)
+				continue;
 
-			centerCounts[closestCenter] += 1;
+			distance = 0.5 * KmeansDistance(state, vec, VectorArrayGet(state->centers, k));
+			if (distance < minDistance)
+				minDistance = distance;
 		}
 
-		for (j = 0; j < numCenters; j++)
-		{
-			vec = VectorArrayGet(newCenters, j);
+		state->s[j] = minDistance;
+	}
+}
 
-			if (centerCounts[j] > 0)
-			{
-				/* Double avoids overflow, but requires more memory */
-				/* TODO Update bounds */
-				for (k = 0; k < dimensions; k++)
-				{
-					if (isinf(vec->x[k]))
-						vec->x[k] = vec->x[k] > 0 ? FLT_MAX : -FLT_MAX;
-				}
+/*
+ * Reassign samples whose bounds do not rule out a closer center
+ */
+static void
+HamerlyAssignRange(KmeansState * state, KmeansTask * task)
+{
+	int64		numCenters = state->numCenters;
+	float	   *lowerBound = state->lowerBound;
+	float	   *upperBound = state->upperBound;
+	int		   *closestCenters = state->closestCenters;
 
-				for (k = 0; k < dimensions; k++)
-					vec->x[k] /= centerCounts[j];
-			}
+	for (int64 j = task->start; j < task->end; j++)
+	{
+		Vector	   *vec;
+		double		bound = Max(state->s[closestCenters[j]], lowerBound[j]);
+		double		minDistance;
+		double		secondDistance;
+		int			closestCenter;
+
+		if (upperBound[j] <= bound)
+			continue;
+
+		/* Tighten upper bound */
+		vec = VectorArrayGet(state->samples, j);
+		upperBound[j] = KmeansDistance(state, vec, VectorArrayGet(state->centers, closestCenters[j]));
+
+		if (upperBound[j] <= bound)
+			continue;
+
+		/* Find closest and second closest centers */
+		minDistance = FLT_MAX;
+		secondDistance = FLT_MAX;
+		closestCenter = closestCenters[j];
+
+		for (int64 k = 0; k < numCenters; k++)
+		{
+			double		distance;
+
+			/* Already computed */
+			if (k == closestCenters[j])
+				distance = upperBound[j];
 			else
+				distance = KmeansDistance(state, vec, VectorArrayGet(state->centers, k));
+
+			if (distance < minDistance)
 			{
-				/* TODO Handle empty centers properly */
-				for (k = 0; k < dimensions; k++)
-					vec->x[k] = RandomDouble();
+				secondDistance = minDistance;
+				minDistance = distance;
+				closestCenter = k;
 			}
+			else if (distance < secondDistance)
+				secondDistance = distance;
+		}
 
-			/* Normalize if needed */
-			if (normprocinfo != NULL)
-				ApplyNorm(normprocinfo, collation, vec);
+		if (closestCenter != closestCenters[j])
+		{
+			closestCenters[j] = closestCenter;
+			task->changes++;
 		}
 
-		/* Step 5 */
-		for (j = 0; j < numCenters; j++)
-			newcdist[j] = DatumGetFloat8(FunctionCall2Coll(procinfo, collation, PointerGetDatum(VectorArrayGet(centers, j)), PointerGetDatum(VectorArrayGet(newCenters, j))));
+		upperBound[j] = minDistance;
+		lowerBound[j] = secondDistance;
+	}
+}
 
-		for (j = 0; j < numSamples; j++)
-		{
-			for (k = 0; k < numCenters; k++)
-			{
-				distance = lowerBound[j * numCenters + k] - newcdist[k];
+/*
+ * Update bounds for how far centers moved
+ */
+static void
+HamerlyUpdateBoundsRange(KmeansState * state, KmeansTask * task)
+{
+	for (int64 j = task->start; j < task->end; j++)
+	{
+		int			closestCenter = state->closestCenters[j];
+		double		distance;
 
-				if (distance < 0)
-					distance = 0;
+		state->upperBound[j] += state->newcdist[closestCenter];
+
+		/* The second closest center moved at most as far as any other center */
+		distance = state->lowerBound[j] - (closestCenter == state->maxCenter ? state->secondcdist : state->maxcdist);
+		state->lowerBound[j] = distance < 0 ? 0 : distance;
+	}
+}
 
-				lowerBound[j * numCenters + k] = distance;
+/*
+ * Use Hamerly when Elkan does not fit in memory. This keeps a single lower
+ * bound per sample (to the second closest center) instead of one per center,
+ * so memory is linear in the number of samples. Like Elkan, this requires
+ * distance function to satisfy triangle inequality.
+ *
+ * https://epubs.siam.org/doi/pdf/10.1137/1.9781611972801.12
+ */
+static void
+HamerlyKmeans(Relation index, VectorArray samples, VectorArray centers)
+{
+	KmeansState state;
+	KmeansTask	result;
+	FmgrInfo   *normprocinfo;
+	int			iteration;
+	int64		changes;
+	int			numCenters = centers->maxlen;
+	int			numSamples = samples->length;
+
+	/* Check memory requirements */
+	CheckMemory(KmeansMemory(samples, centers, false));
+
+	normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_KMEANS_NORM_PROC);
+
+	InitKmeansState(&state, index, samples, centers, false);
+
+	/* Pick initial centers and assign each x to its closest initial center */
+	InitCenters(&state);
+
+	/* Give 500 iterations to converge */
+	for (iteration = 0; iteration < 500; iteration++)
+	{
+		/* Can take a while, so ensure we can interrupt */
+		CHECK_FOR_INTERRUPTS();
+
+		KmeansRun(&state, HamerlySRange, numCenters, KMEANS_MIN_CENTERS_PER_THREAD, &result);
+
+		KmeansRun(&state, HamerlyAssignRange, numSamples, KMEANS_MIN_SAMPLES_PER_THREAD, &result);
+		changes = result.changes;
+
+		/* For each center c, let m(c) be mean of all points assigned */
+		ComputeNewCenters(&state, normprocinfo);
+
+		/* Compute how far each center moved */
+		KmeansRun(&state, CenterMovedRange, numCenters, KMEANS_MIN_CENTERS_PER_THREAD, &result);
+
+		state.maxcdist = 0;
+		state.secondcdist = 0;
+		state.maxCenter = -1;
+		for (int j = 0; j < numCenters; j++)
+		{
+			if (state.newcdist[j] > state.maxcdist)
+			{
+				state.secondcdist = state.maxcdist;
+				state.maxcdist = state.newcdist[j];
+				state.maxCenter = j;
 			}
+			else if (state.newcdist[j] > state.secondcdist)
+				state.secondcdist = state.newcdist[j];
 		}
 
-		/* Step 6 */
-		/* We reset r(x) before Step 3 in the next iteration */
-		for (j = 0; j < numSamples; j++)
-			upperBound[j] += newcdist[closestCenters[j]];
+		KmeansRun(&state, HamerlyUpdateBoundsRange, numSamples, KMEANS_MIN_SAMPLES_PER_THREAD, &result);
 
-		/* Step 7 */
-		for (j = 0; j < numCenters; j++)
-			memcpy(VectorArrayGet(centers, j), VectorArrayGet(newCenters, j), VECTOR_SIZE(dimensions));
+		MoveCenters(&state);
 
 		if (changes == 0 && iteration != 0)
 			break;
 	}
 
-	VectorArrayFree(newCenters);
-	pfree(centerCounts);
-	pfree(closestCenters);
-	pfree(lowerBound);
-	pfree(upperBound);
-	pfree(s);
-	pfree(halfcdist);
-	pfree(newcdist);
+	FreeKmeansState(&state);
 }
 
 /*
@@ -474,6 +1036,7 @@ CheckCenters(Relation index, VectorArray centers)
 	int			i;
 	int			j;
 	double		norm;
+	Datum		center;
 
 	if (centers->length != centers->maxlen)
 		elog(ERROR, "Not enough centers. Please report a bug.");
@@ -507,11 +1070,18 @@ CheckCenters(Relation index, VectorArray centers)
 	normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_NORM_PROC);
 	if (normprocinfo != NULL)
 	{
+		IvfflatType type = IvfflatGetType(index);
+
 		collation = index->rd_indcollation[0];
 
 		for (i = 0; i < centers->length; i++)
 		{
-			norm = DatumGetFloat8(FunctionCall1Coll(normprocinfo, collation, PointerGetDatum(VectorArrayGet(centers, i))));
+			/* NORM_PROC takes the type of the indexed column */
+			center = PointerGetDatum(VectorArrayGet(centers, i));
+			if (type == IVFFLAT_TYPE_HALFVEC)
+				center = PointerGetDatum(VectorToHalfVector(DatumGetVector(center)));
+
+			norm = DatumGetFloat8(FunctionCall1Coll(normprocinfo, collation, center));
 			if (norm == 0)
 				elog(ERROR, "Zero norm detected. Please report a bug.");
 		}
@@ -527,8 +1097,10 @@ IvfflatKmeans(Relation index, VectorArray samples, VectorArray centers)
 {
 	if (samples->length <= centers->maxlen)
 		QuickCenters(index, samples, centers);
-	else
+	else if (KmeansMemory(samples, centers, true) <= (Size) maintenance_work_mem * 1024L)
 		ElkanKmeans(index, samples, centers);
+	else
+		HamerlyKmeans(index, samples, centers);
 
 	CheckCenters(index, centers);
 }
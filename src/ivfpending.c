@@ -0,0 +1,773 @@
+#include "postgres.h"
+
+#include "commands/vacuum.h"
+#include "ivfflat.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/lmgr.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+/*
+ * Pending list for fastupdate
+ *
+ * Inserts append tuples to the pending pages instead of finding the closest
+ * list. Flushes move the pending tuples to lists in bulk, sorted by list, so
+ * each list page is written once. Scans read the pending pages before the
+ * lists.
+ *
+ * The pages form a ring: the pending pages from the head to the tail, then
+ * the pages already flushed, which inserts reuse before adding pages. Pages
+ * are only added to the ring, never removed, so a walk from the head still
+ * reaches the tail after other backends change them.
+ *
+ * Like GIN's fastupdate, inserts only lock the metapage and tail buffers.
+ * Flushes take a lock on the metapage (separate from the buffer lock) in
+ * exclusive mode for each batch of pages, only conditionally, so nothing
+ * waits for a flush to start, and vacuum waits for one batch at most. Before
+ * moving the tail, a flush starts a new tail, so the pages it moves do not
+ * change. Scans only take buffer locks, and since a page leaves the pending
+ * pages after its tuples are in lists, they see each tuple in one place or
+ * both, and skip the pending tids in lists.
+ *
+ * Moving tuples takes more than one WAL record, so the metapage marks the
+ * pages being moved. If a flush does not finish, the next flush skips the
+ * tuples already moved.
+ */
+
+typedef struct PendingTuple
+{
+	ListInfo	listInfo;
+	BlockNumber startPage;
+	int			order;			/* in the pending list, to keep sort stable */
+	IndexTuple	itup;
+}			PendingTuple;
+
+typedef struct PendingState
+{
+	PendingTuple *tuples;
+	int			length;
+	int			maxlen;
+	Size		bytes;
+}			PendingState;
+
+/*
+ * Check if the metapage has the pending list, which indexes created before
+ * fastupdate do not
+ */
+static bool
+MetaHasPending(Page page)
+{
+	char	   *end = (char *) &IvfflatPageGetMeta(page)->nFlushingPages + sizeof(uint32);
+
+	return ((PageHeader) page)->pd_lower >= end - (char *) page;
+}
+
+/*
+ * Compare heap tids
+ */
+int
+IvfflatCompareTids(const void *a, const void *b)
+{
+	return ItemPointerCompare((ItemPointer) a, (ItemPointer) b);
+}
+
+/*
+ * Get the pending pages with tuples that are not in lists
+ *
+ * Returns false if there are none
+ */
+bool
+IvfflatGetPending(Relation index, IvfflatPendingInfo * pending)
+{
+	Buffer		buf;
+	Page		page;
+	IvfflatMetaPage metap;
+
+	pending->startPage = InvalidBlockNumber;
+	pending->tailPage = InvalidBlockNumber;
+	pending->nPages = 0;
+	pending->nFlushingPages = 0;
+
+	buf = ReadBuffer(index, IVFFLAT_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	metap = IvfflatPageGetMeta(page);
+	if (MetaHasPending(page) && metap->nPendingPages > 0)
+	{
+		pending->startPage = metap->pendingHead;
+		pending->tailPage = metap->pendingTail;
+		pending->nPages = metap->nPendingPages;
+		pending->nFlushingPages = metap->nFlushingPages;
+	}
+	UnlockReleaseBuffer(buf);
+
+	return pending->nPages > 0;
+}
+
+/*
+ * Start a new tail after the tail, reusing the next page if it was flushed
+ *
+ * The caller holds the metapage and tail buffers in exclusive mode, and
+ * passes the registered metapage
+ */
+static Buffer
+AdvanceTail(Relation index, GenericXLogState *state, IvfflatMetaPage metap, Buffer buf)
+{
+	BlockNumber nextblkno = IvfflatPageGetOpaque(BufferGetPage(buf))->nextblkno;
+	Buffer		newbuf;
+	Page		newpage;
+
+	if (nextblkno != metap->pendingHead)
+	{
+		newbuf = ReadBuffer(index, nextblkno);
+		LockBuffer(newbuf, BUFFER_LOCK_EXCLUSIVE);
+		nextblkno = IvfflatPageGetOpaque(BufferGetPage(newbuf))->nextblkno;
+	}
+	else
+	{
+		/* Add a page between the tail and the head */
+		Page		page = GenericXLogRegisterBuffer(state, buf, 0);
+
+		newbuf = IvfflatNewBuffer(index, MAIN_FORKNUM);
+		IvfflatPageGetOpaque(page)->nextblkno = BufferGetBlockNumber(newbuf);
+		MarkBufferDirty(buf);
+	}
+
+	newpage = GenericXLogRegisterBuffer(state, newbuf, GENERIC_XLOG_FULL_IMAGE);
+	IvfflatInitPage(newbuf, newpage);
+	IvfflatPageGetOpaque(newpage)->nextblkno = nextblkno;
+
+	metap->pendingTail = BufferGetBlockNumber(newbuf);
+
+	return newbuf;
+}
+
+/*
+ * Append a tuple to the pending list
+ *
+ * Returns true if the pending list is larger than ivfflat.pending_list_limit
+ */
+bool
+IvfflatInsertPending(Relation index, IndexTuple itup)
+{
+	Size		itemsz = MAXALIGN(IndexTupleSize(itup));
+	Buffer		metabuf;
+	Page		metapage;
+	IvfflatMetaPage metap;
+	Buffer		buf;
+	Buffer		prevbuf = InvalidBuffer;
+	Page		page;
+	GenericXLogState *state;
+	uint32		nPendingPages;
+
+	Assert(itemsz <= BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(sizeof(IvfflatPageOpaqueData)));
+
+	/* Serializes appends, and extending the relation */
+	metabuf = ReadBuffer(index, IVFFLAT_METAPAGE_BLKNO);
+	LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+	metapage = BufferGetPage(metabuf);
+	metap = IvfflatPageGetMeta(metapage);
+
+	state = GenericXLogStart(index);
+
+	if (!MetaHasPending(metapage) || !BlockNumberIsValid(metap->pendingTail))
+	{
+		/* Create the pending list, with a page that points to itself */
+		metapage = GenericXLogRegisterBuffer(state, metabuf, 0);
+		metap = IvfflatPageGetMeta(metapage);
+
+		buf = IvfflatNewBuffer(index, MAIN_FORKNUM);
+		page = GenericXLogRegisterBuffer(state, buf, GENERIC_XLOG_FULL_IMAGE);
+		IvfflatInitPage(buf, page);
+		IvfflatPageGetOpaque(page)->nextblkno = BufferGetBlockNumber(buf);
+
+		metap->pendingHead = BufferGetBlockNumber(buf);
+		metap->pendingTail = metap->pendingHead;
+		metap->nPendingPages = 0;
+		metap->nFlushingPages = 0;
+		((PageHeader) metapage)->pd_lower =
+			((char *) metap + sizeof(IvfflatMetaPageData)) - (char *) metapage;
+		MarkBufferDirty(metabuf);
+	}
+	else
+	{
+		buf = ReadBuffer(index, metap->pendingTail);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+
+		if (PageGetFreeSpace(BufferGetPage(buf)) < itemsz)
+		{
+			metapage = GenericXLogRegisterBuffer(state, metabuf, 0);
+			metap = IvfflatPageGetMeta(metapage);
+			MarkBufferDirty(metabuf);
+
+			prevbuf = buf;
+			buf = AdvanceTail(index, state, metap, prevbuf);
+		}
+
+		/* Returns the same page if already registered */
+		page = GenericXLogRegisterBuffer(state, buf, 0);
+	}
+
+	/* Pages are counted once they have tuples */
+	if (PageIsEmpty(page))
+	{
+		metapage = GenericXLogRegisterBuffer(state, metabuf, 0);
+		metap = IvfflatPageGetMeta(metapage);
+		metap->nPendingPages++;
+		MarkBufferDirty(metabuf);
+	}
+
+	/* Add to next offset */
+	if (PageAddItem(page, (Item) itup, itemsz, InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
+		elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+
+	nPendingPages = metap->nPendingPages;
+
+	/* Commit */
+	MarkBufferDirty(buf);
+	GenericXLogFinish(state);
+
+	UnlockReleaseBuffer(buf);
+	if (BufferIsValid(prevbuf))
+		UnlockReleaseBuffer(prevbuf);
+	UnlockReleaseBuffer(metabuf);
+
+	return (Size) nPendingPages * BLCKSZ > (Size) ivfflat_pending_list_limit * 1024;
+}
+
+/*
+ * Copy the tuples of a pending page
+ *
+ * Returns the next page
+ */
+static BlockNumber
+ReadPendingPage(Relation index, BlockNumber blkno, PendingState * state)
+{
+	Buffer		buf;
+	Page		page;
+	OffsetNumber offno;
+	OffsetNumber maxoffno;
+
+	buf = ReadBuffer(index, blkno);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	maxoffno = PageGetMaxOffsetNumber(page);
+
+	for (offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+	{
+		IndexTuple	itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, offno));
+		Size		itemsz = IndexTupleSize(itup);
+		PendingTuple *tuple;
+
+		if (state->length == state->maxlen)
+		{
+			state->maxlen *= 2;
+			state->tuples = repalloc_huge(state->tuples, sizeof(PendingTuple) * state->maxlen);
+		}
+
+		tuple = &state->tuples[state->length];
+		tuple->order = state->length;
+		tuple->itup = palloc(itemsz);
+		memcpy(tuple->itup, itup, itemsz);
+		state->length++;
+		state->bytes += sizeof(PendingTuple) + itemsz;
+	}
+
+	blkno = IvfflatPageGetOpaque(page)->nextblkno;
+
+	UnlockReleaseBuffer(buf);
+
+	return blkno;
+}
+
+/*
+ * Compare pending tuples by list
+ */
+static int
+ComparePendingTuples(const void *a, const void *b)
+{
+	const PendingTuple *ta = (const PendingTuple *) a;
+	const PendingTuple *tb = (const PendingTuple *) b;
+
+	if (ta->listInfo.blkno != tb->listInfo.blkno)
+		return ta->listInfo.blkno < tb->listInfo.blkno ? -1 : 1;
+
+	if (ta->listInfo.offno != tb->listInfo.offno)
+		return ta->listInfo.offno < tb->listInfo.offno ? -1 : 1;
+
+	return ta->order - tb->order;
+}
+
+/*
+ * Remove tuples that a flush that did not finish already moved to the list
+ *
+ * Returns the number of tuples left
+ */
+static int
+RemoveMovedTuples(Relation index, BlockNumber startPage, PendingTuple * tuples, int ntuples)
+{
+	BlockNumber searchPage = startPage;
+	ItemPointerData *tids;
+	int			ntids = 0;
+	int			maxtids = 1024;
+	int			count = 0;
+
+	tids = palloc(sizeof(ItemPointerData) * maxtids);
+
+	while (BlockNumberIsValid(searchPage))
+	{
+		Buffer		buf;
+		Page		page;
+		OffsetNumber offno;
+		OffsetNumber maxoffno;
+
+		buf = ReadBuffer(index, searchPage);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		maxoffno = PageGetMaxOffsetNumber(page);
+
+		for (offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			IndexTuple	itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, offno));
+
+			if (ntids == maxtids)
+			{
+				maxtids *= 2;
+				tids = repalloc_huge(tids, sizeof(ItemPointerData) * maxtids);
+			}
+
+			tids[ntids++] = itup->t_tid;
+		}
+
+		searchPage = IvfflatPageGetOpaque(page)->nextblkno;
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	qsort(tids, ntids, sizeof(ItemPointerData), IvfflatCompareTids);
+
+	for (int i = 0; i < ntuples; i++)
+	{
+		if (bsearch(&tuples[i].itup->t_tid, tids, ntids, sizeof(ItemPointerData), IvfflatCompareTids) == NULL)
+			tuples[count++] = tuples[i];
+	}
+
+	pfree(tids);
+
+	return count;
+}
+
+/*
+ * Add tuples to a list, with one WAL record for each page
+ */
+static void
+AppendTuples(Relation index, ListInfo listInfo, PendingTuple * tuples, int ntuples)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState *state;
+	IvfflatList list;
+	BlockNumber insertPage;
+	BlockNumber originalInsertPage;
+	bool		changed = false;
+
+	if (ntuples == 0)
+		return;
+
+	/* Insert pages change with inserts and vacuum, so they are not cached */
+	buf = ReadBuffer(index, listInfo.blkno);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	list = (IvfflatList) PageGetItem(page, PageGetItemId(page, listInfo.offno));
+	insertPage = list->insertPage;
+	UnlockReleaseBuffer(buf);
+
+	originalInsertPage = insertPage;
+
+	buf = ReadBuffer(index, insertPage);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, 0);
+
+	for (int i = 0; i < ntuples; i++)
+	{
+		IndexTuple	itup = tuples[i].itup;
+		Size		itemsz = MAXALIGN(IndexTupleSize(itup));
+
+		while (PageGetFreeSpace(page) < itemsz)
+		{
+			BlockNumber nextblkno = IvfflatPageGetOpaque(page)->nextblkno;
+
+			if (BlockNumberIsValid(nextblkno))
+			{
+				/* Move to next page */
+				if (changed)
+					IvfflatCommitBuffer(buf, state);
+				else
+				{
+					GenericXLogAbort(state);
+					UnlockReleaseBuffer(buf);
+				}
+
+				buf = ReadBuffer(index, nextblkno);
+				LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+				state = GenericXLogStart(index);
+				page = GenericXLogRegisterBuffer(state, buf, 0);
+			}
+			else
+			{
+				Buffer		metabuf;
+
+				/*
+				 * From ReadBufferExtended: Caller is responsible for ensuring
+				 * that only one backend tries to extend a relation at the
+				 * same time!
+				 */
+				metabuf = ReadBuffer(index, IVFFLAT_METAPAGE_BLKNO);
+				LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+
+				/* Commits the tuples added to the previous page */
+				IvfflatAppendPage(index, &buf, &page, &state, MAIN_FORKNUM);
+
+				UnlockReleaseBuffer(metabuf);
+			}
+
+			insertPage = BufferGetBlockNumber(buf);
+			changed = false;
+		}
+
+		/* Add to next offset */
+		if (PageAddItem(page, (Item) itup, itemsz, InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
+			elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+
+		changed = true;
+	}
+
+	IvfflatCommitBuffer(buf, state);
+
+	/* Update the insert page */
+	if (insertPage != originalInsertPage)
+		IvfflatUpdateList(index, state, listInfo, insertPage, originalInsertPage, InvalidBlockNumber, MAIN_FORKNUM);
+}
+
+/*
+ * Move tuples to their closest lists
+ */
+static void
+MoveTuples(Relation index, PendingState * state, bool recovering)
+{
+	TupleDesc	tupdesc = RelationGetDescr(index);
+	PendingTuple *tuples = state->tuples;
+	bool		quantized = IvfflatIsQuantized(index);
+	Vector	   *vec = NULL;
+	int			start;
+	int			end;
+
+	if (quantized)
+		vec = InitVector(TupleDescAttr(tupdesc, 0)->atttypmod);
+
+	for (int i = 0; i < state->length; i++)
+	{
+		PendingTuple *tuple = &tuples[i];
+		bool		isnull;
+		Datum		datum = index_getattr(tuple->itup, 1, tupdesc, &isnull);
+
+		/* Values were normalized when added to the pending list */
+		Datum		value = PointerGetDatum(PG_DETOAST_DATUM(datum));
+
+		/* Find lists with the levels of quantized vectors */
+		if (quantized)
+		{
+			QuantVectorDecode((QuantVector *) DatumGetPointer(value), vec->x);
+			IvfflatFindList(index, PointerGetDatum(vec), &tuple->listInfo, &tuple->startPage, NULL);
+		}
+		else
+			IvfflatFindList(index, value, &tuple->listInfo, &tuple->startPage, NULL);
+
+		if (value != datum)
+			pfree(DatumGetPointer(value));
+	}
+
+	if (vec != NULL)
+		pfree(vec);
+
+	qsort(tuples, state->length, sizeof(PendingTuple), ComparePendingTuples);
+
+	for (start = 0; start < state->length; start = end)
+	{
+		int			count;
+
+		CHECK_FOR_INTERRUPTS();
+
+		/* Find the tuples of the same list */
+		for (end = start + 1; end < state->length; end++)
+		{
+			if (tuples[end].listInfo.blkno != tuples[start].listInfo.blkno ||
+				tuples[end].listInfo.offno != tuples[start].listInfo.offno)
+				break;
+		}
+
+		count = end - start;
+		if (recovering)
+			count = RemoveMovedTuples(index, tuples[start].startPage, &tuples[start], count);
+
+		AppendTuples(index, tuples[start].listInfo, &tuples[start], count);
+	}
+}
+
+/*
+ * Mark the pages that are being moved
+ */
+static void
+SetFlushingPages(Relation index, uint32 nFlushingPages)
+{
+	Buffer		metabuf;
+	Page		metapage;
+	GenericXLogState *state;
+
+	metabuf = ReadBuffer(index, IVFFLAT_METAPAGE_BLKNO);
+	LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	metapage = GenericXLogRegisterBuffer(state, metabuf, 0);
+	IvfflatPageGetMeta(metapage)->nFlushingPages = nFlushingPages;
+	IvfflatCommitBuffer(metabuf, state);
+}
+
+/*
+ * Start a new tail if the page is still the tail, so inserts do not add
+ * tuples to it while they are moved
+ */
+static void
+SealTail(Relation index, BlockNumber blkno)
+{
+	Buffer		metabuf;
+	Page		metapage;
+	Buffer		buf;
+	Buffer		newbuf;
+	GenericXLogState *state;
+
+	metabuf = ReadBuffer(index, IVFFLAT_METAPAGE_BLKNO);
+	LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+	if (IvfflatPageGetMeta(BufferGetPage(metabuf))->pendingTail != blkno)
+	{
+		UnlockReleaseBuffer(metabuf);
+		return;
+	}
+
+	buf = ReadBuffer(index, blkno);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+
+	state = GenericXLogStart(index);
+	metapage = GenericXLogRegisterBuffer(state, metabuf, 0);
+	newbuf = AdvanceTail(index, state, IvfflatPageGetMeta(metapage), buf);
+	MarkBufferDirty(newbuf);
+	MarkBufferDirty(metabuf);
+	GenericXLogFinish(state);
+
+	UnlockReleaseBuffer(newbuf);
+	UnlockReleaseBuffer(buf);
+	UnlockReleaseBuffer(metabuf);
+}
+
+/*
+ * Remove the moved pages from the pending pages, which leaves them for
+ * inserts to reuse
+ */
+static void
+FinishFlushingPages(Relation index, uint32 npages, BlockNumber nextblkno)
+{
+	Buffer		metabuf;
+	Page		metapage;
+	IvfflatMetaPage metap;
+	GenericXLogState *state;
+
+	metabuf = ReadBuffer(index, IVFFLAT_METAPAGE_BLKNO);
+	LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	metapage = GenericXLogRegisterBuffer(state, metabuf, 0);
+	metap = IvfflatPageGetMeta(metapage);
+
+	metap->pendingHead = nextblkno;
+	metap->nPendingPages -= npages;
+	metap->nFlushingPages = 0;
+
+	IvfflatCommitBuffer(metabuf, state);
+}
+
+/*
+ * Move a batch of pending pages to lists
+ *
+ * Returns the number of pages moved
+ */
+static uint32
+FlushBatch(Relation index, IvfflatPendingInfo * pending, uint32 maxPages, Size maxBytes)
+{
+	PendingState state;
+	BlockNumber blkno = pending->startPage;
+	uint32		npages = 0;
+
+	/* Pages of a flush that did not finish are moved first */
+	bool		recovering = pending->nFlushingPages > 0;
+
+	if (recovering)
+		maxPages = pending->nFlushingPages;
+
+	state.length = 0;
+	state.maxlen = 1024;
+	state.bytes = 0;
+	state.tuples = palloc(sizeof(PendingTuple) * state.maxlen);
+
+	while (npages < maxPages)
+	{
+		if (!recovering && npages > 0 && state.bytes >= maxBytes)
+			break;
+
+		CHECK_FOR_INTERRUPTS();
+
+		/* Pages of a flush that did not finish were already sealed */
+		if (!recovering && blkno == pending->tailPage)
+			SealTail(index, blkno);
+
+		blkno = ReadPendingPage(index, blkno, &state);
+		npages++;
+	}
+
+	if (!recovering)
+		SetFlushingPages(index, npages);
+
+	MoveTuples(index, &state, recovering);
+
+	FinishFlushingPages(index, npages, blkno);
+
+	return npages;
+}
+
+/*
+ * Move the pending tuples to lists
+ *
+ * Does nothing if vacuum, a parallel scan, or another flush holds the
+ * pending list lock, so callers never wait. workMem (in kB) limits the
+ * tuples moved at once, and the lock is released between batches. Only
+ * moves the pages pending at the start, so inserts cannot keep it running.
+ */
+void
+IvfflatFlushPending(Relation index, int workMem)
+{
+	IvfflatPendingInfo pending;
+	MemoryContext flushCtx;
+	MemoryContext oldCtx;
+	uint32		remaining;
+	Size		maxBytes = (Size) workMem * 1024;
+
+	/* Check without the lock first, since there is usually nothing to do */
+	if (!IvfflatGetPending(index, &pending))
+		return;
+
+	remaining = pending.nPages;
+
+	flushCtx = AllocSetContextCreate(CurrentMemoryContext,
+									 "Ivfflat flush temporary context",
+									 ALLOCSET_DEFAULT_SIZES);
+	oldCtx = MemoryContextSwitchTo(flushCtx);
+
+	while (remaining > 0)
+	{
+		uint32		npages;
+
+		if (!ConditionalLockPage(index, IVFFLAT_METAPAGE_BLKNO, ExclusiveLock))
+			break;
+
+		/* Pending pages only move while the lock is held */
+		if (!IvfflatGetPending(index, &pending))
+		{
+			UnlockPage(index, IVFFLAT_METAPAGE_BLKNO, ExclusiveLock);
+			break;
+		}
+
+		npages = FlushBatch(index, &pending, Min(remaining, pending.nPages), maxBytes);
+
+		UnlockPage(index, IVFFLAT_METAPAGE_BLKNO, ExclusiveLock);
+
+		remaining -= Min(remaining, npages);
+
+		MemoryContextReset(flushCtx);
+	}
+
+	MemoryContextSwitchTo(oldCtx);
+	MemoryContextDelete(flushCtx);
+}
+
+/*
+ * Bulk delete tuples from the pending list
+ *
+ * The caller holds the pending list lock in share mode, so a flush cannot
+ * move tuples after they are checked
+ */
+void
+IvfflatBulkDeletePending(Relation index, IndexBulkDeleteResult *stats,
+						 IndexBulkDeleteCallback callback, void *callback_state)
+{
+	IvfflatPendingInfo pending;
+	BlockNumber blkno;
+	OffsetNumber deletable[MaxOffsetNumber];
+
+	if (!IvfflatGetPending(index, &pending))
+		return;
+
+	blkno = pending.startPage;
+	for (uint32 i = 0; i < pending.nPages; i++)
+	{
+		Buffer		buf;
+		Page		page;
+		GenericXLogState *state;
+		OffsetNumber offno;
+		OffsetNumber maxoffno;
+		int			ndeletable = 0;
+
+		vacuum_delay_point();
+
+		buf = ReadBuffer(index, blkno);
+
+		/*
+		 * ambulkdelete cannot delete entries from pages that are pinned by
+		 * other backends
+		 *
+		 * https://www.postgresql.org/docs/current/index-locking.html
+		 */
+		LockBufferForCleanup(buf);
+
+		state = GenericXLogStart(index);
+		page = GenericXLogRegisterBuffer(state, buf, 0);
+
+		maxoffno = PageGetMaxOffsetNumber(page);
+
+		/* Find deleted tuples */
+		for (offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			IndexTuple	itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, offno));
+
+			if (callback(&itup->t_tid, callback_state))
+			{
+				deletable[ndeletable++] = offno;
+				stats->tuples_removed++;
+			}
+			else
+				stats->num_index_tuples++;
+		}
+
+		blkno = IvfflatPageGetOpaque(page)->nextblkno;
+
+		if (ndeletable > 0)
+		{
+			/* Delete tuples */
+			PageIndexMultiDelete(page, deletable, ndeletable);
+			MarkBufferDirty(buf);
+			GenericXLogFinish(state);
+		}
+		else
+			GenericXLogAbort(state);
+
+		UnlockReleaseBuffer(buf);
+	}
+}
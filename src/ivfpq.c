@@ -0,0 +1,359 @@
+#include "postgres.h"
+
+#include <float.h>
+#include <math.h>
+
+#include "ivfflat.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "vectorutils.h"
+
+/* Residuals of a sample of the samples are enough to train the codebooks */
+#define IVFPQ_TRAIN_SAMPLES 10000
+
+/*
+ * Get the number of subvectors
+ */
+int
+IvfpqGetM(Relation index, int dimensions)
+{
+	IvfpqOptions *opts = (IvfpqOptions *) index->rd_options;
+	int			m;
+
+	if (opts && opts->m != IVFPQ_DEFAULT_M)
+		return opts->m;
+
+	/* Largest divisor with at least eight dimensions per subvector */
+	for (m = Max(dimensions / 8, 1); m > 1; m--)
+	{
+		if (dimensions % m == 0)
+			break;
+	}
+
+	return m;
+}
+
+/*
+ * Get the norm of an array
+ */
+static double
+Norm(int dim, const float *x)
+{
+	double		norm = 0.0;
+
+	for (int i = 0; i < dim; i++)
+		norm += (double) x[i] * (double) x[i];
+
+	return sqrt(norm);
+}
+
+/*
+ * Compare vectors
+ */
+static int
+CompareVectors(const void *a, const void *b)
+{
+	return vector_cmp_internal((Vector *) a, (Vector *) b);
+}
+
+/*
+ * Keep only distinct subvectors if there are few
+ *
+ * k-means++ cannot choose more distinct centers than there are distinct
+ * samples, so these use the quick approach instead
+ */
+static void
+DedupSubvectors(VectorArray subsamples, int maxlen)
+{
+	int			distinct = 0;
+
+	qsort(subsamples->items, subsamples->length, subsamples->itemsize, CompareVectors);
+
+	for (int i = 0; i < subsamples->length && distinct <= maxlen; i++)
+	{
+		if (i == 0 || CompareVectors(VectorArrayGet(subsamples, i), VectorArrayGet(subsamples, i - 1)) != 0)
+			distinct++;
+	}
+
+	if (distinct > maxlen)
+		return;
+
+	distinct = 0;
+	for (int i = 0; i < subsamples->length; i++)
+	{
+		Vector	   *vec = VectorArrayGet(subsamples, i);
+
+		if (i == 0 || CompareVectors(vec, VectorArrayGet(subsamples, distinct - 1)) != 0)
+		{
+			if (i != distinct)
+				VectorArraySet(subsamples, distinct, vec);
+			distinct++;
+		}
+	}
+	subsamples->length = distinct;
+}
+
+/*
+ * Train the codebooks on the residuals of the samples
+ *
+ * Samples are replaced with their residuals
+ */
+IvfpqCodebook *
+IvfpqTrainCodebook(Relation index, VectorArray samples, VectorArray centers, int m)
+{
+	IvfpqCodebook *codebook = palloc(sizeof(IvfpqCodebook));
+	int			dimensions = samples->dim;
+	int			dsub = dimensions / m;
+	int			numSamples = Min(samples->length, IVFPQ_TRAIN_SAMPLES);
+	int			step = numSamples > 0 ? samples->length / numSamples : 1;
+
+	codebook->dimensions = dimensions;
+	codebook->m = m;
+	codebook->dsub = dsub;
+	codebook->centroids = palloc(sizeof(float) * IVFPQ_CENTROIDS * dimensions);
+
+	/* Subtract the closest center */
+	for (int i = 0; i < numSamples; i++)
+	{
+		Vector	   *vec = VectorArrayGet(samples, i * step);
+		double		minDistance = DBL_MAX;
+		Vector	   *closest = NULL;
+
+		CHECK_FOR_INTERRUPTS();
+
+		for (int j = 0; j < centers->length; j++)
+		{
+			Vector	   *center = VectorArrayGet(centers, j);
+			double		distance = VectorL2SquaredDistance(dimensions, vec->x, center->x);
+
+			if (distance < minDistance)
+			{
+				minDistance = distance;
+				closest = center;
+			}
+		}
+
+		for (int d = 0; d < dimensions; d++)
+			vec->x[d] -= closest->x[d];
+	}
+
+	/* Cluster each subvector */
+	for (int j = 0; j < m; j++)
+	{
+		VectorArray subsamples = VectorArrayInit(numSamples, dsub, VECTOR_SIZE(dsub));
+		VectorArray subcenters = VectorArrayInit(IVFPQ_CENTROIDS, dsub, VECTOR_SIZE(dsub));
+
+		for (int i = 0; i < numSamples; i++)
+		{
+			Vector	   *vec = VectorArrayGet(subsamples, i);
+
+			SET_VARSIZE(vec, VECTOR_SIZE(dsub));
+			vec->dim = dsub;
+			memcpy(vec->x, VectorArrayGet(samples, i * step)->x + j * dsub, sizeof(float) * dsub);
+		}
+		subsamples->length = numSamples;
+
+		DedupSubvectors(subsamples, IVFPQ_CENTROIDS);
+		IvfflatKmeans(index, subsamples, subcenters);
+
+		for (int k = 0; k < IVFPQ_CENTROIDS; k++)
+			memcpy(codebook->centroids + ((Size) j * IVFPQ_CENTROIDS + k) * dsub, VectorArrayGet(subcenters, k)->x, sizeof(float) * dsub);
+
+		VectorArrayFree(subsamples);
+		VectorArrayFree(subcenters);
+	}
+
+	return codebook;
+}
+
+/*
+ * Create codebook pages and point the metapage to them
+ *
+ * The centroids are split across items as needed to fill each page
+ */
+void
+IvfpqCreateCodebookPages(Relation index, IvfpqCodebook * codebook, ForkNumber forkNum)
+{
+	Buffer		buf;
+	Page		page;
+	GenericXLogState *state;
+	BlockNumber codebookPage;
+	IvfpqMetaPageData *metap;
+	char	   *ptr = (char *) codebook->centroids;
+	Size		remaining = sizeof(float) * IVFPQ_CENTROIDS * codebook->dimensions;
+
+	buf = IvfflatNewBuffer(index, forkNum);
+	IvfflatInitRegisterPage(index, &buf, &page, &state);
+
+	codebookPage = BufferGetBlockNumber(buf);
+
+	while (remaining > 0)
+	{
+		Size		itemsz;
+
+		if (PageGetFreeSpace(page) < MAXALIGN(sizeof(float)))
+			IvfflatAppendPage(index, &buf, &page, &state, forkNum);
+
+		itemsz = Min(remaining, MAXALIGN_DOWN(PageGetFreeSpace(page)));
+
+		if (PageAddItem(page, (Item) ptr, itemsz, InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
+			elog(ERROR, "failed to add index item to \"%s\"", RelationGetRelationName(index));
+
+		ptr += itemsz;
+		remaining -= itemsz;
+	}
+
+	IvfflatCommitBuffer(buf, state);
+
+	/* Update the metapage */
+	buf = ReadBufferExtended(index, forkNum, IVFFLAT_METAPAGE_BLKNO, RBM_NORMAL, NULL);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	state = GenericXLogStart(index);
+	page = GenericXLogRegisterBuffer(state, buf, 0);
+
+	metap = IvfpqPageGetMeta(page);
+	metap->m = codebook->m;
+	metap->codebookPage = codebookPage;
+	((PageHeader) page)->pd_lower =
+		((char *) metap + sizeof(IvfpqMetaPageData)) - (char *) page;
+
+	IvfflatCommitBuffer(buf, state);
+}
+
+/*
+ * Read the codebook pages into centroids
+ */
+void
+IvfpqReadCodebook(Relation index, BlockNumber blkno, float *centroids, Size size)
+{
+	char	   *ptr = (char *) centroids;
+
+	while (BlockNumberIsValid(blkno))
+	{
+		Buffer		buf;
+		Page		page;
+		OffsetNumber maxoffno;
+
+		buf = ReadBuffer(index, blkno);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		maxoffno = PageGetMaxOffsetNumber(page);
+
+		for (OffsetNumber offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			ItemId		itemid = PageGetItemId(page, offno);
+			Size		itemsz = ItemIdGetLength(itemid);
+
+			if (ptr + itemsz > (char *) centroids + size)
+				elog(ERROR, "invalid codebook in \"%s\"", RelationGetRelationName(index));
+
+			memcpy(ptr, PageGetItem(page, itemid), itemsz);
+			ptr += itemsz;
+		}
+
+		blkno = IvfflatPageGetOpaque(page)->nextblkno;
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	if (ptr != (char *) centroids + size)
+		elog(ERROR, "invalid codebook in \"%s\"", RelationGetRelationName(index));
+}
+
+/*
+ * Get the codebook, which is cached with the lists
+ */
+IvfpqCodebook *
+IvfpqGetCodebook(Relation index)
+{
+	return IvfflatGetCache(index, true)->codebook;
+}
+
+/*
+ * Encode the residual of a value from its list center
+ *
+ * The error bound is computed in double precision and rounded up, since
+ * scans rely on it to never overestimate the distance
+ */
+void
+IvfpqEncode(IvfpqCodebook * codebook, Vector * value, Vector * center, IndexTuple itup)
+{
+	int			dsub = codebook->dsub;
+	uint8	   *codes = IvfpqTupleCodes(itup);
+	float	   *residual = palloc(sizeof(float) * codebook->dimensions);
+	double		error = 0.0;
+
+	for (int i = 0; i < codebook->dimensions; i++)
+		residual[i] = value->x[i] - center->x[i];
+
+	for (int j = 0; j < codebook->m; j++)
+	{
+		float	   *sub = residual + j * dsub;
+		float	   *centroids = codebook->centroids + (Size) j * IVFPQ_CENTROIDS * dsub;
+		double		minDistance = DBL_MAX;
+		int			closest = 0;
+
+		for (int k = 0; k < IVFPQ_CENTROIDS; k++)
+		{
+			double		distance = VectorL2SquaredDistance(dsub, sub, centroids + k * dsub);
+
+			if (distance < minDistance)
+			{
+				minDistance = distance;
+				closest = k;
+			}
+		}
+
+		codes[j] = closest;
+
+		for (int d = 0; d < dsub; d++)
+		{
+			double		diff = (double) sub[d] - centroids[closest * dsub + d];
+
+			error += diff * diff;
+		}
+	}
+
+	itup->t_info = IVFPQ_TUPLE_SIZE(codebook->m);
+	IvfpqTupleError(itup) = sqrt(error) + IVFPQ_ERROR_SLACK * (Norm(value->dim, value->x) + Norm(center->dim, center->x));
+
+	pfree(residual);
+}
+
+/*
+ * Compute the lookup table for a list
+ *
+ * Entry k of subvector j is the squared distance from the residual of the
+ * query to that centroid, so the distance to an entry is the sum of one
+ * entry per subvector. Returns the slack for rounding on the query side.
+ */
+double
+IvfpqComputeTable(IvfpqCodebook * codebook, Vector * query, Vector * center, float *table)
+{
+	int			dsub = codebook->dsub;
+
+	for (int j = 0; j < codebook->m; j++)
+	{
+		float	   *centroids = codebook->centroids + (Size) j * IVFPQ_CENTROIDS * dsub;
+		float	   *qx = query->x + j * dsub;
+		float	   *cx = center->x + j * dsub;
+
+		for (int k = 0; k < IVFPQ_CENTROIDS; k++)
+		{
+			double		distance = 0.0;
+
+			for (int d = 0; d < dsub; d++)
+			{
+				double		diff = ((double) qx[d] - cx[d]) - centroids[k * dsub + d];
+
+				distance += diff * diff;
+			}
+
+			table[j * IVFPQ_CENTROIDS + k] = distance;
+		}
+	}
+
+	return IVFPQ_ERROR_SLACK * (Norm(query->dim, query->x) + Norm(center->dim, center->x));
+}
@@ -9,12 +9,14 @@
 
 #include "postgres.h"
 #include <float.h>
+#include <math.h>
 #include <sys/mman.h>
 #include "access/relscan.h"
 #include "ivfflat.h"
 #include "miscadmin.h"
 #include "pgstat.h"
 #include "storage/bufmgr.h"
+#include "storage/lmgr.h"
 
 #include "catalog/pg_operator_d.h"
 #include "catalog/pg_type_d.h"
@@ -36,76 +38,482 @@ CompareLists(const pairingheap_node *a, const pairingheap_node *b, void *arg)
 }
 
 /*
- * Get lists and sort by distance
+ * Compare list distances for sorting
+ */
+static int
+CompareScanLists(const void *a, const void *b)
+{
+	double		da = ((const IvfflatScanList *) a)->distance;
+	double		db = ((const IvfflatScanList *) b)->distance;
+
+	if (da < db)
+		return -1;
+	if (da > db)
+		return 1;
+	return 0;
+}
+
+/*
+ * Get the distance to a product quantized entry from the lookup table
+ *
+ * With re-ranking, this is a lower bound on the exact distance, which the
+ * executor rechecks with the heap tuple
+ */
+static inline double
+GetPqDistance(IvfflatScanOpaque so, IndexTuple itup, double slack)
+{
+	uint8	   *codes = IvfpqTupleCodes(itup);
+	float	   *table = so->table;
+	double		distance = 0.0;
+
+	for (int j = 0; j < so->codebook->m; j++)
+		distance += table[j * IVFPQ_CENTROIDS + codes[j]];
+
+	if (!so->rerank)
+		return distance;
+
+	distance = sqrt(distance) - IvfpqTupleError(itup) - slack;
+	return distance > 0 ? distance : 0;
+}
+
+/*
+ * Get the distance to an entry
+ */
+static inline double
+GetItemDistance(IvfflatScanOpaque so, TupleDesc tupdesc, IndexTuple itup, Datum value, double slack)
+{
+	Datum		datum;
+	bool		isnull;
+
+	if (so->codebook != NULL)
+		return GetPqDistance(so, itup, slack);
+
+	datum = index_getattr(itup, 1, tupdesc, &isnull);
+
+	/*
+	 * Compute the distance on the page for built-in opclasses
+	 *
+	 * Use procinfo from the index instead of scan key for performance
+	 */
+	if (so->distfunc != NULL)
+	{
+		Pointer		ptr = DatumGetPointer(datum);
+
+		/* Large values may be compressed or have a short header */
+		if (VARATT_IS_EXTENDED(ptr))
+		{
+			Pointer		detoasted = (Pointer) PG_DETOAST_DATUM(datum);
+			double		distance = so->distfunc(detoasted, DatumGetPointer(value));
+
+			pfree(detoasted);
+			return distance;
+		}
+
+		return so->distfunc(ptr, DatumGetPointer(value));
+	}
+
+	return DatumGetFloat8(FunctionCall2Coll(so->procinfo, so->collation, datum, value));
+}
+
+/*
+ * Restore the heap property downwards from an item
  */
 static void
-GetScanLists(IndexScanDesc scan, Datum value)
+SiftDownScanItem(IvfflatScanOpaque so, int64 i)
+{
+	IvfflatScanItem *items = so->items;
+	IvfflatScanItem item = items[i];
+
+	for (;;)
+	{
+		int64		child = 2 * i + 1;
+
+		if (child >= so->itemCount)
+			break;
+
+		if (child + 1 < so->itemCount && items[child + 1].distance < items[child].distance)
+			child++;
+
+		if (items[child].distance >= item.distance)
+			break;
+
+		items[i] = items[child];
+		i = child;
+	}
+
+	items[i] = item;
+}
+
+/*
+ * Add an item to the tuplesort
+ */
+static void
+PutScanItem(IvfflatScanOpaque so, TupleTableSlot *slot, IvfflatScanItem * item)
+{
+	ExecClearTuple(slot);
+	slot->tts_values[0] = Float8GetDatum(item->distance);
+	slot->tts_isnull[0] = false;
+	slot->tts_values[1] = PointerGetDatum(&item->tid);
+	slot->tts_isnull[1] = false;
+	slot->tts_values[2] = Int32GetDatum((int) item->indexblkno);
+	slot->tts_isnull[2] = false;
+	ExecStoreVirtualTuple(slot);
+
+	tuplesort_puttupleslot(so->sortstate, slot);
+}
+
+/*
+ * Add a candidate
+ *
+ * Candidates are kept in memory up to work_mem, and moved to the
+ * tuplesort, which can spill to disk, past that
+ */
+static inline void
+AddScanItem(IvfflatScanOpaque so, TupleTableSlot *slot, IvfflatScanItem * item)
+{
+	if (!so->spilled && so->itemCount == so->maxItems)
+	{
+		Size		maxBytes = (Size) work_mem * 1024;
+
+		if (so->maxItems * 2 * sizeof(IvfflatScanItem) <= maxBytes)
+		{
+			so->maxItems *= 2;
+			so->items = repalloc_huge(so->items, so->maxItems * sizeof(IvfflatScanItem));
+		}
+		else
+		{
+			for (int64 i = 0; i < so->itemCount; i++)
+				PutScanItem(so, slot, &so->items[i]);
+
+			so->itemCount = 0;
+			so->spilled = true;
+		}
+	}
+
+	if (so->spilled)
+		PutScanItem(so, slot, item);
+	else
+		so->items[so->itemCount++] = *item;
+}
+
+/*
+ * Get items from the pending list
+ *
+ * Flushes can move pending tuples to lists at any point, so this runs
+ * before lists are scanned and keeps the tids to skip in lists. Only one
+ * participant of a parallel scan reads the pending list, and it shares the
+ * tids with the others.
+ */
+static void
+GetPendingItems(IndexScanDesc scan, Datum value)
 {
-	Buffer		cbuf;
-	Page		cpage;
-	IvfflatList list;
-	OffsetNumber offno;
-	OffsetNumber maxoffno;
-	BlockNumber nextblkno = IVFFLAT_HEAD_BLKNO;
-	int			listCount = 0;
 	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
-	double		distance;
-	IvfflatScanList *scanlist;
-	double		maxDistance = DBL_MAX;
+	Relation	index = scan->indexRelation;
+	TupleDesc	tupdesc = RelationGetDescr(index);
+	IvfflatPendingInfo pending;
+	BlockNumber blkno;
+	IvfflatScanItem item;
+	int			maxTids = 1024;
+	TupleTableSlot *slot;
+
+	if (!IvfflatGetPending(index, &pending))
+		return;
+
+	so->pendingTids = palloc(sizeof(ItemPointerData) * maxTids);
+
+#if PG_VERSION_NUM >= 120000
+	slot = MakeSingleTupleTableSlot(so->tupdesc, &TTSOpsVirtual);
+#else
+	slot = MakeSingleTupleTableSlot(so->tupdesc);
+#endif
 
-	/* Search all list pages */
-	while (BlockNumberIsValid(nextblkno))
+	/*
+	 * Pages can be added between the start and the tail, and flushed pages
+	 * reused, so this reads to the tail instead of counting pages
+	 */
+	blkno = pending.startPage;
+	for (;;)
 	{
-		cbuf = ReadBuffer(scan->indexRelation, nextblkno);
-		LockBuffer(cbuf, BUFFER_LOCK_SHARE);
-		cpage = BufferGetPage(cbuf);
+		Buffer		buf;
+		Page		page;
+		OffsetNumber offno;
+		OffsetNumber maxoffno;
+		BlockNumber nextblkno;
+
+		CHECK_FOR_INTERRUPTS();
 
-		maxoffno = PageGetMaxOffsetNumber(cpage);
+		buf = ReadBuffer(index, blkno);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		maxoffno = PageGetMaxOffsetNumber(page);
 
 		for (offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
 		{
-			list = (IvfflatList) PageGetItem(cpage, PageGetItemId(cpage, offno));
+			IndexTuple	itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, offno));
 
-			/* Use procinfo from the index instead of scan key for performance */
-			distance = DatumGetFloat8(FunctionCall2Coll(so->procinfo, so->collation, PointerGetDatum(&list->center), value));
-
-			if (listCount < so->probes)
+			if (so->pendingCount == maxTids)
 			{
-				scanlist = &so->lists[listCount];
-				scanlist->startPage = list->startPage;
-				scanlist->distance = distance;
-				listCount++;
+				maxTids *= 2;
+				so->pendingTids = repalloc_huge(so->pendingTids, sizeof(ItemPointerData) * maxTids);
+			}
 
-				/* Add to heap */
-				pairingheap_add(so->listQueue, &scanlist->ph_node);
+			so->pendingTids[so->pendingCount++] = itup->t_tid;
 
-				/* Calculate max distance */
-				if (listCount == so->probes)
-					maxDistance = ((IvfflatScanList *) pairingheap_first(so->listQueue))->distance;
-			}
-			else if (distance < maxDistance)
-			{
-				/* Remove */
-				scanlist = (IvfflatScanList *) pairingheap_remove_first(so->listQueue);
+			item.distance = GetItemDistance(so, tupdesc, itup, value, 0.0);
+			item.tid = itup->t_tid;
+			item.indexblkno = blkno;
+			AddScanItem(so, slot, &item);
+		}
 
-				/* Reuse */
-				scanlist->startPage = list->startPage;
-				scanlist->distance = distance;
-				pairingheap_add(so->listQueue, &scanlist->ph_node);
+		nextblkno = IvfflatPageGetOpaque(page)->nextblkno;
 
-				/* Update max distance */
-				maxDistance = ((IvfflatScanList *) pairingheap_first(so->listQueue))->distance;
-			}
+		UnlockReleaseBuffer(buf);
+
+		if (blkno == pending.tailPage)
+			break;
+
+		blkno = nextblkno;
+	}
+
+	qsort(so->pendingTids, so->pendingCount, sizeof(ItemPointerData), IvfflatCompareTids);
+
+	ExecDropSingleTupleTableSlot(slot);
+}
+
+/*
+ * Free the pending tids
+ */
+static void
+ResetPending(IndexScanDesc scan)
+{
+	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+
+	if (so->pendingTids != NULL)
+		pfree(so->pendingTids);
+
+	so->pendingTids = NULL;
+	so->pendingCount = 0;
+}
+
+typedef struct ScanListsState
+{
+	IvfflatScanOpaque so;
+	int			listCount;
+	double		maxDistance;
+}			ScanListsState;
+
+/*
+ * Keep the closest lists
+ */
+static void
+AddScanList(BlockNumber startPage, ListInfo listInfo, Vector * center, double distance, void *arg)
+{
+	ScanListsState *state = (ScanListsState *) arg;
+	IvfflatScanOpaque so = state->so;
+	IvfflatScanList *scanlist;
+
+	if (state->listCount < so->maxLists)
+	{
+		scanlist = &so->lists[state->listCount];
+		scanlist->startPage = startPage;
+		scanlist->listInfo = listInfo;
+		scanlist->distance = distance;
+		state->listCount++;
+
+		/* Add to heap */
+		pairingheap_add(so->listQueue, &scanlist->ph_node);
+
+		/* Calculate max distance */
+		if (state->listCount == so->maxLists)
+			state->maxDistance = ((IvfflatScanList *) pairingheap_first(so->listQueue))->distance;
+	}
+	else if (distance < state->maxDistance)
+	{
+		/* Remove */
+		scanlist = (IvfflatScanList *) pairingheap_remove_first(so->listQueue);
+
+		/* Reuse */
+		scanlist->startPage = startPage;
+		scanlist->listInfo = listInfo;
+		scanlist->distance = distance;
+		pairingheap_add(so->listQueue, &scanlist->ph_node);
+
+		/* Update max distance */
+		state->maxDistance = ((IvfflatScanList *) pairingheap_first(so->listQueue))->distance;
+	}
+}
+
+/*
+ * Get lists and sort by distance
+ */
+static void
+GetScanLists(IndexScanDesc scan, Datum value)
+{
+	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+	ScanListsState state;
+
+	state.so = so;
+	state.listCount = 0;
+	state.maxDistance = DBL_MAX;
+
+	/* Use procinfo from the index instead of scan key for performance */
+	IvfflatSearchLists(scan->indexRelation, so->procinfo, so->collation, value, so->maxLists, AddScanList, &state);
+
+	/* Scan the closest lists first */
+	pairingheap_reset(so->listQueue);
+	qsort(so->lists, state.listCount, sizeof(IvfflatScanList), CompareScanLists);
+	so->listCount = state.listCount;
+	so->listIndex = 0;
+}
+
+/*
+ * Get the shared state of a parallel scan
+ */
+static inline IvfflatParallelScan
+GetParallelScan(IndexScanDesc scan)
+{
+	return (IvfflatParallelScan) OffsetToPointer((void *) scan->parallel_scan, scan->parallel_scan->ps_offset);
+}
+
+/*
+ * Get lists for a parallel scan
+ *
+ * The first participant selects the lists for everyone, so they are the
+ * same as a serial scan. It also reads the pending list and shares the
+ * tids, so every participant skips the same tuples in lists. If they do
+ * not fit, it scans every list itself.
+ */
+static void
+GetParallelScanLists(IndexScanDesc scan, Datum value)
+{
+	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+	IvfflatParallelScan pscan = GetParallelScan(scan);
+	bool		select = false;
+
+	if (so->maxLists > pscan->maxLists)
+		elog(ERROR, "ivfflat.probes or ivfflat.max_probes changed during parallel scan");
+
+	SpinLockAcquire(&pscan->mutex);
+	if (pscan->status == IVFFLAT_PARALLEL_NOT_INITIALIZED)
+	{
+		pscan->status = IVFFLAT_PARALLEL_SELECTING;
+		select = true;
+	}
+	SpinLockRelease(&pscan->mutex);
+
+	if (select)
+	{
+		GetScanLists(scan, value);
+
+		/* Before other participants scan lists */
+		if (so->codebook == NULL)
+			GetPendingItems(scan, value);
+
+		memcpy(pscan->lists, so->lists, sizeof(IvfflatScanList) * so->listCount);
+
+		if (so->pendingCount > pscan->maxPendingTids)
+			pscan->pendingCount = -1;
+		else
+		{
+			if (so->pendingCount > 0)
+				memcpy(IvfflatParallelScanPendingTids(pscan), so->pendingTids, sizeof(ItemPointerData) * so->pendingCount);
+			pscan->pendingCount = so->pendingCount;
 		}
 
-		nextblkno = IvfflatPageGetOpaque(cpage)->nextblkno;
+		SpinLockAcquire(&pscan->mutex);
+		pscan->listCount = so->listCount;
+		pscan->status = IVFFLAT_PARALLEL_READY;
+		SpinLockRelease(&pscan->mutex);
+
+		ConditionVariableBroadcast(&pscan->listsreadycv);
+		return;
+	}
+
+	/* Wait for the lists */
+	for (;;)
+	{
+		bool		ready;
+
+		SpinLockAcquire(&pscan->mutex);
+		ready = pscan->status == IVFFLAT_PARALLEL_READY;
+		SpinLockRelease(&pscan->mutex);
 
-		UnlockReleaseBuffer(cbuf);
+		if (ready)
+			break;
+
+		ConditionVariableSleep(&pscan->listsreadycv, PG_WAIT_EXTENSION);
+	}
+	ConditionVariableCancelSleep();
+
+	if (pscan->listCount > so->maxLists)
+		elog(ERROR, "ivfflat.probes or ivfflat.max_probes changed during parallel scan");
+
+	/* The participant that selected the lists scans them all */
+	if (pscan->pendingCount < 0)
+	{
+		so->listCount = 0;
+		so->listIndex = 0;
+		return;
 	}
+
+	if (pscan->pendingCount > 0)
+	{
+		so->pendingTids = palloc(sizeof(ItemPointerData) * pscan->pendingCount);
+		memcpy(so->pendingTids, IvfflatParallelScanPendingTids(pscan), sizeof(ItemPointerData) * pscan->pendingCount);
+		so->pendingCount = pscan->pendingCount;
+	}
+
+	so->listCount = pscan->listCount;
+	so->listIndex = 0;
+	memcpy(so->lists, pscan->lists, sizeof(IvfflatScanList) * so->listCount);
+}
+
+/*
+ * Get the next list of the current batch, claimed from the shared counter
+ * for parallel scans
+ */
+static IvfflatScanList *
+NextScanList(IndexScanDesc scan)
+{
+	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+	int			i = -1;
+
+	if (scan->parallel_scan != NULL)
+	{
+		IvfflatParallelScan pscan = GetParallelScan(scan);
+
+		SpinLockAcquire(&pscan->mutex);
+		if (pscan->nextList < so->batchEnd)
+			i = pscan->nextList++;
+		SpinLockRelease(&pscan->mutex);
+	}
+	else if (so->listIndex < so->batchEnd)
+		i = so->listIndex++;
+
+	return i >= 0 ? &so->lists[i] : NULL;
+}
+
+/*
+ * Read the center of a list for ivfpq
+ */
+static void
+GetScanListCenter(IndexScanDesc scan, IvfflatScanList * scanlist)
+{
+	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+	Buffer		buf;
+	Page		page;
+	IvfflatList list;
+
+	buf = ReadBuffer(scan->indexRelation, scanlist->listInfo.blkno);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	list = (IvfflatList) PageGetItem(page, PageGetItemId(page, scanlist->listInfo.offno));
+	memcpy(so->center, &list->center, VECTOR_SIZE(list->center.dim));
+	UnlockReleaseBuffer(buf);
 }
 
 /*
- * Get items
+ * Get items from the next probes lists
  */
 static void
 GetScanItems(IndexScanDesc scan, Datum value)
@@ -117,10 +525,14 @@ GetScanItems(IndexScanDesc scan, Datum value)
 	BlockNumber searchPage;
 	OffsetNumber offno;
 	OffsetNumber maxoffno;
-	Datum		datum;
-	bool		isnull;
 	TupleDesc	tupdesc = RelationGetDescr(scan->indexRelation);
 	double		tuples = 0;
+	IvfflatScanItem item;
+	bool		first = so->batchEnd == 0;
+	IvfflatScanList *scanlist;
+
+	/* Tuples read from the pending list may also be in lists */
+	bool		checkPending = so->pendingCount > 0;
 
 #if PG_VERSION_NUM >= 120000
 	TupleTableSlot *slot = MakeSingleTupleTableSlot(so->tupdesc, &TTSOpsVirtual);
@@ -135,10 +547,20 @@ GetScanItems(IndexScanDesc scan, Datum value)
 	 */
 	BufferAccessStrategy bas = GetAccessStrategy(BAS_BULKREAD);
 
-	/* Search closest probes lists */
-	while (!pairingheap_is_empty(so->listQueue))
+	/* Search the next probes closest lists */
+	so->batchEnd = Min(so->batchEnd + so->probes, so->listCount);
+	while ((scanlist = NextScanList(scan)) != NULL)
 	{
-		searchPage = ((IvfflatScanList *) pairingheap_remove_first(so->listQueue))->startPage;
+		double		slack = 0.0;
+
+		searchPage = scanlist->startPage;
+
+		/* Entries are relative to the list center */
+		if (so->codebook != NULL)
+		{
+			GetScanListCenter(scan, scanlist);
+			slack = IvfpqComputeTable(so->codebook, DatumGetVector(value), so->center, so->table);
+		}
 
 		/* Search all entry pages for list */
 		while (BlockNumberIsValid(searchPage))
@@ -151,24 +573,15 @@ GetScanItems(IndexScanDesc scan, Datum value)
 			for (offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
 			{
 				itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, offno));
-				datum = index_getattr(itup, 1, tupdesc, &isnull);
-
-				/*
-				 * Add virtual tuple
-				 *
-				 * Use procinfo from the index instead of scan key for
-				 * performance
-				 */
-				ExecClearTuple(slot);
-				slot->tts_values[0] = FunctionCall2Coll(so->procinfo, so->collation, datum, value);
-				slot->tts_isnull[0] = false;
-				slot->tts_values[1] = PointerGetDatum(&itup->t_tid);
-				slot->tts_isnull[1] = false;
-				slot->tts_values[2] = Int32GetDatum((int) searchPage);
-				slot->tts_isnull[2] = false;
-				ExecStoreVirtualTuple(slot);
-
-				tuplesort_puttupleslot(so->sortstate, slot);
+
+				/* Returned from the pending list */
+				if (checkPending && bsearch(&itup->t_tid, so->pendingTids, so->pendingCount, sizeof(ItemPointerData), IvfflatCompareTids) != NULL)
+					continue;
+
+				item.distance = GetItemDistance(so, tupdesc, itup, value, slack);
+				item.tid = itup->t_tid;
+				item.indexblkno = searchPage;
+				AddScanItem(so, slot, &item);
 
 				tuples++;
 			}
@@ -181,30 +594,98 @@ GetScanItems(IndexScanDesc scan, Datum value)
 
 	FreeAccessStrategy(bas);
 
-	/* TODO Scan more lists */
-	if (tuples < 100)
+	if (first && tuples < 100 && !ivfflat_iterative_scan && scan->parallel_scan == NULL)
 		ereport(DEBUG1,
 				(errmsg("index scan found few tuples"),
 				 errdetail("Index may have been created with little data."),
 				 errhint("Recreate the index and possibly decrease lists.")));
 
-	tuplesort_performsort(so->sortstate);
+	if (so->spilled)
+		tuplesort_performsort(so->sortstate);
+	else
+	{
+		/* Heapify so only the items returned are ordered */
+		for (int64 i = so->itemCount / 2 - 1; i >= 0; i--)
+			SiftDownScanItem(so, i);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
 }
 
 /*
- * Prepare for an index scan
+ * Create the tuplesort for items past work_mem
  */
-IndexScanDesc
-ivfflatbeginscan(Relation index, int nkeys, int norderbys)
+static Tuplesortstate *
+InitScanSort(TupleDesc tupdesc)
 {
-	IndexScanDesc scan;
-	IvfflatScanOpaque so;
-	int			lists;
 	AttrNumber	attNums[] = {1};
 	Oid			sortOperators[] = {Float8LessOperator};
 	Oid			sortCollations[] = {InvalidOid};
 	bool		nullsFirstFlags[] = {false};
+
+	return tuplesort_begin_heap(tupdesc, 1, attNums, sortOperators, sortCollations, nullsFirstFlags, work_mem, NULL, false);
+}
+
+/*
+ * Remove all items, before scanning more lists or restarting the scan
+ */
+static void
+ResetScanItems(IvfflatScanOpaque so)
+{
+	if (so->spilled)
+	{
+#if PG_VERSION_NUM >= 130000
+		tuplesort_reset(so->sortstate);
+#else
+		tuplesort_end(so->sortstate);
+		so->sortstate = InitScanSort(so->tupdesc);
+#endif
+	}
+
+	so->itemCount = 0;
+	so->spilled = false;
+}
+
+/*
+ * Free the value if it was normalized
+ */
+static void
+FreeScanValue(IndexScanDesc scan)
+{
+	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+
+	if (DatumGetPointer(so->value) != NULL && so->value != scan->orderByData->sk_argument)
+		pfree(DatumGetPointer(so->value));
+
+	so->value = PointerGetDatum(NULL);
+}
+
+/*
+ * Get the number of lists to rank, which is more than probes to keep
+ * scanning up to max probes for iterative scans
+ */
+static int
+GetMaxLists(int lists)
+{
+	int			probes = Min(ivfflat_probes, lists);
+
+	if (ivfflat_iterative_scan && ivfflat_max_probes > probes)
+		return Min(ivfflat_max_probes, lists);
+
+	return probes;
+}
+
+/*
+ * Prepare for an index scan
+ */
+static IndexScanDesc
+BeginScan(Relation index, int nkeys, int norderbys, bool pq)
+{
+	IndexScanDesc scan;
+	IvfflatScanOpaque so;
+	int			lists;
 	int			probes = ivfflat_probes;
+	int			maxLists;
 
 	scan = RelationGetIndexScan(index, nkeys, norderbys);
 	lists = IvfflatGetLists(scan->indexRelation);
@@ -212,15 +693,57 @@ ivfflatbeginscan(Relation index, int nkeys, int norderbys)
 	if (probes > lists)
 		probes = lists;
 
-	so = (IvfflatScanOpaque) palloc(offsetof(IvfflatScanOpaqueData, lists) + probes * sizeof(IvfflatScanList));
+	maxLists = GetMaxLists(lists);
+
+	so = (IvfflatScanOpaque) palloc(offsetof(IvfflatScanOpaqueData, lists) + maxLists * sizeof(IvfflatScanList));
 	so->buf = InvalidBuffer;
 	so->first = true;
 	so->probes = probes;
+	so->maxLists = maxLists;
+	so->value = PointerGetDatum(NULL);
+	so->listCount = 0;
+	so->listIndex = 0;
+	so->batchEnd = 0;
+	so->pendingTids = NULL;
+	so->pendingCount = 0;
 
 	/* Set support functions */
 	so->procinfo = index_getprocinfo(index, 1, IVFFLAT_DISTANCE_PROC);
 	so->normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_NORM_PROC);
 	so->collation = index->rd_indcollation[0];
+	so->distfunc = IvfflatGetDistanceFunc(so->procinfo);
+
+	if (pq)
+	{
+		so->codebook = IvfpqGetCodebook(index);
+		so->table = palloc(sizeof(float) * IVFPQ_CENTROIDS * so->codebook->m);
+		so->center = InitVector(so->codebook->dimensions);
+		so->rerank = ivfpq_rerank;
+
+		/* Distances are returned for the executor to recheck */
+		scan->xs_orderbyvals = palloc0(sizeof(Datum) * norderbys);
+		scan->xs_orderbynulls = palloc(sizeof(bool) * norderbys);
+	}
+	else
+	{
+		so->codebook = NULL;
+		so->table = NULL;
+		so->center = NULL;
+
+		/* Entries of quantized vectors have bounds on the distance */
+		so->rerank = IvfflatIsQuantized(index);
+		if (so->rerank)
+		{
+			so->distfunc = IvfflatGetQuantBoundFunc(so->procinfo, so->normprocinfo != NULL);
+			scan->xs_orderbyvals = palloc0(sizeof(Datum) * norderbys);
+			scan->xs_orderbynulls = palloc(sizeof(bool) * norderbys);
+		}
+	}
+
+	so->maxItems = 1024;
+	so->items = palloc(so->maxItems * sizeof(IvfflatScanItem));
+	so->itemCount = 0;
+	so->spilled = false;
 elog(NOTICE, "Check!!");
 	/* Create tuple description for sorting */
 #if PG_VERSION_NUM >= 120000
@@ -233,7 +756,7 @@ elog(NOTICE, "Check!!");
 	TupleDescInitEntry(so->tupdesc, (AttrNumber) 3, "indexblkno", INT4OID, -1, 0);
 
 	/* Prep sort */
-	so->sortstate = tuplesort_begin_heap(so->tupdesc, 1, attNums, sortOperators, sortCollations, nullsFirstFlags, work_mem, NULL, false);
+	so->sortstate = InitScanSort(so->tupdesc);
 
 #if PG_VERSION_NUM >= 120000
 	so->slot = MakeSingleTupleTableSlot(so->tupdesc, &TTSOpsMinimalTuple);
@@ -248,6 +771,24 @@ elog(NOTICE, "Check!!");
 	return scan;
 }
 
+/*
+ * Prepare for an ivfflat index scan
+ */
+IndexScanDesc
+ivfflatbeginscan(Relation index, int nkeys, int norderbys)
+{
+	return BeginScan(index, nkeys, norderbys, false);
+}
+
+/*
+ * Prepare for an ivfpq index scan
+ */
+IndexScanDesc
+ivfpqbeginscan(Relation index, int nkeys, int norderbys)
+{
+	return BeginScan(index, nkeys, norderbys, true);
+}
+
 /*
  * Start or restart an index scan
  */
@@ -256,12 +797,14 @@ ivfflatrescan(IndexScanDesc scan, ScanKey keys, int nkeys, ScanKey orderbys, int
 {
 	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
 
-#if PG_VERSION_NUM >= 130000
-	if (!so->first)
-		tuplesort_reset(so->sortstate);
-#endif
+	ResetScanItems(so);
+	FreeScanValue(scan);
+	ResetPending(scan);
 
 	so->first = true;
+	so->listCount = 0;
+	so->listIndex = 0;
+	so->batchEnd = 0;
 	pairingheap_reset(so->listQueue);
 
 	if (keys && scan->numberOfKeys > 0)
@@ -278,6 +821,9 @@ bool
 ivfflatgettuple(IndexScanDesc scan, ScanDirection dir)
 {
 	IvfflatScanOpaque so = (IvfflatScanOpaque) scan->opaque;
+	ItemPointerData tid;
+	BlockNumber indexblkno;
+	double		distance;
 
 	/*
 	 * Index can be used to scan backward, but Postgres doesn't support
@@ -309,46 +855,80 @@ ivfflatgettuple(IndexScanDesc scan, ScanDirection dir)
 		if (so->normprocinfo != NULL)
 		{
 			/* No items will match if normalization fails */
-			if (!IvfflatNormValue(so->normprocinfo, so->collation, &value, NULL))
+			if (!IvfflatNormValue(so->normprocinfo, so->collation, &value, NULL, IvfflatGetType(scan->indexRelation)))
 				return false;
 		}
 
-		IvfflatBench("GetScanLists", GetScanLists(scan, value));
+		/* Kept for scanning more lists */
+		so->value = value;
+
+		if (scan->parallel_scan != NULL)
+			IvfflatBench("GetScanLists", GetParallelScanLists(scan, value));
+		else
+		{
+			IvfflatBench("GetScanLists", GetScanLists(scan, value));
+
+			/* Pending list of fastupdate, which ivfpq does not have */
+			if (so->codebook == NULL)
+				IvfflatBench("GetPendingItems", GetPendingItems(scan, value));
+		}
 		IvfflatBench("GetScanItems", GetScanItems(scan, value));
 		so->first = false;
+	}
+
+	/* Scan the next closest lists for iterative scans */
+	while (!(so->spilled ? tuplesort_gettupleslot(so->sortstate, true, false, so->slot, NULL) : so->itemCount > 0))
+	{
+		if (so->batchEnd >= so->listCount)
+			return false;
 
-		/* Clean up if we allocated a new value */
-		if (value != scan->orderByData->sk_argument)
-			pfree(DatumGetPointer(value));
+		ResetScanItems(so);
+		IvfflatBench("GetScanItems", GetScanItems(scan, so->value));
 	}
 
-	if (tuplesort_gettupleslot(so->sortstate, true, false, so->slot, NULL))
+	if (so->spilled)
 	{
-		ItemPointer tid = (ItemPointer) DatumGetPointer(slot_getattr(so->slot, 2, &so->isnull));
-		BlockNumber indexblkno = DatumGetInt32(slot_getattr(so->slot, 3, &so->isnull));
+		distance = DatumGetFloat8(slot_getattr(so->slot, 1, &so->isnull));
+		tid = *((ItemPointer) DatumGetPointer(slot_getattr(so->slot, 2, &so->isnull)));
+		indexblkno = DatumGetInt32(slot_getattr(so->slot, 3, &so->isnull));
+	}
+	else
+	{
+		/* Pop the closest */
+		distance = so->items[0].distance;
+		tid = so->items[0].tid;
+		indexblkno = so->items[0].indexblkno;
+		so->items[0] = so->items[--so->itemCount];
+		SiftDownScanItem(so, 0);
+	}
 
 #if PG_VERSION_NUM >= 120000
-		scan->xs_heaptid = *tid;
+	scan->xs_heaptid = tid;
 #else
-		scan->xs_ctup.t_self = *tid;
+	scan->xs_ctup.t_self = tid;
 #endif
 
-		if (BufferIsValid(so->buf))
-			ReleaseBuffer(so->buf);
+	if (BufferIsValid(so->buf))
+		ReleaseBuffer(so->buf);
 
-		/*
-		 * An index scan must maintain a pin on the index page holding the
-		 * item last returned by amgettuple
-		 *
-		 * https://www.postgresql.org/docs/current/index-locking.html
-		 */
-		so->buf = ReadBuffer(scan->indexRelation, indexblkno);
+	/*
+	 * An index scan must maintain a pin on the index page holding the item
+	 * last returned by amgettuple
+	 *
+	 * https://www.postgresql.org/docs/current/index-locking.html
+	 */
+	so->buf = ReadBuffer(scan->indexRelation, indexblkno);
 
-		scan->xs_recheckorderby = false;
-		return true;
+	/* Re-rank with the exact distance from the heap */
+	if (so->rerank)
+	{
+		scan->xs_orderbyvals[0] = Float8GetDatum(distance);
+		scan->xs_orderbynulls[0] = false;
+		scan->xs_recheckorderby = true;
 	}
-
-	return false;
+	else
+		scan->xs_recheckorderby = false;
+	return true;
 }
 
 /*
@@ -370,13 +950,83 @@ ivfflatendscan(IndexScanDesc scan)
 	if (BufferIsValid(so->buf))
 		ReleaseBuffer(so->buf);
 
+	FreeScanValue(scan);
+	ResetPending(scan);
 	pairingheap_free(so->listQueue);
 	tuplesort_end(so->sortstate);
+	pfree(so->items);
+
+	if (so->codebook != NULL)
+	{
+		pfree(so->center);
+		pfree(so->table);
+	}
 
 	pfree(so);
 	scan->opaque = NULL;
 }
 
+/*
+ * Get the max number of pending tids shared by a parallel scan, enough for
+ * a pending list of ivfflat.pending_list_limit
+ */
+static int
+GetMaxPendingTids(void)
+{
+	Size		pages = (Size) ivfflat_pending_list_limit * 1024 / BLCKSZ + 1;
+
+	return (int) Min(pages * MaxIndexTuplesPerPage, IVFFLAT_PARALLEL_MAX_PENDING_TIDS);
+}
+
+/*
+ * Estimate the shared memory for a parallel scan
+ *
+ * The index is not known yet, so allow for the max number of lists
+ */
+Size
+#if PG_VERSION_NUM >= 170000
+ivfflatestimateparallelscan(int nkeys, int norderbys)
+#else
+ivfflatestimateparallelscan(void)
+#endif
+{
+	return add_size(IVFFLAT_PARALLEL_SCAN_LISTS_SIZE(GetMaxLists(IVFFLAT_MAX_LISTS)), mul_size(sizeof(ItemPointerData), GetMaxPendingTids()));
+}
+
+/*
+ * Initialize the shared state of a parallel scan
+ */
+void
+ivfflatinitparallelscan(void *target)
+{
+	IvfflatParallelScan pscan = (IvfflatParallelScan) target;
+
+	pscan->maxLists = GetMaxLists(IVFFLAT_MAX_LISTS);
+	pscan->maxPendingTids = GetMaxPendingTids();
+	SpinLockInit(&pscan->mutex);
+	ConditionVariableInit(&pscan->listsreadycv);
+	pscan->status = IVFFLAT_PARALLEL_NOT_INITIALIZED;
+	pscan->listCount = 0;
+	pscan->nextList = 0;
+	pscan->pendingCount = 0;
+}
+
+/*
+ * Reset the shared state of a parallel scan before a rescan
+ */
+void
+ivfflatparallelrescan(IndexScanDesc scan)
+{
+	IvfflatParallelScan pscan = GetParallelScan(scan);
+
+	SpinLockAcquire(&pscan->mutex);
+	pscan->status = IVFFLAT_PARALLEL_NOT_INITIALIZED;
+	pscan->listCount = 0;
+	pscan->nextList = 0;
+	pscan->pendingCount = 0;
+	SpinLockRelease(&pscan->mutex);
+}
+
 float* readArrayMem (const char* name, const int SIZE){
     /* pointer to shared memory object */
     void* ptr;
@@ -430,4 +1080,4 @@ float* readArrayMem (const char* name, const int SIZE){
 //     free(data);
 //     free(labels);
 //     free(distances);
-// }
\ No newline at end of file
+// }
@@ -0,0 +1,470 @@
+#include "postgres.h"
+
+#include <float.h>
+#include <math.h>
+
+#include "ivfflat.h"
+#include "miscadmin.h"
+#include "sparsevec.h"
+
+#define SPARSE_KMEANS_MAX_ITERATIONS 50
+
+/*
+ * State for k-means on sparse vectors
+ *
+ * Samples are compact copies of different sizes, and each center keeps at
+ * most IVFFLAT_SPARSEVEC_CENTER_NNZ elements, so every distance is a merge
+ * of the indices of a sample and a center
+ */
+typedef struct SparseKmeansState
+{
+	SparseVector **samples;
+	int			numSamples;
+	VectorArray centers;
+	int			numCenters;
+
+	/* Support functions */
+	FmgrInfo   *procinfo;
+	FmgrInfo   *normprocinfo;
+	Oid			collation;
+
+	int		   *closestCenters;
+	int		   *centerCounts;
+	int		   *centerStarts;
+	int		   *order;			/* samples ordered by closest center */
+	SparseElement *elements;	/* for summing the samples of a center */
+}			SparseKmeansState;
+
+/*
+ * Get the distance between sparse vectors
+ */
+static inline double
+SparseKmeansDistance(SparseKmeansState * state, SparseVector * a, SparseVector * b)
+{
+	return DatumGetFloat8(FunctionCall2Coll(state->procinfo, state->collation, PointerGetDatum(a), PointerGetDatum(b)));
+}
+
+/*
+ * Compare elements by index
+ */
+static int
+CompareElementIndices(const void *a, const void *b)
+{
+	int32		ai = ((const SparseElement *) a)->index;
+	int32		bi = ((const SparseElement *) b)->index;
+
+	if (ai < bi)
+		return -1;
+
+	if (ai > bi)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Compare elements by magnitude, largest first
+ */
+static int
+CompareElementMagnitudes(const void *a, const void *b)
+{
+	float		av = fabsf(((const SparseElement *) a)->value);
+	float		bv = fabsf(((const SparseElement *) b)->value);
+
+	if (av > bv)
+		return -1;
+
+	if (av < bv)
+		return 1;
+
+	return CompareElementIndices(a, b);
+}
+
+/*
+ * Compare samples, which only needs to be consistent to find duplicates
+ */
+static int
+CompareSamples(const void *a, const void *b)
+{
+	SparseVector *sa = *((SparseVector * const *) a);
+	SparseVector *sb = *((SparseVector * const *) b);
+
+	if (VARSIZE(sa) != VARSIZE(sb))
+		return VARSIZE(sa) < VARSIZE(sb) ? -1 : 1;
+
+	return memcmp(sa, sb, VARSIZE(sa));
+}
+
+/*
+ * Set a center from elements sorted by index, keeping the largest ones
+ *
+ * The elements are reordered
+ */
+static void
+SetCenter(SparseKmeansState * state, int i, SparseElement * elements, int nnz)
+{
+	VectorArray centers = state->centers;
+	SparseVector *center = (SparseVector *) VectorArrayGet(centers, i);
+	float	   *values;
+
+	if (nnz > IVFFLAT_SPARSEVEC_CENTER_NNZ)
+	{
+		qsort(elements, nnz, sizeof(SparseElement), CompareElementMagnitudes);
+		nnz = IVFFLAT_SPARSEVEC_CENTER_NNZ;
+		qsort(elements, nnz, sizeof(SparseElement), CompareElementIndices);
+	}
+
+	/* Zero the rest of the item, which is written to the list pages */
+	memset(center, 0, centers->itemsize);
+	SET_VARSIZE(center, SPARSEVEC_SIZE(nnz));
+	center->dim = centers->dim;
+	center->nnz = nnz;
+
+	values = SPARSEVEC_VALUES(center);
+	for (int j = 0; j < nnz; j++)
+	{
+		center->indices[j] = elements[j].index;
+		values[j] = elements[j].value;
+	}
+
+	/* Spherical distance function expects unit vectors */
+	if (state->normprocinfo != NULL)
+	{
+		double		norm = DatumGetFloat8(FunctionCall1Coll(state->normprocinfo, state->collation, PointerGetDatum(center)));
+
+		if (norm > 0)
+		{
+			for (int j = 0; j < nnz; j++)
+				values[j] /= norm;
+		}
+	}
+}
+
+/*
+ * Set a center to a sample
+ */
+static void
+SetCenterToSample(SparseKmeansState * state, int i, SparseVector * sample)
+{
+	float	   *values = SPARSEVEC_VALUES(sample);
+
+	for (int j = 0; j < sample->nnz; j++)
+	{
+		state->elements[j].index = sample->indices[j];
+		state->elements[j].value = values[j];
+	}
+
+	SetCenter(state, i, state->elements, sample->nnz);
+}
+
+/*
+ * Set a center to random values at random indices
+ */
+static void
+SetRandomCenter(SparseKmeansState * state, int i)
+{
+	SparseElement *elements = state->elements;
+	int			dim = state->centers->dim;
+	int			nnz = Min(dim, IVFFLAT_SPARSEVEC_CENTER_NNZ);
+	int			count = 0;
+
+	for (int j = 0; j < nnz; j++)
+	{
+		/* Use every index when there are few dimensions */
+		elements[j].index = nnz == dim ? j : (int32) (RandomInt() % dim);
+		elements[j].value = RandomDouble();
+	}
+
+	/* Remove duplicate indices */
+	qsort(elements, nnz, sizeof(SparseElement), CompareElementIndices);
+	for (int j = 0; j < nnz; j++)
+	{
+		if (count == 0 || elements[j].index != elements[count - 1].index)
+			elements[count++] = elements[j];
+	}
+
+	SetCenter(state, i, elements, count);
+}
+
+/*
+ * Quick approach if we have little data
+ */
+static void
+QuickCenters(SparseKmeansState * state)
+{
+	VectorArray centers = state->centers;
+
+	/* Copy existing vectors while avoiding duplicates */
+	/* Fine to sort in-place */
+	qsort(state->samples, state->numSamples, sizeof(SparseVector *), CompareSamples);
+	for (int j = 0; j < state->numSamples; j++)
+	{
+		if (j == 0 || CompareSamples(&state->samples[j], &state->samples[j - 1]) != 0)
+			SetCenterToSample(state, centers->length++, state->samples[j]);
+	}
+
+	/* Fill remaining with random data */
+	while (centers->length < centers->maxlen)
+		SetRandomCenter(state, centers->length++);
+}
+
+/*
+ * Initialize with kmeans++
+ *
+ * https://theory.stanford.edu/~sergei/papers/kMeansPP-soda.pdf
+ */
+static void
+InitCenters(SparseKmeansState * state)
+{
+	VectorArray centers = state->centers;
+	int			numSamples = state->numSamples;
+	double	   *weight = palloc(sizeof(double) * numSamples);
+	int			j;
+
+	/* Choose an initial center uniformly at random */
+	SetCenterToSample(state, centers->length++, state->samples[RandomInt() % numSamples]);
+
+	for (j = 0; j < numSamples; j++)
+		weight[j] = DBL_MAX;
+
+	for (int i = 0; i < state->numCenters; i++)
+	{
+		SparseVector *center = (SparseVector *) VectorArrayGet(centers, i);
+		double		sum = 0.0;
+		double		choice;
+
+		CHECK_FOR_INTERRUPTS();
+
+		/* Only need to compute distance for new center */
+		for (j = 0; j < numSamples; j++)
+		{
+			double		distance = SparseKmeansDistance(state, state->samples[j], center);
+
+			/* Use distance squared for weighted probability distribution */
+			distance *= distance;
+
+			if (distance < weight[j])
+				weight[j] = distance;
+
+			sum += weight[j];
+		}
+
+		if (i + 1 == state->numCenters)
+			break;
+
+		/* Choose new center using weighted probability distribution. */
+		choice = sum * RandomDouble();
+		for (j = 0; j < numSamples - 1; j++)
+		{
+			choice -= weight[j];
+			if (choice <= 0)
+				break;
+		}
+
+		SetCenterToSample(state, centers->length++, state->samples[j]);
+	}
+
+	pfree(weight);
+}
+
+/*
+ * Assign each sample to the closest center
+ *
+ * Returns the number of samples that changed centers
+ */
+static int64
+AssignSamples(SparseKmeansState * state)
+{
+	int64		changes = 0;
+
+	for (int j = 0; j < state->numSamples; j++)
+	{
+		double		minDistance = DBL_MAX;
+		int			closestCenter = 0;
+
+		CHECK_FOR_INTERRUPTS();
+
+		for (int i = 0; i < state->numCenters; i++)
+		{
+			double		distance = SparseKmeansDistance(state, state->samples[j], (SparseVector *) VectorArrayGet(state->centers, i));
+
+			if (distance < minDistance)
+			{
+				minDistance = distance;
+				closestCenter = i;
+			}
+		}
+
+		if (state->closestCenters[j] != closestCenter)
+		{
+			state->closestCenters[j] = closestCenter;
+			changes++;
+		}
+	}
+
+	return changes;
+}
+
+/*
+ * Move each center to the mean of its samples
+ *
+ * The elements of the samples are sorted by index and summed, which only
+ * needs memory for the non-zero elements instead of every dimension
+ */
+static void
+UpdateCenters(SparseKmeansState * state)
+{
+	int			numCenters = state->numCenters;
+	SparseElement *elements = state->elements;
+
+	/* Order samples by center */
+	memset(state->centerCounts, 0, sizeof(int) * numCenters);
+	for (int j = 0; j < state->numSamples; j++)
+		state->centerCounts[state->closestCenters[j]]++;
+
+	state->centerStarts[0] = 0;
+	for (int i = 1; i < numCenters; i++)
+		state->centerStarts[i] = state->centerStarts[i - 1] + state->centerCounts[i - 1];
+
+	for (int j = 0; j < state->numSamples; j++)
+		state->order[state->centerStarts[state->closestCenters[j]]++] = j;
+
+	for (int i = 0, start = 0; i < numCenters; start += state->centerCounts[i], i++)
+	{
+		int			count = state->centerCounts[i];
+		int			nelements = 0;
+		int			nnz = 0;
+		int			k;
+
+		/* Keep the center of an empty list */
+		if (count == 0)
+			continue;
+
+		CHECK_FOR_INTERRUPTS();
+
+		for (int s = start; s < start + count; s++)
+		{
+			SparseVector *sample = state->samples[state->order[s]];
+			float	   *values = SPARSEVEC_VALUES(sample);
+
+			for (int j = 0; j < sample->nnz; j++)
+			{
+				elements[nelements].index = sample->indices[j];
+				elements[nelements].value = values[j];
+				nelements++;
+			}
+		}
+
+		qsort(elements, nelements, sizeof(SparseElement), CompareElementIndices);
+
+		/* Combine elements with the same index into the mean */
+		for (k = 0; k < nelements;)
+		{
+			int32		index = elements[k].index;
+			double		sum = 0.0;
+
+			for (; k < nelements && elements[k].index == index; k++)
+				sum += elements[k].value;
+
+			if (sum != 0)
+			{
+				elements[nnz].index = index;
+				elements[nnz].value = sum / count;
+				nnz++;
+			}
+		}
+
+		SetCenter(state, i, elements, nnz);
+	}
+}
+
+/*
+ * Check memory requirements
+ */
+static void
+CheckMemory(SparseKmeansState * state, int64 totalNnz)
+{
+	Size		totalSize = 0;
+
+	/* Samples and centers */
+	for (int j = 0; j < state->numSamples; j++)
+		totalSize += VARSIZE(state->samples[j]);
+	totalSize += sizeof(SparseVector *) * state->numSamples;
+	totalSize += VECTOR_ARRAY_SIZE(state->centers->maxlen, state->centers->itemsize);
+
+	/* Closest centers, order, center counts and starts, and elements */
+	totalSize += sizeof(int) * state->numSamples * 2;
+	totalSize += sizeof(int) * state->numCenters * 2;
+	totalSize += sizeof(SparseElement) * Max(totalNnz, IVFFLAT_SPARSEVEC_CENTER_NNZ);
+
+	/* Add one to error message to ceil */
+	if (totalSize > (Size) maintenance_work_mem * 1024L)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("memory required is %zu MB, maintenance_work_mem is %d MB",
+						totalSize / (1024 * 1024) + 1, maintenance_work_mem / 1024)));
+}
+
+/*
+ * Perform k-means on sparse vectors with at most
+ * IVFFLAT_SPARSEVEC_CENTER_NNZ elements per center, since the mean of many
+ * sparse vectors is dense. Uses spherical k-means for inner product and
+ * cosine, where samples are unit vectors.
+ *
+ * Centers has an itemsize of SPARSEVEC_SIZE(IVFFLAT_SPARSEVEC_CENTER_NNZ)
+ * and samples may be reordered.
+ */
+void
+IvfflatSparseKmeans(Relation index, SparseVector * *samples, int numSamples, VectorArray centers)
+{
+	SparseKmeansState state;
+	int64		totalNnz = 0;
+
+	state.samples = samples;
+	state.numSamples = numSamples;
+	state.centers = centers;
+	state.numCenters = centers->maxlen;
+
+	/* Set support functions */
+	state.procinfo = index_getprocinfo(index, 1, IVFFLAT_KMEANS_DISTANCE_PROC);
+	state.normprocinfo = IvfflatOptionalProcInfo(index, IVFFLAT_KMEANS_NORM_PROC);
+	state.collation = index->rd_indcollation[0];
+
+	for (int j = 0; j < numSamples; j++)
+		totalNnz += samples[j]->nnz;
+
+	CheckMemory(&state, totalNnz);
+
+	/* Large enough for every element of the samples of a center */
+	state.elements = palloc_extended(sizeof(SparseElement) * Max(totalNnz, IVFFLAT_SPARSEVEC_CENTER_NNZ), MCXT_ALLOC_HUGE);
+
+	if (numSamples <= state.numCenters)
+		QuickCenters(&state);
+	else
+	{
+		state.closestCenters = palloc(sizeof(int) * numSamples);
+		state.order = palloc(sizeof(int) * numSamples);
+		state.centerCounts = palloc(sizeof(int) * state.numCenters);
+		state.centerStarts = palloc(sizeof(int) * state.numCenters);
+
+		for (int j = 0; j < numSamples; j++)
+			state.closestCenters[j] = -1;
+
+		InitCenters(&state);
+
+		for (int iteration = 0; iteration < SPARSE_KMEANS_MAX_ITERATIONS; iteration++)
+		{
+			if (AssignSamples(&state) == 0)
+				break;
+
+			UpdateCenters(&state);
+		}
+
+		pfree(state.closestCenters);
+		pfree(state.order);
+		pfree(state.centerCounts);
+		pfree(state.centerStarts);
+	}
+
+	pfree(state.elements);
+}
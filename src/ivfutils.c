@@ -1,21 +1,31 @@
 #include "postgres.h"
 
+#include "bitutils.h"
+#include "halfutils.h"
 #include "ivfflat.h"
+#include "miscadmin.h"
 #include "storage/bufmgr.h"
+#include "utils/memutils.h"
+#include "utils/lsyscache.h"
 #include "vector.h"
+#include "vectorutils.h"
 
 /*
  * Allocate a vector array
+ *
+ * itemsize is VECTOR_SIZE(dimensions) except for centers converted to the
+ * type of the indexed column
  */
 VectorArray
-VectorArrayInit(int maxlen, int dimensions)
+VectorArrayInit(int maxlen, int dimensions, Size itemsize)
 {
 	VectorArray res = palloc(sizeof(VectorArrayData));
 
 	res->length = 0;
 	res->maxlen = maxlen;
 	res->dim = dimensions;
-	res->items = palloc_extended(maxlen * VECTOR_SIZE(dimensions), MCXT_ALLOC_ZERO | MCXT_ALLOC_HUGE);
+	res->itemsize = itemsize;
+	res->items = palloc_extended(maxlen * itemsize, MCXT_ALLOC_ZERO | MCXT_ALLOC_HUGE);
 	return res;
 }
 
@@ -55,6 +65,731 @@ IvfflatGetLists(Relation index)
 	return IVFFLAT_DEFAULT_LISTS;
 }
 
+/*
+ * Get the number of groups in the index options
+ */
+int
+IvfflatGetGroups(Relation index)
+{
+	IvfflatOptions *opts = (IvfflatOptions *) index->rd_options;
+
+	if (opts)
+		return opts->groups;
+
+	return IVFFLAT_DEFAULT_GROUPS;
+}
+
+/*
+ * Get whether fastupdate is enabled in the index options
+ */
+bool
+IvfflatGetFastUpdate(Relation index)
+{
+	IvfflatOptions *opts = (IvfflatOptions *) index->rd_options;
+
+	if (opts)
+		return opts->fastupdate;
+
+	return IVFFLAT_DEFAULT_FASTUPDATE;
+}
+
+/*
+ * Distance functions for the built-in opclasses
+ *
+ * These match the support functions, so the order is the same with or
+ * without fmgr, and dimensions were already checked with the centers
+ */
+static double
+VectorL2SquaredScanDistance(Pointer a, Pointer b)
+{
+	Vector	   *va = (Vector *) a;
+
+	return VectorL2SquaredDistance(va->dim, va->x, ((Vector *) b)->x);
+}
+
+static double
+VectorNegativeInnerProductScanDistance(Pointer a, Pointer b)
+{
+	Vector	   *va = (Vector *) a;
+
+	return -VectorInnerProduct(va->dim, va->x, ((Vector *) b)->x);
+}
+
+static double
+HalfvecL2SquaredScanDistance(Pointer a, Pointer b)
+{
+	HalfVector *va = (HalfVector *) a;
+
+	return HalfvecL2SquaredDistance(va->dim, va->x, ((HalfVector *) b)->x);
+}
+
+static double
+HalfvecNegativeInnerProductScanDistance(Pointer a, Pointer b)
+{
+	HalfVector *va = (HalfVector *) a;
+
+	return -HalfvecInnerProduct(va->dim, va->x, ((HalfVector *) b)->x);
+}
+
+static double
+HammingScanDistance(Pointer a, Pointer b)
+{
+	BitVector  *va = (BitVector *) a;
+
+	return (double) BitHammingDistance(BITVEC_BYTES(va->dim), va->data, ((BitVector *) b)->data);
+}
+
+static double
+JaccardScanDistance(Pointer a, Pointer b)
+{
+	BitVector  *va = (BitVector *) a;
+
+	return BitJaccardDistance(BITVEC_BYTES(va->dim), va->data, ((BitVector *) b)->data);
+}
+
+/*
+ * Get the distance function for a support function
+ *
+ * Returns NULL for other opclasses, which use fmgr
+ */
+IvfflatDistanceFunc
+IvfflatGetDistanceFunc(FmgrInfo *procinfo)
+{
+	PGFunction	fn = procinfo->fn_addr;
+
+	if (fn == vector_l2_squared_distance)
+		return VectorL2SquaredScanDistance;
+	if (fn == vector_negative_inner_product)
+		return VectorNegativeInnerProductScanDistance;
+	if (fn == halfvec_l2_squared_distance)
+		return HalfvecL2SquaredScanDistance;
+	if (fn == halfvec_negative_inner_product)
+		return HalfvecNegativeInnerProductScanDistance;
+	if (fn == hamming_distance)
+		return HammingScanDistance;
+	if (fn == jaccard_distance)
+		return JaccardScanDistance;
+
+	return NULL;
+}
+
+/*
+ * Distance functions for quantized vectors
+ *
+ * Centers use the distance to the levels, which matches the support
+ * function. Entries use bounds on the distance of the operator, which the
+ * executor rechecks with the heap tuple.
+ */
+static double
+QuantL2SquaredScanDistance(Pointer a, Pointer b)
+{
+	return QuantL2SquaredDistance((QuantVector *) a, (Vector *) b);
+}
+
+static double
+QuantNegativeInnerProductScanDistance(Pointer a, Pointer b)
+{
+	return -QuantInnerProduct((QuantVector *) a, (Vector *) b);
+}
+
+static double
+QuantL2ScanBound(Pointer a, Pointer b)
+{
+	return QuantL2DistanceBound((QuantVector *) a, (Vector *) b);
+}
+
+static double
+QuantNegativeInnerProductScanBound(Pointer a, Pointer b)
+{
+	return -QuantInnerProductBound((QuantVector *) a, (Vector *) b);
+}
+
+static double
+QuantCosineScanBound(Pointer a, Pointer b)
+{
+	QuantVector *qa = (QuantVector *) a;
+
+	/* Both are unit vectors, with rounding from normalizing */
+	return 1 - QuantInnerProductBound(qa, (Vector *) b) - QUANTVEC_SLACK(qa->dim);
+}
+
+/*
+ * Get the distance function for quantized centers
+ *
+ * Returns NULL for other opclasses, which cannot index quantized vectors
+ */
+IvfflatDistanceFunc
+IvfflatGetQuantDistanceFunc(FmgrInfo *procinfo)
+{
+	PGFunction	fn = procinfo->fn_addr;
+
+	if (fn == vector_l2_squared_distance)
+		return QuantL2SquaredScanDistance;
+	if (fn == vector_negative_inner_product)
+		return QuantNegativeInnerProductScanDistance;
+
+	return NULL;
+}
+
+/*
+ * Get the bound function for quantized entries, with normalized set for
+ * cosine distance
+ *
+ * Returns NULL for other opclasses, which cannot index quantized vectors
+ */
+IvfflatDistanceFunc
+IvfflatGetQuantBoundFunc(FmgrInfo *procinfo, bool normalized)
+{
+	PGFunction	fn = procinfo->fn_addr;
+
+	if (fn == vector_l2_squared_distance)
+		return QuantL2ScanBound;
+	if (fn == vector_negative_inner_product)
+		return normalized ? QuantCosineScanBound : QuantNegativeInnerProductScanBound;
+
+	return NULL;
+}
+
+/*
+ * Get whether vectors are stored quantized, which is the case past
+ * IVFFLAT_MAX_DIM
+ */
+bool
+IvfflatIsQuantized(Relation index)
+{
+	return IvfflatGetType(index) == IVFFLAT_TYPE_VECTOR && TupleDescAttr(index->rd_att, 0)->atttypmod > IVFFLAT_MAX_DIM;
+}
+
+/*
+ * Check the dimensions of a value against quantized centers, which the
+ * support function cannot read
+ */
+static void
+CheckQuantDims(Relation index, Datum value)
+{
+	int			dimensions = TupleDescAttr(index->rd_att, 0)->atttypmod;
+	Vector	   *vec = DatumGetVector(value);
+
+	if (vec->dim != dimensions)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("different vector dimensions %d and %d", dimensions, vec->dim)));
+}
+
+/*
+ * Get the space for a list center, which is the same for every list
+ *
+ * Taken from the item instead of the center, since centers of sparse
+ * vectors have different sizes
+ */
+static Size
+GetCenterSize(Relation index)
+{
+	Buffer		buf;
+	Page		page;
+	Size		size;
+
+	buf = ReadBuffer(index, IVFFLAT_HEAD_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	size = ItemIdGetLength(PageGetItemId(page, FirstOffsetNumber)) - offsetof(IvfflatListData, center);
+	UnlockReleaseBuffer(buf);
+
+	return MAXALIGN(size);
+}
+
+/*
+ * Read the list pages into the cache
+ */
+static void
+ReadCacheLists(Relation index, IvfflatCache * cache)
+{
+	BlockNumber blkno = IVFFLAT_HEAD_BLKNO;
+	int			count = 0;
+
+	while (BlockNumberIsValid(blkno))
+	{
+		Buffer		buf = ReadBuffer(index, blkno);
+		Page		page;
+		OffsetNumber maxoffno;
+
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		maxoffno = PageGetMaxOffsetNumber(page);
+
+		for (OffsetNumber offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			IvfflatList list = (IvfflatList) PageGetItem(page, PageGetItemId(page, offno));
+
+			if (count == cache->lists || VARSIZE(&list->center) > cache->centerSize)
+				elog(ERROR, "invalid lists in \"%s\"", RelationGetRelationName(index));
+
+			memcpy(IvfflatCacheCenter(cache, count), &list->center, VARSIZE(&list->center));
+			cache->startPages[count] = list->startPage;
+			cache->listInfo[count].blkno = blkno;
+			cache->listInfo[count].offno = offno;
+			count++;
+		}
+
+		blkno = IvfflatPageGetOpaque(page)->nextblkno;
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	if (count != cache->lists)
+		elog(ERROR, "invalid lists in \"%s\"", RelationGetRelationName(index));
+}
+
+/*
+ * Read the group pages into the cache
+ */
+static void
+ReadCacheGroups(Relation index, IvfflatCache * cache, BlockNumber blkno)
+{
+	int			count = 0;
+	int			start = 0;
+
+	while (BlockNumberIsValid(blkno))
+	{
+		Buffer		buf = ReadBuffer(index, blkno);
+		Page		page;
+		OffsetNumber maxoffno;
+
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		maxoffno = PageGetMaxOffsetNumber(page);
+
+		for (OffsetNumber offno = FirstOffsetNumber; offno <= maxoffno; offno = OffsetNumberNext(offno))
+		{
+			IvfflatGroup group = (IvfflatGroup) PageGetItem(page, PageGetItemId(page, offno));
+
+			if (count == cache->groups || VARSIZE(&group->center) > cache->centerSize)
+				elog(ERROR, "invalid groups in \"%s\"", RelationGetRelationName(index));
+
+			memcpy(IvfflatCacheGroupCenter(cache, count), &group->center, VARSIZE(&group->center));
+
+			/* Lists are ordered by group */
+			cache->groupStarts[count] = start;
+			cache->groupCounts[count] = group->listCount;
+			start += group->listCount;
+			count++;
+		}
+
+		blkno = IvfflatPageGetOpaque(page)->nextblkno;
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	if (count != cache->groups || start != cache->lists)
+		elog(ERROR, "invalid groups in \"%s\"", RelationGetRelationName(index));
+}
+
+/*
+ * Look up the type of the indexed column
+ *
+ * Types are matched by OID in the schema of the extension
+ */
+static IvfflatType
+LookupType(Relation index)
+{
+	Oid			typid = TupleDescAttr(index->rd_att, 0)->atttypid;
+	Oid			namespaceId = get_func_namespace(index->rd_amhandler);
+	IvfflatType result;
+
+	if (typid == VectorTypeOid("vector", namespaceId))
+		result = IVFFLAT_TYPE_VECTOR;
+	else if (typid == VectorTypeOid("halfvec", namespaceId))
+		result = IVFFLAT_TYPE_HALFVEC;
+	else if (typid == VectorTypeOid("bitvec", namespaceId))
+		result = IVFFLAT_TYPE_BITVEC;
+	else if (typid == VectorTypeOid("sparsevec", namespaceId))
+		result = IVFFLAT_TYPE_SPARSEVEC;
+	else
+		elog(ERROR, "type not supported for ivfflat index");
+
+	return result;
+}
+
+/*
+ * Get the cached lists, groups, and codebook (when pq is true)
+ *
+ * Loaded on first use in each backend instead of reading every list page
+ * for each scan and insert. Lists that do not fit in work_mem are not
+ * cached, and are read from the pages as before.
+ */
+IvfflatCache *
+IvfflatGetCache(Relation index, bool pq)
+{
+	IvfflatCache *cache = (IvfflatCache *) index->rd_amcache;
+	Buffer		buf;
+	Page		page;
+	IvfflatMetaPage metap;
+	int			dimensions;
+	int			lists;
+	int			groups;
+	BlockNumber groupPage;
+	int			m = 0;
+	BlockNumber codebookPage = InvalidBlockNumber;
+	Size		centerSize;
+	Size		listsSize;
+	Size		codebookSize = 0;
+	bool		hasLists;
+	IvfflatType type;
+	char	   *ptr;
+
+	if (cache != NULL && (!pq || cache->codebook != NULL))
+		return cache;
+
+	type = cache != NULL ? cache->type : LookupType(index);
+
+	/* Only read the ivfpq fields for ivfpq */
+	buf = ReadBuffer(index, IVFFLAT_METAPAGE_BLKNO);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	metap = IvfflatPageGetMeta(page);
+	dimensions = metap->dimensions;
+	lists = metap->lists;
+	groups = metap->groups;
+	groupPage = metap->groupPage;
+	if (pq)
+	{
+		IvfpqMetaPageData *pqmetap = IvfpqPageGetMeta(page);
+
+		m = pqmetap->m;
+		codebookPage = pqmetap->codebookPage;
+	}
+	UnlockReleaseBuffer(buf);
+
+	centerSize = GetCenterSize(index);
+	listsSize = MAXALIGN(centerSize * lists) + MAXALIGN(sizeof(BlockNumber) * lists) + MAXALIGN(sizeof(ListInfo) * lists)
+		+ MAXALIGN(centerSize * groups) + 2 * MAXALIGN(sizeof(int) * groups);
+	hasLists = listsSize <= (Size) work_mem * 1024;
+
+	if (pq)
+	{
+		if (m < 1)
+			elog(ERROR, "invalid codebook in \"%s\"", RelationGetRelationName(index));
+
+		codebookSize = MAXALIGN(sizeof(IvfpqCodebook)) + sizeof(float) * IVFPQ_CENTROIDS * dimensions;
+	}
+
+	/* Pointers into a single chunk */
+	ptr = MemoryContextAllocHuge(index->rd_indexcxt, MAXALIGN(sizeof(IvfflatCache)) + (hasLists ? listsSize : 0) + codebookSize);
+	cache = (IvfflatCache *) ptr;
+	ptr += MAXALIGN(sizeof(IvfflatCache));
+
+	cache->type = type;
+	cache->hasLists = hasLists;
+	cache->lists = lists;
+	cache->groups = groups;
+	cache->centerSize = centerSize;
+	cache->codebook = NULL;
+
+	if (hasLists)
+	{
+		cache->centers = ptr;
+		ptr += MAXALIGN(centerSize * lists);
+		cache->startPages = (BlockNumber *) ptr;
+		ptr += MAXALIGN(sizeof(BlockNumber) * lists);
+		cache->listInfo = (ListInfo *) ptr;
+		ptr += MAXALIGN(sizeof(ListInfo) * lists);
+		cache->groupCenters = ptr;
+		ptr += MAXALIGN(centerSize * groups);
+		cache->groupStarts = (int *) ptr;
+		ptr += MAXALIGN(sizeof(int) * groups);
+		cache->groupCounts = (int *) ptr;
+		ptr += MAXALIGN(sizeof(int) * groups);
+	}
+
+	if (pq)
+	{
+		IvfpqCodebook *codebook = (IvfpqCodebook *) ptr;
+
+		codebook->dimensions = dimensions;
+		codebook->m = m;
+		codebook->dsub = dimensions / m;
+		codebook->centroids = (float *) (ptr + MAXALIGN(sizeof(IvfpqCodebook)));
+		cache->codebook = codebook;
+	}
+
+	/* Free the chunk on error */
+	PG_TRY();
+	{
+		if (hasLists)
+		{
+			ReadCacheLists(index, cache);
+			if (groups > 0)
+				ReadCacheGroups(index, cache, groupPage);
+		}
+
+		if (pq)
+			IvfpqReadCodebook(index, codebookPage, cache->codebook->centroids, sizeof(float) * IVFPQ_CENTROIDS * dimensions);
+	}
+	PG_CATCH();
+	{
+		pfree(cache);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	/* Replace a cache loaded without the codebook */
+	if (index->rd_amcache != NULL)
+		pfree(index->rd_amcache);
+	index->rd_amcache = cache;
+
+	return cache;
+}
+
+/*
+ * Get the distance from a center
+ */
+static inline double
+CenterDistance(IvfflatDistanceFunc distfunc, FmgrInfo *procinfo, Oid collation, Vector * center, Datum value)
+{
+	if (distfunc != NULL)
+		return distfunc((Pointer) center, DatumGetPointer(value));
+
+	return DatumGetFloat8(FunctionCall2Coll(procinfo, collation, PointerGetDatum(center), value));
+}
+
+/*
+ * Call the callback for count lists starting at a list, or every list if
+ * count is negative
+ *
+ * distfunc is only set for quantized centers, so the support function
+ * checks dimensions otherwise
+ */
+static int
+SearchListRange(Relation index, IvfflatDistanceFunc distfunc, FmgrInfo *procinfo, Oid collation, Datum value, BlockNumber blkno, OffsetNumber offno, int count, IvfflatListCallback callback, void *arg)
+{
+	int			searched = 0;
+
+	while (BlockNumberIsValid(blkno) && searched != count)
+	{
+		Buffer		cbuf = ReadBuffer(index, blkno);
+		Page		cpage;
+		OffsetNumber maxoffno;
+
+		LockBuffer(cbuf, BUFFER_LOCK_SHARE);
+		cpage = BufferGetPage(cbuf);
+		maxoffno = PageGetMaxOffsetNumber(cpage);
+
+		for (; offno <= maxoffno && searched != count; offno = OffsetNumberNext(offno))
+		{
+			IvfflatList list = (IvfflatList) PageGetItem(cpage, PageGetItemId(cpage, offno));
+			ListInfo	listInfo;
+			double		distance;
+
+			distance = CenterDistance(distfunc, procinfo, collation, &list->center, value);
+
+			listInfo.blkno = blkno;
+			listInfo.offno = offno;
+			callback(list->startPage, listInfo, &list->center, distance, arg);
+			searched++;
+		}
+
+		blkno = IvfflatPageGetOpaque(cpage)->nextblkno;
+		offno = FirstOffsetNumber;
+
+		UnlockReleaseBuffer(cbuf);
+	}
+
+	return searched;
+}
+
+/*
+ * Call the callback for count cached lists starting at a list
+ */
+static void
+SearchCacheRange(IvfflatCache * cache, IvfflatDistanceFunc distfunc, FmgrInfo *procinfo, Oid collation, Datum value, int start, int count, IvfflatListCallback callback, void *arg)
+{
+	for (int i = start; i < start + count; i++)
+	{
+		Vector	   *center = IvfflatCacheCenter(cache, i);
+
+		callback(cache->startPages[i], cache->listInfo[i], center, CenterDistance(distfunc, procinfo, collation, center, value), arg);
+	}
+}
+
+typedef struct GroupDistance
+{
+	double		distance;
+	BlockNumber listPage;
+	OffsetNumber listOffset;
+	int			listStart;		/* only for cached groups */
+	uint16		listCount;
+}			GroupDistance;
+
+static int
+CompareGroupDistances(const void *a, const void *b)
+{
+	double		da = ((const GroupDistance *) a)->distance;
+	double		db = ((const GroupDistance *) b)->distance;
+
+	if (da < db)
+		return -1;
+	if (da > db)
+		return 1;
+	return 0;
+}
+
+/*
+ * Search lists for a value
+ *
+ * Without groups, every list is searched. With groups, only the lists in
+ * the closest groups are searched, with at least ivfflat.group_probes groups
+ * and minLists lists.
+ */
+void
+IvfflatSearchLists(Relation index, FmgrInfo *procinfo, Oid collation, Datum value, int minLists, IvfflatListCallback callback, void *arg)
+{
+	IvfflatCache *cache = IvfflatGetCache(index, false);
+	bool		quantized = IvfflatIsQuantized(index);
+	IvfflatDistanceFunc distfunc;
+	IvfflatDistanceFunc pagefunc = NULL;
+	int			groups = cache->groups;
+	BlockNumber nextblkno = InvalidBlockNumber;
+	GroupDistance *distances;
+	int			groupCount = 0;
+	int			searchedGroups = 0;
+	int			listCount = 0;
+
+	/* Options changed after the index was built */
+	if (IvfflatGetGroups(index) == 0)
+		groups = 0;
+
+	/* Quantized centers can only use the kernels, also for list pages */
+	if (quantized)
+	{
+		CheckQuantDims(index, value);
+		distfunc = IvfflatGetQuantDistanceFunc(procinfo);
+		pagefunc = distfunc;
+	}
+	else
+	{
+		distfunc = IvfflatGetDistanceFunc(procinfo);
+
+		/* The support function checks dimensions, so call it before the kernels */
+		if (cache->hasLists && distfunc != NULL)
+			(void) FunctionCall2Coll(procinfo, collation, PointerGetDatum(IvfflatCacheCenter(cache, 0)), value);
+	}
+
+	if (groups == 0)
+	{
+		if (cache->hasLists)
+			SearchCacheRange(cache, distfunc, procinfo, collation, value, 0, cache->lists, callback, arg);
+		else
+			SearchListRange(index, pagefunc, procinfo, collation, value, IVFFLAT_HEAD_BLKNO, FirstOffsetNumber, -1, callback, arg);
+		return;
+	}
+
+	distances = palloc(sizeof(GroupDistance) * groups);
+
+	if (cache->hasLists)
+	{
+		for (int i = 0; i < groups; i++)
+		{
+			GroupDistance *gd = &distances[groupCount++];
+
+			gd->distance = CenterDistance(distfunc, procinfo, collation, IvfflatCacheGroupCenter(cache, i), value);
+			gd->listStart = cache->groupStarts[i];
+			gd->listCount = cache->groupCounts[i];
+		}
+	}
+	else
+	{
+		Buffer		buf;
+		Page		page;
+
+		buf = ReadBuffer(index, IVFFLAT_METAPAGE_BLKNO);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+		nextblkno = IvfflatPageGetMeta(page)->groupPage;
+		UnlockReleaseBuffer(buf);
+	}
+
+	/* Search all group pages */
+	while (BlockNumberIsValid(nextblkno))
+	{
+		Buffer		gbuf = ReadBuffer(index, nextblkno);
+		Page		gpage;
+		OffsetNumber offno;
+		OffsetNumber maxoffno;
+
+		LockBuffer(gbuf, BUFFER_LOCK_SHARE);
+		gpage = BufferGetPage(gbuf);
+		maxoffno = PageGetMaxOffsetNumber(gpage);
+
+		for (offno = FirstOffsetNumber; offno <= maxoffno && groupCount < groups; offno = OffsetNumberNext(offno))
+		{
+			IvfflatGroup group = (IvfflatGroup) PageGetItem(gpage, PageGetItemId(gpage, offno));
+			GroupDistance *gd = &distances[groupCount++];
+
+			gd->distance = CenterDistance(pagefunc, procinfo, collation, &group->center, value);
+			gd->listPage = group->listPage;
+			gd->listOffset = group->listOffset;
+			gd->listCount = group->listCount;
+		}
+
+		nextblkno = IvfflatPageGetOpaque(gpage)->nextblkno;
+
+		UnlockReleaseBuffer(gbuf);
+	}
+
+	qsort(distances, groupCount, sizeof(GroupDistance), CompareGroupDistances);
+
+	/* Search closest groups first, skipping empty groups */
+	for (int i = 0; i < groupCount; i++)
+	{
+		if (searchedGroups >= ivfflat_group_probes && listCount >= minLists)
+			break;
+
+		if (distances[i].listCount == 0)
+			continue;
+
+		if (cache->hasLists)
+		{
+			SearchCacheRange(cache, distfunc, procinfo, collation, value, distances[i].listStart, distances[i].listCount, callback, arg);
+			listCount += distances[i].listCount;
+		}
+		else
+			listCount += SearchListRange(index, pagefunc, procinfo, collation, value, distances[i].listPage, distances[i].listOffset, distances[i].listCount, callback, arg);
+		searchedGroups++;
+	}
+
+	pfree(distances);
+}
+
+/*
+ * Get the type of the indexed column
+ *
+ * Cached with the lists after the first scan or insert in each backend
+ */
+IvfflatType
+IvfflatGetType(Relation index)
+{
+	IvfflatCache *cache = (IvfflatCache *) index->rd_amcache;
+
+	if (cache != NULL)
+		return cache->type;
+
+	return LookupType(index);
+}
+
+/*
+ * Ensure a sparse vector fits on an index page
+ *
+ * Sparse vectors are limited by non-zero elements instead of dimensions
+ */
+void
+IvfflatCheckSparsevec(Datum value)
+{
+	SparseVector *vec = DatumGetSparseVector(value);
+
+	if (vec->nnz > IVFFLAT_MAX_SPARSEVEC_NNZ)
+		elog(ERROR, "sparsevec cannot have more than %d non-zero elements for ivfflat index", IVFFLAT_MAX_SPARSEVEC_NNZ);
+}
+
 /*
  * Get proc
  */
@@ -74,27 +809,69 @@ IvfflatOptionalProcInfo(Relation rel, uint16 procnum)
  *
  * The caller needs to free the pointer stored in value
  * if it's different than the original value
+ *
+ * For half vectors, result only provides the storage (a vector of the
+ * same dimensions is large enough), and sparse vectors do not use it
+ *
+ * Vectors from l2_normalize are used as is without calling the proc
  */
 bool
-IvfflatNormValue(FmgrInfo *procinfo, Oid collation, Datum *value, Vector * result)
+IvfflatNormValue(FmgrInfo *procinfo, Oid collation, Datum *value, Vector * result, IvfflatType type)
 {
-	Vector	   *v;
 	int			i;
 	double		norm;
 
+	if (type == IVFFLAT_TYPE_VECTOR && VectorIsUnit(DatumGetVector(*value)))
+		return true;
+
 	norm = DatumGetFloat8(FunctionCall1Coll(procinfo, collation, *value));
 
 	if (norm > 0)
 	{
-		v = DatumGetVector(*value);
+		if (type == IVFFLAT_TYPE_HALFVEC)
+		{
+			HalfVector *v = DatumGetHalfVector(*value);
+			HalfVector *hresult = (HalfVector *) result;
 
-		if (result == NULL)
-			result = InitVector(v->dim);
+			if (hresult == NULL)
+				hresult = InitHalfVector(v->dim);
 
-		for (i = 0; i < v->dim; i++)
-			result->x[i] = v->x[i] / norm;
+			SET_VARSIZE(hresult, HALFVEC_SIZE(v->dim));
+			hresult->dim = v->dim;
+			hresult->unused = 0;
+			for (i = 0; i < v->dim; i++)
+				hresult->x[i] = Float4ToHalfUnchecked(HalfToFloat4(v->x[i]) / norm);
 
-		*value = PointerGetDatum(result);
+			*value = PointerGetDatum(hresult);
+		}
+		else if (type == IVFFLAT_TYPE_SPARSEVEC)
+		{
+			SparseVector *v = DatumGetSparseVector(*value);
+			SparseVector *sresult = InitSparseVector(v->dim, v->nnz);
+			float	   *x = SPARSEVEC_VALUES(v);
+			float	   *rx = SPARSEVEC_VALUES(sresult);
+
+			for (i = 0; i < v->nnz; i++)
+			{
+				sresult->indices[i] = v->indices[i];
+				rx[i] = x[i] / norm;
+			}
+
+			*value = PointerGetDatum(sresult);
+		}
+		else
+		{
+			Vector	   *v = DatumGetVector(*value);
+
+			if (result == NULL)
+				result = InitVector(v->dim);
+
+			for (i = 0; i < v->dim; i++)
+				result->x[i] = v->x[i] / norm;
+			result->unused = VECTOR_FLAG_UNIT;
+
+			*value = PointerGetDatum(result);
+		}
 
 		return true;
 	}
@@ -2,7 +2,9 @@
 
 #include "commands/vacuum.h"
 #include "ivfflat.h"
+#include "miscadmin.h"
 #include "storage/bufmgr.h"
+#include "storage/lmgr.h"
 
 /*
  * Bulk delete tuples from the index
@@ -36,6 +38,14 @@ ivfflatbulkdelete(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
 	if (stats == NULL)
 		stats = (IndexBulkDeleteResult *) palloc0(sizeof(IndexBulkDeleteResult));
 
+	/* Move pending tuples to lists, unless the pending list is in use */
+	IvfflatFlushPending(index, maintenance_work_mem);
+
+	/* Prevent flushes from moving tuples after they are checked */
+	LockPage(index, IVFFLAT_METAPAGE_BLKNO, ShareLock);
+
+	IvfflatBulkDeletePending(index, stats, callback, callback_state);
+
 	/* Iterate over list pages */
 	while (BlockNumberIsValid(nextblkno))
 	{
@@ -134,6 +144,8 @@ ivfflatbulkdelete(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
 
 	FreeAccessStrategy(bas);
 
+	UnlockPage(index, IVFFLAT_METAPAGE_BLKNO, ShareLock);
+
 	return stats;
 }
 
@@ -151,7 +163,11 @@ ivfflatvacuumcleanup(IndexVacuumInfo *info, IndexBulkDeleteResult *stats)
 	/* stats is NULL if ambulkdelete not called */
 	/* OK to return NULL if index not changed */
 	if (stats == NULL)
+	{
+		/* Tables with only inserts are vacuumed without ambulkdelete */
+		IvfflatFlushPending(rel, maintenance_work_mem);
 		return NULL;
+	}
 
 	stats->num_pages = RelationGetNumberOfBlocks(rel);
 
@@ -0,0 +1,174 @@
+#include "postgres.h"
+
+#include <math.h>
+
+#include "quantutils.h"
+
+/*
+ * Get the level of an element, with two elements per byte for 4 bits
+ */
+static inline int
+QuantLevel(QuantVector * qvec, int i)
+{
+	if (qvec->bits == 8)
+		return qvec->data[i];
+
+	return (qvec->data[i / 2] >> ((i % 2) * 4)) & 0x0F;
+}
+
+/*
+ * Get the value of the level of an element
+ */
+static inline double
+QuantValue(QuantVector * qvec, int i)
+{
+	return (double) qvec->min + QuantLevel(qvec, i) * (double) qvec->step;
+}
+
+/*
+ * Quantize a vector
+ *
+ * Levels span the elements of the vector, with the step rounded up so the
+ * last level is not below the largest element
+ */
+QuantVector *
+VectorToQuantVector(Vector * vec, QuantVector * result)
+{
+	int			dim = vec->dim;
+	int			bits = QUANTVEC_BITS(dim);
+	int			maxLevel = (1 << bits) - 1;
+	float		min = vec->x[0];
+	float		max = vec->x[0];
+	float		step;
+
+	if (result == NULL)
+		result = (QuantVector *) palloc(QUANTVEC_SIZE(dim));
+
+	memset(result, 0, QUANTVEC_SIZE(dim));
+
+	for (int i = 1; i < dim; i++)
+	{
+		if (vec->x[i] < min)
+			min = vec->x[i];
+		if (vec->x[i] > max)
+			max = vec->x[i];
+	}
+
+	step = ((double) max - min) / maxLevel;
+	while ((double) min + (double) step * maxLevel < max)
+		step = nextafterf(step, FLT_MAX);
+
+	SET_VARSIZE(result, QUANTVEC_SIZE(dim));
+	result->dim = dim;
+	result->bits = bits;
+	result->min = min;
+	result->step = step;
+
+	for (int i = 0; i < dim; i++)
+	{
+		int			level = 0;
+
+		if (step > 0)
+			level = (int) rint(((double) vec->x[i] - min) / step);
+
+		if (level > maxLevel)
+			level = maxLevel;
+
+		if (bits == 8)
+			result->data[i] = level;
+		else
+			result->data[i / 2] |= level << ((i % 2) * 4);
+	}
+
+	return result;
+}
+
+/*
+ * Get the levels of a quantized vector
+ */
+void
+QuantVectorDecode(QuantVector * qvec, float *x)
+{
+	for (int i = 0; i < qvec->dim; i++)
+		x[i] = QuantValue(qvec, i);
+}
+
+/*
+ * Get the L2 squared distance from the levels
+ */
+double
+QuantL2SquaredDistance(QuantVector * a, Vector * b)
+{
+	double		distance = 0.0;
+
+	for (int i = 0; i < a->dim; i++)
+	{
+		double		diff = QuantValue(a, i) - b->x[i];
+
+		distance += diff * diff;
+	}
+
+	return distance;
+}
+
+/*
+ * Get the inner product with the levels
+ */
+double
+QuantInnerProduct(QuantVector * a, Vector * b)
+{
+	double		distance = 0.0;
+
+	for (int i = 0; i < a->dim; i++)
+		distance += QuantValue(a, i) * b->x[i];
+
+	return distance;
+}
+
+/*
+ * Get a lower bound on the L2 distance from the original vector
+ *
+ * Each element is up to half a step from its level, and the bound is
+ * lowered for the rounding of the distance in float
+ */
+double
+QuantL2DistanceBound(QuantVector * a, Vector * b)
+{
+	double		half = a->step * 0.5;
+	double		distance = 0.0;
+
+	for (int i = 0; i < a->dim; i++)
+	{
+		double		diff = fabs(QuantValue(a, i) - b->x[i]) - half;
+
+		if (diff > 0)
+			distance += diff * diff;
+	}
+
+	return sqrt(distance * (1 - QUANTVEC_SLACK(a->dim)));
+}
+
+/*
+ * Get an upper bound on the inner product with the original vector
+ *
+ * Each element is up to half a step from its level, and the bound is
+ * raised for the rounding of the inner product in float
+ */
+double
+QuantInnerProductBound(QuantVector * a, Vector * b)
+{
+	double		half = a->step * 0.5;
+	double		distance = 0.0;
+	double		magnitude = 0.0;
+
+	for (int i = 0; i < a->dim; i++)
+	{
+		double		value = QuantValue(a, i);
+		double		bx = fabs(b->x[i]);
+
+		distance += value * b->x[i] + half * bx;
+		magnitude += (fabs(value) + half) * bx;
+	}
+
+	return distance + magnitude * QUANTVEC_SLACK(a->dim);
+}
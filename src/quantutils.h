@@ -0,0 +1,39 @@
+#ifndef QUANTUTILS_H
+#define QUANTUTILS_H
+
+#include <float.h>
+
+#include "vector.h"
+
+/*
+ * Vectors with more dimensions than fit on an index page, with each element
+ * rounded to the nearest of 2^bits levels starting at min, so each element
+ * is within half a step of its level
+ */
+typedef struct QuantVector
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	int16		dim;			/* number of dimensions */
+	int16		bits;			/* per element */
+	float		min;
+	float		step;			/* between levels */
+	uint8		data[FLEXIBLE_ARRAY_MEMBER];
+}			QuantVector;
+
+/* One byte per element fits on a page up to this, and half a byte past it */
+#define QUANTVEC_MAX_BYTE_DIM	8000
+
+#define QUANTVEC_BITS(_dim)		((_dim) > QUANTVEC_MAX_BYTE_DIM ? 4 : 8)
+#define QUANTVEC_SIZE(_dim)		(offsetof(QuantVector, data) + ((_dim) * QUANTVEC_BITS(_dim) + 7) / 8)
+
+/* Relative rounding of a float distance over dim elements */
+#define QUANTVEC_SLACK(_dim)	(((_dim) + 3) * FLT_EPSILON)
+
+QuantVector *VectorToQuantVector(Vector * vec, QuantVector * result);
+void		QuantVectorDecode(QuantVector * qvec, float *x);
+double		QuantL2SquaredDistance(QuantVector * a, Vector * b);
+double		QuantInnerProduct(QuantVector * a, Vector * b);
+double		QuantL2DistanceBound(QuantVector * a, Vector * b);
+double		QuantInnerProductBound(QuantVector * a, Vector * b);
+
+#endif
@@ -0,0 +1,782 @@
+#include "postgres.h"
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+
+#include "sparsevec.h"
+#include "vector.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+
+#if PG_VERSION_NUM >= 120000
+#include "common/shortest_dec.h"
+#include "utils/float.h"
+#endif
+
+/*
+ * Ensure same dimensions
+ */
+static inline void
+CheckDims(SparseVector * a, SparseVector * b)
+{
+	if (a->dim != b->dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("different sparsevec dimensions %d and %d", a->dim, b->dim)));
+}
+
+/*
+ * Ensure expected dimensions
+ */
+static inline void
+CheckExpectedDim(int32 typmod, int dim)
+{
+	if (typmod != -1 && typmod != dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("expected %d dimensions, not %d", typmod, dim)));
+}
+
+/*
+ * Ensure valid dimensions
+ */
+static inline void
+CheckDim(int dim)
+{
+	if (dim < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("sparsevec must have at least 1 dimension")));
+
+	if (dim > SPARSEVEC_MAX_DIM)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("sparsevec cannot have more than %d dimensions", SPARSEVEC_MAX_DIM)));
+}
+
+/*
+ * Ensure valid number of stored elements
+ */
+static inline void
+CheckNnz(int nnz, int dim)
+{
+	if (nnz < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("sparsevec cannot have negative number of elements")));
+
+	if (nnz > SPARSEVEC_MAX_NNZ)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("sparsevec cannot have more than %d non-zero elements", SPARSEVEC_MAX_NNZ)));
+
+	if (nnz > dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("sparsevec cannot have more elements than dimensions")));
+}
+
+/*
+ * Ensure valid index
+ */
+static inline void
+CheckIndex(long index, int dim)
+{
+	if (index < 0 || index >= dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("sparsevec index out of bounds")));
+}
+
+/*
+ * Ensure finite elements
+ */
+static inline void
+CheckElement(float value)
+{
+	if (isnan(value))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("NaN not allowed in sparsevec")));
+
+	if (isinf(value))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("infinite value not allowed in sparsevec")));
+}
+
+/*
+ * Check if a character is whitespace
+ */
+static inline bool
+sparsevec_isspace(char ch)
+{
+	if (ch == ' ' ||
+		ch == '\t' ||
+		ch == '\n' ||
+		ch == '\r' ||
+		ch == '\v' ||
+		ch == '\f')
+		return true;
+	return false;
+}
+
+/*
+ * Compare elements by index
+ */
+static int
+CompareSparseElements(const void *a, const void *b)
+{
+	int32		ai = ((const SparseElement *) a)->index;
+	int32		bi = ((const SparseElement *) b)->index;
+
+	if (ai < bi)
+		return -1;
+	if (ai > bi)
+		return 1;
+	return 0;
+}
+
+/*
+ * Parse an integer in the text representation
+ */
+static long
+ParseSparseInt(char **str, char *lit)
+{
+	char	   *end;
+	long		value;
+
+	while (sparsevec_isspace(**str))
+		(*str)++;
+
+	errno = 0;
+	value = strtol(*str, &end, 10);
+
+	if (end == *str)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type sparsevec: \"%s\"", lit)));
+
+	if (errno == ERANGE || value < INT_MIN || value > INT_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("value out of range for type sparsevec: \"%s\"", lit)));
+
+	*str = end;
+	while (sparsevec_isspace(**str))
+		(*str)++;
+
+	return value;
+}
+
+/*
+ * Get the inner product of two sparse vectors
+ *
+ * The merge advances one or both sides per step with comparisons instead
+ * of branches, since matches are unpredictable
+ */
+static double
+SparsevecInnerProduct(SparseVector * a, SparseVector * b)
+{
+	float	   *ax = SPARSEVEC_VALUES(a);
+	float	   *bx = SPARSEVEC_VALUES(b);
+	double		distance = 0.0;
+	int			i = 0;
+	int			j = 0;
+
+	while (i < a->nnz && j < b->nnz)
+	{
+		int32		ai = a->indices[i];
+		int32		bj = b->indices[j];
+		float		prod = ax[i] * bx[j];
+
+		distance += ai == bj ? prod : 0;
+		i += ai <= bj;
+		j += bj <= ai;
+	}
+
+	return distance;
+}
+
+/*
+ * Get the L2 squared distance between two sparse vectors
+ *
+ * Elements stored in only one vector are compared with zero
+ */
+static double
+SparsevecL2SquaredDistance(SparseVector * a, SparseVector * b)
+{
+	float	   *ax = SPARSEVEC_VALUES(a);
+	float	   *bx = SPARSEVEC_VALUES(b);
+	double		distance = 0.0;
+	int			i = 0;
+	int			j = 0;
+
+	while (i < a->nnz && j < b->nnz)
+	{
+		int32		ai = a->indices[i];
+		int32		bj = b->indices[j];
+		float		diff = (ai <= bj ? ax[i] : 0) - (bj <= ai ? bx[j] : 0);
+
+		distance += diff * diff;
+		i += ai <= bj;
+		j += bj <= ai;
+	}
+
+	for (; i < a->nnz; i++)
+		distance += ax[i] * ax[i];
+
+	for (; j < b->nnz; j++)
+		distance += bx[j] * bx[j];
+
+	return distance;
+}
+
+/*
+ * Get the squared L2 norm of a sparse vector
+ */
+static double
+SparsevecSquaredNorm(SparseVector * a)
+{
+	float	   *ax = SPARSEVEC_VALUES(a);
+	double		norm = 0.0;
+
+	for (int i = 0; i < a->nnz; i++)
+		norm += ax[i] * ax[i];
+
+	return norm;
+}
+
+/*
+ * Convert textual representation to internal representation
+ *
+ * The format is {index:value,...}/dimensions with one-based indices
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_in);
+Datum
+sparsevec_in(PG_FUNCTION_ARGS)
+{
+	char	   *lit = PG_GETARG_CSTRING(0);
+	int32		typmod = PG_GETARG_INT32(2);
+	char	   *str = lit;
+	char	   *pt;
+	int			maxnnz = 1;
+	int			nnz = 0;
+	int			nonzero = 0;
+	int			dim;
+	SparseElement *elements;
+	SparseVector *result;
+	float	   *values;
+
+	while (sparsevec_isspace(*str))
+		str++;
+
+	if (*str != '{')
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("malformed sparsevec literal: \"%s\"", lit),
+				 errdetail("Sparse vector contents must start with \"{\".")));
+
+	str++;
+
+	/* Upper bound on the number of elements */
+	for (pt = str; *pt != '\0' && maxnnz <= SPARSEVEC_MAX_NNZ; pt++)
+	{
+		if (*pt == ',')
+			maxnnz++;
+	}
+	maxnnz = Min(maxnnz, SPARSEVEC_MAX_NNZ);
+
+	elements = palloc(maxnnz * sizeof(SparseElement));
+
+	while (sparsevec_isspace(*str))
+		str++;
+
+	if (*str != '}')
+	{
+		for (;;)
+		{
+			long		index;
+			float		value;
+			char	   *stringEnd;
+
+			if (nnz == SPARSEVEC_MAX_NNZ)
+				ereport(ERROR,
+						(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						 errmsg("sparsevec cannot have more than %d non-zero elements", SPARSEVEC_MAX_NNZ)));
+
+			index = ParseSparseInt(&str, lit);
+
+			if (*str != ':')
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("malformed sparsevec literal: \"%s\"", lit),
+						 errdetail("Elements must be index:value pairs.")));
+			str++;
+
+			while (sparsevec_isspace(*str))
+				str++;
+
+			errno = 0;
+			value = strtof(str, &stringEnd);
+
+			if (stringEnd == str)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("invalid input syntax for type sparsevec: \"%s\"", lit)));
+
+			if (errno == ERANGE && isinf(value))
+				ereport(ERROR,
+						(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+						 errmsg("value out of range: overflow")));
+
+			CheckElement(value);
+
+			/* Indices are checked against the dimensions once they are known */
+			if (index < 1 || index > SPARSEVEC_MAX_DIM)
+				ereport(ERROR,
+						(errcode(ERRCODE_DATA_EXCEPTION),
+						 errmsg("sparsevec index out of bounds")));
+
+			elements[nnz].index = index - 1;
+			elements[nnz].value = value;
+			nnz++;
+
+			str = stringEnd;
+			while (sparsevec_isspace(*str))
+				str++;
+
+			if (*str == ',')
+				str++;
+			else if (*str == '}')
+				break;
+			else
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("malformed sparsevec literal: \"%s\"", lit)));
+		}
+	}
+
+	/* Skip the closing brace */
+	str++;
+
+	while (sparsevec_isspace(*str))
+		str++;
+
+	if (*str != '/')
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("malformed sparsevec literal: \"%s\"", lit),
+				 errdetail("Dimensions must follow \"/\" after the elements.")));
+	str++;
+
+	dim = ParseSparseInt(&str, lit);
+
+	if (*str != '\0')
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("malformed sparsevec literal: \"%s\"", lit),
+				 errdetail("Junk after dimensions.")));
+
+	CheckDim(dim);
+	CheckExpectedDim(typmod, dim);
+
+	qsort(elements, nnz, sizeof(SparseElement), CompareSparseElements);
+
+	for (int i = 0; i < nnz; i++)
+	{
+		CheckIndex(elements[i].index, dim);
+
+		if (i > 0 && elements[i].index == elements[i - 1].index)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("sparsevec indices must not contain duplicates")));
+	}
+
+	/* Zeros are not stored */
+	for (int i = 0; i < nnz; i++)
+	{
+		if (elements[i].value != 0)
+			nonzero++;
+	}
+
+	result = InitSparseVector(dim, nonzero);
+	values = SPARSEVEC_VALUES(result);
+	for (int i = 0, j = 0; i < nnz; i++)
+	{
+		if (elements[i].value != 0)
+		{
+			result->indices[j] = elements[i].index;
+			values[j] = elements[i].value;
+			j++;
+		}
+	}
+
+	pfree(elements);
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Convert internal representation to textual representation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_out);
+Datum
+sparsevec_out(PG_FUNCTION_ARGS)
+{
+	SparseVector *vec = PG_GETARG_SPARSEVEC_P(0);
+	float	   *values = SPARSEVEC_VALUES(vec);
+	char	   *buf;
+	char	   *ptr;
+	int			i;
+	int			n;
+
+#if PG_VERSION_NUM < 120000
+	int			ndig = FLT_DIG + extra_float_digits;
+
+	if (ndig < 1)
+		ndig = 1;
+
+#define FLOAT_SHORTEST_DECIMAL_LEN (ndig + 10)
+#endif
+
+	/* Each element has an index of up to 10 digits, a colon and a comma */
+	buf = (char *) palloc((10 + 1 + FLOAT_SHORTEST_DECIMAL_LEN + 1) * vec->nnz + 2 + 1 + 10 + 1);
+	ptr = buf;
+
+	*ptr = '{';
+	ptr++;
+	for (i = 0; i < vec->nnz; i++)
+	{
+		if (i > 0)
+		{
+			*ptr = ',';
+			ptr++;
+		}
+
+		ptr += sprintf(ptr, "%d:", vec->indices[i] + 1);
+
+#if PG_VERSION_NUM >= 120000
+		n = float_to_shortest_decimal_bufn(values[i], ptr);
+#else
+		n = sprintf(ptr, "%.*g", ndig, values[i]);
+#endif
+		ptr += n;
+	}
+	*ptr = '}';
+	ptr++;
+
+	sprintf(ptr, "/%d", vec->dim);
+
+	PG_FREE_IF_COPY(vec, 0);
+	PG_RETURN_CSTRING(buf);
+}
+
+/*
+ * Convert type modifier
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_typmod_in);
+Datum
+sparsevec_typmod_in(PG_FUNCTION_ARGS)
+{
+	ArrayType  *ta = PG_GETARG_ARRAYTYPE_P(0);
+	int32	   *tl;
+	int			n;
+
+	tl = ArrayGetIntegerTypmods(ta, &n);
+
+	if (n != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid type modifier")));
+
+	if (*tl < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("dimensions for type sparsevec must be at least 1")));
+
+	if (*tl > SPARSEVEC_MAX_DIM)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("dimensions for type sparsevec cannot exceed %d", SPARSEVEC_MAX_DIM)));
+
+	PG_RETURN_INT32(*tl);
+}
+
+/*
+ * Convert external binary representation to internal representation
+ *
+ * The header is followed by the zero-based indices and then the values
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_recv);
+Datum
+sparsevec_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo	buf = (StringInfo) PG_GETARG_POINTER(0);
+	int32		typmod = PG_GETARG_INT32(2);
+	SparseVector *result;
+	float	   *values;
+	int32		dim;
+	int32		nnz;
+	int32		unused;
+	int			i;
+
+	dim = pq_getmsgint(buf, sizeof(int32));
+	nnz = pq_getmsgint(buf, sizeof(int32));
+	unused = pq_getmsgint(buf, sizeof(int32));
+
+	CheckDim(dim);
+	CheckNnz(nnz, dim);
+	CheckExpectedDim(typmod, dim);
+
+	if (unused != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("expected unused to be 0, not %d", unused)));
+
+	result = InitSparseVector(dim, nnz);
+	values = SPARSEVEC_VALUES(result);
+
+	for (i = 0; i < nnz; i++)
+	{
+		result->indices[i] = pq_getmsgint(buf, sizeof(int32));
+		CheckIndex(result->indices[i], dim);
+
+		/* The distance functions rely on the order */
+		if (i > 0 && result->indices[i] <= result->indices[i - 1])
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("sparsevec indices must be in ascending order")));
+	}
+
+	for (i = 0; i < nnz; i++)
+	{
+		values[i] = pq_getmsgfloat4(buf);
+		CheckElement(values[i]);
+	}
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Convert internal representation to the external binary representation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_send);
+Datum
+sparsevec_send(PG_FUNCTION_ARGS)
+{
+	SparseVector *vec = PG_GETARG_SPARSEVEC_P(0);
+	float	   *values = SPARSEVEC_VALUES(vec);
+	StringInfoData buf;
+	int			i;
+
+	pq_begintypsend(&buf);
+	pq_sendint(&buf, vec->dim, sizeof(int32));
+	pq_sendint(&buf, vec->nnz, sizeof(int32));
+	pq_sendint(&buf, vec->unused, sizeof(int32));
+	for (i = 0; i < vec->nnz; i++)
+		pq_sendint(&buf, vec->indices[i], sizeof(int32));
+	for (i = 0; i < vec->nnz; i++)
+		pq_sendfloat4(&buf, values[i]);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Convert sparsevec to sparsevec
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec);
+Datum
+sparsevec(PG_FUNCTION_ARGS)
+{
+	SparseVector *arg = PG_GETARG_SPARSEVEC_P(0);
+	int32		typmod = PG_GETARG_INT32(1);
+
+	CheckExpectedDim(typmod, arg->dim);
+
+	PG_RETURN_POINTER(arg);
+}
+
+/*
+ * Convert vector to sparsevec
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(vector_to_sparsevec);
+Datum
+vector_to_sparsevec(PG_FUNCTION_ARGS)
+{
+	Vector	   *vec = PG_GETARG_VECTOR_P(0);
+	int32		typmod = PG_GETARG_INT32(1);
+	SparseVector *result;
+	float	   *values;
+	int			nnz = 0;
+	int			j = 0;
+
+	CheckExpectedDim(typmod, vec->dim);
+
+	for (int i = 0; i < vec->dim; i++)
+	{
+		if (vec->x[i] != 0)
+			nnz++;
+	}
+
+	result = InitSparseVector(vec->dim, nnz);
+	values = SPARSEVEC_VALUES(result);
+	for (int i = 0; i < vec->dim; i++)
+	{
+		if (vec->x[i] != 0)
+		{
+			result->indices[j] = i;
+			values[j] = vec->x[i];
+			j++;
+		}
+	}
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Convert sparsevec to vector
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_to_vector);
+Datum
+sparsevec_to_vector(PG_FUNCTION_ARGS)
+{
+	SparseVector *vec = PG_GETARG_SPARSEVEC_P(0);
+	int32		typmod = PG_GETARG_INT32(1);
+	float	   *values = SPARSEVEC_VALUES(vec);
+	Vector	   *result;
+
+	CheckExpectedDim(typmod, vec->dim);
+
+	if (vec->dim > VECTOR_MAX_DIM)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("vector cannot have more than %d dimensions", VECTOR_MAX_DIM)));
+
+	result = InitVector(vec->dim);
+	for (int i = 0; i < vec->nnz; i++)
+		result->x[vec->indices[i]] = values[i];
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Get the L2 distance between sparse vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_l2_distance);
+Datum
+sparsevec_l2_distance(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	CheckDims(a, b);
+
+	PG_RETURN_FLOAT8(sqrt(SparsevecL2SquaredDistance(a, b)));
+}
+
+/*
+ * Get the L2 squared distance between sparse vectors
+ * This saves a sqrt calculation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_l2_squared_distance);
+Datum
+sparsevec_l2_squared_distance(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	CheckDims(a, b);
+
+	PG_RETURN_FLOAT8(SparsevecL2SquaredDistance(a, b));
+}
+
+/*
+ * Get the inner product of two sparse vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_inner_product);
+Datum
+sparsevec_inner_product(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	CheckDims(a, b);
+
+	PG_RETURN_FLOAT8(SparsevecInnerProduct(a, b));
+}
+
+/*
+ * Get the negative inner product of two sparse vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_negative_inner_product);
+Datum
+sparsevec_negative_inner_product(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+
+	CheckDims(a, b);
+
+	PG_RETURN_FLOAT8(-SparsevecInnerProduct(a, b));
+}
+
+/*
+ * Get the cosine distance between two sparse vectors
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_cosine_distance);
+Datum
+sparsevec_cosine_distance(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+	double		similarity;
+
+	CheckDims(a, b);
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	similarity = SparsevecInnerProduct(a, b) / sqrt(SparsevecSquaredNorm(a) * SparsevecSquaredNorm(b));
+
+	PG_RETURN_FLOAT8(1 - similarity);
+}
+
+/*
+ * Get the spherical distance between two sparse vectors
+ * Assumes inputs are unit vectors (skips norm)
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_spherical_distance);
+Datum
+sparsevec_spherical_distance(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+	SparseVector *b = PG_GETARG_SPARSEVEC_P(1);
+	double		distance;
+
+	CheckDims(a, b);
+
+	distance = SparsevecInnerProduct(a, b);
+
+	/* Prevent NaN with acos with loss of precision */
+	if (distance > 1)
+		distance = 1;
+	else if (distance < -1)
+		distance = -1;
+
+	PG_RETURN_FLOAT8(acos(distance) / M_PI);
+}
+
+/*
+ * Get the L2 norm of a sparse vector
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(sparsevec_norm);
+Datum
+sparsevec_norm(PG_FUNCTION_ARGS)
+{
+	SparseVector *a = PG_GETARG_SPARSEVEC_P(0);
+
+	PG_RETURN_FLOAT8(sqrt(SparsevecSquaredNorm(a)));
+}
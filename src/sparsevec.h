@@ -0,0 +1,59 @@
+#ifndef SPARSEVEC_H
+#define SPARSEVEC_H
+
+#include "postgres.h"
+
+#if PG_VERSION_NUM >= 160000
+#include "varatt.h"
+#endif
+
+#include "vector.h"
+
+#define SPARSEVEC_MAX_DIM 1000000000
+#define SPARSEVEC_MAX_NNZ 16000
+
+#define SPARSEVEC_SIZE(_nnz)		(offsetof(SparseVector, indices) + (_nnz) * (sizeof(int32) + sizeof(float)))
+#define SPARSEVEC_VALUES(_vec)		((float *) ((char *) (_vec)->indices + (_vec)->nnz * sizeof(int32)))
+#define DatumGetSparseVector(x)		((SparseVector *) PG_DETOAST_DATUM(x))
+#define PG_GETARG_SPARSEVEC_P(x)	DatumGetSparseVector(PG_GETARG_DATUM(x))
+#define PG_RETURN_SPARSEVEC_P(x)	PG_RETURN_POINTER(x)
+
+/*
+ * Indices are zero-based and strictly increasing, and the values follow
+ * them, so a vector is one varlena with no pointers
+ */
+typedef struct SparseVector
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	int32		dim;			/* number of dimensions */
+	int32		nnz;			/* number of stored elements */
+	int32		unused;
+	int32		indices[FLEXIBLE_ARRAY_MEMBER];
+}			SparseVector;
+
+/* An element of a sparse vector while it is parsed or summed */
+typedef struct SparseElement
+{
+	int32		index;
+	float		value;
+}			SparseElement;
+
+/*
+ * Allocate and initialize a new sparse vector
+ */
+static inline SparseVector *
+InitSparseVector(int dim, int nnz)
+{
+	SparseVector *result;
+	int			size;
+
+	size = SPARSEVEC_SIZE(nnz);
+	result = (SparseVector *) palloc0(size);
+	SET_VARSIZE(result, size);
+	result->dim = dim;
+	result->nnz = nnz;
+
+	return result;
+}
+
+#endif
@@ -0,0 +1,307 @@
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+#include "vector.h"
+#include "vectorutils.h"
+
+#if PG_VERSION_NUM >= 120000
+#include "access/table.h"
+#include "access/tableam.h"
+#else
+#define table_open(r, l) heap_open(r, l)
+#define table_close(r, l) heap_close(r, l)
+#endif
+
+/* Grow the heap as needed so a large k does not allocate up front */
+#define TOPK_INITIAL_SIZE 1024
+
+typedef struct TopkItem
+{
+	ItemPointerData tid;
+	double		distance;
+}			TopkItem;
+
+/*
+ * Bounded max-heap of the closest rows seen so far
+ */
+typedef struct TopkHeap
+{
+	TopkItem   *items;
+	int			length;
+	int			maxlen;
+	int			k;
+}			TopkHeap;
+
+/*
+ * Restore the heap property downwards from the root
+ */
+static void
+TopkSiftDown(TopkHeap * heap)
+{
+	TopkItem   *items = heap->items;
+	TopkItem	item = items[0];
+	int			i = 0;
+
+	for (;;)
+	{
+		int			child = 2 * i + 1;
+
+		if (child >= heap->length)
+			break;
+
+		if (child + 1 < heap->length && items[child + 1].distance > items[child].distance)
+			child++;
+
+		if (items[child].distance <= item.distance)
+			break;
+
+		items[i] = items[child];
+		i = child;
+	}
+
+	items[i] = item;
+}
+
+/*
+ * Add a row, keeping only the k closest
+ */
+static inline void
+TopkAdd(TopkHeap * heap, ItemPointer tid, double distance)
+{
+	TopkItem   *items;
+	int			i;
+
+	/* Full, replace the farthest if closer */
+	if (heap->length == heap->k)
+	{
+		if (distance >= heap->items[0].distance)
+			return;
+
+		heap->items[0].tid = *tid;
+		heap->items[0].distance = distance;
+		TopkSiftDown(heap);
+		return;
+	}
+
+	if (heap->length == heap->maxlen)
+	{
+		heap->maxlen = Min(heap->maxlen * 2, heap->k);
+		heap->items = repalloc(heap->items, sizeof(TopkItem) * heap->maxlen);
+	}
+
+	/* Sift up */
+	items = heap->items;
+	i = heap->length++;
+	while (i > 0)
+	{
+		int			parent = (i - 1) / 2;
+
+		if (items[parent].distance >= distance)
+			break;
+
+		items[i] = items[parent];
+		i = parent;
+	}
+
+	items[i].tid = *tid;
+	items[i].distance = distance;
+}
+
+/*
+ * Compare items by distance, then tid for a stable order
+ */
+static int
+CompareTopkItems(const void *a, const void *b)
+{
+	const TopkItem *ia = (const TopkItem *) a;
+	const TopkItem *ib = (const TopkItem *) b;
+
+	if (ia->distance < ib->distance)
+		return -1;
+
+	if (ia->distance > ib->distance)
+		return 1;
+
+	return ItemPointerCompare((ItemPointer) &ia->tid, (ItemPointer) &ib->tid);
+}
+
+/*
+ * Add the distance for a single value
+ */
+static inline void
+TopkAddValue(TopkHeap * heap, Vector * query, Datum value, ItemPointer tid)
+{
+	Vector	   *vec = DatumGetVector(value);
+
+	if (vec->dim != query->dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("different vector dimensions %d and %d", vec->dim, query->dim)));
+
+	TopkAdd(heap, tid, VectorL2SquaredDistance(vec->dim, vec->x, query->x));
+
+	/* Free detoasted copy */
+	if ((Pointer) vec != DatumGetPointer(value))
+		pfree(vec);
+}
+
+/*
+ * Scan the table and collect the closest rows
+ */
+static void
+TopkScan(TopkHeap * heap, Relation rel, AttrNumber attnum, Vector * query)
+{
+	Snapshot	snapshot = GetActiveSnapshot();
+	bool		isnull;
+	Datum		value;
+
+#if PG_VERSION_NUM >= 120000
+	TableScanDesc scan = table_beginscan(rel, snapshot, 0, NULL);
+	TupleTableSlot *slot = table_slot_create(rel, NULL);
+
+	while (table_scan_getnextslot(scan, ForwardScanDirection, slot))
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		value = slot_getattr(slot, attnum, &isnull);
+		if (!isnull)
+			TopkAddValue(heap, query, value, &slot->tts_tid);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	table_endscan(scan);
+#else
+	HeapScanDesc scan = heap_beginscan(rel, snapshot, 0, NULL);
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	HeapTuple	tuple;
+
+	while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		value = heap_getattr(tuple, attnum, tupdesc, &isnull);
+		if (!isnull)
+			TopkAddValue(heap, query, value, &tuple->t_self);
+	}
+
+	heap_endscan(scan);
+#endif
+}
+
+/*
+ * Find the k rows closest to the query by L2 distance with a sequential
+ * scan
+ *
+ * Distances are computed directly with the SIMD kernel and only the k
+ * closest rows are kept, instead of a distance call and a sort entry for
+ * every row
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(vector_topk);
+Datum
+vector_topk(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	TopkHeap   *heap;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		Oid			relid = PG_GETARG_OID(0);
+		Name		colname = PG_GETARG_NAME(1);
+		Vector	   *query;
+		int32		k = PG_GETARG_INT32(3);
+		MemoryContext oldcontext;
+		TupleDesc	tupdesc;
+		Relation	rel;
+		AttrNumber	attnum;
+		AclResult	aclresult;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (k < 1)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("k must be at least 1")));
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		rel = table_open(relid, AccessShareLock);
+
+		if (rel->rd_rel->relkind != RELKIND_RELATION && rel->rd_rel->relkind != RELKIND_MATVIEW)
+			ereport(ERROR,
+					(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+					 errmsg("\"%s\" is not a table or materialized view", RelationGetRelationName(rel))));
+
+		aclresult = pg_class_aclcheck(relid, GetUserId(), ACL_SELECT);
+		if (aclresult != ACLCHECK_OK)
+			aclcheck_error(aclresult, get_relkind_objtype(rel->rd_rel->relkind), RelationGetRelationName(rel));
+
+		attnum = get_attnum(relid, NameStr(*colname));
+		if (attnum == InvalidAttrNumber)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_COLUMN),
+					 errmsg("column \"%s\" of relation \"%s\" does not exist",
+							NameStr(*colname), RelationGetRelationName(rel))));
+
+		/* The query argument has the vector type */
+		if (attnum < 0 || TupleDescAttr(RelationGetDescr(rel), attnum - 1)->atttypid != get_fn_expr_argtype(fcinfo->flinfo, 2))
+			ereport(ERROR,
+					(errcode(ERRCODE_DATATYPE_MISMATCH),
+					 errmsg("column \"%s\" must have type vector", NameStr(*colname))));
+
+		query = PG_GETARG_VECTOR_P(2);
+
+		heap = palloc(sizeof(TopkHeap));
+		heap->k = k;
+		heap->length = 0;
+		heap->maxlen = Min(k, TOPK_INITIAL_SIZE);
+		heap->items = palloc(sizeof(TopkItem) * heap->maxlen);
+
+		TopkScan(heap, rel, attnum, query);
+
+		table_close(rel, AccessShareLock);
+
+		/* Closest first */
+		qsort(heap->items, heap->length, sizeof(TopkItem), CompareTopkItems);
+
+		funcctx->max_calls = heap->length;
+		funcctx->user_fctx = heap;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	heap = (TopkHeap *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		TopkItem   *item = &heap->items[funcctx->call_cntr];
+		Datum		values[2];
+		bool		nulls[2] = {false, false};
+		HeapTuple	tuple;
+
+		values[0] = ItemPointerGetDatum(&item->tid);
+		values[1] = Float8GetDatum(sqrt(item->distance));
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
@@ -1,8 +1,10 @@
 #include "postgres.h"
 
+#include <float.h>
 #include <math.h>
 
 #include "vector.h"
+#include "vectorutils.h"
 #include "fmgr.h"
 #include "catalog/pg_type.h"
 #include "lib/stringinfo.h"
@@ -11,12 +13,11 @@
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/numeric.h"
+#include "utils/syscache.h"
 
 #if PG_VERSION_NUM >= 120000
 #include "common/shortest_dec.h"
 #include "utils/float.h"
-#else
-#include <float.h>
 #endif
 
 #if PG_VERSION_NUM < 130000
@@ -27,6 +28,21 @@
 #define STATE_DIMS(x) (ARR_DIMS(x)[0] - 1)
 #define CreateStateDatums(dim) palloc(sizeof(Datum) * (dim + 1))
 
+/*
+ * Transition state of the avg and sum aggregates
+ *
+ * Lives in the aggregate context for the whole group, so each row only
+ * adds to the sums
+ */
+typedef struct VectorAggState
+{
+	int64		n;
+	int			dim;
+	double		sum[FLEXIBLE_ARRAY_MEMBER];
+}			VectorAggState;
+
+#define VECTOR_AGG_STATE_SIZE(_dim) (offsetof(VectorAggState, sum) + sizeof(double) * (_dim))
+
 PG_MODULE_MAGIC;
 
 /*
@@ -71,20 +87,29 @@ CheckDim(int dim)
 }
 
 /*
- * Ensure finite elements
+ * Ensure finite elements, for input that is also parsed for other types
  */
 static inline void
-CheckElement(float value)
+CheckElementForType(float value, const char *typname)
 {
 	if (isnan(value))
 		ereport(ERROR,
 				(errcode(ERRCODE_DATA_EXCEPTION),
-				 errmsg("NaN not allowed in vector")));
+				 errmsg("NaN not allowed in %s", typname)));
 
 	if (isinf(value))
 		ereport(ERROR,
 				(errcode(ERRCODE_DATA_EXCEPTION),
-				 errmsg("infinite value not allowed in vector")));
+				 errmsg("infinite value not allowed in %s", typname)));
+}
+
+/*
+ * Ensure finite elements
+ */
+static inline void
+CheckElement(float value)
+{
+	CheckElementForType(value, "vector");
 }
 
 /*
@@ -128,21 +153,162 @@ float_overflow_error(void)
 #endif
 
 /*
- * Convert textual representation to internal representation
+ * Powers of ten that are exact in double
  */
-PGDLLEXPORT PG_FUNCTION_INFO_V1(vector_in);
-Datum
-vector_in(PG_FUNCTION_ARGS)
+static const double exact_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * Check for a character that can follow an element
+ */
+static inline bool
+vector_isdelim(char ch)
 {
-	char	   *str = PG_GETARG_CSTRING(0);
-	int32		typmod = PG_GETARG_INT32(2);
-	int			i;
-	float		x[VECTOR_MAX_DIM];
-	int			dim = 0;
+	return ch == ',' || ch == ']' || ch == '\0' || vector_isspace(ch);
+}
+
+/*
+ * Parse a float like strtof
+ *
+ * Plain decimal numbers with a mantissa below 2^53 and an exponent of at
+ * most 22 are converted with one correctly rounded double multiplication
+ * or division (Clinger's fast path). Rounding that double to float gives
+ * the correctly rounded float unless the double lies exactly halfway
+ * between two floats, so that case and everything else (long mantissas,
+ * NaN, Infinity, hex, values outside the normal float range) goes to
+ * strtof.
+ */
+static float
+vector_strtof(char *str, char **endptr)
+{
+	/* The fast path needs double arithmetic without excess precision (x87) */
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD >= 0 && FLT_EVAL_METHOD != 2
+	char	   *p = str;
+	bool		negative = false;
+	bool		seen_digit = false;
+	uint64		mantissa = 0;
+	int			digits = 0;
+	int			exponent = 0;
+	double		value;
+	uint64		bits;
+
+	if (*p == '-')
+	{
+		negative = true;
+		p++;
+	}
+	else if (*p == '+')
+		p++;
+
+	for (; *p >= '0' && *p <= '9'; p++)
+	{
+		seen_digit = true;
+		if (mantissa == 0 && *p == '0')
+			continue;
+		if (++digits > 19)
+			goto fallback;
+		mantissa = mantissa * 10 + (*p - '0');
+	}
+
+	if (*p == '.')
+	{
+		for (p++; *p >= '0' && *p <= '9'; p++)
+		{
+			seen_digit = true;
+			exponent--;
+			if (mantissa == 0 && *p == '0')
+				continue;
+			if (++digits > 19)
+				goto fallback;
+			mantissa = mantissa * 10 + (*p - '0');
+		}
+	}
+
+	if (!seen_digit)
+		goto fallback;
+
+	if (*p == 'e' || *p == 'E')
+	{
+		bool		exp_negative = false;
+		int			exp_value = 0;
+
+		p++;
+		if (*p == '-')
+		{
+			exp_negative = true;
+			p++;
+		}
+		else if (*p == '+')
+			p++;
+
+		if (!(*p >= '0' && *p <= '9'))
+			goto fallback;
+
+		for (; *p >= '0' && *p <= '9'; p++)
+		{
+			if (exp_value > 1000)
+				goto fallback;
+			exp_value = exp_value * 10 + (*p - '0');
+		}
+
+		exponent += exp_negative ? -exp_value : exp_value;
+	}
+
+	/* Let strtof decide where the number ends in unusual cases */
+	if (!vector_isdelim(*p))
+		goto fallback;
+
+	/* Leave negative zero to strtof, the build may not preserve signed zeros */
+	if (mantissa == 0 && !negative)
+	{
+		*endptr = p;
+		return 0.0f;
+	}
+
+	if (mantissa == 0 || mantissa > ((uint64) 1 << 53) || exponent < -22 || exponent > 22)
+		goto fallback;
+
+	if (exponent < 0)
+		value = (double) mantissa / exact_powers_of_ten[-exponent];
+	else
+		value = (double) mantissa * exact_powers_of_ten[exponent];
+
+	/* Subnormal and overflowing values */
+	if (value < FLT_MIN || value > FLT_MAX)
+		goto fallback;
+
+	/* Halfway between two floats, rounding again could be off by one ulp */
+	memcpy(&bits, &value, sizeof(bits));
+	if ((bits & ((UINT64CONST(1) << 29) - 1)) == (UINT64CONST(1) << 28))
+		goto fallback;
+
+	*endptr = p;
+	return negative ? (float) -value : (float) value;
+
+fallback:
+#endif
+	/* Use strtof like float4in to avoid a double-rounding problem */
+	return strtof(str, endptr);
+}
+
+/*
+ * Parse the textual representation of a vector
+ *
+ * Parses the literal in a single pass and writes the elements directly
+ * into the result, which is sized from the number of delimiters. Errors
+ * name typname, since halfvec uses the same format.
+ */
+Vector *
+VectorParseLiteral(char *lit, const char *typname, int maxdims)
+{
+	char	   *str = lit;
 	char	   *pt;
-	char	   *stringEnd;
+	int			maxdim = 1;
+	int			dim = 0;
+	bool		consecutiveDelims = false;
 	Vector	   *result;
-	char	   *lit = pstrdup(str);
 
 	while (vector_isspace(*str))
 		str++;
@@ -150,89 +316,127 @@ vector_in(PG_FUNCTION_ARGS)
 	if (*str != '[')
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-				 errmsg("malformed vector literal: \"%s\"", lit),
+				 errmsg("malformed %s literal: \"%s\"", typname, lit),
 				 errdetail("Vector contents must start with \"[\".")));
 
 	str++;
-	pt = strtok(str, ",");
-	stringEnd = pt;
 
-	while (pt != NULL && *stringEnd != ']')
+	/* Upper bound on the number of elements */
+	for (pt = str; *pt != '\0' && maxdim <= maxdims; pt++)
 	{
-		if (dim == VECTOR_MAX_DIM)
-			ereport(ERROR,
-					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
-					 errmsg("vector cannot have more than %d dimensions", VECTOR_MAX_DIM)));
-
-		while (vector_isspace(*pt))
-			pt++;
-
-		/* Check for empty string like float4in */
-		if (*pt == '\0')
-			ereport(ERROR,
-					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-					 errmsg("invalid input syntax for type vector: \"%s\"", lit)));
-
-		/* Use strtof like float4in to avoid a double-rounding problem */
-		x[dim] = strtof(pt, &stringEnd);
-		CheckElement(x[dim]);
-		dim++;
-
-		if (stringEnd == pt)
-			ereport(ERROR,
-					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-					 errmsg("invalid input syntax for type vector: \"%s\"", lit)));
-
-		while (vector_isspace(*stringEnd))
-			stringEnd++;
+		if (*pt == ',')
+			maxdim++;
+	}
+	maxdim = Min(maxdim, maxdims);
 
-		if (*stringEnd != '\0' && *stringEnd != ']')
-			ereport(ERROR,
-					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-					 errmsg("invalid input syntax for type vector: \"%s\"", lit)));
+	result = (Vector *) palloc(VECTOR_SIZE(maxdim));
 
-		pt = strtok(NULL, ",");
+	if (*str != ']')
+	{
+		for (;;)
+		{
+			float		val;
+			char	   *stringEnd;
+
+			/* Consecutive delimiters, reported once the rest is parsed */
+			if (*str == ',')
+			{
+				consecutiveDelims = true;
+				while (*str == ',')
+					str++;
+			}
+
+			if (*str == '\0')
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("malformed %s literal: \"%s\"", typname, lit),
+						 errdetail("Unexpected end of input.")));
+
+			if (dim == maxdims)
+				ereport(ERROR,
+						(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						 errmsg("%s cannot have more than %d dimensions", typname, maxdims)));
+
+			while (vector_isspace(*str))
+				str++;
+
+			/* Check for empty string like float4in */
+			if (*str == '\0' || *str == ',')
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("invalid input syntax for type %s: \"%s\"", typname, lit)));
+
+			val = vector_strtof(str, &stringEnd);
+
+			if (stringEnd == str)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("invalid input syntax for type %s: \"%s\"", typname, lit)));
+
+			CheckElementForType(val, typname);
+			result->x[dim++] = val;
+
+			str = stringEnd;
+			while (vector_isspace(*str))
+				str++;
+
+			if (*str == ',')
+				str++;
+			else if (*str == ']')
+				break;
+			else if (*str == '\0')
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("malformed %s literal: \"%s\"", typname, lit),
+						 errdetail("Unexpected end of input.")));
+			else
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("invalid input syntax for type %s: \"%s\"", typname, lit)));
+		}
 	}
 
-	if (stringEnd == NULL || *stringEnd != ']')
-		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-				 errmsg("malformed vector literal: \"%s\"", lit),
-				 errdetail("Unexpected end of input.")));
-
-	stringEnd++;
+	str++;
 
 	/* Only whitespace is allowed after the closing brace */
-	while (vector_isspace(*stringEnd))
-		stringEnd++;
+	while (vector_isspace(*str))
+		str++;
 
-	if (*stringEnd != '\0')
+	if (*str != '\0')
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-				 errmsg("malformed vector literal: \"%s\"", lit),
+				 errmsg("malformed %s literal: \"%s\"", typname, lit),
 				 errdetail("Junk after closing right brace.")));
 
-	/* Ensure no consecutive delimiters since strtok skips */
-	for (pt = lit + 1; *pt != '\0'; pt++)
-	{
-		if (pt[-1] == ',' && *pt == ',')
-			ereport(ERROR,
-					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-					 errmsg("malformed vector literal: \"%s\"", lit)));
-	}
+	if (consecutiveDelims)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("malformed %s literal: \"%s\"", typname, lit)));
 
 	if (dim < 1)
 		ereport(ERROR,
 				(errcode(ERRCODE_DATA_EXCEPTION),
-				 errmsg("vector must have at least 1 dimension")));
+				 errmsg("%s must have at least 1 dimension", typname)));
 
-	pfree(lit);
+	SET_VARSIZE(result, VECTOR_SIZE(dim));
+	result->dim = dim;
+	result->unused = 0;
 
-	CheckExpectedDim(typmod, dim);
+	return result;
+}
 
-	result = InitVector(dim);
-	for (i = 0; i < dim; i++)
-		result->x[i] = x[i];
+/*
+ * Convert textual representation to internal representation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(vector_in);
+Datum
+vector_in(PG_FUNCTION_ARGS)
+{
+	char	   *lit = PG_GETARG_CSTRING(0);
+	int32		typmod = PG_GETARG_INT32(2);
+	Vector	   *result = VectorParseLiteral(lit, "vector", VECTOR_MAX_DIM);
+
+	CheckExpectedDim(typmod, result->dim);
 
 	PG_RETURN_POINTER(result);
 }
@@ -298,6 +502,23 @@ vector_out(PG_FUNCTION_ARGS)
 	PG_RETURN_CSTRING(buf);
 }
 
+/*
+ * Get the OID of a type in a schema
+ *
+ * Index access methods look up the types in the schema of their handler,
+ * which is the schema of the extension, so types with the same name in
+ * other schemas are not mistaken for them
+ */
+Oid
+VectorTypeOid(const char *typname, Oid namespaceId)
+{
+#if PG_VERSION_NUM >= 120000
+	return GetSysCacheOid2(TYPENAMENSP, Anum_pg_type_oid, CStringGetDatum(typname), ObjectIdGetDatum(namespaceId));
+#else
+	return GetSysCacheOid2(TYPENAMENSP, CStringGetDatum(typname), ObjectIdGetDatum(namespaceId));
+#endif
+}
+
 /*
  * Print vector - useful for debugging
  */
@@ -389,7 +610,8 @@ vector_send(PG_FUNCTION_ARGS)
 
 	pq_begintypsend(&buf);
 	pq_sendint(&buf, vec->dim, sizeof(int16));
-	pq_sendint(&buf, vec->unused, sizeof(int16));
+	/* Flags are internal */
+	pq_sendint(&buf, 0, sizeof(int16));
 	for (i = 0; i < vec->dim; i++)
 		pq_sendfloat4(&buf, vec->x[i]);
 
@@ -412,14 +634,12 @@ vector(PG_FUNCTION_ARGS)
 }
 
 /*
- * Convert array to vector
+ * Convert an array to a vector, with errors that name typname
  */
-PGDLLEXPORT PG_FUNCTION_INFO_V1(array_to_vector);
-Datum
-array_to_vector(PG_FUNCTION_ARGS)
+Vector *
+VectorFromArray(Datum arrayDatum, int32 typmod, const char *typname, int maxdims)
 {
-	ArrayType  *array = PG_GETARG_ARRAYTYPE_P(0);
-	int32		typmod = PG_GETARG_INT32(1);
+	ArrayType  *array = DatumGetArrayTypeP(arrayDatum);
 	int			i;
 	Vector	   *result;
 	int16		typlen;
@@ -437,7 +657,16 @@ array_to_vector(PG_FUNCTION_ARGS)
 	get_typlenbyvalalign(ARR_ELEMTYPE(array), &typlen, &typbyval, &typalign);
 	deconstruct_array(array, ARR_ELEMTYPE(array), typlen, typbyval, typalign, &elemsp, &nullsp, &nelemsp);
 
-	CheckDim(nelemsp);
+	if (nelemsp < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("%s must have at least 1 dimension", typname)));
+
+	if (nelemsp > maxdims)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("%s cannot have more than %d dimensions", typname, maxdims)));
+
 	CheckExpectedDim(typmod, nelemsp);
 
 	result = InitVector(nelemsp);
@@ -462,10 +691,20 @@ array_to_vector(PG_FUNCTION_ARGS)
 					(errcode(ERRCODE_DATA_EXCEPTION),
 					 errmsg("unsupported array type")));
 
-		CheckElement(result->x[i]);
+		CheckElementForType(result->x[i], typname);
 	}
 
-	PG_RETURN_POINTER(result);
+	return result;
+}
+
+/*
+ * Convert array to vector
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(array_to_vector);
+Datum
+array_to_vector(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_POINTER(VectorFromArray(PG_GETARG_DATUM(0), PG_GETARG_INT32(1), "vector", VECTOR_MAX_DIM));
 }
 
 /*
@@ -502,21 +741,10 @@ l2_distance(PG_FUNCTION_ARGS)
 {
 	Vector	   *a = PG_GETARG_VECTOR_P(0);
 	Vector	   *b = PG_GETARG_VECTOR_P(1);
-	float	   *ax = a->x;
-	float	   *bx = b->x;
-	double		distance = 0.0;
-	double		diff;
 
 	CheckDims(a, b);
 
-	/* Auto-vectorized */
-	for (int i = 0; i < a->dim; i++)
-	{
-		diff = ax[i] - bx[i];
-		distance += diff * diff;
-	}
-
-	PG_RETURN_FLOAT8(sqrt(distance));
+	PG_RETURN_FLOAT8(sqrt(VectorL2SquaredDistance(a->dim, a->x, b->x)));
 }
 
 /*
@@ -529,21 +757,10 @@ vector_l2_squared_distance(PG_FUNCTION_ARGS)
 {
 	Vector	   *a = PG_GETARG_VECTOR_P(0);
 	Vector	   *b = PG_GETARG_VECTOR_P(1);
-	float	   *ax = a->x;
-	float	   *bx = b->x;
-	double		distance = 0.0;
-	double		diff;
 
 	CheckDims(a, b);
 
-	/* Auto-vectorized */
-	for (int i = 0; i < a->dim; i++)
-	{
-		diff = ax[i] - bx[i];
-		distance += diff * diff;
-	}
-
-	PG_RETURN_FLOAT8(distance);
+	PG_RETURN_FLOAT8(VectorL2SquaredDistance(a->dim, a->x, b->x));
 }
 
 /*
@@ -555,17 +772,10 @@ inner_product(PG_FUNCTION_ARGS)
 {
 	Vector	   *a = PG_GETARG_VECTOR_P(0);
 	Vector	   *b = PG_GETARG_VECTOR_P(1);
-	float	   *ax = a->x;
-	float	   *bx = b->x;
-	double		distance = 0.0;
 
 	CheckDims(a, b);
 
-	/* Auto-vectorized */
-	for (int i = 0; i < a->dim; i++)
-		distance += ax[i] * bx[i];
-
-	PG_RETURN_FLOAT8(distance);
+	PG_RETURN_FLOAT8(VectorInnerProduct(a->dim, a->x, b->x));
 }
 
 /*
@@ -577,17 +787,10 @@ vector_negative_inner_product(PG_FUNCTION_ARGS)
 {
 	Vector	   *a = PG_GETARG_VECTOR_P(0);
 	Vector	   *b = PG_GETARG_VECTOR_P(1);
-	float	   *ax = a->x;
-	float	   *bx = b->x;
-	double		distance = 0.0;
 
 	CheckDims(a, b);
 
-	/* Auto-vectorized */
-	for (int i = 0; i < a->dim; i++)
-		distance += ax[i] * bx[i];
-
-	PG_RETURN_FLOAT8(distance * -1);
+	PG_RETURN_FLOAT8(-VectorInnerProduct(a->dim, a->x, b->x));
 }
 
 /*
@@ -599,24 +802,14 @@ cosine_distance(PG_FUNCTION_ARGS)
 {
 	Vector	   *a = PG_GETARG_VECTOR_P(0);
 	Vector	   *b = PG_GETARG_VECTOR_P(1);
-	float	   *ax = a->x;
-	float	   *bx = b->x;
-	double		distance = 0.0;
-	double		norma = 0.0;
-	double		normb = 0.0;
 
 	CheckDims(a, b);
 
-	/* Auto-vectorized */
-	for (int i = 0; i < a->dim; i++)
-	{
-		distance += ax[i] * bx[i];
-		norma += ax[i] * ax[i];
-		normb += bx[i] * bx[i];
-	}
+	/* Norms are already one */
+	if (VectorIsUnit(a) && VectorIsUnit(b))
+		PG_RETURN_FLOAT8(1 - VectorInnerProduct(a->dim, a->x, b->x));
 
-	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
-	PG_RETURN_FLOAT8(1 - (distance / sqrt(norma * normb)));
+	PG_RETURN_FLOAT8(1 - VectorCosineSimilarity(a->dim, a->x, b->x));
 }
 
 /*
@@ -630,13 +823,11 @@ vector_spherical_distance(PG_FUNCTION_ARGS)
 {
 	Vector	   *a = PG_GETARG_VECTOR_P(0);
 	Vector	   *b = PG_GETARG_VECTOR_P(1);
-	double		distance = 0.0;
+	double		distance;
 
 	CheckDims(a, b);
 
-	/* Auto-vectorized */
-	for (int i = 0; i < a->dim; i++)
-		distance += a->x[i] * b->x[i];
+	distance = VectorInnerProduct(a->dim, a->x, b->x);
 
 	/* Prevent NaN with acos with loss of precision */
 	if (distance > 1)
@@ -677,6 +868,45 @@ vector_norm(PG_FUNCTION_ARGS)
 	PG_RETURN_FLOAT8(sqrt(norm));
 }
 
+/*
+ * Normalize a vector with the L2 norm
+ *
+ * The result is flagged as unit length so cosine distance can skip the
+ * norms, zero vectors are returned unchanged and unflagged
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(l2_normalize);
+Datum
+l2_normalize(PG_FUNCTION_ARGS)
+{
+	Vector	   *a = PG_GETARG_VECTOR_P(0);
+	float	   *ax = a->x;
+	double		norm = 0.0;
+	Vector	   *result;
+	float	   *rx;
+
+	result = InitVector(a->dim);
+	rx = result->x;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < a->dim; i++)
+		norm += ax[i] * ax[i];
+
+	norm = sqrt(norm);
+
+	if (norm > 0)
+	{
+		/* Auto-vectorized */
+		for (int i = 0; i < a->dim; i++)
+			rx[i] = ax[i] / norm;
+
+		result->unused |= VECTOR_FLAG_UNIT;
+	}
+	else
+		memcpy(rx, ax, sizeof(float) * a->dim);
+
+	PG_RETURN_POINTER(result);
+}
+
 /*
  * Add vectors
  */
@@ -743,6 +973,44 @@ vector_sub(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(result);
 }
 
+/*
+ * Get a subvector
+ *
+ * Start is one-based like substring, and the range is clamped to the
+ * vector so a prefix can be taken without knowing the dimensions
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(subvector);
+Datum
+subvector(PG_FUNCTION_ARGS)
+{
+	Vector	   *a = PG_GETARG_VECTOR_P(0);
+	int32		start = PG_GETARG_INT32(1);
+	int32		count = PG_GETARG_INT32(2);
+	int32		end;
+	Vector	   *result;
+
+	if (count < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("vector must have at least 1 dimension")));
+
+	/* Check for overflow */
+	if (start > PG_INT32_MAX - count)
+		end = a->dim + 1;
+	else
+		end = Min(start + count, a->dim + 1);
+
+	if (start < 1)
+		start = 1;
+
+	CheckDim(end - start);
+
+	result = InitVector(end - start);
+	memcpy(result->x, a->x + start - 1, sizeof(float) * result->dim);
+
+	PG_RETURN_POINTER(result);
+}
+
 /*
  * Internal helper to compare vectors
  */
@@ -1019,3 +1287,197 @@ vector_avg(PG_FUNCTION_ARGS)
 
 	PG_RETURN_POINTER(result);
 }
+
+/*
+ * Allocate an aggregate state with zero sums
+ */
+static VectorAggState *
+CreateAggState(MemoryContext context, int dim)
+{
+	VectorAggState *state = MemoryContextAllocZero(context, VECTOR_AGG_STATE_SIZE(dim));
+
+	state->dim = dim;
+	return state;
+}
+
+/*
+ * Accumulate vectors into an internal state
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(vector_agg_accum);
+Datum
+vector_agg_accum(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	VectorAggState *state;
+	Vector	   *newval;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "vector_agg_accum called in non-aggregate context");
+
+	state = PG_ARGISNULL(0) ? NULL : (VectorAggState *) PG_GETARG_POINTER(0);
+
+	/* Skip nulls like avg */
+	if (PG_ARGISNULL(1))
+	{
+		if (state == NULL)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(state);
+	}
+
+	newval = PG_GETARG_VECTOR_P(1);
+
+	if (state == NULL)
+		state = CreateAggState(aggcontext, newval->dim);
+	else
+		CheckExpectedDim(state->dim, newval->dim);
+
+	state->n++;
+	VectorAccumulate(state->dim, state->sum, newval->x);
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Combine internal states
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(vector_agg_combine);
+Datum
+vector_agg_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	VectorAggState *state1;
+	VectorAggState *state2;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "vector_agg_combine called in non-aggregate context");
+
+	state1 = PG_ARGISNULL(0) ? NULL : (VectorAggState *) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (VectorAggState *) PG_GETARG_POINTER(1);
+
+	if (state2 == NULL)
+	{
+		if (state1 == NULL)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(state1);
+	}
+
+	/* The result must live in the aggregate context */
+	if (state1 == NULL)
+	{
+		state1 = CreateAggState(aggcontext, state2->dim);
+		state1->n = state2->n;
+		memcpy(state1->sum, state2->sum, sizeof(double) * state2->dim);
+		PG_RETURN_POINTER(state1);
+	}
+
+	CheckExpectedDim(state1->dim, state2->dim);
+
+	state1->n += state2->n;
+	for (int i = 0; i < state1->dim; i++)
+		state1->sum[i] += state2->sum[i];
+
+	PG_RETURN_POINTER(state1);
+}
+
+/*
+ * Serialize an internal state for parallel aggregation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(vector_agg_serialize);
+Datum
+vector_agg_serialize(PG_FUNCTION_ARGS)
+{
+	VectorAggState *state;
+	StringInfoData buf;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "vector_agg_serialize called in non-aggregate context");
+
+	state = (VectorAggState *) PG_GETARG_POINTER(0);
+
+	pq_begintypsend(&buf);
+	pq_sendint64(&buf, state->n);
+	pq_sendint(&buf, state->dim, sizeof(int32));
+	for (int i = 0; i < state->dim; i++)
+		pq_sendfloat8(&buf, state->sum[i]);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Deserialize an internal state for parallel aggregation
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(vector_agg_deserialize);
+Datum
+vector_agg_deserialize(PG_FUNCTION_ARGS)
+{
+	bytea	   *sstate;
+	StringInfoData buf;
+	VectorAggState *state;
+	int64		n;
+	int			dim;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "vector_agg_deserialize called in non-aggregate context");
+
+	sstate = PG_GETARG_BYTEA_PP(0);
+
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf, VARDATA_ANY(sstate), VARSIZE_ANY_EXHDR(sstate));
+
+	n = pq_getmsgint64(&buf);
+	dim = pq_getmsgint(&buf, sizeof(int32));
+	CheckDim(dim);
+
+	state = CreateAggState(CurrentMemoryContext, dim);
+	state->n = n;
+	for (int i = 0; i < dim; i++)
+		state->sum[i] = pq_getmsgfloat8(&buf);
+
+	pq_getmsgend(&buf);
+	pfree(buf.data);
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Average vectors from an internal state
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(vector_agg_avg);
+Datum
+vector_agg_avg(PG_FUNCTION_ARGS)
+{
+	VectorAggState *state = (VectorAggState *) PG_GETARG_POINTER(0);
+	Vector	   *result;
+
+	result = InitVector(state->dim);
+	for (int i = 0; i < state->dim; i++)
+	{
+		result->x[i] = state->sum[i] / state->n;
+		CheckElement(result->x[i]);
+	}
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Sum vectors from an internal state
+ */
+PGDLLEXPORT PG_FUNCTION_INFO_V1(vector_agg_sum);
+Datum
+vector_agg_sum(PG_FUNCTION_ARGS)
+{
+	VectorAggState *state = (VectorAggState *) PG_GETARG_POINTER(0);
+	Vector	   *result;
+
+	result = InitVector(state->dim);
+	for (int i = 0; i < state->dim; i++)
+	{
+		/* Sums are kept in double, so check they fit */
+		if (fabs(state->sum[i]) > FLT_MAX)
+			float_overflow_error();
+
+		result->x[i] = state->sum[i];
+	}
+
+	PG_RETURN_POINTER(result);
+}
@@ -3,6 +3,8 @@
 
 #include "postgres.h"
 
+#include "fmgr.h"
+
 #if PG_VERSION_NUM >= 160000
 #include "varatt.h"
 #endif
@@ -18,12 +20,28 @@ typedef struct Vector
 {
 	int32		vl_len_;		/* varlena header (do not touch directly!) */
 	int16		dim;			/* number of dimensions */
-	int16		unused;
+	int16		unused;			/* flags, always sent to clients as 0 */
 	float		x[FLEXIBLE_ARRAY_MEMBER];
 }			Vector;
 
+/* Set by l2_normalize, cleared by anything that builds a new vector */
+#define VECTOR_FLAG_UNIT		0x0001
+
+#define VectorIsUnit(v)			(((v)->unused & VECTOR_FLAG_UNIT) != 0)
+
 void		PrintVector(char *msg, Vector * vector);
 int			vector_cmp_internal(Vector * a, Vector * b);
+Oid			VectorTypeOid(const char *typname, Oid namespaceId);
+
+/* Shared with the halfvec input functions, which name their own type */
+Vector	   *VectorParseLiteral(char *lit, const char *typname, int maxdims);
+Vector	   *VectorFromArray(Datum arrayDatum, int32 typmod, const char *typname, int maxdims);
+
+/* Recognized by index scans and k-means to call the kernels directly */
+PGDLLEXPORT Datum vector_l2_squared_distance(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum vector_negative_inner_product(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum l2_distance(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum vector_spherical_distance(PG_FUNCTION_ARGS);
 
 /*
  * Allocate and initialize a new vector
@@ -0,0 +1,565 @@
+#include "postgres.h"
+
+#include <math.h>
+
+#include "vectorutils.h"
+
+/*
+ * Explicit SIMD kernels
+ *
+ * The default kernels accumulate in double and rely on auto-vectorization,
+ * which the float to double widening makes slow. The SIMD kernels keep
+ * four float accumulators per lane width (so consecutive FMAs do not wait
+ * on each other) and only add the lanes up in double at the end.
+ *
+ * On x86-64 the AVX2 and AVX-512 kernels are compiled with target
+ * attributes and picked at load time based on the CPU, so the extension
+ * does not need to be built with -march=native to use them. NEON is part
+ * of the base instruction set on AArch64.
+ */
+#if (defined(__x86_64__) || defined(_M_AMD64)) && defined(__GNUC__)
+#define USE_DISPATCH
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * Default kernels
+ */
+static double
+VectorL2SquaredDistanceDefault(int dim, const float *ax, const float *bx)
+{
+	double		distance = 0.0;
+	double		diff;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+	{
+		diff = ax[i] - bx[i];
+		distance += diff * diff;
+	}
+
+	return distance;
+}
+
+static double
+VectorInnerProductDefault(int dim, const float *ax, const float *bx)
+{
+	double		distance = 0.0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+		distance += ax[i] * bx[i];
+
+	return distance;
+}
+
+static double
+VectorCosineSimilarityDefault(int dim, const float *ax, const float *bx)
+{
+	double		similarity = 0.0;
+	double		norma = 0.0;
+	double		normb = 0.0;
+
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+	{
+		similarity += ax[i] * bx[i];
+		norma += ax[i] * ax[i];
+		normb += bx[i] * bx[i];
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return similarity / sqrt(norma * normb);
+}
+
+static void
+VectorAccumulateDefault(int dim, double *sum, const float *x)
+{
+	/* Auto-vectorized */
+	for (int i = 0; i < dim; i++)
+		sum[i] += x[i];
+}
+
+#ifdef USE_DISPATCH
+/*
+ * AVX2 kernels, the tail of fewer than 8 elements is handled in double
+ */
+TARGET_AVX2 static inline double
+HorizontalSumAvx2(__m256 sum)
+{
+	float		lanes[8];
+	double		result = 0.0;
+
+	_mm256_storeu_ps(lanes, sum);
+	for (int i = 0; i < 8; i++)
+		result += lanes[i];
+
+	return result;
+}
+
+TARGET_AVX2 static double
+VectorL2SquaredDistanceAvx2(int dim, const float *ax, const float *bx)
+{
+	__m256		sum0 = _mm256_setzero_ps();
+	__m256		sum1 = _mm256_setzero_ps();
+	__m256		sum2 = _mm256_setzero_ps();
+	__m256		sum3 = _mm256_setzero_ps();
+	__m256		diff;
+	double		distance;
+	int			i = 0;
+
+	for (; i + 32 <= dim; i += 32)
+	{
+		diff = _mm256_sub_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i));
+		sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+		diff = _mm256_sub_ps(_mm256_loadu_ps(ax + i + 8), _mm256_loadu_ps(bx + i + 8));
+		sum1 = _mm256_fmadd_ps(diff, diff, sum1);
+		diff = _mm256_sub_ps(_mm256_loadu_ps(ax + i + 16), _mm256_loadu_ps(bx + i + 16));
+		sum2 = _mm256_fmadd_ps(diff, diff, sum2);
+		diff = _mm256_sub_ps(_mm256_loadu_ps(ax + i + 24), _mm256_loadu_ps(bx + i + 24));
+		sum3 = _mm256_fmadd_ps(diff, diff, sum3);
+	}
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		diff = _mm256_sub_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i));
+		sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+	}
+
+	distance = HorizontalSumAvx2(_mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3)));
+
+	for (; i < dim; i++)
+	{
+		double		d = ax[i] - bx[i];
+
+		distance += d * d;
+	}
+
+	return distance;
+}
+
+TARGET_AVX2 static double
+VectorInnerProductAvx2(int dim, const float *ax, const float *bx)
+{
+	__m256		sum0 = _mm256_setzero_ps();
+	__m256		sum1 = _mm256_setzero_ps();
+	__m256		sum2 = _mm256_setzero_ps();
+	__m256		sum3 = _mm256_setzero_ps();
+	double		distance;
+	int			i = 0;
+
+	for (; i + 32 <= dim; i += 32)
+	{
+		sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i), sum0);
+		sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(ax + i + 8), _mm256_loadu_ps(bx + i + 8), sum1);
+		sum2 = _mm256_fmadd_ps(_mm256_loadu_ps(ax + i + 16), _mm256_loadu_ps(bx + i + 16), sum2);
+		sum3 = _mm256_fmadd_ps(_mm256_loadu_ps(ax + i + 24), _mm256_loadu_ps(bx + i + 24), sum3);
+	}
+
+	for (; i + 8 <= dim; i += 8)
+		sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i), sum0);
+
+	distance = HorizontalSumAvx2(_mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3)));
+
+	for (; i < dim; i++)
+		distance += (double) ax[i] * bx[i];
+
+	return distance;
+}
+
+TARGET_AVX2 static double
+VectorCosineSimilarityAvx2(int dim, const float *ax, const float *bx)
+{
+	__m256		sim0 = _mm256_setzero_ps();
+	__m256		sim1 = _mm256_setzero_ps();
+	__m256		norma0 = _mm256_setzero_ps();
+	__m256		norma1 = _mm256_setzero_ps();
+	__m256		normb0 = _mm256_setzero_ps();
+	__m256		normb1 = _mm256_setzero_ps();
+	__m256		a;
+	__m256		b;
+	double		similarity;
+	double		norma;
+	double		normb;
+	int			i = 0;
+
+	for (; i + 16 <= dim; i += 16)
+	{
+		a = _mm256_loadu_ps(ax + i);
+		b = _mm256_loadu_ps(bx + i);
+		sim0 = _mm256_fmadd_ps(a, b, sim0);
+		norma0 = _mm256_fmadd_ps(a, a, norma0);
+		normb0 = _mm256_fmadd_ps(b, b, normb0);
+
+		a = _mm256_loadu_ps(ax + i + 8);
+		b = _mm256_loadu_ps(bx + i + 8);
+		sim1 = _mm256_fmadd_ps(a, b, sim1);
+		norma1 = _mm256_fmadd_ps(a, a, norma1);
+		normb1 = _mm256_fmadd_ps(b, b, normb1);
+	}
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		a = _mm256_loadu_ps(ax + i);
+		b = _mm256_loadu_ps(bx + i);
+		sim0 = _mm256_fmadd_ps(a, b, sim0);
+		norma0 = _mm256_fmadd_ps(a, a, norma0);
+		normb0 = _mm256_fmadd_ps(b, b, normb0);
+	}
+
+	similarity = HorizontalSumAvx2(_mm256_add_ps(sim0, sim1));
+	norma = HorizontalSumAvx2(_mm256_add_ps(norma0, norma1));
+	normb = HorizontalSumAvx2(_mm256_add_ps(normb0, normb1));
+
+	for (; i < dim; i++)
+	{
+		similarity += (double) ax[i] * bx[i];
+		norma += (double) ax[i] * ax[i];
+		normb += (double) bx[i] * bx[i];
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return similarity / sqrt(norma * normb);
+}
+
+TARGET_AVX2 static void
+VectorAccumulateAvx2(int dim, double *sum, const float *x)
+{
+	int			i = 0;
+
+	for (; i + 8 <= dim; i += 8)
+	{
+		__m256		v = _mm256_loadu_ps(x + i);
+
+		_mm256_storeu_pd(sum + i, _mm256_add_pd(_mm256_loadu_pd(sum + i), _mm256_cvtps_pd(_mm256_castps256_ps128(v))));
+		_mm256_storeu_pd(sum + i + 4, _mm256_add_pd(_mm256_loadu_pd(sum + i + 4), _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1))));
+	}
+
+	for (; i < dim; i++)
+		sum[i] += x[i];
+}
+
+/*
+ * AVX-512 kernels, the tail is handled with a masked load
+ */
+TARGET_AVX512 static inline double
+HorizontalSumAvx512(__m512 sum)
+{
+	float		lanes[16];
+	double		result = 0.0;
+
+	_mm512_storeu_ps(lanes, sum);
+	for (int i = 0; i < 16; i++)
+		result += lanes[i];
+
+	return result;
+}
+
+TARGET_AVX512 static inline __mmask16
+TailMask(int count)
+{
+	return (__mmask16) ((1U << count) - 1);
+}
+
+TARGET_AVX512 static double
+VectorL2SquaredDistanceAvx512(int dim, const float *ax, const float *bx)
+{
+	__m512		sum0 = _mm512_setzero_ps();
+	__m512		sum1 = _mm512_setzero_ps();
+	__m512		sum2 = _mm512_setzero_ps();
+	__m512		sum3 = _mm512_setzero_ps();
+	__m512		diff;
+	int			i = 0;
+
+	for (; i + 64 <= dim; i += 64)
+	{
+		diff = _mm512_sub_ps(_mm512_loadu_ps(ax + i), _mm512_loadu_ps(bx + i));
+		sum0 = _mm512_fmadd_ps(diff, diff, sum0);
+		diff = _mm512_sub_ps(_mm512_loadu_ps(ax + i + 16), _mm512_loadu_ps(bx + i + 16));
+		sum1 = _mm512_fmadd_ps(diff, diff, sum1);
+		diff = _mm512_sub_ps(_mm512_loadu_ps(ax + i + 32), _mm512_loadu_ps(bx + i + 32));
+		sum2 = _mm512_fmadd_ps(diff, diff, sum2);
+		diff = _mm512_sub_ps(_mm512_loadu_ps(ax + i + 48), _mm512_loadu_ps(bx + i + 48));
+		sum3 = _mm512_fmadd_ps(diff, diff, sum3);
+	}
+
+	for (; i + 16 <= dim; i += 16)
+	{
+		diff = _mm512_sub_ps(_mm512_loadu_ps(ax + i), _mm512_loadu_ps(bx + i));
+		sum0 = _mm512_fmadd_ps(diff, diff, sum0);
+	}
+
+	if (i < dim)
+	{
+		__mmask16	mask = TailMask(dim - i);
+
+		diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, ax + i), _mm512_maskz_loadu_ps(mask, bx + i));
+		sum1 = _mm512_fmadd_ps(diff, diff, sum1);
+	}
+
+	return HorizontalSumAvx512(_mm512_add_ps(_mm512_add_ps(sum0, sum1), _mm512_add_ps(sum2, sum3)));
+}
+
+TARGET_AVX512 static double
+VectorInnerProductAvx512(int dim, const float *ax, const float *bx)
+{
+	__m512		sum0 = _mm512_setzero_ps();
+	__m512		sum1 = _mm512_setzero_ps();
+	__m512		sum2 = _mm512_setzero_ps();
+	__m512		sum3 = _mm512_setzero_ps();
+	int			i = 0;
+
+	for (; i + 64 <= dim; i += 64)
+	{
+		sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(ax + i), _mm512_loadu_ps(bx + i), sum0);
+		sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(ax + i + 16), _mm512_loadu_ps(bx + i + 16), sum1);
+		sum2 = _mm512_fmadd_ps(_mm512_loadu_ps(ax + i + 32), _mm512_loadu_ps(bx + i + 32), sum2);
+		sum3 = _mm512_fmadd_ps(_mm512_loadu_ps(ax + i + 48), _mm512_loadu_ps(bx + i + 48), sum3);
+	}
+
+	for (; i + 16 <= dim; i += 16)
+		sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(ax + i), _mm512_loadu_ps(bx + i), sum0);
+
+	if (i < dim)
+	{
+		__mmask16	mask = TailMask(dim - i);
+
+		sum1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, ax + i), _mm512_maskz_loadu_ps(mask, bx + i), sum1);
+	}
+
+	return HorizontalSumAvx512(_mm512_add_ps(_mm512_add_ps(sum0, sum1), _mm512_add_ps(sum2, sum3)));
+}
+
+TARGET_AVX512 static double
+VectorCosineSimilarityAvx512(int dim, const float *ax, const float *bx)
+{
+	__m512		sim0 = _mm512_setzero_ps();
+	__m512		sim1 = _mm512_setzero_ps();
+	__m512		norma0 = _mm512_setzero_ps();
+	__m512		norma1 = _mm512_setzero_ps();
+	__m512		normb0 = _mm512_setzero_ps();
+	__m512		normb1 = _mm512_setzero_ps();
+	__m512		a;
+	__m512		b;
+	int			i = 0;
+
+	for (; i + 32 <= dim; i += 32)
+	{
+		a = _mm512_loadu_ps(ax + i);
+		b = _mm512_loadu_ps(bx + i);
+		sim0 = _mm512_fmadd_ps(a, b, sim0);
+		norma0 = _mm512_fmadd_ps(a, a, norma0);
+		normb0 = _mm512_fmadd_ps(b, b, normb0);
+
+		a = _mm512_loadu_ps(ax + i + 16);
+		b = _mm512_loadu_ps(bx + i + 16);
+		sim1 = _mm512_fmadd_ps(a, b, sim1);
+		norma1 = _mm512_fmadd_ps(a, a, norma1);
+		normb1 = _mm512_fmadd_ps(b, b, normb1);
+	}
+
+	for (; i < dim; i += 16)
+	{
+		__mmask16	mask = dim - i >= 16 ? (__mmask16) 0xFFFF : TailMask(dim - i);
+
+		a = _mm512_maskz_loadu_ps(mask, ax + i);
+		b = _mm512_maskz_loadu_ps(mask, bx + i);
+		sim0 = _mm512_fmadd_ps(a, b, sim0);
+		norma0 = _mm512_fmadd_ps(a, a, norma0);
+		normb0 = _mm512_fmadd_ps(b, b, normb0);
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return HorizontalSumAvx512(_mm512_add_ps(sim0, sim1)) /
+		sqrt(HorizontalSumAvx512(_mm512_add_ps(norma0, norma1)) *
+			 HorizontalSumAvx512(_mm512_add_ps(normb0, normb1)));
+}
+
+TARGET_AVX512 static void
+VectorAccumulateAvx512(int dim, double *sum, const float *x)
+{
+	int			i = 0;
+
+	for (; i < dim; i += 8)
+	{
+		__mmask8	mask = dim - i >= 8 ? (__mmask8) 0xFF : (__mmask8) TailMask(dim - i);
+		__m512d		v = _mm512_cvtps_pd(_mm512_castps512_ps256(_mm512_maskz_loadu_ps(mask, x + i)));
+
+		_mm512_mask_storeu_pd(sum + i, mask, _mm512_add_pd(_mm512_maskz_loadu_pd(mask, sum + i), v));
+	}
+}
+#endif
+
+#ifdef USE_NEON
+/*
+ * NEON kernels, the tail of fewer than 4 elements is handled in double
+ */
+static double
+VectorL2SquaredDistanceNeon(int dim, const float *ax, const float *bx)
+{
+	float32x4_t sum0 = vdupq_n_f32(0);
+	float32x4_t sum1 = vdupq_n_f32(0);
+	float32x4_t sum2 = vdupq_n_f32(0);
+	float32x4_t sum3 = vdupq_n_f32(0);
+	float32x4_t diff;
+	double		distance;
+	int			i = 0;
+
+	for (; i + 16 <= dim; i += 16)
+	{
+		diff = vsubq_f32(vld1q_f32(ax + i), vld1q_f32(bx + i));
+		sum0 = vfmaq_f32(sum0, diff, diff);
+		diff = vsubq_f32(vld1q_f32(ax + i + 4), vld1q_f32(bx + i + 4));
+		sum1 = vfmaq_f32(sum1, diff, diff);
+		diff = vsubq_f32(vld1q_f32(ax + i + 8), vld1q_f32(bx + i + 8));
+		sum2 = vfmaq_f32(sum2, diff, diff);
+		diff = vsubq_f32(vld1q_f32(ax + i + 12), vld1q_f32(bx + i + 12));
+		sum3 = vfmaq_f32(sum3, diff, diff);
+	}
+
+	for (; i + 4 <= dim; i += 4)
+	{
+		diff = vsubq_f32(vld1q_f32(ax + i), vld1q_f32(bx + i));
+		sum0 = vfmaq_f32(sum0, diff, diff);
+	}
+
+	distance = vaddvq_f32(vaddq_f32(vaddq_f32(sum0, sum1), vaddq_f32(sum2, sum3)));
+
+	for (; i < dim; i++)
+	{
+		double		d = ax[i] - bx[i];
+
+		distance += d * d;
+	}
+
+	return distance;
+}
+
+static double
+VectorInnerProductNeon(int dim, const float *ax, const float *bx)
+{
+	float32x4_t sum0 = vdupq_n_f32(0);
+	float32x4_t sum1 = vdupq_n_f32(0);
+	float32x4_t sum2 = vdupq_n_f32(0);
+	float32x4_t sum3 = vdupq_n_f32(0);
+	double		distance;
+	int			i = 0;
+
+	for (; i + 16 <= dim; i += 16)
+	{
+		sum0 = vfmaq_f32(sum0, vld1q_f32(ax + i), vld1q_f32(bx + i));
+		sum1 = vfmaq_f32(sum1, vld1q_f32(ax + i + 4), vld1q_f32(bx + i + 4));
+		sum2 = vfmaq_f32(sum2, vld1q_f32(ax + i + 8), vld1q_f32(bx + i + 8));
+		sum3 = vfmaq_f32(sum3, vld1q_f32(ax + i + 12), vld1q_f32(bx + i + 12));
+	}
+
+	for (; i + 4 <= dim; i += 4)
+		sum0 = vfmaq_f32(sum0, vld1q_f32(ax + i), vld1q_f32(bx + i));
+
+	distance = vaddvq_f32(vaddq_f32(vaddq_f32(sum0, sum1), vaddq_f32(sum2, sum3)));
+
+	for (; i < dim; i++)
+		distance += (double) ax[i] * bx[i];
+
+	return distance;
+}
+
+static double
+VectorCosineSimilarityNeon(int dim, const float *ax, const float *bx)
+{
+	float32x4_t sim = vdupq_n_f32(0);
+	float32x4_t norma4 = vdupq_n_f32(0);
+	float32x4_t normb4 = vdupq_n_f32(0);
+	float32x4_t a;
+	float32x4_t b;
+	double		similarity;
+	double		norma;
+	double		normb;
+	int			i = 0;
+
+	for (; i + 4 <= dim; i += 4)
+	{
+		a = vld1q_f32(ax + i);
+		b = vld1q_f32(bx + i);
+		sim = vfmaq_f32(sim, a, b);
+		norma4 = vfmaq_f32(norma4, a, a);
+		normb4 = vfmaq_f32(normb4, b, b);
+	}
+
+	similarity = vaddvq_f32(sim);
+	norma = vaddvq_f32(norma4);
+	normb = vaddvq_f32(normb4);
+
+	for (; i < dim; i++)
+	{
+		similarity += (double) ax[i] * bx[i];
+		norma += (double) ax[i] * ax[i];
+		normb += (double) bx[i] * bx[i];
+	}
+
+	/* Use sqrt(a * b) over sqrt(a) * sqrt(b) */
+	return similarity / sqrt(norma * normb);
+}
+
+static void
+VectorAccumulateNeon(int dim, double *sum, const float *x)
+{
+	int			i = 0;
+
+	for (; i + 4 <= dim; i += 4)
+	{
+		float32x4_t v = vld1q_f32(x + i);
+
+		vst1q_f64(sum + i, vaddq_f64(vld1q_f64(sum + i), vcvt_f64_f32(vget_low_f32(v))));
+		vst1q_f64(sum + i + 2, vaddq_f64(vld1q_f64(sum + i + 2), vcvt_high_f64_f32(v)));
+	}
+
+	for (; i < dim; i++)
+		sum[i] += x[i];
+}
+#endif
+
+double		(*VectorL2SquaredDistance) (int dim, const float *ax, const float *bx) = VectorL2SquaredDistanceDefault;
+double		(*VectorInnerProduct) (int dim, const float *ax, const float *bx) = VectorInnerProductDefault;
+double		(*VectorCosineSimilarity) (int dim, const float *ax, const float *bx) = VectorCosineSimilarityDefault;
+void		(*VectorAccumulate) (int dim, double *sum, const float *x) = VectorAccumulateDefault;
+
+/*
+ * Choose the distance kernels for the CPU
+ */
+void
+VectorUtilsInit(void)
+{
+#ifdef USE_DISPATCH
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		VectorL2SquaredDistance = VectorL2SquaredDistanceAvx512;
+		VectorInnerProduct = VectorInnerProductAvx512;
+		VectorCosineSimilarity = VectorCosineSimilarityAvx512;
+		VectorAccumulate = VectorAccumulateAvx512;
+	}
+	else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	{
+		VectorL2SquaredDistance = VectorL2SquaredDistanceAvx2;
+		VectorInnerProduct = VectorInnerProductAvx2;
+		VectorCosineSimilarity = VectorCosineSimilarityAvx2;
+		VectorAccumulate = VectorAccumulateAvx2;
+	}
+#endif
+
+#ifdef USE_NEON
+	VectorL2SquaredDistance = VectorL2SquaredDistanceNeon;
+	VectorInnerProduct = VectorInnerProductNeon;
+	VectorCosineSimilarity = VectorCosineSimilarityNeon;
+	VectorAccumulate = VectorAccumulateNeon;
+#endif
+}
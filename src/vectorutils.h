@@ -0,0 +1,17 @@
+#ifndef VECTORUTILS_H
+#define VECTORUTILS_H
+
+/*
+ * Distance kernels, set by VectorUtilsInit to the best implementation
+ * for the CPU the server runs on
+ */
+extern double (*VectorL2SquaredDistance) (int dim, const float *ax, const float *bx);
+extern double (*VectorInnerProduct) (int dim, const float *ax, const float *bx);
+extern double (*VectorCosineSimilarity) (int dim, const float *ax, const float *bx);
+
+/* Add a vector to a sum in double, used by the aggregates */
+extern void (*VectorAccumulate) (int dim, double *sum, const float *x);
+
+void		VectorUtilsInit(void);
+
+#endif
@@ -0,0 +1,33 @@
+SELECT '101'::bitvec;
+SELECT ' 0101 '::bitvec;
+SELECT '012'::bitvec;
+SELECT ''::bitvec;
+SELECT '101'::bitvec(2);
+
+SELECT binary_quantize('[1,-2,0,3]');
+SELECT bitvec_dims('10101');
+
+SELECT hamming_distance('1010', '0110');
+SELECT hamming_distance('1010', '01');
+SELECT jaccard_distance('1110', '0111');
+SELECT jaccard_distance('0000', '0000');
+
+SELECT '1111'::bitvec <~> '0000';
+SELECT '1100'::bitvec <%> '1000';
+
+SET enable_seqscan = off;
+
+CREATE TABLE t (val bitvec(4));
+INSERT INTO t (val) VALUES ('0000'), ('1100'), ('1111'), (NULL);
+CREATE INDEX ON t USING ivfflat (val bitvec_hamming_ops) WITH (lists = 1);
+
+INSERT INTO t (val) VALUES ('1110');
+
+SELECT * FROM t ORDER BY val <~> '1111';
+
+DROP INDEX t_val_idx;
+CREATE INDEX ON t USING ivfflat (val bitvec_jaccard_ops) WITH (lists = 1);
+
+SELECT * FROM t ORDER BY val <%> '1000';
+
+DROP TABLE t;
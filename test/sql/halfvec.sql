@@ -0,0 +1,55 @@
+SELECT '[1,2,3]'::halfvec;
+SELECT '[-1,0.1,65504]'::halfvec;
+SELECT '[65520]'::halfvec;
+SELECT '[1,2,3]'::halfvec(2);
+SELECT '[NaN]'::halfvec;
+SELECT '[1,2'::halfvec;
+SELECT '[]'::halfvec;
+
+SELECT '[1,2,3]'::vector::halfvec;
+SELECT '[0.1]'::halfvec::vector;
+SELECT ARRAY[1,2,3]::halfvec;
+SELECT '[1,2,3]'::halfvec::real[];
+
+SELECT halfvec_dims('[1,2,3]');
+SELECT halfvec_norm('[3,4]');
+
+SELECT halfvec_l2_distance('[0,0]', '[3,4]');
+SELECT halfvec_l2_distance('[1,2]', '[3]');
+SELECT halfvec_inner_product('[1,2]', '[3,4]');
+SELECT halfvec_cosine_distance('[1,2]', '[2,4]');
+
+SELECT '[0,0]'::halfvec <-> '[3,4]';
+SELECT '[1,2]'::halfvec <#> '[3,4]';
+SELECT '[1,1]'::halfvec <=> '[-1,-1]';
+
+SET enable_seqscan = off;
+
+CREATE TABLE t (val halfvec(3));
+INSERT INTO t (val) VALUES ('[0,0,0]'), ('[1,2,3]'), ('[1,1,1]'), (NULL);
+CREATE INDEX ON t USING ivfflat (val halfvec_l2_ops) WITH (lists = 1);
+
+INSERT INTO t (val) VALUES ('[1,2,4]');
+
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+
+DROP INDEX t_val_idx;
+CREATE INDEX ON t USING ivfflat (val halfvec_cosine_ops) WITH (lists = 1);
+
+SELECT * FROM t ORDER BY val <=> '[3,3,3]';
+
+DROP TABLE t;
+
+CREATE TABLE t (val halfvec(4000));
+INSERT INTO t (val) SELECT array_fill(n, ARRAY[4000])::halfvec FROM generate_series(1, 3) n;
+CREATE INDEX ON t USING ivfflat (val halfvec_l2_ops) WITH (lists = 1);
+
+INSERT INTO t (val) VALUES (array_fill(4, ARRAY[4000])::halfvec);
+
+SELECT (val::real[])[1] AS first FROM t ORDER BY val <-> array_fill(2.9, ARRAY[4000])::halfvec;
+
+DROP TABLE t;
+
+CREATE TABLE t (val halfvec(4001));
+CREATE INDEX ON t USING ivfflat (val halfvec_l2_ops) WITH (lists = 1);
+DROP TABLE t;
@@ -21,6 +21,9 @@ SELECT '[1,]'::vector;
 SELECT '[1a]'::vector;
 SELECT '[1,,3]'::vector;
 SELECT '[1, ,3]'::vector;
+SELECT '[,1]'::vector;
+SELECT '[1],2'::vector;
+SELECT '[0.1,1e-3,3.4028235e38,-0]'::vector;
 SELECT '[1,2,3]'::vector(2);
 
 SELECT unnest('{"[1,2,3]", "[4,5,6]"}'::vector[]);
@@ -0,0 +1,32 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (val vector(3));
+INSERT INTO t (val) VALUES ('[0,0,0]'), ('[1,2,3]'), ('[1,1,1]'), (NULL);
+CREATE INDEX ON t USING ivfflat (val) WITH (lists = 1, fastupdate = on);
+
+INSERT INTO t (val) VALUES ('[1,2,4]'), ('[2,2,2]'), (NULL);
+
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+
+VACUUM t;
+
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+
+DELETE FROM t WHERE val = '[1,2,3]';
+INSERT INTO t (val) VALUES ('[3,3,3]');
+
+VACUUM t;
+
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+
+SET ivfflat.pending_list_limit = 64;
+INSERT INTO t (val) SELECT ARRAY[i + 10, i + 10, i + 10] FROM generate_series(1, 10000) i;
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <-> '[3,3,3]') t2;
+RESET ivfflat.pending_list_limit;
+
+ALTER INDEX t_val_idx SET (fastupdate = off);
+INSERT INTO t (val) VALUES ('[3,3,4]');
+
+SELECT * FROM t ORDER BY val <-> '[3,3,3]' LIMIT 3;
+
+DROP TABLE t;
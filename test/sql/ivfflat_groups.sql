@@ -0,0 +1,18 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (val vector(3));
+INSERT INTO t (val) VALUES ('[0,0,0]'), ('[1,2,3]'), ('[1,1,1]'), (NULL);
+CREATE INDEX ON t USING ivfflat (val) WITH (lists = 3, groups = 2);
+
+INSERT INTO t (val) VALUES ('[1,2,4]');
+
+SET ivfflat.probes = 3;
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+
+SET ivfflat.group_probes = 1;
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+
+RESET ivfflat.group_probes;
+RESET ivfflat.probes;
+
+DROP TABLE t;
@@ -0,0 +1,21 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (val vector(3));
+INSERT INTO t (val) VALUES ('[0,0,0]'), ('[1,2,3]'), ('[1,1,1]'), (NULL);
+CREATE INDEX ON t USING ivfflat (val) WITH (lists = 3);
+
+INSERT INTO t (val) VALUES ('[1,2,4]');
+
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+
+SET ivfflat.iterative_scan = on;
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+SELECT * FROM t WHERE val <> '[1,2,3]' AND val <> '[1,2,4]' ORDER BY val <-> '[3,3,3]' LIMIT 1;
+
+SET ivfflat.max_probes = 2;
+SELECT * FROM t ORDER BY val <-> '[3,3,3]';
+
+RESET ivfflat.max_probes;
+RESET ivfflat.iterative_scan;
+
+DROP TABLE t;
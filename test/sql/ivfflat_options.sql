@@ -3,7 +3,13 @@ SET enable_seqscan = off;
 CREATE TABLE t (val vector(3));
 CREATE INDEX ON t USING ivfflat (val) WITH (lists = 0);
 CREATE INDEX ON t USING ivfflat (val) WITH (lists = 32769);
+CREATE INDEX ON t USING ivfflat (val) WITH (groups = -1);
+CREATE INDEX ON t USING ivfflat (val) WITH (lists = 10, groups = 10);
 
 SHOW ivfflat.probes;
+SHOW ivfflat.group_probes;
+SHOW ivfflat.iterative_scan;
+SHOW ivfflat.max_probes;
+SHOW ivfflat.pending_list_limit;
 
 DROP TABLE t;
@@ -0,0 +1,12 @@
+SET enable_seqscan = off;
+SET max_parallel_maintenance_workers = 2;
+
+CREATE TABLE t (val vector(3)) WITH (parallel_workers = 2);
+INSERT INTO t (val) SELECT ARRAY[i % 10, i % 7, i % 3] FROM generate_series(1, 1000) i;
+CREATE INDEX ON t USING ivfflat (val) WITH (lists = 10);
+
+SET ivfflat.probes = 10;
+SELECT * FROM t ORDER BY val <-> '[3,3,2.1]' LIMIT 1;
+SELECT COUNT(*) FROM (SELECT * FROM t ORDER BY val <-> '[3,3,3]') t2;
+
+DROP TABLE t;
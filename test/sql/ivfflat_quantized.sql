@@ -0,0 +1,38 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (id int, val vector(3072));
+INSERT INTO t (id, val) SELECT i, ARRAY(SELECT j % (i + 1) FROM generate_series(1, 3072) j)::real[]::vector FROM generate_series(1, 5) i;
+INSERT INTO t (id, val) VALUES (0, NULL);
+CREATE TABLE q AS SELECT ARRAY(SELECT j % 4 FROM generate_series(1, 3072) j)::real[]::vector AS val;
+
+SET ivfflat.probes = 2;
+
+CREATE INDEX ON t USING ivfflat (val vector_l2_ops) WITH (lists = 2);
+INSERT INTO t (id, val) SELECT 6, ARRAY(SELECT j % 7 FROM generate_series(1, 3072) j)::real[]::vector;
+SELECT id FROM t ORDER BY val <-> (SELECT val FROM q);
+SELECT id FROM t ORDER BY val <-> (SELECT NULL::vector);
+DROP INDEX t_val_idx;
+
+CREATE INDEX ON t USING ivfflat (val vector_ip_ops) WITH (lists = 2);
+SELECT id FROM t ORDER BY val <#> (SELECT val FROM q);
+DROP INDEX t_val_idx;
+
+CREATE INDEX ON t USING ivfflat (val vector_cosine_ops) WITH (lists = 2);
+SELECT id FROM t ORDER BY val <=> (SELECT val FROM q);
+DROP INDEX t_val_idx;
+
+CREATE INDEX ON t USING ivfflat (val vector_l2_ops) WITH (lists = 2, fastupdate = on);
+INSERT INTO t (id, val) SELECT 7, ARRAY(SELECT j % 8 FROM generate_series(1, 3072) j)::real[]::vector;
+SELECT id FROM t ORDER BY val <-> (SELECT val FROM q);
+
+VACUUM t;
+
+SELECT id FROM t ORDER BY val <-> (SELECT val FROM q);
+DROP INDEX t_val_idx;
+
+RESET ivfflat.probes;
+
+CREATE INDEX ON t USING ivfpq (val) WITH (m = 3);
+
+DROP TABLE t;
+DROP TABLE q;
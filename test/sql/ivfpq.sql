@@ -0,0 +1,32 @@
+SET enable_seqscan = off;
+
+CREATE TABLE t (val vector(4));
+INSERT INTO t (val) VALUES ('[0,0,0,0]'), ('[1,2,3,4]'), ('[1,1,1,1]'), (NULL);
+CREATE INDEX ON t USING ivfpq (val) WITH (lists = 1, m = 2);
+
+INSERT INTO t (val) VALUES ('[1,2,4,4]');
+
+SELECT * FROM t ORDER BY val <-> '[3,3,3,3]';
+SELECT * FROM t ORDER BY val <-> (SELECT NULL::vector);
+SELECT COUNT(*) FROM t;
+
+CREATE INDEX ON t USING ivfpq (val) WITH (m = 3);
+CREATE INDEX ON t USING ivfpq (val) WITH (m = 0);
+
+SHOW ivfpq.rerank;
+
+DROP TABLE t;
+
+CREATE TABLE t (val vector(8));
+INSERT INTO t (val) SELECT array_fill(i, '{8}')::real[]::vector FROM generate_series(1, 20) i;
+CREATE INDEX ON t USING ivfpq (val) WITH (lists = 3, m = 4);
+
+SET ivfflat.probes = 3;
+SELECT * FROM t ORDER BY val <-> '[5.2,5.2,5.2,5.2,5.2,5.2,5.2,5.2]' LIMIT 5;
+
+SET ivfpq.rerank = off;
+SELECT * FROM t ORDER BY val <-> '[5.2,5.2,5.2,5.2,5.2,5.2,5.2,5.2]' LIMIT 5;
+
+RESET ivfpq.rerank;
+RESET ivfflat.probes;
+DROP TABLE t;
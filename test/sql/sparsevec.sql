@@ -0,0 +1,62 @@
+SELECT '{1:1.5,3:2}/5'::sparsevec;
+SELECT ' { 3 : 2 , 1 : 1.5 , 2 : 0 } / 5 '::sparsevec;
+SELECT '{}/3'::sparsevec;
+SELECT '{1:1,1:2}/3'::sparsevec;
+SELECT '{4:1}/3'::sparsevec;
+SELECT '{1:NaN}/3'::sparsevec;
+SELECT '[1,2,3]'::sparsevec;
+SELECT '{1:1}'::sparsevec;
+SELECT '{1:1}/3'::sparsevec(2);
+SELECT '{1:1}/100000'::sparsevec;
+
+SELECT '[0,1.5,0,2]'::vector::sparsevec;
+SELECT '{2:1.5,4:2}/4'::sparsevec::vector;
+
+SELECT sparsevec_norm('{1:3,5:4}/5');
+
+SELECT sparsevec_l2_distance('{1:3}/30000', '{30000:4}/30000');
+SELECT sparsevec_l2_distance('{1:1}/2', '{1:1}/3');
+SELECT sparsevec_inner_product('{1:1,2:2,5:3}/5', '{2:4,3:5,5:6}/5');
+SELECT sparsevec_cosine_distance('{1:1,2:2}/3', '{1:2,2:4}/3');
+
+SELECT '{1:1,2:2}/3'::sparsevec <-> '{1:4,3:4}/3';
+SELECT '{1:1,2:2}/3'::sparsevec <#> '{2:3}/3';
+SELECT '{1:1}/3'::sparsevec <=> '{1:-1}/3';
+
+SET enable_seqscan = off;
+
+CREATE TABLE t (val sparsevec(3));
+INSERT INTO t (val) VALUES ('{}/3'), ('{1:1,2:2,3:3}/3'), ('{1:1,2:1,3:1}/3'), (NULL);
+CREATE INDEX ON t USING ivfflat (val sparsevec_l2_ops) WITH (lists = 1);
+
+INSERT INTO t (val) VALUES ('{1:1,2:2,3:4}/3');
+
+SELECT * FROM t ORDER BY val <-> '{1:3,2:3,3:3}/3';
+
+DROP INDEX t_val_idx;
+CREATE INDEX ON t USING ivfflat (val sparsevec_ip_ops) WITH (lists = 1);
+
+SELECT * FROM t ORDER BY val <#> '{1:3,2:3,3:3}/3';
+
+DROP INDEX t_val_idx;
+CREATE INDEX ON t USING ivfflat (val sparsevec_cosine_ops) WITH (lists = 1);
+
+SELECT * FROM t ORDER BY val <=> '{1:3,2:3,3:3}/3';
+
+DROP TABLE t;
+
+CREATE TABLE t (val sparsevec(100000));
+INSERT INTO t (val) SELECT ('{' || n || ':1,' || n + 50000 || ':2}/100000')::sparsevec FROM generate_series(1, 1000) n;
+CREATE INDEX ON t USING ivfflat (val sparsevec_l2_ops) WITH (lists = 10, groups = 2);
+
+SET ivfflat.probes = 10;
+SELECT * FROM t ORDER BY val <-> '{5:1,50005:2}/100000' LIMIT 1;
+RESET ivfflat.probes;
+
+DROP TABLE t;
+
+CREATE TABLE t (val sparsevec(1001));
+INSERT INTO t (val) VALUES (array_fill(1, ARRAY[1000])::vector::sparsevec);
+CREATE INDEX ON t USING ivfflat (val sparsevec_l2_ops) WITH (lists = 1);
+INSERT INTO t (val) VALUES (array_fill(1, ARRAY[1001])::vector::sparsevec);
+DROP TABLE t;
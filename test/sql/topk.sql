@@ -0,0 +1,12 @@
+CREATE TABLE t (id serial, val vector(3));
+INSERT INTO t (val) VALUES ('[1,1,4]'), ('[2,1,1]'), ('[1,5,1]'), ('[1,1,1]'), (NULL);
+
+SELECT t.val, topk.distance FROM vector_topk('t', 'val', '[1,1,1]', 3) topk JOIN t ON t.ctid = topk.tid ORDER BY topk.distance;
+SELECT count(*) FROM vector_topk('t', 'val', '[1,1,1]', 100);
+
+SELECT * FROM vector_topk('t', 'val', '[1,1]', 3);
+SELECT * FROM vector_topk('t', 'id', '[1,1,1]', 3);
+SELECT * FROM vector_topk('t', 'missing', '[1,1,1]', 3);
+SELECT * FROM vector_topk('t', 'val', '[1,1,1]', 0);
+
+DROP TABLE t;
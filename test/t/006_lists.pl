@@ -24,9 +24,16 @@ my $res = $node->safe_psql("postgres", "EXPLAIN SELECT v FROM tst ORDER BY v <->
 like($res, qr/lists100/);
 unlike($res, qr/lists50/);
 
-# Test errors with too much memory
+# Test uses less memory when bounds for every center do not fit
 my ($ret, $stdout, $stderr) = $node->psql("postgres",
-	"CREATE INDEX lists10000 ON tst USING ivfflat (v) WITH (lists = 10000);"
+	"SET maintenance_work_mem = '1MB'; CREATE INDEX lists100_small ON tst USING ivfflat (v) WITH (lists = 100);"
+);
+is($ret, 0, $stderr);
+$node->safe_psql("postgres", "DROP INDEX lists100_small;");
+
+# Test errors with too much memory
+($ret, $stdout, $stderr) = $node->psql("postgres",
+	"SET maintenance_work_mem = '1MB'; CREATE INDEX lists10000 ON tst USING ivfflat (v) WITH (lists = 10000);"
 );
 like($stderr, qr/memory required is/);
 
@@ -0,0 +1,84 @@
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More;
+
+# Initialize node
+my $node = get_new_node('node');
+$node->init;
+$node->start;
+
+# Create table and index
+$node->safe_psql("postgres", "CREATE EXTENSION vector;");
+$node->safe_psql("postgres", "CREATE TABLE tst (i int4, v vector(3));");
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[random(), random(), random()] FROM generate_series(1, 100000) i;"
+);
+$node->safe_psql("postgres", "CREATE INDEX ON tst USING ivfflat (v) WITH (lists = 100);");
+$node->safe_psql("postgres", "ANALYZE tst;");
+
+my $parallel = qq(
+	SET enable_seqscan = off;
+	SET parallel_setup_cost = 0;
+	SET parallel_tuple_cost = 0;
+	SET min_parallel_table_scan_size = 0;
+	SET min_parallel_index_scan_size = 0;
+	SET max_parallel_workers_per_gather = 2;
+	SET ivfflat.probes = 20;
+);
+
+my $serial = qq(
+	SET enable_seqscan = off;
+	SET max_parallel_workers_per_gather = 0;
+	SET ivfflat.probes = 20;
+);
+
+# Check plan
+my $explain = $node->safe_psql("postgres", qq(
+	$parallel
+	EXPLAIN SELECT i FROM tst ORDER BY v <-> '[0.5,0.5,0.5]' LIMIT 10;
+));
+like($explain, qr/Gather Merge/);
+like($explain, qr/Parallel Index Scan/);
+
+# Test same results as serial scans
+for (1..20) {
+	my $query = "[" . join(",", rand(), rand(), rand()) . "]";
+	my $sql = "SELECT i FROM tst ORDER BY v <-> '$query' LIMIT 10;";
+	my $expected = $node->safe_psql("postgres", "$serial $sql");
+	my $res = $node->safe_psql("postgres", "$parallel $sql");
+	is($res, $expected);
+}
+
+# Add tuples to the pending list, which the participants share
+$node->safe_psql("postgres", "ALTER INDEX tst_v_idx SET (fastupdate = on);");
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT i, ARRAY[random(), random(), random()] FROM generate_series(100001, 105000) i;"
+);
+
+# Fewer shared tids than pending tuples, so one participant scans every list
+my $small = "SET ivfflat.pending_list_limit = 64;";
+
+for (1..10) {
+	my $query = "[" . join(",", rand(), rand(), rand()) . "]";
+	my $sql = "SELECT i FROM tst ORDER BY v <-> '$query' LIMIT 10;";
+	my $expected = $node->safe_psql("postgres", "$serial $sql");
+	my $res = $node->safe_psql("postgres", "$parallel $sql");
+	is($res, $expected);
+	$res = $node->safe_psql("postgres", "$parallel $small $sql");
+	is($res, $expected);
+}
+
+# Each tuple once, from the pending list or lists
+foreach (("", $small)) {
+	my $res = $node->safe_psql("postgres", qq(
+		$parallel
+		$_
+		SET ivfflat.probes = 100;
+		SELECT COUNT(*), COUNT(DISTINCT i) FROM (SELECT i FROM tst ORDER BY v <-> '[0.5,0.5,0.5]') t;
+	));
+	is($res, "105000|105000");
+}
+
+done_testing();
@@ -0,0 +1,64 @@
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More;
+
+my $dim = 32;
+
+my $array_sql = join(",", ('random()') x $dim);
+
+# Initialize node
+my $node = get_new_node('node');
+$node->init;
+$node->start;
+
+# Create table and index
+$node->safe_psql("postgres", "CREATE EXTENSION vector;");
+$node->safe_psql("postgres", "CREATE TABLE tst (v vector($dim));");
+$node->safe_psql("postgres",
+	"INSERT INTO tst SELECT ARRAY[$array_sql] FROM generate_series(1, 10000) i;"
+);
+$node->safe_psql("postgres", "CREATE INDEX ON tst USING ivfflat (v) WITH (lists = 10, fastupdate = on);");
+
+# Flush often, while scans read the pending list
+$node->pgbench(
+	"--no-vacuum --client=5 --transactions=100",
+	0,
+	[qr{actually processed}],
+	[qr{^$}],
+	"concurrent INSERTs and scans",
+	{
+		"011_inserts" => qq(
+			SET ivfflat.pending_list_limit = 64;
+			INSERT INTO tst SELECT ARRAY[$array_sql] FROM generate_series(1, 10) i;
+		),
+		"011_scans" => qq(
+			SET enable_seqscan = off;
+			SET ivfflat.probes = 10;
+			SELECT 1 / (COUNT(*) = COUNT(DISTINCT ctid))::int FROM (SELECT ctid FROM tst ORDER BY v <-> (SELECT v FROM tst LIMIT 1)) t;
+		)
+	}
+);
+
+my $count = $node->safe_psql("postgres", "SELECT COUNT(*) FROM tst;");
+cmp_ok($count, '>=', 10000);
+
+# Each row once, from the pending list or lists
+my $result = $node->safe_psql("postgres", qq(
+	SET enable_seqscan = off;
+	SET ivfflat.probes = 10;
+	SELECT COUNT(*), COUNT(DISTINCT ctid) FROM (SELECT ctid FROM tst ORDER BY v <-> (SELECT v FROM tst LIMIT 1)) t;
+));
+is($result, "$count|$count");
+
+$node->safe_psql("postgres", "VACUUM tst;");
+
+$result = $node->safe_psql("postgres", qq(
+	SET enable_seqscan = off;
+	SET ivfflat.probes = 10;
+	SELECT COUNT(*) FROM (SELECT ctid FROM tst ORDER BY v <-> (SELECT v FROM tst LIMIT 1)) t;
+));
+is($result, $count);
+
+done_testing();